@@ -0,0 +1,399 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// A slice is {T* data, i64 length}, passed and stored by value. It never owns
+// its elements: it views a fixed size array or the memory of make().
+llvm::StructType* CodeGen::getSliceType(llvm::Type* elem_type) {
+    return llvm::StructType::get(_context, {elem_type->getPointerTo(), llvm::Type::getInt64Ty(_context)});
+}
+
+bool CodeGen::isSliceType(llvm::Type* type) {
+    auto struct_type = llvm::dyn_cast<llvm::StructType>(type);
+    return struct_type != nullptr
+        && struct_type->isLiteral()
+        && struct_type->getNumElements() == 2
+        && struct_type->getElementType(0)->isPointerTy()
+        && struct_type->getElementType(1)->isIntegerTy(64);
+}
+
+// Allocas go to the entry block, so a var declared in a loop body reuses
+// its slot and mem2reg can promote it.
+llvm::AllocaInst* CodeGen::createEntryAlloca(llvm::Type* type, const std::string& name) {
+    auto& entry = _builder.GetInsertBlock()->getParent()->getEntryBlock();
+    llvm::IRBuilder<> builder(&entry, entry.begin());
+    auto alloca = builder.CreateAlloca(type, nullptr, name);
+    alloca->setAlignment(typeAlign(type));
+    return alloca;
+}
+
+// an array used as a value is a slice of the whole array
+llvm::Value* CodeGen::arraySliceGen(llvm::Value* array_addr) {
+    auto array_type = array_addr->getType()->getPointerElementType();
+    auto zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), 0);
+    auto data = _builder.CreateInBoundsGEP(array_type, array_addr, {zero, zero});
+    auto length = llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), array_type->getArrayNumElements());
+    llvm::Value* slice = llvm::UndefValue::get(getSliceType(array_type->getArrayElementType()));
+    slice = _builder.CreateInsertValue(slice, data, 0);
+    return _builder.CreateInsertValue(slice, length, 1);
+}
+
+// Generates the base of an index, slice or field: its address if it names
+// memory, its value otherwise. Returns its type.
+llvm::Type* CodeGen::operandGen(ExpressionPtr expr, std::list<Environment>& env, llvm::Value*& addr, llvm::Value*& value) {
+    value = nullptr;
+    addr = addressGen(expr, env);
+    if (addr != nullptr) {
+        return addr->getType()->getPointerElementType();
+    }
+    value = exprGen(expr, env);
+    return value->getType();
+}
+
+// value of the memory at addr; arrays are used as slices of themselves
+llvm::Value* CodeGen::loadValueGen(llvm::Value* addr, llvm::Align align) {
+    auto type = addr->getType()->getPointerElementType();
+    if (type->isArrayTy()) {
+        return arraySliceGen(addr);
+    }
+    auto soa = soaInfo(type);
+    if (soa != nullptr && soa->length != 0) {
+        return soaSliceGen(addr);
+    }
+    return _builder.CreateAlignedLoad(type, addr, align);
+}
+
+// Fixed size arrays are indexed in place through their address, anything
+// else has to evaluate to a slice. base_addr or base_value is base, if the
+// caller already generated it.
+void CodeGen::arrayBaseGen(ExpressionPtr base, std::list<Environment>& env, llvm::Value*& data, llvm::Value*& length, llvm::Value* base_addr, llvm::Value* base_value) {
+    auto& builder = _builder;
+    if (base_addr == nullptr && base_value == nullptr) {
+        base_addr = addressGen(base, env);
+        if (base_addr == nullptr) {
+            base_value = exprGen(base, env);
+        }
+    }
+    if (base_addr != nullptr) {
+        auto base_type = base_addr->getType()->getPointerElementType();
+        if (base_type->isArrayTy()) {
+            auto zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), 0);
+            data = builder.CreateInBoundsGEP(base_type, base_addr, {zero, zero});
+            length = llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), base_type->getArrayNumElements());
+            return;
+        }
+        base_value = builder.CreateLoad(base_type, base_addr);
+    }
+    if (!isSliceType(base_value->getType())) {
+        printf("[arrayBaseGen] can only index arrays, slices and vectors\n");
+        exit(1);
+    }
+    data = builder.CreateExtractValue(base_value, 0);
+    length = builder.CreateExtractValue(base_value, 1);
+}
+
+llvm::Value* CodeGen::indexValueGen(ExpressionPtr expr, std::list<Environment>& env) {
+    auto index = exprGen(expr, env);
+    if (index->getType()->isIntegerTy(1)) {
+        index = _builder.CreateZExt(index, llvm::Type::getInt64Ty(_context));
+    }
+    if (!index->getType()->isIntegerTy(64)) {
+        printf("[indexValueGen] array index must be int\n");
+        exit(1);
+    }
+    return index;
+}
+
+// Branches to a per-function llvm.trap block unless ok holds.
+void CodeGen::trapUnlessGen(llvm::Value* ok, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto func = builder.GetInsertBlock()->getParent();
+    auto& trap_block = _trap_blocks[func];
+    if (trap_block == nullptr) {
+        trap_block = llvm::BasicBlock::Create(_context, "bounds.fail", func);
+        llvm::IRBuilder<> trap_builder(trap_block);
+        trap_builder.CreateCall(llvm::Intrinsic::getDeclaration(_module.get(), llvm::Intrinsic::trap));
+        trap_builder.CreateUnreachable();
+    }
+    auto ok_block = llvm::BasicBlock::Create(_context, std::to_string(env.front().GetIncID()) + ".inbounds", func);
+    llvm::MDBuilder md(_context);
+    builder.CreateCondBr(ok, ok_block, trap_block, md.createBranchWeights(1 << 20, 1));
+    env.front().block = ok_block;
+    builder.SetInsertPoint(ok_block);
+}
+
+// Traps unless 0 <= index < length. The check is left out where the range
+// analysis proved index_expr in bounds, or both index and length are constants.
+void CodeGen::boundsCheckGen(IndexExpressionPtr index_expr, llvm::Value* index, llvm::Value* length, std::list<Environment>& env) {
+    _bounds_checks++;
+    bool in_bounds = _range_analysis.isInBounds(index_expr.get());
+    auto const_index = llvm::dyn_cast<llvm::ConstantInt>(index);
+    auto const_length = llvm::dyn_cast<llvm::ConstantInt>(length);
+    if (!in_bounds && const_index != nullptr && const_length != nullptr) {
+        if (const_index->getValue().uge(const_length->getValue())) {
+            printf("index %ld out of range [0, %lu)\n", long(const_index->getSExtValue()), (unsigned long)const_length->getZExtValue());
+            exit(1);
+        }
+        in_bounds = true;
+    }
+    if (in_bounds) {
+        _bounds_checks_elided++;
+    } else {
+        // unsigned compare, negative indexes fail too
+        trapUnlessGen(_builder.CreateICmpULT(index, length), env);
+    }
+}
+
+llvm::Value* CodeGen::elementAddressGen(IndexExpressionPtr index_expr, std::list<Environment>& env, llvm::Value* base_addr, llvm::Value* base_value) {
+    llvm::Value *data, *length;
+    arrayBaseGen(index_expr->_base, env, data, length, base_addr, base_value);
+    auto index = indexValueGen(index_expr->_index, env);
+    auto elem_type = data->getType()->getPointerElementType();
+    boundsCheckGen(index_expr, index, length, env);
+    return _builder.CreateInBoundsGEP(elem_type, data, index);
+}
+
+// Address of base[index] once base is generated: an element of an array or
+// slice, or a lane of a vector in memory.
+llvm::Value* CodeGen::indexAddressGen(IndexExpressionPtr index_expr, llvm::Value* base_addr, llvm::Value* base_value, std::list<Environment>& env) {
+    auto base_type = base_addr != nullptr ? base_addr->getType()->getPointerElementType() : base_value->getType();
+    if (base_type->isVectorTy()) {
+        if (base_addr == nullptr) {
+            printf("a lane of a temporary vector has no address\n");
+            exit(1);
+        }
+        auto index = laneIndexGen(index_expr, laneCount(base_type), env);
+        auto zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), 0);
+        return _builder.CreateInBoundsGEP(base_type, base_addr, {zero, index});
+    }
+    if (soaInfo(base_type) != nullptr) {
+        printf("an element of a soa collection has no address, use its fields\n");
+        exit(1);
+    }
+    if (isStrType(base_type)) {
+        printf("a byte of a str has no address\n");
+        exit(1);
+    }
+    return elementAddressGen(index_expr, env, base_addr, base_value);
+}
+
+llvm::Value* CodeGen::indexExprGen(AstPtr ast, std::list<Environment>& env) {
+    auto index_expr = std::dynamic_pointer_cast<IndexExpression>(ast);
+    assert(index_expr != nullptr);
+    llvm::Value *base_addr, *base_value;
+    auto base_type = operandGen(index_expr->_base, env, base_addr, base_value);
+    if (base_type->isVectorTy()) {
+        return laneGen(index_expr, base_value != nullptr ? base_value : _builder.CreateLoad(base_type, base_addr), env);
+    }
+    auto soa = soaInfo(base_type);
+    if (soa != nullptr) {
+        return soaElementGen(index_expr, soa, base_addr, base_value, env);
+    }
+    if (isStrType(base_type)) {
+        return strIndexGen(index_expr, base_addr, base_value, env);
+    }
+    auto addr = elementAddressGen(index_expr, env, base_addr, base_value);
+    return loadValueGen(addr, typeAlign(addr->getType()->getPointerElementType()));
+}
+
+llvm::Value* CodeGen::elementAssignGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto assign = std::dynamic_pointer_cast<ElementAssignStatement>(ast);
+    assert(assign != nullptr);
+
+    auto val = exprGen(assign->_assign_value, env);
+    llvm::Value* addr = nullptr;
+    llvm::Align align;
+    auto index_expr = std::dynamic_pointer_cast<IndexExpression>(assign->_target);
+    if (index_expr != nullptr) {
+        llvm::Value *base_addr, *base_value;
+        auto base_type = operandGen(index_expr->_base, env, base_addr, base_value);
+        if (base_type->isVectorTy()) {
+            if (base_addr == nullptr) {
+                printf("[elementAssignGen] lanes of a temporary vector can't be assigned\n");
+                exit(1);
+            }
+            return laneAssignGen(index_expr, val, base_addr, env);
+        }
+        auto soa = soaInfo(base_type);
+        if (soa != nullptr) {
+            return soaElementAssignGen(index_expr, val, soa, base_addr, base_value, env);
+        }
+        if (isStrType(base_type)) {
+            printf("[elementAssignGen] strings can't be changed, build a new one\n");
+            exit(1);
+        }
+        addr = elementAddressGen(index_expr, env, base_addr, base_value);
+        align = typeAlign(addr->getType()->getPointerElementType());
+    } else {
+        auto member = std::dynamic_pointer_cast<MemberExpression>(assign->_target);
+        assert(member != nullptr);
+        addr = fieldAddressGen(member, env, align);
+        if (addr == nullptr) {
+            printf("[elementAssignGen] fields of a temporary struct can't be assigned\n");
+            exit(1);
+        }
+    }
+
+    auto elem_type = addr->getType()->getPointerElementType();
+    if (isFixedCollection(elem_type)) {
+        printf("[elementAssignGen] arrays can't be assigned, assign their elements\n");
+        exit(1);
+    }
+    auto converted = convertValue(val, elem_type);
+    if (converted == nullptr) {
+        printf("[elementAssignGen] element type no matched\n");
+        exit(1);
+    }
+    builder.CreateAlignedStore(converted, addr, align);
+    return nullptr;
+}
+
+// low and high of base[low:high], trapping unless low <= high <= length
+void CodeGen::sliceBoundsGen(SliceExpressionPtr slice_expr, llvm::Value* length, std::list<Environment>& env, llvm::Value*& low, llvm::Value*& high) {
+    auto& builder = _builder;
+    low = llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), 0);
+    high = length;
+    if (slice_expr->_low != nullptr) {
+        low = indexValueGen(slice_expr->_low, env);
+    }
+    if (slice_expr->_high != nullptr) {
+        high = indexValueGen(slice_expr->_high, env);
+    }
+    auto ok = builder.CreateAnd(builder.CreateICmpULE(low, high), builder.CreateICmpULE(high, length));
+    if (!llvm::isa<llvm::ConstantInt>(ok)) {
+        trapUnlessGen(ok, env);
+    } else if (llvm::cast<llvm::ConstantInt>(ok)->isZero()) {
+        printf("slice bounds out of range\n");
+        exit(1);
+    }
+}
+
+// a[low:high] views the elements low..high-1 of a, without copying
+llvm::Value* CodeGen::sliceExprGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto slice_expr = std::dynamic_pointer_cast<SliceExpression>(ast);
+    assert(slice_expr != nullptr);
+
+    llvm::Value *base_addr, *base_value;
+    auto base_type = operandGen(slice_expr->_base, env, base_addr, base_value);
+    auto soa = soaInfo(base_type);
+    if (soa != nullptr) {
+        return soaSubsliceGen(slice_expr, soa, base_addr, base_value, env);
+    }
+    if (isStrType(base_type)) {
+        return strSliceGen(slice_expr, base_addr, base_value, env);
+    }
+    llvm::Value *data, *length, *low, *high;
+    arrayBaseGen(slice_expr->_base, env, data, length, base_addr, base_value);
+    sliceBoundsGen(slice_expr, length, env, low, high);
+
+    auto elem_type = data->getType()->getPointerElementType();
+    llvm::Value* slice = llvm::UndefValue::get(getSliceType(elem_type));
+    slice = builder.CreateInsertValue(slice, builder.CreateInBoundsGEP(elem_type, data, low), 0);
+    return builder.CreateInsertValue(slice, builder.CreateSub(high, low), 1);
+}
+
+// make([]T, n): n zeroed elements on the heap (or in the region), released
+// with delete(s)
+llvm::Value* CodeGen::makeExprGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto make_expr = std::dynamic_pointer_cast<MakeExpression>(ast);
+    assert(make_expr != nullptr);
+
+    auto slice_type = llvm::cast<llvm::StructType>(getValueType(make_expr->_slice_type));
+    auto soa = soaInfo(slice_type);
+    if (soa != nullptr) {
+        return soaMakeGen(make_expr, soa, env);
+    }
+    auto elem_type = slice_type->getElementType(0)->getPointerElementType();
+    auto length = indexValueGen(make_expr->_length, env);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    trapUnlessGen(builder.CreateICmpSGE(length, llvm::ConstantInt::get(int_type, 0)), env);
+
+    auto elem_size = _module->getDataLayout().getTypeAllocSize(elem_type);
+    auto bytes = builder.CreateMul(length, llvm::ConstantInt::get(int_type, elem_size));
+    auto memory = allocGen(bytes, typeAlign(elem_type).value());
+    auto data = builder.CreateBitCast(memory, elem_type->getPointerTo());
+
+    llvm::Value* slice = llvm::UndefValue::get(slice_type);
+    slice = builder.CreateInsertValue(slice, data, 0);
+    return builder.CreateInsertValue(slice, length, 1);
+}
+
+llvm::Value* CodeGen::lenGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    if (funcall->_parameters.size() != 1) {
+        printf("len takes 1 argument\n");
+        exit(1);
+    }
+    auto param = funcall->_parameters[0];
+    llvm::Value *base_addr, *base_value, *data, *length;
+    auto base_type = operandGen(param, env, base_addr, base_value);
+    if (base_type->isVectorTy()) {
+        return llvm::ConstantInt::get(llvm::Type::getInt64Ty(_context), laneCount(base_type));
+    }
+    if (isStrType(base_type)) {
+        return strLenGen(base_value != nullptr ? base_value : _builder.CreateLoad(base_type, base_addr));
+    }
+    auto soa = soaInfo(base_type);
+    if (soa != nullptr) {
+        std::vector<llvm::Value*> columns;
+        soaBaseGen(soa, base_addr, base_value, columns, length);
+        return length;
+    }
+    arrayBaseGen(param, env, data, length, base_addr, base_value);
+    return length;
+}
+
+llvm::Value* CodeGen::deleteGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    if (funcall->_parameters.size() != 1) {
+        printf("delete takes 1 argument\n");
+        exit(1);
+    }
+    llvm::Value *base_addr, *slice;
+    auto base_type = operandGen(funcall->_parameters[0], env, base_addr, slice);
+    if (isStrType(base_type)) {
+        return strFreeGen(base_addr, slice);
+    }
+    if (isHandleType(base_type, "queue")) {
+        if (base_addr != nullptr) {
+            slice = _builder.CreateLoad(base_type, base_addr);
+        }
+        return queueFreeGen(_builder.CreateExtractValue(slice, 0));
+    }
+    if (genYieldType(base_type) != nullptr || taskResultType(base_type) != nullptr) {
+        if (base_addr != nullptr) {
+            slice = _builder.CreateLoad(base_type, base_addr);
+        }
+        return genDestroyGen(_builder.CreateExtractValue(slice, 0));
+    }
+    if (isFixedCollection(base_type)) {
+        printf("delete takes a slice from make, not an array\n");
+        exit(1);
+    }
+    if (base_addr != nullptr) {
+        slice = _builder.CreateLoad(base_type, base_addr);
+    }
+    if (!isSliceType(slice->getType()) && soaInfo(base_type) == nullptr) {
+        printf("delete takes a slice from make\n");
+        exit(1);
+    }
+    return freeGen(_builder.CreateExtractValue(slice, 0));
+}
+
+} //begonia
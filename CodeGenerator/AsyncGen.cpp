@@ -0,0 +1,319 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include "llvm/IR/Intrinsics.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// task<T> is {i8*} around the coroutine handle, one type per result T
+llvm::StructType* CodeGen::getTaskType(llvm::Type* result_type) {
+    if (atomicElemType(result_type) != nullptr || isFixedCollection(result_type)) {
+        printf("task<T> needs T a value type or void, return slices instead of arrays\n");
+        exit(1);
+    }
+    auto& type = _task_types[result_type];
+    if (type == nullptr) {
+        type = llvm::StructType::create(_context, {llvm::Type::getInt8PtrTy(_context)}, "task");
+    }
+    return type;
+}
+
+// T of a task<T>, nullptr for other types
+llvm::Type* CodeGen::taskResultType(llvm::Type* type) {
+    for (auto& task : _task_types) {
+        if (task.second == type) {
+            return task.first;
+        }
+    }
+    return nullptr;
+}
+
+// The promise of an async func: the io record of the coroutine awaiting it,
+// as an i8*, and the result
+llvm::StructType* CodeGen::taskPromiseType(llvm::Type* result_type) {
+    std::vector<llvm::Type*> fields = {llvm::Type::getInt8PtrTy(_context)};
+    if (!result_type->isVoidTy()) {
+        fields.push_back(result_type);
+    }
+    return llvm::StructType::get(_context, fields);
+}
+
+// Declares a function of runtime/async.c. The records and buffers it is
+// given are written once the operation completes, after the caller resumed
+// from somewhere else, so it gets no memory attributes.
+llvm::FunctionCallee CodeGen::asyncRuntimeFunc(const std::string& name, llvm::Type* ret_type, const std::vector<llvm::Type*>& params) {
+    auto callee = _module->getOrInsertFunction(name, llvm::FunctionType::get(ret_type, params, false));
+    llvm::cast<llvm::Function>(callee.getCallee())->addFnAttr(llvm::Attribute::NoUnwind);
+    return callee;
+}
+
+// The begonia_io record of the async func being generated, {handle, result,
+// and fields only the runtime uses}, with the handle of the coroutine to
+// resume once it is ready. One per function: it awaits one thing at a time.
+llvm::Value* CodeGen::asyncRecordGen() {
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto& type = _runtime_types["async.io"];
+    if (type == nullptr) {
+        type = llvm::StructType::create(_context, {i8ptr, int_type, i8ptr, i8ptr, i8ptr, int_type}, "async.io");
+    }
+    auto& coro = *_coroutine;
+    if (coro.io == nullptr) {
+        coro.io = createEntryAlloca(type, "io");
+    }
+    _builder.CreateStore(coro.handle, _builder.CreateStructGEP(type, coro.io, 0));
+    return _builder.CreateBitCast(coro.io, i8ptr);
+}
+
+// the body of an async func ended: the coroutine awaiting it runs next
+void CodeGen::asyncReadyGen() {
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto promise = _coroutine->promise;
+    auto waiter = _builder.CreateLoad(i8ptr, _builder.CreateStructGEP(promise->getAllocatedType(), promise, 0));
+    _builder.CreateCall(asyncRuntimeFunc("begonia_async_ready", llvm::Type::getVoidTy(_context), {i8ptr}), {waiter});
+}
+
+// return exp; in an async func is the result await takes
+void CodeGen::asyncReturnGen(ReturnStatementPtr ret_stat, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto promise = _coroutine->promise;
+    auto promise_type = llvm::cast<llvm::StructType>(promise->getAllocatedType());
+    auto func_name = builder.GetInsertBlock()->getParent()->getName().str();
+    if (promise_type->getNumElements() == 1) {
+        if (ret_stat->_ret_values.size() != 0) {
+            printf("return in async func %s takes no value, its task is task<void>\n", func_name.c_str());
+            exit(1);
+        }
+        return;
+    }
+    if (ret_stat->_ret_values.size() != 1) {
+        printf("return in async func %s takes its result\n", func_name.c_str());
+        exit(1);
+    }
+    auto val = exprGen(ret_stat->_ret_values[0], env);
+    if (val->getType()->isPointerTy() && val->getType() != llvm::Type::getInt8PtrTy(_context)) {
+        val = builder.CreateLoad(val->getType()->getPointerElementType(), val);
+    }
+    auto converted = convertValue(val, promise_type->getElementType(1));
+    if (converted == nullptr) {
+        printf("return in async func %s: type no matched\n", func_name.c_str());
+        exit(1);
+    }
+    builder.CreateStore(converted, builder.CreateStructGEP(promise_type, promise, 1));
+}
+
+// await t, await f(x) of an async f, await read(...), write, open or close:
+// suspends the async func until the result is there. Other coroutines run
+// meanwhile, so awaits of tasks started before are in flight together.
+llvm::Value* CodeGen::awaitGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto await_expr = std::dynamic_pointer_cast<AwaitExpression>(ast);
+    assert(await_expr != nullptr);
+    if (_coroutine == nullptr || !_coroutine->async) {
+        printf("await outside an async func, run(t) waits for a task elsewhere\n");
+        exit(1);
+    }
+    suspendCheck("await", env);
+    auto funcall = std::dynamic_pointer_cast<FuncallExpression>(await_expr->_value);
+    if (funcall != nullptr) {
+        auto& name = funcall->_identifier;
+        if (name == "read" || name == "write" || name == "open" || name == "close") {
+            return awaitIoGen(funcall, env);
+        }
+    }
+    auto task = exprGen(await_expr->_value, env);
+    if (task->getType()->isPointerTy() && task->getType() != llvm::Type::getInt8PtrTy(_context)) {
+        task = builder.CreateLoad(task->getType()->getPointerElementType(), task);
+    }
+    return awaitTaskGen(task, env);
+}
+
+// The task may have ended already; otherwise it gets the record of this
+// coroutine to hand to begonia_async_ready when it ends. Either way the
+// result is taken and the task destroyed, it is awaited once.
+llvm::Value* CodeGen::awaitTaskGen(llvm::Value* task, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto result_type = taskResultType(task->getType());
+    if (result_type == nullptr) {
+        printf("await takes a task<T>, or read, write, open or close\n");
+        exit(1);
+    }
+    auto handle = builder.CreateExtractValue(task, 0);
+    auto func = builder.GetInsertBlock()->getParent();
+    auto id = std::to_string(env.front().GetIncID());
+    auto wait_block = llvm::BasicBlock::Create(_context, id + ".await", func);
+    auto ready_block = llvm::BasicBlock::Create(_context, id + ".ready", func);
+    auto done = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_done), {handle});
+    builder.CreateCondBr(done, ready_block, wait_block);
+
+    builder.SetInsertPoint(wait_block);
+    env.front().block = wait_block;
+    auto record = asyncRecordGen();
+    auto promise_type = taskPromiseType(result_type);
+    auto promise = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_promise),
+                                      {handle, builder.getInt32(typeAlign(promise_type).value()), builder.getFalse()});
+    auto waiter = builder.CreateStructGEP(promise_type, builder.CreateBitCast(promise, promise_type->getPointerTo()), 0);
+    builder.CreateStore(record, waiter);
+    coroSuspendGen(env);
+    builder.CreateBr(ready_block);
+
+    builder.SetInsertPoint(ready_block);
+    env.front().block = ready_block;
+    return taskResultGen(handle, result_type);
+}
+
+// await read(fd, s, n[, offset]), write(fd, s[, offset]),
+// open(path[, flags[, mode]]) and close(fd): bytes read or written, the fd
+// opened or 0, -errno when the operation failed. An offset < 0, the default,
+// reads or writes at the position of fd.
+llvm::Value* CodeGen::awaitIoGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto void_type = llvm::Type::getVoidTy(_context);
+    auto& name = funcall->_identifier;
+    auto& args = funcall->_parameters;
+    auto int_arg = [&](size_t i, int64_t default_value) -> llvm::Value* {
+        if (i >= args.size()) {
+            return llvm::ConstantInt::get(int_type, default_value);
+        }
+        return atomicOperandGen(args[i], int_type, name, env);
+    };
+
+    if (name == "read") {
+        if (args.size() != 3 && args.size() != 4) {
+            printf("read takes a fd, the str to read into, the number of bytes and an offset\n");
+            exit(1);
+        }
+        auto fd = int_arg(0, 0);
+        auto out = addressGen(args[1], env);
+        if (out == nullptr || !isStrType(out->getType()->getPointerElementType())) {
+            printf("read stores into a str variable, element or field\n");
+            exit(1);
+        }
+        auto len = int_arg(2, 0);
+        auto offset = int_arg(3, -1);
+        auto record = asyncRecordGen();
+        builder.CreateCall(asyncRuntimeFunc("begonia_async_read", void_type, {i8ptr, int_type, i8ptr, int_type, int_type}),
+                           {record, fd, builder.CreateBitCast(out, i8ptr), len, offset});
+    } else if (name == "write") {
+        if (args.size() != 2 && args.size() != 3) {
+            printf("write takes a fd, the str to write and an offset\n");
+            exit(1);
+        }
+        auto fd = int_arg(0, 0);
+        auto str = atomicOperandGen(args[1], getStrType(), name, env);
+        // the kernel reads the bytes after the coroutine suspended, from its frame
+        auto data = strDataGen(strSpillGen(str));
+        auto len = strLenGen(str);
+        auto offset = int_arg(2, -1);
+        auto record = asyncRecordGen();
+        builder.CreateCall(asyncRuntimeFunc("begonia_async_write", void_type, {i8ptr, int_type, i8ptr, int_type, int_type}),
+                           {record, fd, data, len, offset});
+    } else if (name == "open") {
+        if (args.size() < 1 || args.size() > 3) {
+            printf("open takes a path, flags and a mode\n");
+            exit(1);
+        }
+        auto path = exprGen(args[0], env);
+        if (path->getType()->isPointerTy() && path->getType() != i8ptr) {
+            path = builder.CreateLoad(path->getType()->getPointerElementType(), path);
+        }
+        if (isStrType(path->getType())) {
+            path = strCStringGen(path);
+        } else if (path->getType() != i8ptr) {
+            printf("open: the path is a str or string\n");
+            exit(1);
+        }
+        auto flags = int_arg(1, 0);
+        auto mode = int_arg(2, 0644);
+        auto record = asyncRecordGen();
+        builder.CreateCall(asyncRuntimeFunc("begonia_async_open", void_type, {i8ptr, i8ptr, int_type, int_type}),
+                           {record, path, flags, mode});
+    } else {
+        if (args.size() != 1) {
+            printf("close takes a fd\n");
+            exit(1);
+        }
+        auto fd = int_arg(0, 0);
+        auto record = asyncRecordGen();
+        builder.CreateCall(asyncRuntimeFunc("begonia_async_close", void_type, {i8ptr, int_type}), {record, fd});
+    }
+    coroSuspendGen(env);
+    auto io = _coroutine->io;
+    return builder.CreateLoad(int_type, builder.CreateStructGEP(io->getAllocatedType(), io, 1));
+}
+
+// the result of the ended task at handle, which is destroyed
+llvm::Value* CodeGen::taskResultGen(llvm::Value* handle, llvm::Type* result_type) {
+    auto& builder = _builder;
+    llvm::Value* result = nullptr;
+    if (!result_type->isVoidTy()) {
+        auto promise_type = taskPromiseType(result_type);
+        auto align = typeAlign(promise_type);
+        auto promise = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_promise),
+                                          {handle, builder.getInt32(align.value()), builder.getFalse()});
+        auto typed = builder.CreateBitCast(promise, promise_type->getPointerTo());
+        result = builder.CreateLoad(result_type, builder.CreateStructGEP(promise_type, typed, 1));
+    }
+    auto destroy = genDestroyGen(handle);
+    return result != nullptr ? result : destroy;
+}
+
+// run(t): the result of t, running the event loop of the thread, and with it
+// every task started before, until t ends
+llvm::Value* CodeGen::runGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    if (funcall->_parameters.size() != 1) {
+        printf("run takes a task\n");
+        exit(1);
+    }
+    if (_coroutine != nullptr && _coroutine->async) {
+        printf("run inside an async func, await the task\n");
+        exit(1);
+    }
+    auto task = exprGen(funcall->_parameters[0], env);
+    if (task->getType()->isPointerTy() && task->getType() != i8ptr) {
+        task = builder.CreateLoad(task->getType()->getPointerElementType(), task);
+    }
+    auto result_type = taskResultType(task->getType());
+    if (result_type == nullptr) {
+        printf("run takes a task<T>\n");
+        exit(1);
+    }
+    auto handle = builder.CreateExtractValue(task, 0);
+
+    auto func = builder.GetInsertBlock()->getParent();
+    auto id = std::to_string(env.front().GetIncID());
+    auto check_block = llvm::BasicBlock::Create(_context, id + ".run", func);
+    auto step_block = llvm::BasicBlock::Create(_context, id + ".runstep", func);
+    auto end_block = llvm::BasicBlock::Create(_context, id + ".runend", func);
+    builder.CreateBr(check_block);
+
+    builder.SetInsertPoint(check_block);
+    auto done = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_done), {handle});
+    builder.CreateCondBr(done, end_block, step_block);
+
+    // resume the coroutine of the next ready record
+    builder.SetInsertPoint(step_block);
+    auto record = builder.CreateCall(asyncRuntimeFunc("begonia_async_wait", i8ptr, {}));
+    auto waiting = builder.CreateLoad(i8ptr, builder.CreateBitCast(record, i8ptr->getPointerTo()));
+    builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_resume), {waiting});
+    builder.CreateBr(check_block);
+
+    builder.SetInsertPoint(end_block);
+    env.front().block = end_block;
+    return taskResultGen(handle, result_type);
+}
+
+} //begonia
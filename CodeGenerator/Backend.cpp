@@ -0,0 +1,737 @@
+#include "CodeGen.h"
+#include "ObjectCache.h"
+
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/LTO/LTO.h"
+#if LLVM_VERSION_MAJOR >= 17
+#include "llvm/TargetParser/SubtargetFeature.h"
+#else
+#include "llvm/MC/SubtargetFeature.h"
+#endif
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/IPO/HotColdSplitting.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace begonia {
+
+#if LLVM_VERSION_MAJOR < 14
+using OptimizationLevel = llvm::PassBuilder::OptimizationLevel;
+#else
+using OptimizationLevel = llvm::OptimizationLevel;
+#endif
+
+static OptimizationLevel getOptimizationLevel(int level) {
+    switch (level) {
+    case 0:  return OptimizationLevel::O0;
+    case 1:  return OptimizationLevel::O1;
+    case 2:  return OptimizationLevel::O2;
+    default: return OptimizationLevel::O3;
+    }
+}
+
+static llvm::CodeGenOpt::Level getCodeGenOptLevel(int level) {
+    switch (level) {
+    case 0:  return llvm::CodeGenOpt::None;
+    case 1:  return llvm::CodeGenOpt::Less;
+    case 2:  return llvm::CodeGenOpt::Default;
+    default: return llvm::CodeGenOpt::Aggressive;
+    }
+}
+
+std::unique_ptr<llvm::TargetMachine> CodeGen::createTargetMachine() {
+    std::string CPU = "generic";
+    std::string Features = "";
+
+    llvm::TargetOptions opt;
+    // a section per function and global, so the linker can drop the unused ones
+    opt.FunctionSections = true;
+    opt.DataSections = true;
+    auto RM = llvm::Optional<llvm::Reloc::Model>();
+    if (_options.jit) {
+        // JIT code only runs here: all of this CPU, loaded anywhere
+        CPU = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> host_features;
+        llvm::SubtargetFeatures features;
+        if (llvm::sys::getHostCPUFeatures(host_features)) {
+            for (auto& feature : host_features) {
+                features.AddFeature(feature.first(), feature.second);
+            }
+        }
+        Features = features.getString();
+        RM = llvm::Reloc::PIC_;
+    }
+    return std::unique_ptr<llvm::TargetMachine>(_target->createTargetMachine(
+        _target_triple, CPU, Features, opt, RM, llvm::None, getCodeGenOptLevel(_options.opt_level)));
+}
+
+// Creating a TargetMachine is a good part of compiling a small file, so the
+// CodeGens of a thread share one per configuration: the driver's modules
+// and linker, and every compile of a --serve worker. Passes only read it,
+// but it isn't thread-safe, so threads never share one.
+llvm::TargetMachine* CodeGen::targetMachine() {
+    static thread_local std::map<std::pair<int, bool>, std::unique_ptr<llvm::TargetMachine>> machines;
+    auto& machine = machines[{_options.opt_level, _options.jit}];
+    if (machine == nullptr) {
+        machine = createTargetMachine();
+    }
+    return machine.get();
+}
+
+std::string CodeGen::profileRuntimePath() {
+    if (_options.profile_runtime != "") {
+        return _options.profile_runtime;
+    }
+#ifdef BEGONIA_LLVM_LIBDIR
+    auto arch = llvm::Triple(_target_triple).getArchName().str();
+    std::string path = std::string(BEGONIA_LLVM_LIBDIR) + "/clang/" + LLVM_VERSION_STRING;
+#ifdef __APPLE__
+    path += "/lib/darwin/libclang_rt.profile_osx.a";
+#else
+    path += "/lib/linux/libclang_rt.profile-" + arch + ".a";
+#endif
+    return path;
+#else
+    return "";
+#endif
+}
+
+// libbegonia_rt.a, which make builds next to bin/begonia
+std::string CodeGen::runtimeLibPath() {
+    if (_options.runtime_lib != "") {
+        return _options.runtime_lib;
+    }
+    auto compiler = llvm::sys::fs::getMainExecutable(nullptr, nullptr);
+    if (compiler == "") {
+        return "";
+    }
+    return llvm::sys::path::parent_path(compiler).str() + "/libbegonia_rt.a";
+}
+
+int CodeGen::initializeProfile() {
+    if (_options.profile_generate) {
+        auto runtime = profileRuntimePath();
+        if (runtime == "" || !llvm::sys::fs::exists(runtime)) {
+            printf("Can't find the profile runtime '%s' (compiler-rt), use --profile-runtime=<path>\n", runtime.c_str());
+            return 1;
+        }
+        _link_args.push_back(runtime);
+#ifndef __APPLE__
+        // nothing in the instrumented code references the runtime registration
+        _link_args.push_back("-u__llvm_profile_runtime");
+#endif
+    }
+    if (_options.profile_use != "") {
+        if (!llvm::sys::fs::exists(_options.profile_use)) {
+            printf("Can't find profile:%s\n", _options.profile_use.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// With a profile, the cold code of functions moves out of the way of their
+// hot paths, like the optimizer's -hot-cold-split but for this compile only.
+bool CodeGen::hotColdSplit() const {
+    return _options.profile_use != "" && _options.opt_level > 0 && !_options.lto_thin;
+}
+
+// calls of llvm.coro.* have to be lowered by the coroutine passes, also at -O0
+static bool usesCoroutines(llvm::Module& module) {
+    for (auto& func : module) {
+        if (func.isDeclaration() && func.getName().startswith("llvm.coro.")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CodeGen::optimize(llvm::Module& module) {
+    llvm::Optional<llvm::PGOOptions> pgo;
+    if (_options.profile_generate) {
+        std::string dir = _options.profile_generate_dir;
+        std::string profraw = dir == "" ? "default.profraw" : dir + "/default_%m.profraw";
+        pgo = llvm::PGOOptions(profraw, "", "", llvm::PGOOptions::IRInstr);
+    } else if (_options.profile_use != "") {
+        pgo = llvm::PGOOptions(_options.profile_use, "", "", llvm::PGOOptions::IRUse);
+    }
+    if (_options.opt_level == 0 && !pgo && !_options.lto_thin && !usesCoroutines(module)) {
+        entryExitGen(module);
+        return;
+    }
+    llvm::LoopAnalysisManager     LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager    CGAM;
+    llvm::ModuleAnalysisManager   MAM;
+
+    llvm::PipelineTuningOptions tuning;
+#if LLVM_VERSION_MAJOR >= 11 && LLVM_VERSION_MAJOR < 13
+    tuning.Coroutines = true;
+#endif
+    llvm::PassBuilder PB(_target_machine, tuning, pgo);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    if (hotColdSplit()) {
+        PB.registerOptimizerLastEPCallback([](llvm::ModulePassManager& MPM, auto) {
+            MPM.addPass(llvm::HotColdSplittingPass());
+        });
+    }
+
+    auto level = getOptimizationLevel(_options.opt_level);
+    llvm::ModulePassManager MPM;
+    if (_options.opt_level == 0) {
+        MPM = PB.buildO0DefaultPipeline(level, _options.lto_thin);
+    } else if (_options.lto_thin) {
+        MPM = PB.buildThinLTOPreLinkDefaultPipeline(level);
+    } else {
+        MPM = PB.buildPerModuleDefaultPipeline(level);
+    }
+    MPM.run(module, MAM);
+    entryExitGen(module);
+}
+
+int CodeGen::emitObject(llvm::Module& module, const std::string& object) {
+    std::error_code EC;
+    llvm::raw_fd_ostream out_dest(object, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+        llvm::errs() << "Could not open file: " << EC.message();
+        return 1;
+    }
+    if (emitObject(module, out_dest) != 0) {
+        return 1;
+    }
+    out_dest.flush();
+    return 0;
+}
+
+int CodeGen::emitObject(llvm::Module& module, llvm::raw_pwrite_stream& out) {
+    auto FileType = llvm::CGFT_ObjectFile;
+
+    llvm::legacy::PassManager           pass;
+    if (_target_machine->addPassesToEmitFile(pass, out, nullptr, FileType)) {
+        llvm::errs() << "TheTargetMachine can't emit a file of this type";
+        return 1;
+    }
+    pass.run(module);
+    return 0;
+}
+
+// Emits the module as one object, or with -j > 1 splits it by function and
+// code-generates every partition on its own thread with its own TargetMachine.
+int CodeGen::emitObjects(std::vector<std::string>& objects) {
+    unsigned jobs = _options.jobs;
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    unsigned defined_funcs = 0;
+    for (auto& func : *_module) {
+        if (!func.isDeclaration()) {
+            defined_funcs++;
+        }
+    }
+    jobs = std::min(jobs, std::max(1u, defined_funcs));
+
+    if (jobs == 1) {
+        objects.push_back(_object_name + ".o");
+        return emitObject(*_module, objects.back());
+    }
+    // splitCodeGen makes local symbols external (hidden) across partitions
+    uniqueLocalNames();
+
+    std::vector<std::unique_ptr<llvm::raw_fd_ostream>> outs;
+    for (unsigned i = 0; i < jobs; i++) {
+        std::string object = _object_name + "." + std::to_string(i) + ".o";
+        std::error_code EC;
+        outs.push_back(std::make_unique<llvm::raw_fd_ostream>(object, EC, llvm::sys::fs::OF_None));
+        if (EC) {
+            llvm::errs() << "Could not open file: " << EC.message();
+            return 1;
+        }
+        objects.push_back(object);
+    }
+
+    auto FileType = llvm::CGFT_ObjectFile;
+
+    std::vector<llvm::raw_pwrite_stream*> streams;
+    for (auto& out : outs) {
+        streams.push_back(out.get());
+    }
+    llvm::splitCodeGen(*_module, streams, {}, [this]() {
+        return createTargetMachine();
+    }, FileType);
+    for (auto& out : outs) {
+        out->flush();
+    }
+    return 0;
+}
+
+static void collectGlobals(llvm::Value* value, std::set<llvm::GlobalValue*>& globals) {
+    if (auto global = llvm::dyn_cast<llvm::GlobalValue>(value)) {
+        globals.insert(global);
+    } else if (auto constant = llvm::dyn_cast<llvm::Constant>(value)) {
+        for (auto& operand : constant->operands()) {
+            collectGlobals(operand, globals);
+        }
+    }
+}
+
+// Whole-program reachability: the functions other modules can see (the entry
+// point, main and export func) are the roots, and internal functions nothing
+// reachable refers to are deleted before they are optimized or emitted.
+void CodeGen::stripDeadFunctions() {
+    std::set<llvm::GlobalValue*> reachable;
+    std::vector<llvm::Function*> worklist;
+    auto reach = [&](std::set<llvm::GlobalValue*>& globals) {
+        for (auto global : globals) {
+            auto func = llvm::dyn_cast<llvm::Function>(global);
+            if (func != nullptr && reachable.insert(func).second) {
+                worklist.push_back(func);
+            }
+        }
+    };
+    for (auto& func : *_module) {
+        if (!func.isDeclaration() && !func.hasLocalLinkage()) {
+            reachable.insert(&func);
+            worklist.push_back(&func);
+        }
+    }
+    for (auto& var : _module->globals()) {
+        std::set<llvm::GlobalValue*> globals;
+        if (var.hasInitializer()) {
+            collectGlobals(var.getInitializer(), globals);
+        }
+        reach(globals);
+    }
+    while (!worklist.empty()) {
+        auto func = worklist.back();
+        worklist.pop_back();
+        std::set<llvm::GlobalValue*> globals;
+        for (auto& block : *func) {
+            for (auto& inst : block) {
+                for (auto& operand : inst.operands()) {
+                    collectGlobals(operand, globals);
+                }
+            }
+        }
+        reach(globals);
+    }
+
+    std::vector<llvm::Function*> dead;
+    for (auto& func : *_module) {
+        if (!func.isDeclaration() && reachable.count(&func) == 0) {
+            dead.push_back(&func);
+        }
+    }
+    // dead functions may call each other
+    for (auto func : dead) {
+        func->dropAllReferences();
+    }
+    for (auto func : dead) {
+        _defined_funcs.erase(func->getName().str());
+        func->eraseFromParent();
+    }
+    for (auto it = _module->global_begin(); it != _module->global_end();) {
+        auto& var = *it++;
+        if (var.hasLocalLinkage() && var.use_empty()) {
+            var.eraseFromParent();
+        }
+    }
+    Profiler::Get().addCounter("functions_stripped", dead.size());
+}
+
+// Suffixes every local function and variable with a hash of the module name.
+// Once a module is split into objects, its locals become external symbols and
+// must not clash with the locals of the other modules of the program.
+void CodeGen::uniqueLocalNames() {
+    if (_local_suffix != "") {
+        return;
+    }
+    _local_suffix = "." + ObjectCache::hashKey(_module_name).substr(0, 16);
+    auto rename = [this](llvm::GlobalValue& global) {
+        if (!global.hasLocalLinkage()) {
+            return;
+        }
+        auto name = global.hasName() ? global.getName().str() : std::string("local");
+        auto ast = _defined_funcs.find(name);
+        global.setName(name + _local_suffix);
+        if (ast != _defined_funcs.end()) {
+            auto func_ast = ast->second;
+            _defined_funcs.erase(ast);
+            _defined_funcs[global.getName().str()] = func_ast;
+        }
+    };
+    for (auto& func : *_module) {
+        rename(func);
+    }
+    for (auto& var : _module->globals()) {
+        rename(var);
+    }
+}
+
+// Copies func into a module of its own. Everything it references is declared
+// there, except local globals (string literals) and the functions generated
+// for it (pfor bodies, spawn thunks), which are copied along.
+std::unique_ptr<llvm::Module> CodeGen::extractFunction(llvm::Function* func) {
+    auto module = std::make_unique<llvm::Module>(func->getName(), _context);
+    module->setDataLayout(_module->getDataLayout());
+    module->setTargetTriple(_module->getTargetTriple());
+    if (_di_unit != nullptr) {
+        debugModuleFlags(*module);
+    }
+
+    std::vector<llvm::Function*> funcs{func};
+    std::set<llvm::GlobalValue*> globals;
+    for (size_t i = 0; i < funcs.size(); i++) {
+        for (auto& block : *funcs[i]) {
+            for (auto& inst : block) {
+                for (auto& operand : inst.operands()) {
+                    collectGlobals(operand, globals);
+                }
+            }
+        }
+        for (auto global : globals) {
+            auto outlined = llvm::dyn_cast<llvm::Function>(global);
+            if (outlined != nullptr && outlined->hasLocalLinkage() && !outlined->isDeclaration()
+             && _defined_funcs.count(outlined->getName().str()) == 0
+             && std::find(funcs.begin(), funcs.end(), outlined) == funcs.end()) {
+                funcs.push_back(outlined);
+            }
+        }
+    }
+
+    llvm::ValueToValueMapTy vmap;
+    for (size_t i = 1; i < funcs.size(); i++) {
+        auto copy = llvm::Function::Create(funcs[i]->getFunctionType(), funcs[i]->getLinkage(), funcs[i]->getName(), module.get());
+        vmap[funcs[i]] = copy;
+    }
+    for (auto global : globals) {
+        if (vmap.count(global) != 0 || global == func) {
+            continue;
+        }
+        if (auto callee = llvm::dyn_cast<llvm::Function>(global)) {
+            auto decl = llvm::Function::Create(callee->getFunctionType(), llvm::Function::ExternalLinkage, callee->getName(), module.get());
+            decl->setAttributes(callee->getAttributes());
+            decl->setCallingConv(callee->getCallingConv());
+            vmap[callee] = decl;
+        } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(global)) {
+            auto copy = new llvm::GlobalVariable(*module, var->getValueType(), var->isConstant(),
+                var->hasLocalLinkage() ? var->getLinkage() : llvm::GlobalValue::ExternalLinkage,
+                var->hasLocalLinkage() ? var->getInitializer() : nullptr, var->getName());
+            copy->setUnnamedAddr(var->getUnnamedAddr());
+            copy->setAlignment(var->getAlign());
+            vmap[var] = copy;
+        }
+    }
+
+    auto new_func = llvm::Function::Create(func->getFunctionType(), llvm::Function::ExternalLinkage, func->getName(), module.get());
+    vmap[func] = new_func;
+    for (size_t i = 0; i < funcs.size(); i++) {
+        auto copy = llvm::cast<llvm::Function>(vmap[funcs[i]]);
+        auto copy_arg = copy->arg_begin();
+        for (auto& arg : funcs[i]->args()) {
+            copy_arg->setName(arg.getName());
+            vmap[&arg] = &*copy_arg++;
+        }
+        llvm::SmallVector<llvm::ReturnInst*, 8> returns;
+#if LLVM_VERSION_MAJOR < 13
+        llvm::CloneFunctionInto(copy, funcs[i], vmap, true, returns);
+#else
+        llvm::CloneFunctionInto(copy, funcs[i], vmap, llvm::CloneFunctionChangeType::DifferentModule, returns);
+#endif
+    }
+    if (_di_unit != nullptr && module->getNamedMetadata("llvm.dbg.cu") == nullptr) {
+        module->getOrInsertNamedMetadata("llvm.dbg.cu")->addOperand(_di_unit);
+    }
+    return module;
+}
+
+// Every function defined in the source is compiled into an object of its own,
+// keyed by its canonical AST, the prototypes of its callees and the compile
+// flags; unchanged functions are taken from the cache instead. Cached functions
+// are then turned into declarations, so only the rest is left in _module.
+int CodeGen::emitCachedFunctions(std::vector<std::string>& objects) {
+    // internal functions are external between the cached objects
+    uniqueLocalNames();
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    std::string flags = std::string("begonia-objcache-1 ") + LLVM_VERSION_STRING + " " + _target_triple
+        + " -O" + std::to_string(_options.opt_level);
+    if (_options.profile_generate) {
+        flags += " -fprofile-generate=" + _options.profile_generate_dir;
+    }
+    if (hotColdSplit()) {
+        flags += " -hot-cold-split";
+    }
+    if (_options.debug_info) {
+        flags += " -g";
+    }
+    if (_options.frame_pointer) {
+        flags += " -fno-omit-frame-pointer";
+    }
+    if (_options.instrument_functions) {
+        flags += " -finstrument-functions";
+    }
+    if (_options.profile_use != "") {
+        auto profile = llvm::MemoryBuffer::getFile(_options.profile_use);
+        if (!profile) {
+            printf("Can't read profile:%s\n", _options.profile_use.c_str());
+            return 1;
+        }
+        flags += " -fprofile-use=" + ObjectCache::hashKey((*profile)->getBuffer().str());
+    }
+    // functions name structs, the key needs their layouts
+    for (auto struct_type : _module->getIdentifiedStructTypes()) {
+        std::string layout;
+        llvm::raw_string_ostream layout_stream(layout);
+        struct_type->print(layout_stream);
+        flags += "\n" + layout_stream.str();
+    }
+
+    for (auto& defined : _defined_funcs) {
+        auto func = _module->getFunction(defined.first);
+        if (func == nullptr || func->isDeclaration()) {
+            continue;
+        }
+        std::string key_data = flags + "\n" + func->getName().str() + " cc" + std::to_string(func->getCallingConv())
+            + " linkage" + std::to_string(func->getLinkage()) + "\n";
+        std::set<std::string> callees;
+        // the lines of the function are in its object with -g
+        if (!CanonicalizeAst(defined.second, key_data, callees, _options.debug_info)) {
+            continue;
+        }
+        for (auto& callee_name : callees) {
+            auto callee = _module->getFunction(callee_name);
+            if (callee == nullptr) {
+                callee = _module->getFunction(callee_name + _local_suffix);
+            }
+            if (callee == nullptr) {
+                continue;
+            }
+            std::string proto;
+            llvm::raw_string_ostream proto_stream(proto);
+            callee->getFunctionType()->print(proto_stream);
+            key_data += "\n" + callee->getName().str() + ":" + proto_stream.str() + " cc" + std::to_string(callee->getCallingConv())
+                + " linkage" + std::to_string(callee->getLinkage())
+                + " " + callee->getAttributes().getAsString(llvm::AttributeList::FunctionIndex);
+        }
+        auto key = ObjectCache::hashKey(key_data);
+
+        std::string object;
+        if (_object_cache->lookup(key, object)) {
+            hits++;
+        } else {
+            misses++;
+            std::string temp;
+            if (_object_cache->createTemp(temp) != 0) {
+                return 1;
+            }
+            auto func_module = extractFunction(func);
+            optimize(*func_module);
+            if (emitObject(*func_module, temp) != 0
+             || _object_cache->commit(temp, key, object) != 0) {
+                return 1;
+            }
+        }
+        objects.push_back(object);
+        func->deleteBody();
+    }
+
+    // generated functions and string literals only used by the cached functions
+    bool erased = true;
+    while (erased) {
+        erased = false;
+        for (auto it = _module->begin(); it != _module->end();) {
+            auto& outlined = *it++;
+            if (outlined.hasLocalLinkage() && outlined.use_empty() && _defined_funcs.count(outlined.getName().str()) == 0) {
+                outlined.eraseFromParent();
+                erased = true;
+            }
+        }
+    }
+    for (auto it = _module->global_begin(); it != _module->global_end();) {
+        auto& var = *it++;
+        if (var.hasLocalLinkage() && var.use_empty()) {
+            var.eraseFromParent();
+        }
+    }
+    Profiler::Get().addCounter("cache_hits", hits);
+    Profiler::Get().addCounter("cache_misses", misses);
+    return 0;
+}
+
+// Writes the module as bitcode with its ThinLTO summary, so the optimization
+// across modules can happen later in thinLink.
+int CodeGen::emitBitcode(std::vector<std::string>& outputs) {
+    std::string bitcode = _object_name + ".bc";
+    std::error_code EC;
+    llvm::raw_fd_ostream out(bitcode, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+        llvm::errs() << "Could not open file: " << EC.message();
+        return 1;
+    }
+    llvm::ProfileSummaryInfo PSI(*_module);
+    auto index = llvm::buildModuleSummaryIndex(*_module, nullptr, &PSI);
+    llvm::WriteBitcodeToFile(*_module, out, false, &index);
+    out.flush();
+    outputs.push_back(bitcode);
+    return 0;
+}
+
+// Runs the ThinLTO backends over the bitcode files in parallel (-j threads)
+// and appends the native objects they produced to objects.
+int CodeGen::thinLink(const std::vector<std::string>& bitcodes, bool has_regular_objects, std::vector<std::string>& objects) {
+    unsigned jobs = _options.jobs;
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    llvm::lto::Config conf;
+    conf.CPU = "generic";
+    conf.RelocModel = llvm::None;
+    conf.OptLevel = _options.opt_level;
+    conf.CGOptLevel = getCodeGenOptLevel(_options.opt_level);
+    conf.Options.FunctionSections = true;
+    conf.Options.DataSections = true;
+#if LLVM_VERSION_MAJOR < 12
+    auto backend = llvm::lto::createInProcessThinBackend(jobs);
+#else
+    auto backend = llvm::lto::createInProcessThinBackend(llvm::heavyweight_hardware_concurrency(jobs));
+#endif
+    llvm::lto::LTO lto(std::move(conf), backend);
+
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+    std::set<std::string> defined;
+    for (auto& bitcode : bitcodes) {
+        auto buffer = llvm::MemoryBuffer::getFile(bitcode);
+        if (!buffer) {
+            printf("Can't read bitcode:%s\n", bitcode.c_str());
+            return 1;
+        }
+        auto input = llvm::lto::InputFile::create((*buffer)->getMemBufferRef());
+        if (!input) {
+            llvm::errs() << bitcode << ": " << llvm::toString(input.takeError()) << "\n";
+            return 1;
+        }
+        std::vector<llvm::lto::SymbolResolution> resolutions;
+        for (auto& symbol : (*input)->symbols()) {
+            llvm::lto::SymbolResolution res;
+            auto name = symbol.getName().str();
+            res.Prevailing = !symbol.isUndefined() && defined.insert(name).second;
+            res.FinalDefinitionInLinkageUnit = res.Prevailing;
+            // only the entry point (and whatever plain objects reference) must
+            // survive, everything else may be internalized and dropped
+            res.VisibleToRegularObj = name == _entry_point_func || has_regular_objects;
+            resolutions.push_back(res);
+        }
+        if (auto err = lto.add(std::move(*input), resolutions)) {
+            llvm::errs() << bitcode << ": " << llvm::toString(std::move(err)) << "\n";
+            return 1;
+        }
+        buffers.push_back(std::move(*buffer));
+    }
+
+    std::vector<std::string> task_objects(lto.getMaxTasks());
+    auto add_stream = [&](unsigned task) {
+        task_objects[task] = _out_filename + ".lto." + std::to_string(task) + ".o";
+        std::error_code EC;
+        auto out = std::make_unique<llvm::raw_fd_ostream>(task_objects[task], EC, llvm::sys::fs::OF_None);
+        if (EC) {
+            llvm::errs() << "Could not open file: " << EC.message();
+            exit(1);
+        }
+#if LLVM_VERSION_MAJOR < 14
+        return std::make_unique<llvm::lto::NativeObjectStream>(std::move(out));
+#else
+        return std::make_unique<llvm::CachedFileStream>(std::move(out));
+#endif
+    };
+    if (auto err = lto.run(add_stream)) {
+        llvm::errs() << llvm::toString(std::move(err)) << "\n";
+        return 1;
+    }
+    for (auto& object : task_objects) {
+        if (object != "") {
+            objects.push_back(object);
+        }
+    }
+    return 0;
+}
+
+int CodeGen::link(const std::vector<std::string>& objects) {
+    std::string inputs;
+    for (auto& object : objects) {
+        inputs += object + " ";
+    }
+    std::string link_args;
+    for (auto& arg : _link_args) {
+        link_args += arg + " ";
+    }
+    // only the members programs reference are pulled from the archive
+    auto runtime = runtimeLibPath();
+    if (runtime != "" && llvm::sys::fs::exists(runtime)) {
+        link_args += runtime + " ";
+    }
+    // one argument of "sh -c" may not exceed 128KB, so long object lists
+    // (e.g. one object per cached function) go through a response file
+    if (inputs.size() > 32 * 1024) {
+        std::string list_file = _out_filename + ".objects";
+        std::error_code EC;
+        llvm::raw_fd_ostream list(list_file, EC, llvm::sys::fs::OF_None);
+        if (EC) {
+            llvm::errs() << "Could not open file: " << EC.message();
+            return 1;
+        }
+        for (auto& object : objects) {
+            list << object << "\n";
+        }
+#ifdef __APPLE__
+        inputs = "-filelist " + list_file;
+#else
+        inputs = "@" + list_file;
+#endif
+    }
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+    #error "Not support Windwos platform yet"
+#elif __linux__
+    std::string ld_cmd = "ld -e " + _entry_point_func +  " --gc-sections -dynamic-linker /lib64/ld-linux-x86-64.so.2 -o " + _out_filename + " " + inputs + link_args + " --as-needed -lpthread -lm --no-as-needed -lc ";
+#elif __APPLE__
+    std::string ld_cmd = "ld -e " + _entry_point_func +  " -dead_strip -o " + _out_filename + " " + inputs + link_args + " -lSystem -macosx_version_min 10.14";
+#else
+    #error "Unknow OS platform"
+#endif
+
+    int retcode = system(ld_cmd.c_str());
+    if (retcode != 0)
+        return 1;
+
+    if (_object_cache != nullptr) {
+        TraceScope scope("cache.prune");
+        _object_cache->prune();
+    }
+    return 0;
+}
+
+} //begonia
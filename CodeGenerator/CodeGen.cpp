@@ -2,14 +2,20 @@
 #include "Parser.h"
 #include "Expression.h"
 #include "CodeGen.h"
+#include "ObjectCache.h"
 
 #include <memory>
+#include <mutex>
 
 namespace begonia {
 
-CodeGen::CodeGen(): _builder(_context) {
+CodeGen::CodeGen(CodeGenOptions options): _builder(_context), _options(options) {
+    _out_filename = _options.out_filename;
+    _object_name = _options.object_name != "" ? _options.object_name : _out_filename;
+    _module_name = _options.module_name;
     _basic_variable_type = {
         {"string",   ValueType::String},
+        {"str",      ValueType::Str},
         {"int",      ValueType::Int},
         {"double",   ValueType::Double},
         {"bool",     ValueType::Bool},
@@ -21,6 +27,12 @@ CodeGen::CodeGen(): _builder(_context) {
         {AstType::DeclareVarStatement, std::bind(&CodeGen::declareVarGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::IfStatement, std::bind(&CodeGen::ifStatementGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::RetStatement, std::bind(&CodeGen::returnGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::WhileStatement, std::bind(&CodeGen::whileStatementGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::ElementAssignStatement, std::bind(&CodeGen::elementAssignGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::DeclareStructStatement, std::bind(&CodeGen::declareStructGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::RegionStatement, std::bind(&CodeGen::regionGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::PforStatement, std::bind(&CodeGen::pforGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::YieldStatement, std::bind(&CodeGen::yieldGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::Expr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::FuncallExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::OpExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
@@ -29,75 +41,148 @@ CodeGen::CodeGen(): _builder(_context) {
         {AstType::NumberExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::StringExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
         {AstType::IdentifierExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::IndexExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::SliceExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::MakeExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::MemberExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {AstType::AwaitExpr, std::bind(&CodeGen::exprGen, this, std::placeholders::_1, std::placeholders::_2)},
     };
+    _builtins = {
+        {"len", std::bind(&CodeGen::lenGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"delete", std::bind(&CodeGen::deleteGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"hash", std::bind(&CodeGen::hashGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"vload", std::bind(&CodeGen::vloadGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"vstore", std::bind(&CodeGen::vstoreGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"vload_masked", std::bind(&CodeGen::vloadMaskedGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"vstore_masked", std::bind(&CodeGen::vstoreMaskedGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"shuffle", std::bind(&CodeGen::shuffleGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"select", std::bind(&CodeGen::selectGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"spawn", std::bind(&CodeGen::spawnGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"join", std::bind(&CodeGen::joinGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"atomic_load", std::bind(&CodeGen::atomicLoadGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"atomic_store", std::bind(&CodeGen::atomicStoreGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"atomic_cas", std::bind(&CodeGen::atomicCasGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"fence", std::bind(&CodeGen::fenceGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"queue_new", std::bind(&CodeGen::queueNewGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"next", std::bind(&CodeGen::nextGen, this, std::placeholders::_1, std::placeholders::_2)},
+        {"run", std::bind(&CodeGen::runGen, this, std::placeholders::_1, std::placeholders::_2)},
+    };
+    for (auto op : {"add", "mul", "min", "max", "and", "or", "xor"}) {
+        std::string name = op;
+        _builtins["reduce_" + name] = std::bind(&CodeGen::reduceGen, this, name, std::placeholders::_1, std::placeholders::_2);
+    }
+    for (auto op : {"add", "sub", "and", "or", "xor", "min", "max", "swap"}) {
+        std::string name = op;
+        _builtins["atomic_" + name] = std::bind(&CodeGen::atomicRMWGen, this, name, std::placeholders::_1, std::placeholders::_2);
+    }
+    for (auto op : {"push", "pop", "try_push", "try_pop"}) {
+        std::string name = op;
+        _builtins["queue_" + name] = std::bind(&CodeGen::queueOpGen, this, name, std::placeholders::_1, std::placeholders::_2);
+    }
+}
+
+CodeGen::~CodeGen() {
+}
+
+// Programs only run where they are compiled, so the other backends are
+// neither registered nor linked. The first CodeGen pays for it, not
+// --help or a parse error.
+void CodeGen::initializeTargets() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+    });
 }
 
 int CodeGen::initialize(){
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+    initializeTargets();
 
     _module =  std::make_unique<llvm::Module>(_module_name.c_str(), _context);
+    _module->setSourceFileName(_module_name);
 
-    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+    _target_triple = llvm::sys::getDefaultTargetTriple();
     std::string Error;
-    auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    _target = llvm::TargetRegistry::lookupTarget(_target_triple, Error);
 
-    if (!Target) {
+    if (!_target) {
         llvm::errs() << Error;
         return 1;
     }
-    auto CPU = "generic";
-    auto Features = "";
 
-    llvm::TargetOptions opt;
-    auto RM = llvm::Optional<llvm::Reloc::Model>();
-    _target_machine = Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+    _target_machine = targetMachine();
     auto layout = _target_machine->createDataLayout();
     _module->setDataLayout(layout);
-    _module->setTargetTriple(TargetTriple);
-
-  return 0;
-
-}
+    _module->setTargetTriple(_target_triple);
+    debugInfoInit();
 
-int CodeGen::generate(AstPtr ast ) {
-    std::error_code EC;
-    llvm::raw_fd_ostream out_dest(_out_filename + ".o", EC, llvm::sys::fs::OF_None);
-    if (EC) {
-        llvm::errs() << "Could not open file: " << EC.message();
+    if (initializeProfile() != 0) {
         return 1;
     }
 
-    auto FileType = llvm::CGFT_ObjectFile;
-
-    llvm::legacy::PassManager           pass;
-    if (_target_machine->addPassesToEmitFile(pass, out_dest, nullptr, FileType)) {
-        llvm::errs() << "TheTargetMachine can't emit a file of this type";
-        return 1;
+    if (_options.cache_dir != "") {
+        _object_cache = std::make_unique<ObjectCache>(_options.cache_dir, _options.cache_max_bytes);
+        if (_object_cache->initialize() != 0) {
+            return 1;
+        }
     }
 
+  return 0;
+
+}
+
+void CodeGen::entryPointGen(AstPtr ast) {
     llvm::FunctionType *func_proto =
         llvm::FunctionType::get(llvm::Type::getVoidTy(_context),  std::vector<llvm::Type *>(), false);
 
     llvm::Function *func =
     llvm::Function::Create(func_proto, llvm::Function::ExternalLinkage, _entry_point_func, _module.get());
+    // the kernel enters here with no return address pushed, so the stack
+    // is 8 bytes off the alignment the ABI promises to every callee
+    func->addFnAttr("stackrealign");
     
 
     std::list<Environment> env;
     Environment e;
     llvm::BasicBlock *block = llvm::BasicBlock::Create(_context, "entry", func);
     e.block = block;
+    e.function_scope = true;
 
     _builder.SetInsertPoint(block);
+    auto outer_loc = debugFuncBegin(func, 1);
 
     env.push_back(e);
 
+    _range_analysis.analyze(std::dynamic_pointer_cast<AstBlock>(ast), {}, _ref_params);
+    // the JIT only takes functions, the interpreter runs the entry point
+    _has_entry_point = !_options.jit && definesMain(ast);
+    if (_has_entry_point) {
+        arenaInitGen();
+    }
+    if (_has_entry_point && _options.profile_generate) {
+        // binaries start at _begonia_main, not crt1, so nothing runs the
+        // static constructor of the profile runtime that arms the .profraw dump
+        auto init_proto = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), false);
+        auto atexit_proto = llvm::FunctionType::get(llvm::Type::getInt32Ty(_context), false);
+        _builder.CreateCall(_module->getOrInsertFunction("__llvm_profile_initialize_file", init_proto));
+        _builder.CreateCall(_module->getOrInsertFunction("__llvm_profile_register_write_file_atexit", atexit_proto));
+    }
+
     blockGen(ast, env);
 
-    _builder.SetInsertPoint(block);
+    if (!_has_entry_point) {
+        // without main this module only contributes functions to a program
+        if (!block->empty()) {
+            printf("top-level statements need func main defined in the same file\n");
+            exit(1);
+        }
+        debugFuncEnd(outer_loc);
+        func->eraseFromParent();
+        return;
+    }
+
+    _builder.SetInsertPoint(env.front().block);
 
     auto main_func_expr = new FuncallExpression(internal_main_func, std::vector<ExpressionPtr>());
     FuncallExprGen(FuncallExpressionPtr(main_func_expr), env);
@@ -107,34 +192,97 @@ int CodeGen::generate(AstPtr ast ) {
     auto exit_func_expr = new FuncallExpression("exit", exit_call_args);
     FuncallExprGen(FuncallExpressionPtr(exit_func_expr), env);
     _builder.CreateRetVoid();
+    debugFuncEnd(outer_loc);
+}
 
+bool CodeGen::definesMain(AstPtr ast) {
+    auto ast_block = std::dynamic_pointer_cast<AstBlock>(ast);
+    assert(ast_block != nullptr);
+    for (auto statement : *ast_block) {
+        auto func = std::dynamic_pointer_cast<DeclareFuncStatement>(statement);
+        if (func != nullptr && func->_name == internal_main_func && func->_block->size() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    _module->print(llvm::errs(), nullptr);
+bool CodeGen::hasEntryPoint() {
+    return _has_entry_point;
+}
+
+// Generates, optimizes and emits the module; the objects (or with -flto=thin,
+// the bitcode files) it produced are appended to outputs.
+int CodeGen::compile(AstPtr ast, std::vector<std::string>& outputs) {
+    {
+        TraceScope scope("codegen");
+        entryPointGen(ast);
+        debugInfoFinalize();
+        framePointerGen();
+        instrumentFunctionsGen();
+    }
+    {
+        TraceScope scope("strip");
+        stripDeadFunctions();
+    }
+    {
+        TraceScope scope("attrs");
+        inferFunctionAttrs();
+    }
+    Profiler::Get().addCounter("ir_instructions", _module->getInstructionCount());
+    Profiler::Get().addCounter("bounds_checks", _bounds_checks);
+    Profiler::Get().addCounter("bounds_checks_elided", _bounds_checks_elided);
+    Profiler::Get().addCounter("tail_calls", _tail_calls_marked);
 
     llvm::raw_ostream &output = llvm::errs();
 
-    if (llvm::verifyModule(*_module.get(), &output)) {
-        assert(false && "verifyModule failed");
+    {
+        TraceScope scope("verify");
+        if (llvm::verifyModule(*_module.get(), &output)) {
+            assert(false && "verifyModule failed");
+        }
+    }
+
+    if (_options.lto_thin) {
+        {
+            TraceScope scope("optimize");
+            optimize(*_module);
+        }
+        if (_options.dump_ir) {
+            _module->print(llvm::errs(), nullptr);
+        }
+        TraceScope scope("emit");
+        return emitBitcode(outputs);
     }
-    pass.run(*_module);
-    out_dest.flush();
 
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
-    #error "Not support Windwos platform yet"
-#elif __linux__
-    std::string ld_cmd = "ld -e " + _entry_point_func +  " -dynamic-linker /lib64/ld-linux-x86-64.so.2 -o " + _out_filename +" ./" + _out_filename + ".o " + " -lc ";
-#elif __APPLE__
-    std::string ld_cmd = "ld -e " + _entry_point_func +  " -o " + _out_filename + " ./" + _out_filename + ".o " + " -lSystem -macosx_version_min 10.14";
-#else
-    #error "Unknow OS platform"
-#endif
+    if (_object_cache != nullptr) {
+        TraceScope scope("cache");
+        if (emitCachedFunctions(outputs) != 0) {
+            return 1;
+        }
+    }
+    {
+        TraceScope scope("optimize");
+        optimize(*_module);
+    }
+    if (_options.dump_ir) {
+        _module->print(llvm::errs(), nullptr);
+    }
 
+    TraceScope scope("emit");
+    return emitObjects(outputs);
+}
 
-    int retcode = system(ld_cmd.c_str());
-    if (retcode != 0) 
+int CodeGen::generate(AstPtr ast ) {
+    std::vector<std::string> objects;
+    if (compile(ast, objects) != 0) {
         return 1;
-
-    return 0;
+    }
+    if (!_has_entry_point) {
+        printf("Can't find func:%s\n", internal_main_func.c_str());
+        return 1;
+    }
+    return link(objects);
 }
 
-}
\ No newline at end of file
+}
@@ -2,9 +2,11 @@
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IRBuilder.h"
@@ -23,10 +25,36 @@
 
 #include "Parser.h"
 #include "Expression.h"
+#include "Profiler.h"
+#include "RangeAnalysis.h"
 
 #include <list>
 
 namespace begonia {
+
+struct CodeGenOptions {
+    std::string     out_filename = "out";
+    std::string     object_name;         // objects are <object_name>[.<n>].o, defaults to out_filename
+    std::string     module_name = "module";
+    bool            dump_ir = false;     // --emit-llvm: print the module to stderr
+    int             opt_level = 0;       // -O0 .. -O3
+    unsigned        jobs = 1;            // -j: backend threads, 0 means one per core
+    std::string     cache_dir;           // --cache-dir: per-function object cache, off if empty
+    uint64_t        cache_max_bytes = 1024ull * 1024 * 1024;
+    bool            profile_generate = false;   // -fprofile-generate[=<dir>]
+    std::string     profile_generate_dir;
+    std::string     profile_use;                // -fprofile-use=<file>: merged .profdata
+    std::string     profile_runtime;            // libclang_rt.profile, found next to LLVM if empty
+    std::string     runtime_lib;                // libbegonia_rt.a, found next to the compiler if empty
+    bool            lto_thin = false;           // -flto=thin: emit bitcode with summary, ThinLTO at link
+    bool            debug_info = false;         // -g: DWARF line tables, functions and variables
+    bool            frame_pointer = false;      // -fno-omit-frame-pointer
+    bool            instrument_functions = false;   // -finstrument-functions: entry/exit hooks of runtime/trace.c
+    bool            jit = false;                // --run: modules of hot functions for the JIT, JitGen.cpp
+};
+
+class ObjectCache;
+
 //class 
 class CodeGen {
 public:
@@ -37,6 +65,7 @@ public:
         Double,
         Bool,
         Void,
+        Str,
         Unkown,
     };
     struct Environment {
@@ -44,15 +73,42 @@ public:
         std::map<std::string, llvm::Function *>     declared_prototype;
         llvm::BasicBlock*                           block;
         uint64_t                                    auto_inc_id = 0;
+        bool                                        function_scope = false; // variables of outer frames are not visible
+        bool                                        region = false;         // frame of a region block
+        bool                                        pfor = false;           // function of a pfor body, outer variables are captured
+        std::vector<llvm::Value*>                   captures;               // of a pfor frame: outer addresses, by slot
         uint64_t GetIncID() { 
             return auto_inc_id++;
         }
     };
+    struct StructInfo {
+        llvm::StructType*                   type;
+        std::map<std::string, unsigned>     field_index;    // element of type holding the field
+        bool                                packed = false;
+        unsigned                            align = 1;      // including align(N) and aligned fields
+    };
+    // soa [N]S is {[N x f0], [N x f1], ...}, soa []S is {f0*, f1*, ..., i64 length}
+    struct SoaInfo {
+        llvm::StructType*                   type;
+        llvm::StructType*                   elem_type;      // S
+        uint64_t                            length = 0;     // N, 0 for soa []S
+        std::map<std::string, unsigned>     column;         // field name to column
+        std::vector<unsigned>               elem_index;     // column to element of elem_type
+    };
     using GeneratorHandler = std::function<llvm::Value*(AstPtr,std::list<Environment>&)>;
+    using BuiltinHandler = std::function<llvm::Value*(FuncallExpressionPtr,std::list<Environment>&)>;
 
-    CodeGen();
+    CodeGen(CodeGenOptions options = CodeGenOptions());
+    ~CodeGen();
     int initialize();
+    // registers the host target with LLVM, once per process
+    static void initializeTargets();
     int generate(AstPtr ast );
+    int compile(AstPtr ast, std::vector<std::string>& outputs);
+    int thinLink(const std::vector<std::string>& bitcodes, bool has_regular_objects, std::vector<std::string>& objects);
+    int link(const std::vector<std::string>& objects);
+    int jitCompile(AstPtr ast, const std::vector<std::pair<std::string, std::string>>& entries, llvm::SmallVectorImpl<char>& object);
+    bool hasEntryPoint();
 
 private:
     llvm::LLVMContext                   _context;
@@ -60,10 +116,54 @@ private:
     std::unique_ptr<llvm::Module>       _module;
     std::map<std::string, ValueType>    _basic_variable_type;
     std::map<AstType, GeneratorHandler> _generator;
+    std::map<std::string, BuiltinHandler> _builtins;
+    std::map<std::string, StructInfo>   _structs;
+    std::map<std::string, SoaInfo>      _soa_types;     // by name of the LLVM type
+    llvm::StructType*                   _str_type = nullptr;
+    std::map<std::string, llvm::StructType*> _runtime_types;   // thread, queue and atomics, ThreadGen.cpp
+    std::map<std::string, std::vector<bool>> _ref_params;  // parameters passed by reference, per function
     Environment                         _global_env;
+    CodeGenOptions                      _options;
     std::string                         _out_filename = "out";
+    std::string                         _object_name = "out";
+    bool                                _has_entry_point = false;
     std::string                         _module_name = "module";
-    llvm::TargetMachine*                _target_machine = nullptr;
+    llvm::TargetMachine*                _target_machine = nullptr;   // of this thread, see targetMachine()
+    const llvm::Target*                 _target = nullptr;
+    std::unique_ptr<ObjectCache>        _object_cache;
+    std::map<std::string, AstPtr>       _defined_funcs;
+    std::string                         _local_suffix;  // of local symbols, see uniqueLocalNames()
+    std::vector<std::string>            _link_args;
+    std::string                         _target_triple;
+    RangeAnalysis                       _range_analysis;
+    std::map<llvm::Function*, llvm::BasicBlock*> _trap_blocks;
+    uint64_t                            _bounds_checks = 0;
+    uint64_t                            _bounds_checks_elided = 0;
+    struct TailCall {
+        llvm::CallInst*     call;
+        bool                required;   // return tailcall f(...)
+    };
+    std::vector<TailCall>               _tail_calls;    // calls in tail position of the function being generated
+    // blocks and values of the gen or async func being generated, CoroutineGen.cpp
+    struct Coroutine {
+        llvm::Value*        id;             // token of llvm.coro.id
+        llvm::Value*        handle;         // llvm.coro.begin
+        llvm::AllocaInst*   promise;        // the yielded value, read by next(); {waiter, result} of a task
+        llvm::BasicBlock*   final_suspend;  // the body ended
+        llvm::BasicBlock*   cleanup;        // destroyed: frees the frame
+        llvm::BasicBlock*   suspend;        // back to the caller of the ramp or of resume
+        bool                async = false;  // of an async func
+        llvm::AllocaInst*   io = nullptr;   // async: record of the I/O or task awaited, made by the first await
+    };
+    Coroutine*                          _coroutine = nullptr;
+    std::map<llvm::Type*, llvm::StructType*> _gen_types;   // yielded type to gen<T>
+    std::map<llvm::Type*, llvm::StructType*> _task_types;  // result type to task<T>
+    uint64_t                            _tail_calls_marked = 0;
+    std::unique_ptr<llvm::DIBuilder>    _di_builder;    // -g, DebugInfoGen.cpp
+    llvm::DICompileUnit*                _di_unit = nullptr;
+    llvm::DIFile*                       _di_file = nullptr;
+    std::vector<llvm::DISubprogram*>    _di_subprograms;    // of the functions being generated, innermost last
+    std::map<llvm::Type*, llvm::DIType*> _di_types;
     std::string                         _entry_point_func = "_begonia_main";
     std::string                         internal_main_func = "main";
 
@@ -71,10 +171,19 @@ private:
     llvm::Type* getValueType(std::string type_name);
     llvm::Type* getPointerOriginType(llvm::Value* pointer_type);
     bool isDoubleType(llvm::Value* v);
+    bool isSliceType(llvm::Type* type);
+    llvm::StructType* getSliceType(llvm::Type* elem_type);
+    llvm::Value* lookupVariable(const std::string& name, std::list<Environment>& env);
+    llvm::AllocaInst* createEntryAlloca(llvm::Type* type, const std::string& name);
+    llvm::Value* convertValue(llvm::Value* val, llvm::Type* type);
+    bool unifyOperands(llvm::Value*& lval, llvm::Value*& rval);
+    llvm::Value* boolValueGen(llvm::Value* val);
 
     llvm::Value* declareProtoGen(AstPtr, std::list<Environment>&);
     llvm::Value* assignGen(AstPtr, std::list<Environment>&);
     llvm::Value* FuncallExprGen(AstPtr, std::list<Environment>&);
+    llvm::Function* lookupFunction(const std::string& name, std::list<Environment>&);
+    std::vector<llvm::Value*> argumentsGen(FuncallExpressionPtr, llvm::Function* func_proto, std::list<Environment>&);
     llvm::Value* declareVarGen(AstPtr, std::list<Environment>&);
     llvm::Value* ifStatementGen(AstPtr, std::list<Environment>&);
     llvm::Value* returnGen(AstPtr, std::list<Environment>&);
@@ -84,20 +193,198 @@ private:
 
     llvm::Value* exprGen(AstPtr, std::list<Environment>&);
     llvm::Value* opExprGen(AstPtr, std::list<Environment>&);
-    llvm::Value* addExprGen(ExpressionPtr, ExpressionPtr, std::list<Environment>&);
-    llvm::Value* subExprGen(ExpressionPtr, ExpressionPtr, std::list<Environment>&);
-    llvm::Value* mulExprGen(ExpressionPtr, ExpressionPtr, std::list<Environment>&);
-    llvm::Value* divExprGen(ExpressionPtr, ExpressionPtr, std::list<Environment>&);
+    llvm::Value* addExprGen(llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* subExprGen(llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* mulExprGen(llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* divExprGen(llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* modExprGen(llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* bitExprGen(TokenType, llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* compareExprGen(TokenType, llvm::Value*, llvm::Value*, std::list<Environment>&);
+    llvm::Value* logicalExprGen(OperationExpressonPtr, std::list<Environment>&);
     llvm::Value* numberExprGen(AstPtr, std::list<Environment>&);
     llvm::Value* blockGen(AstPtr, std::list<Environment>&);
     llvm::Value* identifierExprGen(AstPtr, std::list<Environment>&);
+    llvm::Value* addressGen(ExpressionPtr, std::list<Environment>&);
     llvm::Value* BoolExprGen(AstPtr, std::list<Environment>&);
     llvm::Value* stringExprGen(AstPtr, std::list<Environment>&);
 
+    // arrays and slices, ArrayGen.cpp
+    llvm::Value* indexExprGen(AstPtr, std::list<Environment>&);
+    llvm::Value* sliceExprGen(AstPtr, std::list<Environment>&);
+    llvm::Value* makeExprGen(AstPtr, std::list<Environment>&);
+    llvm::Value* elementAssignGen(AstPtr, std::list<Environment>&);
+    llvm::Value* lenGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* deleteGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* elementAddressGen(IndexExpressionPtr, std::list<Environment>&, llvm::Value* base_addr = nullptr, llvm::Value* base_value = nullptr);
+    llvm::Value* indexAddressGen(IndexExpressionPtr, llvm::Value* base_addr, llvm::Value* base_value, std::list<Environment>&);
+    void boundsCheckGen(IndexExpressionPtr, llvm::Value* index, llvm::Value* length, std::list<Environment>&);
+    void sliceBoundsGen(SliceExpressionPtr, llvm::Value* length, std::list<Environment>&, llvm::Value*& low, llvm::Value*& high);
+    llvm::Type* operandGen(ExpressionPtr, std::list<Environment>&, llvm::Value*& addr, llvm::Value*& value);
+    llvm::Value* loadValueGen(llvm::Value* addr, llvm::Align align);
+    llvm::Value* indexValueGen(ExpressionPtr, std::list<Environment>&);
+    void arrayBaseGen(ExpressionPtr base, std::list<Environment>& env, llvm::Value*& data, llvm::Value*& length, llvm::Value* base_addr = nullptr, llvm::Value* base_value = nullptr);
+    llvm::Value* arraySliceGen(llvm::Value* array_addr);
+    void trapUnlessGen(llvm::Value* ok, std::list<Environment>& env);
+
+    // SIMD vectors, VectorGen.cpp
+    llvm::Type* getVectorType(llvm::Type* elem_type, unsigned lanes);
+    unsigned laneCount(llvm::Type* vec_type);
+    llvm::Value* laneIndexGen(IndexExpressionPtr, unsigned lanes, std::list<Environment>&);
+    llvm::Value* laneGen(IndexExpressionPtr, llvm::Value* vec, std::list<Environment>&);
+    llvm::Value* laneAssignGen(IndexExpressionPtr, llvm::Value* val, llvm::Value* vec_addr, std::list<Environment>&);
+    llvm::Value* vectorAddressGen(FuncallExpressionPtr, unsigned lanes, llvm::Value** lane_mask, std::list<Environment>&);
+    llvm::Value* vloadGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* vstoreGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* vloadMaskedGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* vstoreMaskedGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* shuffleGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* selectGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* reduceGen(const std::string& op, FuncallExpressionPtr, std::list<Environment>&);
+
+    // calling conventions and tail calls, TailCallGen.cpp
+    llvm::CallingConv::ID callingConv(llvm::Function* func);
+    void tailCallCandidate(ReturnStatementPtr, llvm::Value* ret_val);
+    void markTailCalls(llvm::Function* func);
+
+    // function attributes, FunctionAttrs.cpp
+    void annotateFunction(DeclareFuncStatementPtr, llvm::Function* func);
+    void inferFunctionAttrs();
+
+    // structs, StructGen.cpp
+    llvm::Value* declareStructGen(AstPtr, std::list<Environment>&);
+    llvm::Value* memberExprGen(AstPtr, std::list<Environment>&);
+    llvm::Value* memberAddressGen(MemberExpressionPtr, llvm::Value* base_addr, llvm::Align& align);
+    const StructInfo* structInfo(llvm::Type* type);
+    llvm::Align typeAlign(llvm::Type* type);
+    llvm::Value* fieldAddressGen(MemberExpressionPtr, std::list<Environment>&, llvm::Align& align);
+
+    // soa collections of structs, SoaGen.cpp
+    llvm::Type* getSoaType(const std::string& type_name);
+    const SoaInfo* soaInfo(llvm::Type* type);
+    bool isFixedCollection(llvm::Type* type);
+    void soaBaseGen(const SoaInfo*, llvm::Value* addr, llvm::Value* value, std::vector<llvm::Value*>& columns, llvm::Value*& length);
+    llvm::Value* soaSliceGen(llvm::Value* soa_addr);
+    llvm::Value* soaFieldAddressGen(IndexExpressionPtr, const std::string& field, const SoaInfo*, llvm::Value* addr, llvm::Value* value, std::list<Environment>&, llvm::Align& align);
+    llvm::Value* soaElementGen(IndexExpressionPtr, const SoaInfo*, llvm::Value* addr, llvm::Value* value, std::list<Environment>&);
+    llvm::Value* soaElementAssignGen(IndexExpressionPtr, llvm::Value* val, const SoaInfo*, llvm::Value* addr, llvm::Value* value, std::list<Environment>&);
+    llvm::Value* soaSubsliceGen(SliceExpressionPtr, const SoaInfo*, llvm::Value* addr, llvm::Value* value, std::list<Environment>&);
+    llvm::Value* soaMakeGen(MakeExpressionPtr, const SoaInfo*, std::list<Environment>&);
+
+    // regions and heap memory, RegionGen.cpp
+    llvm::FunctionCallee arenaRuntimeFunc(const std::string& name, llvm::FunctionType* func_type);
+    llvm::Value* allocGen(llvm::Value* bytes, uint64_t align);
+    llvm::Value* freeGen(llvm::Value* memory);
+    void arenaInitGen();
+    llvm::Value* regionGen(AstPtr, std::list<Environment>&);
+    bool leaveRegionsGen(ReturnStatementPtr, std::list<Environment>&);
+
+    // parallel loops, PforGen.cpp
+    llvm::Value* pforGen(AstPtr, std::list<Environment>&);
+    llvm::Value* captureGen(Environment& pfor_frame, const std::string& name, llvm::Value* outer_addr);
+    llvm::Value* reduceCombineGen(const std::string& op, llvm::Value* lval, llvm::Value* rval);
+
+    // threads, atomics and queues, ThreadGen.cpp
+    llvm::StructType* getHandleType(const std::string& name);
+    bool isHandleType(llvm::Type* type, const std::string& name);
+    llvm::StructType* getAtomicType(llvm::Type* elem_type);
+    llvm::Type* atomicElemType(llvm::Type* type);
+    llvm::FunctionCallee threadRuntimeFunc(const std::string& name, llvm::FunctionType* func_type);
+    llvm::Value* handleGen(ExpressionPtr, const std::string& type_name, const std::string& builtin, std::list<Environment>&);
+    llvm::Value* spawnGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* joinGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* atomicAddressGen(ExpressionPtr, const std::string& builtin, std::list<Environment>&);
+    llvm::Value* atomicOperandGen(ExpressionPtr, llvm::Type* type, const std::string& builtin, std::list<Environment>&);
+    llvm::Value* atomicLoadGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* atomicStoreGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* atomicRMWGen(const std::string& op, FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* atomicCasGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* fenceGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* queueNewGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* queueOpGen(const std::string& op, FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* queueFreeGen(llvm::Value* handle);
+
+    // generators, CoroutineGen.cpp
+    llvm::StructType* getGenType(llvm::Type* yield_type);
+    llvm::Type* genYieldType(llvm::Type* type);
+    llvm::Function* coroIntrinsic(llvm::Intrinsic::ID id);
+    llvm::BasicBlock* coroBeginGen(llvm::Function* func, llvm::Type* promise_type, Coroutine& coro);
+    void coroEndGen(std::list<Environment>& env);
+    llvm::Value* yieldGen(AstPtr, std::list<Environment>&);
+    void suspendCheck(const std::string& what, std::list<Environment>&);
+    void coroSuspendGen(std::list<Environment>&);
+    void coroReturnGen(ReturnStatementPtr, std::list<Environment>&);
+    llvm::Value* nextGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* genDestroyGen(llvm::Value* handle);
+
+    // async func and await, AsyncGen.cpp
+    llvm::StructType* getTaskType(llvm::Type* result_type);
+    llvm::Type* taskResultType(llvm::Type* type);
+    llvm::StructType* taskPromiseType(llvm::Type* result_type);
+    llvm::FunctionCallee asyncRuntimeFunc(const std::string& name, llvm::Type* ret_type, const std::vector<llvm::Type*>& params);
+    llvm::Value* asyncRecordGen();
+    void asyncReadyGen();
+    void asyncReturnGen(ReturnStatementPtr, std::list<Environment>&);
+    llvm::Value* awaitGen(AstPtr, std::list<Environment>&);
+    llvm::Value* awaitTaskGen(llvm::Value* task, std::list<Environment>&);
+    llvm::Value* awaitIoGen(FuncallExpressionPtr, std::list<Environment>&);
+    llvm::Value* taskResultGen(llvm::Value* handle, llvm::Type* result_type);
+    llvm::Value* runGen(FuncallExpressionPtr, std::list<Environment>&);
+
+    // debug info, frame pointers and entry/exit hooks, DebugInfoGen.cpp
+    void debugInfoInit();
+    void debugModuleFlags(llvm::Module& module);
+    void debugInfoFinalize();
+    llvm::DIType* debugType(llvm::Type* type);
+    llvm::DebugLoc debugFuncBegin(llvm::Function* func, long line);
+    void debugFuncEnd(llvm::DebugLoc outer_loc);
+    void debugLocGen(AstPtr statement);
+    void debugVarGen(llvm::Value* addr, const std::string& name, long line, unsigned arg_no = 0);
+    void framePointerGen();
+    void instrumentFunctionsGen();
+    void entryExitGen(llvm::Module& module);
+    // tier entries of --run, JitGen.cpp
+    void tierEntryGen(const std::string& func_name, const std::string& entry_name);
+    // strings, StringGen.cpp
+    llvm::StructType* getStrType();
+    bool isStrType(llvm::Type* type);
+    llvm::Constant* cStringConstant(const std::string& bytes);
+    llvm::Constant* strLiteralGen(const std::string& bytes);
+    llvm::Value* strIsHeapGen(llvm::Value* str);
+    llvm::Value* strLenGen(llvm::Value* str);
+    llvm::Value* strDataGen(llvm::Value* addr);
+    llvm::Value* strSpillGen(llvm::Value* str);
+    llvm::FunctionCallee strRuntimeFunc(const std::string& name, llvm::Type* ret_type, const std::vector<llvm::Type*>& params, bool read_only);
+    llvm::Value* strCStringGen(llvm::Value* str);
+    llvm::Value* strOwnedCStringGen(llvm::Value* str);
+    llvm::Value* cStringToStrGen(llvm::Value* cstr);
+    llvm::Value* strOpExprGen(TokenType, llvm::Value* lval, llvm::Value* rval);
+    llvm::Value* strIndexGen(IndexExpressionPtr, llvm::Value* addr, llvm::Value* value, std::list<Environment>&);
+    llvm::Value* strSliceGen(SliceExpressionPtr, llvm::Value* addr, llvm::Value* value, std::list<Environment>&);
+    llvm::Value* strFreeGen(llvm::Value* addr, llvm::Value* value);
+    llvm::Value* hashGen(FuncallExpressionPtr, std::list<Environment>&);
+
     void CondBranchGen(std::list<Environment>& env,llvm::Value* val, llvm::BasicBlock* true_br, llvm::BasicBlock* false_br);
 
     //llvm::IRBuilder<> getBuilder(std::list<Environment>& env);
     void MainFuncCodegen();
+    void entryPointGen(AstPtr ast);
+    bool definesMain(AstPtr ast);
+
+    std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+    llvm::TargetMachine* targetMachine();
+    void stripDeadFunctions();
+    void uniqueLocalNames();
+    void optimize(llvm::Module& module);
+    int  emitObject(llvm::Module& module, const std::string& object);
+    int  emitObject(llvm::Module& module, llvm::raw_pwrite_stream& out);
+    int  emitObjects(std::vector<std::string>& objects);
+    int  emitCachedFunctions(std::vector<std::string>& objects);
+    int  emitBitcode(std::vector<std::string>& outputs);
+    std::unique_ptr<llvm::Module> extractFunction(llvm::Function* func);
+    int  initializeProfile();
+    bool hotColdSplit() const;
+    std::string profileRuntimePath();
+    std::string runtimeLibPath();
 };
 
 } //begonia
@@ -0,0 +1,281 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include "llvm/IR/Intrinsics.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace begonia {
+
+// gen<T> is {i8*} around the coroutine handle, one type per yielded T
+llvm::StructType* CodeGen::getGenType(llvm::Type* yield_type) {
+    if (yield_type->isVoidTy() || atomicElemType(yield_type) != nullptr || isFixedCollection(yield_type)) {
+        printf("gen<T> needs T a value type, yield slices instead of arrays\n");
+        exit(1);
+    }
+    auto& type = _gen_types[yield_type];
+    if (type == nullptr) {
+        type = llvm::StructType::create(_context, {llvm::Type::getInt8PtrTy(_context)}, "gen");
+    }
+    return type;
+}
+
+// T of a gen<T>, nullptr for other types
+llvm::Type* CodeGen::genYieldType(llvm::Type* type) {
+    for (auto& gen : _gen_types) {
+        if (gen.second == type) {
+            return gen.first;
+        }
+    }
+    return nullptr;
+}
+
+llvm::Function* CodeGen::coroIntrinsic(llvm::Intrinsic::ID id) {
+    return llvm::Intrinsic::getDeclaration(_module.get(), id);
+}
+
+// The ramp of a gen or async func: allocates the frame, unless CoroElide
+// finds that the caller can hold it. A gen func suspends before the first
+// statement, so calling it only makes the generator; an async func runs until
+// its first await. Returns the block the body starts in; the blocks
+// coroEndGen fills are made here for yields and returns to branch to.
+llvm::BasicBlock* CodeGen::coroBeginGen(llvm::Function* func, llvm::Type* promise_type, Coroutine& coro) {
+    auto& builder = _builder;
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto null = llvm::ConstantPointerNull::get(i8ptr);
+    // CoroSplit only splits functions the frontend marked, as clang does
+#if LLVM_VERSION_MAJOR >= 15
+    func->addFnAttr(llvm::Attribute::PresplitCoroutine);
+#else
+    func->addFnAttr("coroutine.presplit", "0");
+#endif
+
+    coro.promise = createEntryAlloca(promise_type, "promise");
+    coro.id = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_id),
+        {builder.getInt32(0), builder.CreateBitCast(coro.promise, i8ptr), null, null}, "coro.id");
+    auto need_alloc = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_alloc), {coro.id});
+    auto entry_block = builder.GetInsertBlock();
+    auto alloc_block = llvm::BasicBlock::Create(_context, "coro.alloc", func);
+    auto begin_block = llvm::BasicBlock::Create(_context, "coro.begin", func);
+    builder.CreateCondBr(need_alloc, alloc_block, begin_block);
+
+    builder.SetInsertPoint(alloc_block);
+    auto size = builder.CreateCall(llvm::Intrinsic::getDeclaration(_module.get(), llvm::Intrinsic::coro_size,
+                                                                   {llvm::Type::getInt64Ty(_context)}));
+    auto memory = allocGen(size, 16);
+    builder.CreateBr(begin_block);
+
+    builder.SetInsertPoint(begin_block);
+    auto frame = builder.CreatePHI(i8ptr, 2);
+    frame->addIncoming(null, entry_block);
+    frame->addIncoming(memory, alloc_block);
+    coro.handle = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_begin), {coro.id, frame}, "coro.handle");
+
+    coro.final_suspend = llvm::BasicBlock::Create(_context, "coro.final");
+    coro.cleanup = llvm::BasicBlock::Create(_context, "coro.cleanup");
+    coro.suspend = llvm::BasicBlock::Create(_context, "coro.suspend");
+    if (coro.async) {
+        // no waiter yet, and the result of a body that doesn't return one
+        builder.CreateStore(llvm::Constant::getNullValue(promise_type), coro.promise);
+        return begin_block;
+    }
+
+    auto body_block = llvm::BasicBlock::Create(_context, "coro.body", func);
+    auto suspended = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_suspend),
+                                        {llvm::ConstantTokenNone::get(_context), builder.getFalse()});
+    auto resumed = builder.CreateSwitch(suspended, coro.suspend, 2);
+    resumed->addCase(builder.getInt8(0), body_block);
+    resumed->addCase(builder.getInt8(1), coro.cleanup);
+    builder.SetInsertPoint(body_block);
+    return body_block;
+}
+
+// The end of a gen or async func body: the final suspend, after which next()
+// is false or await takes the result, the cleanup run by delete and await
+// and the return to whoever resumed it.
+void CodeGen::coroEndGen(std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto& coro = *_coroutine;
+    auto func = env.front().block->getParent();
+    if (env.front().block->getTerminator() == nullptr) {
+        builder.SetInsertPoint(env.front().block);
+        builder.CreateBr(coro.final_suspend);
+    }
+
+    coro.final_suspend->insertInto(func);
+    builder.SetInsertPoint(coro.final_suspend);
+    if (coro.async) {
+        asyncReadyGen();
+    }
+    auto suspended = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_suspend),
+                                        {llvm::ConstantTokenNone::get(_context), builder.getTrue()});
+    auto done_block = llvm::BasicBlock::Create(_context, "coro.resumed_done", func);
+    auto resumed = builder.CreateSwitch(suspended, coro.suspend, 2);
+    resumed->addCase(builder.getInt8(0), done_block);
+    resumed->addCase(builder.getInt8(1), coro.cleanup);
+    builder.SetInsertPoint(done_block);
+    builder.CreateUnreachable();
+
+    coro.cleanup->insertInto(func);
+    builder.SetInsertPoint(coro.cleanup);
+    auto memory = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_free), {coro.id, coro.handle});
+    auto free_block = llvm::BasicBlock::Create(_context, "coro.free", func);
+    builder.CreateCondBr(builder.CreateIsNotNull(memory), free_block, coro.suspend);
+    builder.SetInsertPoint(free_block);
+    freeGen(memory);
+    builder.CreateBr(coro.suspend);
+
+    coro.suspend->insertInto(func);
+    builder.SetInsertPoint(coro.suspend);
+    builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_end), {coro.handle, builder.getFalse()});
+    auto gen = builder.CreateInsertValue(llvm::UndefValue::get(func->getReturnType()), coro.handle, 0);
+    builder.CreateRet(gen);
+}
+
+// yield exp; stores exp for next() and suspends. The caller runs until it
+// resumes the generator, so a yield can't leave a region entered or run on
+// the threads of a pfor.
+llvm::Value* CodeGen::yieldGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto yield_stat = std::dynamic_pointer_cast<YieldStatement>(ast);
+    assert(yield_stat != nullptr);
+    if (_coroutine == nullptr || _coroutine->async) {
+        printf("yield outside a gen func\n");
+        exit(1);
+    }
+    suspendCheck("yield", env);
+
+    auto val = exprGen(yield_stat->_value, env);
+    if (val->getType()->isPointerTy() && val->getType() != llvm::Type::getInt8PtrTy(_context)) {
+        val = builder.CreateLoad(val->getType()->getPointerElementType(), val);
+    }
+    auto converted = convertValue(val, _coroutine->promise->getAllocatedType());
+    if (converted == nullptr) {
+        printf("yield: type no matched\n");
+        exit(1);
+    }
+    builder.CreateStore(converted, _coroutine->promise);
+    coroSuspendGen(env);
+    return nullptr;
+}
+
+// Code other than the coroutine runs while it is suspended, so it can't
+// suspend in a region that code would allocate from, or on the threads of a
+// pfor.
+void CodeGen::suspendCheck(const std::string& what, std::list<Environment>& env) {
+    for (auto& env_frame : env) {
+        if (env_frame.pfor) {
+            printf("%s inside a pfor body: its iterations run on other threads\n", what.c_str());
+            exit(1);
+        }
+        if (env_frame.region) {
+            printf("%s inside a region: other code would allocate from the region while suspended\n", what.c_str());
+            exit(1);
+        }
+        if (env_frame.function_scope) {
+            break;
+        }
+    }
+}
+
+// suspends the coroutine being generated, code after it runs once resumed
+void CodeGen::coroSuspendGen(std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto func = builder.GetInsertBlock()->getParent();
+    auto resume_block = llvm::BasicBlock::Create(_context, std::to_string(env.front().GetIncID()) + ".resume", func);
+    auto suspended = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_suspend),
+                                        {llvm::ConstantTokenNone::get(_context), builder.getFalse()});
+    auto resumed = builder.CreateSwitch(suspended, _coroutine->suspend, 2);
+    resumed->addCase(builder.getInt8(0), resume_block);
+    resumed->addCase(builder.getInt8(1), _coroutine->cleanup);
+    env.front().block = resume_block;
+    builder.SetInsertPoint(resume_block);
+}
+
+// return; in a gen func ends the sequence, return exp; in an async func gives
+// await its result
+void CodeGen::coroReturnGen(ReturnStatementPtr ret_stat, std::list<Environment>& env) {
+    if (_coroutine->async) {
+        asyncReturnGen(ret_stat, env);
+    } else if (ret_stat->_ret_values.size() != 0) {
+        printf("return in gen func %s takes no value, it ends what the generator yields\n",
+               _builder.GetInsertBlock()->getParent()->getName().str().c_str());
+        exit(1);
+    }
+    leaveRegionsGen(ret_stat, env);
+    _builder.CreateBr(_coroutine->final_suspend);
+}
+
+// next(g, x): resumes g until its next yield and stores the yielded value in
+// x. false, leaving x alone, once g has ended.
+llvm::Value* CodeGen::nextGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto& builder = _builder;
+    if (funcall->_parameters.size() != 2) {
+        printf("next takes a generator and the variable to store its value in\n");
+        exit(1);
+    }
+    auto gen = exprGen(funcall->_parameters[0], env);
+    if (gen->getType()->isPointerTy() && gen->getType() != llvm::Type::getInt8PtrTy(_context)) {
+        gen = builder.CreateLoad(gen->getType()->getPointerElementType(), gen);
+    }
+    auto yield_type = genYieldType(gen->getType());
+    if (yield_type == nullptr) {
+        printf("next takes a gen<T>\n");
+        exit(1);
+    }
+    auto addr = addressGen(funcall->_parameters[1], env);
+    if (addr == nullptr) {
+        printf("next stores into a variable, element or field\n");
+        exit(1);
+    }
+    auto handle = builder.CreateExtractValue(gen, 0);
+
+    auto func = builder.GetInsertBlock()->getParent();
+    auto id = std::to_string(env.front().GetIncID());
+    auto check_block = builder.GetInsertBlock();
+    auto resume_block = llvm::BasicBlock::Create(_context, id + ".next", func);
+    auto value_block = llvm::BasicBlock::Create(_context, id + ".yielded", func);
+    auto end_block = llvm::BasicBlock::Create(_context, id + ".nextend", func);
+    // resuming a generator at its final suspend is undefined
+    auto done = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_done), {handle});
+    builder.CreateCondBr(done, end_block, resume_block);
+
+    builder.SetInsertPoint(resume_block);
+    builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_resume), {handle});
+    auto ended = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_done), {handle});
+    builder.CreateCondBr(ended, end_block, value_block);
+
+    builder.SetInsertPoint(value_block);
+    auto align = typeAlign(yield_type);
+    auto promise = builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_promise),
+                                      {handle, builder.getInt32(align.value()), builder.getFalse()});
+    auto val = builder.CreateAlignedLoad(yield_type, builder.CreateBitCast(promise, yield_type->getPointerTo()), align);
+    auto converted = convertValue(val, addr->getType()->getPointerElementType());
+    if (converted == nullptr) {
+        printf("next: the variable doesn't hold what the generator yields\n");
+        exit(1);
+    }
+    builder.CreateStore(converted, addr);
+    builder.CreateBr(end_block);
+
+    builder.SetInsertPoint(end_block);
+    auto yielded = builder.CreatePHI(builder.getInt1Ty(), 3);
+    yielded->addIncoming(builder.getFalse(), check_block);
+    yielded->addIncoming(builder.getFalse(), resume_block);
+    yielded->addIncoming(builder.getTrue(), value_block);
+    env.front().block = end_block;
+    return yielded;
+}
+
+// delete(g): destroys the frame of g, whether or not it ended
+llvm::Value* CodeGen::genDestroyGen(llvm::Value* handle) {
+    return _builder.CreateCall(coroIntrinsic(llvm::Intrinsic::coro_destroy), {handle});
+}
+
+} //begonia
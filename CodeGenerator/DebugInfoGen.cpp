@@ -0,0 +1,222 @@
+#include "CodeGen.h"
+
+#include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/EntryExitInstrumenter.h"
+
+namespace begonia {
+
+// -g: one compile unit per module. Every function defined in the source, pfor
+// body and the entry point gets a subprogram, every statement the line it
+// starts on, and parameters and vars are described where they are declared.
+void CodeGen::debugInfoInit() {
+    if (!_options.debug_info) {
+        return;
+    }
+    llvm::SmallString<256> path(_module_name);
+    llvm::sys::fs::make_absolute(path);
+    _di_builder = std::make_unique<llvm::DIBuilder>(*_module);
+    _di_file = _di_builder->createFile(llvm::sys::path::filename(path), llvm::sys::path::parent_path(path));
+    // DWARF has no code for begonia, debuggers and profilers take it as C
+    _di_unit = _di_builder->createCompileUnit(llvm::dwarf::DW_LANG_C, _di_file, "begonia", _options.opt_level > 0, "", 0);
+    debugModuleFlags(*_module);
+}
+
+// modules without these flags have their debug info dropped
+void CodeGen::debugModuleFlags(llvm::Module& module) {
+    if (module.getModuleFlag("Debug Info Version") == nullptr) {
+        module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+    }
+    if (module.getModuleFlag("Dwarf Version") == nullptr) {
+        module.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    }
+}
+
+void CodeGen::debugInfoFinalize() {
+    if (_di_builder != nullptr) {
+        _di_builder->finalize();
+    }
+}
+
+llvm::DIType* CodeGen::debugType(llvm::Type* type) {
+    auto found = _di_types.find(type);
+    if (found != _di_types.end()) {
+        return found->second;
+    }
+    auto& layout = _module->getDataLayout();
+    llvm::DIType* di_type = nullptr;
+    if (type->isVoidTy()) {
+        return nullptr;
+    } else if (!type->isSized()) {
+        di_type = _di_builder->createUnspecifiedType("opaque");
+    } else if (type->isIntegerTy(1)) {
+        di_type = _di_builder->createBasicType("bool", 8, llvm::dwarf::DW_ATE_boolean);
+    } else if (type->isIntegerTy(8)) {
+        di_type = _di_builder->createBasicType("char", 8, llvm::dwarf::DW_ATE_signed_char);
+    } else if (type->isIntegerTy(64)) {
+        di_type = _di_builder->createBasicType("int", 64, llvm::dwarf::DW_ATE_signed);
+    } else if (type->isIntegerTy()) {
+        unsigned bits = type->getIntegerBitWidth();
+        di_type = _di_builder->createBasicType("i" + std::to_string(bits), bits, llvm::dwarf::DW_ATE_signed);
+    } else if (type->isDoubleTy()) {
+        di_type = _di_builder->createBasicType("double", 64, llvm::dwarf::DW_ATE_float);
+    } else if (type->isPointerTy()) {
+        di_type = _di_builder->createPointerType(debugType(type->getPointerElementType()), layout.getPointerSizeInBits());
+    } else if (type->isArrayTy() || type->isVectorTy()) {
+        auto elem_type = type->isArrayTy() ? type->getArrayElementType() : llvm::cast<llvm::VectorType>(type)->getElementType();
+        uint64_t count = type->isArrayTy() ? type->getArrayNumElements() : laneCount(type);
+        auto subscripts = _di_builder->getOrCreateArray({_di_builder->getOrCreateSubrange(0, count)});
+        auto bits = layout.getTypeAllocSizeInBits(type);
+        auto align = layout.getABITypeAlignment(type) * 8;
+        di_type = type->isArrayTy()
+            ? _di_builder->createArrayType(bits, align, debugType(elem_type), subscripts)
+            : _di_builder->createVectorType(bits, align, debugType(elem_type), subscripts);
+    } else if (auto struct_type = llvm::dyn_cast<llvm::StructType>(type)) {
+        // fields of user structs by name, the parts of str, slices and handles by position
+        std::vector<std::string> names(struct_type->getNumElements());
+        for (unsigned i = 0; i < names.size(); i++) {
+            names[i] = "_" + std::to_string(i);
+        }
+        if (auto info = structInfo(struct_type)) {
+            for (auto& field : info->field_index) {
+                names[field.second] = field.first;
+            }
+        }
+        std::string name = struct_type->hasName() ? struct_type->getName().str() : "";
+        if (name.rfind("struct.", 0) == 0) {
+            name = name.substr(strlen("struct."));
+        }
+        auto struct_layout = layout.getStructLayout(struct_type);
+        std::vector<llvm::Metadata*> members;
+        for (unsigned i = 0; i < names.size(); i++) {
+            auto elem_type = struct_type->getElementType(i);
+            members.push_back(_di_builder->createMemberType(_di_unit, names[i], _di_file, 0,
+                layout.getTypeAllocSizeInBits(elem_type), layout.getABITypeAlignment(elem_type) * 8,
+                struct_layout->getElementOffsetInBits(i), llvm::DINode::FlagZero, debugType(elem_type)));
+        }
+        di_type = _di_builder->createStructType(_di_unit, name, _di_file, 0, struct_layout->getSizeInBits(),
+            layout.getABITypeAlignment(struct_type) * 8, llvm::DINode::FlagZero, nullptr,
+            _di_builder->getOrCreateArray(members));
+    } else {
+        di_type = _di_builder->createUnspecifiedType("unknown");
+    }
+    _di_types[type] = di_type;
+    return di_type;
+}
+
+// Gives the function a subprogram and makes it the scope of the following
+// statements; returns the location to restore with debugFuncEnd.
+llvm::DebugLoc CodeGen::debugFuncBegin(llvm::Function* func, long line) {
+    auto outer_loc = _builder.getCurrentDebugLocation();
+    if (_di_builder == nullptr) {
+        return outer_loc;
+    }
+    std::vector<llvm::Metadata*> types{debugType(func->getReturnType())};
+    for (auto& arg : func->args()) {
+        types.push_back(debugType(arg.getType()));
+    }
+    auto subroutine_type = _di_builder->createSubroutineType(_di_builder->getOrCreateTypeArray(types));
+    auto flags = llvm::DISubprogram::SPFlagDefinition;
+    if (func->hasLocalLinkage()) {
+        flags |= llvm::DISubprogram::SPFlagLocalToUnit;
+    }
+    if (_options.opt_level > 0) {
+        flags |= llvm::DISubprogram::SPFlagOptimized;
+    }
+    auto subprogram = _di_builder->createFunction(_di_file, func->getName(), func->getName(), _di_file,
+        line, subroutine_type, line, llvm::DINode::FlagPrototyped, flags);
+    func->setSubprogram(subprogram);
+    _di_subprograms.push_back(subprogram);
+    _builder.SetCurrentDebugLocation(llvm::DILocation::get(_context, line, 0, subprogram));
+    return outer_loc;
+}
+
+void CodeGen::debugFuncEnd(llvm::DebugLoc outer_loc) {
+    if (_di_builder != nullptr) {
+        _di_builder->finalizeSubprogram(_di_subprograms.back());
+        _di_subprograms.pop_back();
+    }
+    _builder.SetCurrentDebugLocation(outer_loc);
+}
+
+// the code of the statement is attributed to its first line
+void CodeGen::debugLocGen(AstPtr statement) {
+    if (_di_builder == nullptr || _di_subprograms.empty() || statement->_line <= 0) {
+        return;
+    }
+    _builder.SetCurrentDebugLocation(llvm::DILocation::get(_context, statement->_line, 0, _di_subprograms.back()));
+}
+
+// describes the variable stored at addr, arg_no counts parameters from 1
+void CodeGen::debugVarGen(llvm::Value* addr, const std::string& name, long line, unsigned arg_no) {
+    if (_di_builder == nullptr || _di_subprograms.empty()) {
+        return;
+    }
+    auto scope = _di_subprograms.back();
+    auto type = debugType(addr->getType()->getPointerElementType());
+    auto var = arg_no > 0
+        ? _di_builder->createParameterVariable(scope, name, arg_no, _di_file, line, type, true)
+        : _di_builder->createAutoVariable(scope, name, _di_file, line, type, true);
+    _di_builder->insertDeclare(addr, var, _di_builder->createExpression(),
+        llvm::DILocation::get(_context, line, 0, scope), _builder.GetInsertBlock());
+}
+
+// -fno-omit-frame-pointer: every function keeps its frame chain in rbp, so
+// profilers can walk the stack without unwind tables
+void CodeGen::framePointerGen() {
+    if (!_options.frame_pointer) {
+        return;
+    }
+    for (auto& func : *_module) {
+        if (!func.isDeclaration()) {
+            func.addFnAttr("frame-pointer", "all");
+        }
+    }
+}
+
+// -finstrument-functions: every function calls the hooks of runtime/trace.c,
+// under the names GCC uses for them; marked here, the calls are inserted by
+// entryExitGen once the module is optimized
+void CodeGen::instrumentFunctionsGen() {
+    if (!_options.instrument_functions) {
+        return;
+    }
+    for (auto& func : *_module) {
+        if (!func.isDeclaration()) {
+            func.addFnAttr("instrument-function-entry-inlined", "__cyg_profile_func_enter");
+            func.addFnAttr("instrument-function-exit-inlined", "__cyg_profile_func_exit");
+        }
+    }
+}
+
+// Inserts the hooks of the functions marked by instrumentFunctionsGen, after
+// inlining, so inlined calls count as time of their caller. An exit hook goes
+// before a musttail call but after any other call, so tail calls that can be
+// are made musttail first; otherwise tail recursion would grow the stack.
+void CodeGen::entryExitGen(llvm::Module& module) {
+    if (!_options.instrument_functions) {
+        return;
+    }
+    llvm::EntryExitInstrumenterPass pass(true);
+    llvm::FunctionAnalysisManager FAM;
+    for (auto& func : module) {
+        if (func.isDeclaration()) {
+            continue;
+        }
+        for (auto& block : func) {
+            auto ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator());
+            auto call = ret != nullptr && ret != &block.front()
+                ? llvm::dyn_cast<llvm::CallInst>(ret->getPrevNode()) : nullptr;
+            if (call != nullptr && call->getTailCallKind() == llvm::CallInst::TCK_Tail
+             && call->getCalledFunction() != nullptr
+             && call->getFunctionType() == func.getFunctionType()
+             && call->getCallingConv() == func.getCallingConv()
+             && (ret->getReturnValue() == nullptr || ret->getReturnValue() == call)) {
+                call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+            }
+        }
+        pass.run(func, FAM);
+    }
+}
+
+} //begonia
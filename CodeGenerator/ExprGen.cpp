@@ -19,6 +19,16 @@ llvm::Value* CodeGen::exprGen(AstPtr ast, std::list<Environment>& env) {
     auto expr = std::dynamic_pointer_cast<Expression>(ast);
     assert(expr != nullptr);
     switch(expr->GetType()) {
+        case AstType::IndexExpr:
+            return indexExprGen(ast, env);
+        case AstType::SliceExpr:
+            return sliceExprGen(ast, env);
+        case AstType::MakeExpr:
+            return makeExprGen(ast, env);
+        case AstType::MemberExpr:
+            return memberExprGen(ast, env);
+        case AstType::AwaitExpr:
+            return awaitGen(ast, env);
         case AstType::OpExpr:
             return opExprGen(expr, env);
         case AstType::NumberExpr:
@@ -44,6 +54,16 @@ llvm::Value* CodeGen::opExprGen(AstPtr ast, std::list<Environment>& env) {
     auto opexpr = std::dynamic_pointer_cast<OperationExpresson>(ast);
     assert(opexpr != nullptr);
 
+    switch(opexpr->_op){
+        case TokenType::TOKEN_OP_AND:
+        case TokenType::TOKEN_OP_OR:
+            return logicalExprGen(opexpr, env);
+        case TokenType::TOKEN_OP_NEG:
+            return _builder.CreateNot(boolValueGen(exprGen(opexpr->_rexp, env)));
+        default:
+            break;
+    }
+
     auto lexpr = opexpr->_lexp;
     auto rexpr = opexpr->_rexp;
     llvm::Value* lval = nullptr;
@@ -54,29 +74,35 @@ llvm::Value* CodeGen::opExprGen(AstPtr ast, std::list<Environment>& env) {
     if (rexpr != nullptr) {
         rval = exprGen(rexpr, env);
     }
+    if (lval == nullptr || rval == nullptr) {
+        printf("[opExprGen] missing operand of op:%d\n", int(opexpr->_op));
+        exit(1);
+    }
+    if (isStrType(lval->getType()) || isStrType(rval->getType())) {
+        return strOpExprGen(opexpr->_op, lval, rval);
+    }
     switch(opexpr->_op){
         case TokenType::TOKEN_OP_ADD:
-            return addExprGen(lexpr,rexpr, env);
+            return addExprGen(lval, rval, env);
         case TokenType::TOKEN_OP_SUB:
-            return subExprGen(lexpr,rexpr, env);
+            return subExprGen(lval, rval, env);
         case TokenType::TOKEN_OP_MUL:
-            return mulExprGen(lexpr,rexpr, env);
+            return mulExprGen(lval, rval, env);
         case TokenType::TOKEN_OP_DIV:
-            return divExprGen(lexpr,rexpr, env);
-        case TokenType::TOKEN_OP_AND:
-            //TODO:
-        case TokenType::TOKEN_OP_OR:
-            //TODO:
+            return divExprGen(lval, rval, env);
+        case TokenType::TOKEN_OP_MOD:
+            return modExprGen(lval, rval, env);
+        case TokenType::TOKEN_OP_BAND:
+        case TokenType::TOKEN_OP_BOR:
+        case TokenType::TOKEN_OP_XOR:
+            return bitExprGen(opexpr->_op, lval, rval, env);
         case TokenType::TOKEN_OP_EQ:
-            //TODO:
+        case TokenType::TOKEN_OP_NEQ:
         case TokenType::TOKEN_OP_GE:
-            //TODO:
         case TokenType::TOKEN_OP_GT:
-            //TODO:
         case TokenType::TOKEN_OP_LE:
-            //TODO:
         case TokenType::TOKEN_OP_LT:
-            //TODO:
+            return compareExprGen(opexpr->_op, lval, rval, env);
         default:
             printf("[opExprGen] unkown op:%d", int(opexpr->_op));
             assert(false && "[opExprGen] unkown op");
@@ -84,79 +110,200 @@ llvm::Value* CodeGen::opExprGen(AstPtr ast, std::list<Environment>& env) {
     }
 }
 
-llvm::Value* CodeGen::addExprGen(ExpressionPtr lexpr, ExpressionPtr rexpr, std::list<Environment>& env){
+static bool isNumericType(llvm::Type* type) {
+    return type->getScalarType()->isDoubleTy() || type->getScalarType()->isIntegerTy(64);
+}
+
+// Brings both operands to one type: bool widens to int, int meets double as double.
+bool CodeGen::unifyOperands(llvm::Value*& lval, llvm::Value*& rval) {
     auto& builder = _builder;
-    builder.SetInsertPoint(env.front().block);
-    auto lval = exprGen(lexpr, env);
-    auto rval = exprGen(rexpr, env);
-    if (!isDoubleType(lval) || !isDoubleType(rval)){
-        assert(false&&"expr type no match double type");
-        return nullptr;
+    if(rval->getType()->isPointerTy() && rval->getType() != llvm::Type::getInt8PtrTy(_context)){
+        rval = builder.CreateLoad(rval->getType()->getPointerElementType(), rval);
     }
-    if(rval->getType()->isPointerTy()){
-        rval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), rval);
+    if(lval->getType()->isPointerTy() && lval->getType() != llvm::Type::getInt8PtrTy(_context)){
+        lval = builder.CreateLoad(lval->getType()->getPointerElementType(), lval);
     }
-    if(lval->getType()->isPointerTy()){
-        lval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), lval);
+    if (lval->getType() == rval->getType()) {
+        return true;
     }
-    auto val = builder.CreateFAdd(lval, rval);
-    return val;
+    if (lval->getType()->isVectorTy() != rval->getType()->isVectorTy()) {
+        // a scalar meets a vector as a splat
+        auto& scalar = lval->getType()->isVectorTy() ? rval : lval;
+        auto vec_type = lval->getType()->isVectorTy() ? lval->getType() : rval->getType();
+        auto splat = convertValue(scalar, vec_type);
+        if (splat != nullptr) {
+            scalar = splat;
+        }
+        return lval->getType() == rval->getType();
+    }
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    if (lval->getType()->isIntegerTy(1)) {
+        lval = builder.CreateZExt(lval, int_type);
+    }
+    if (rval->getType()->isIntegerTy(1)) {
+        rval = builder.CreateZExt(rval, int_type);
+    }
+    if (lval->getType()->isDoubleTy() && rval->getType() == int_type) {
+        rval = builder.CreateSIToFP(rval, lval->getType());
+    }
+    if (rval->getType()->isDoubleTy() && lval->getType() == int_type) {
+        lval = builder.CreateSIToFP(lval, rval->getType());
+    }
+    return lval->getType() == rval->getType();
 }
 
-llvm::Value* CodeGen::subExprGen(ExpressionPtr lexpr, ExpressionPtr rexpr, std::list<Environment>& env){
+static void operandTypeError(const char* op, llvm::Value* lval, llvm::Value* rval) {
+    printf("[%s] operand types no match: ", op);
+    lval->getType()->print(llvm::outs());
+    llvm::outs() << ", ";
+    rval->getType()->print(llvm::outs());
+    llvm::outs() << "\n";
+    llvm::outs().flush();
+    exit(1);
+}
+
+llvm::Value* CodeGen::addExprGen(llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
     auto& builder = _builder;
-    builder.SetInsertPoint(env.front().block);
-    auto lval = exprGen(lexpr, env);
-    auto rval = exprGen(rexpr, env);
-    if (!isDoubleType(lval) || !isDoubleType(rval)){
-        assert(false&&"expr type no match double type");
-        return nullptr;
+    if (!unifyOperands(lval, rval) || !isNumericType(lval->getType())) {
+        operandTypeError("+", lval, rval);
+    }
+    if (lval->getType()->getScalarType()->isDoubleTy()) {
+        return builder.CreateFAdd(lval, rval);
     }
-    if(rval->getType()->isPointerTy()){
-        rval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), rval);
+    return builder.CreateAdd(lval, rval);
+}
+
+llvm::Value* CodeGen::subExprGen(llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
+    auto& builder = _builder;
+    if (!unifyOperands(lval, rval) || !isNumericType(lval->getType())) {
+        operandTypeError("-", lval, rval);
     }
-    if(lval->getType()->isPointerTy()){
-        lval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), lval);
+    if (lval->getType()->getScalarType()->isDoubleTy()) {
+        return builder.CreateFSub(lval, rval);
     }
-    auto val = builder.CreateFSub(lval, rval);
-    return val;
+    return builder.CreateSub(lval, rval);
 }
 
-llvm::Value* CodeGen::mulExprGen(ExpressionPtr lexpr, ExpressionPtr rexpr, std::list<Environment>& env){
+llvm::Value* CodeGen::mulExprGen(llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
     auto& builder = _builder;
-    builder.SetInsertPoint(env.front().block);
-    auto lval = exprGen(lexpr, env);
-    auto rval = exprGen(rexpr, env);
-    if (!isDoubleType(lval) || !isDoubleType(rval)){
-        assert(false&&"expr type no match double type");
-        return nullptr;
+    if (!unifyOperands(lval, rval) || !isNumericType(lval->getType())) {
+        operandTypeError("*", lval, rval);
     }
-    if(rval->getType()->isPointerTy()){
-        rval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), rval);
+    if (lval->getType()->getScalarType()->isDoubleTy()) {
+        return builder.CreateFMul(lval, rval);
     }
-    if(lval->getType()->isPointerTy()){
-        lval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), lval);
+    return builder.CreateMul(lval, rval);
+}
+
+llvm::Value* CodeGen::divExprGen(llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
+    auto& builder = _builder;
+    if (!unifyOperands(lval, rval) || !isNumericType(lval->getType())) {
+        operandTypeError("/", lval, rval);
     }
-    auto val = builder.CreateFMul(lval, rval);
-    return val;
+    if (lval->getType()->getScalarType()->isDoubleTy()) {
+        return builder.CreateFDiv(lval, rval);
+    }
+    return builder.CreateSDiv(lval, rval);
 }
-llvm::Value* CodeGen::divExprGen(ExpressionPtr lexpr, ExpressionPtr rexpr, std::list<Environment>& env){
+
+llvm::Value* CodeGen::modExprGen(llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
     auto& builder = _builder;
-    builder.SetInsertPoint(env.front().block);
-    auto lval = exprGen(lexpr, env);
-    auto rval = exprGen(rexpr, env);
-    if (!isDoubleType(lval) || !isDoubleType(rval)){
-        assert(false&&"expr type no match double type");
-        return nullptr;
+    if (!unifyOperands(lval, rval) || !isNumericType(lval->getType())) {
+        operandTypeError("%", lval, rval);
+    }
+    if (lval->getType()->getScalarType()->isDoubleTy()) {
+        return builder.CreateFRem(lval, rval);
+    }
+    return builder.CreateSRem(lval, rval);
+}
+
+llvm::Value* CodeGen::bitExprGen(TokenType op, llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
+    auto& builder = _builder;
+    if (!unifyOperands(lval, rval) || !lval->getType()->getScalarType()->isIntegerTy()) {
+        operandTypeError("&|^", lval, rval);
+    }
+    switch (op) {
+    case TokenType::TOKEN_OP_BAND:
+        return builder.CreateAnd(lval, rval);
+    case TokenType::TOKEN_OP_BOR:
+        return builder.CreateOr(lval, rval);
+    default:
+        return builder.CreateXor(lval, rval);
+    }
+}
+
+llvm::Value* CodeGen::compareExprGen(TokenType op, llvm::Value* lval, llvm::Value* rval, std::list<Environment>& env){
+    auto& builder = _builder;
+    if (!unifyOperands(lval, rval) || !(lval->getType()->getScalarType()->isDoubleTy() || lval->getType()->getScalarType()->isIntegerTy())) {
+        operandTypeError("compare", lval, rval);
+    }
+    if (lval->getType()->getScalarType()->isDoubleTy()) {
+        switch (op) {
+        case TokenType::TOKEN_OP_EQ:    return builder.CreateFCmpOEQ(lval, rval);
+        case TokenType::TOKEN_OP_NEQ:   return builder.CreateFCmpUNE(lval, rval);
+        case TokenType::TOKEN_OP_LT:    return builder.CreateFCmpOLT(lval, rval);
+        case TokenType::TOKEN_OP_LE:    return builder.CreateFCmpOLE(lval, rval);
+        case TokenType::TOKEN_OP_GT:    return builder.CreateFCmpOGT(lval, rval);
+        default:                        return builder.CreateFCmpOGE(lval, rval);
+        }
+    }
+    switch (op) {
+    case TokenType::TOKEN_OP_EQ:    return builder.CreateICmpEQ(lval, rval);
+    case TokenType::TOKEN_OP_NEQ:   return builder.CreateICmpNE(lval, rval);
+    case TokenType::TOKEN_OP_LT:    return builder.CreateICmpSLT(lval, rval);
+    case TokenType::TOKEN_OP_LE:    return builder.CreateICmpSLE(lval, rval);
+    case TokenType::TOKEN_OP_GT:    return builder.CreateICmpSGT(lval, rval);
+    default:                        return builder.CreateICmpSGE(lval, rval);
     }
-    if(rval->getType()->isPointerTy()){
-        rval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), rval);
+}
+
+// && and || only evaluate the right side when it decides the result,
+// so `i < len(a) && a[i] > 0` never indexes out of bounds
+llvm::Value* CodeGen::logicalExprGen(OperationExpressonPtr opexpr, std::list<Environment>& env){
+    auto& builder = _builder;
+    bool is_and = opexpr->_op == TokenType::TOKEN_OP_AND;
+    auto lval = boolValueGen(exprGen(opexpr->_lexp, env));
+    auto lhs_block = builder.GetInsertBlock();
+    auto func = lhs_block->getParent();
+    auto id = std::to_string(env.front().GetIncID());
+    auto rhs_block = llvm::BasicBlock::Create(_context, id + (is_and ? ".and" : ".or"), func);
+    auto merge_block = llvm::BasicBlock::Create(_context, id + ".logicend", func);
+    if (is_and) {
+        builder.CreateCondBr(lval, rhs_block, merge_block);
+    } else {
+        builder.CreateCondBr(lval, merge_block, rhs_block);
     }
-    if(lval->getType()->isPointerTy()){
-        lval = builder.CreateLoad(llvm::Type::getDoubleTy(_context), lval);
+
+    env.front().block = rhs_block;
+    builder.SetInsertPoint(rhs_block);
+    auto rval = boolValueGen(exprGen(opexpr->_rexp, env));
+    auto rhs_end = builder.GetInsertBlock();
+    builder.CreateBr(merge_block);
+
+    env.front().block = merge_block;
+    builder.SetInsertPoint(merge_block);
+    auto phi = builder.CreatePHI(llvm::Type::getInt1Ty(_context), 2);
+    phi->addIncoming(llvm::ConstantInt::get(llvm::Type::getInt1Ty(_context), !is_and), lhs_block);
+    phi->addIncoming(rval, rhs_end);
+    return phi;
+}
+
+llvm::Value* CodeGen::boolValueGen(llvm::Value* val) {
+    auto type = val->getType();
+    if (type->getScalarType()->isIntegerTy(1)) {
+        // a vector of i1 is a lane mask, ! and & | ^ work lane-wise on it
+        return val;
     }
-    auto val = builder.CreateFDiv(lval, rval);
-    return val;
+    if (type->isIntegerTy()) {
+        return _builder.CreateICmpNE(val, llvm::Constant::getNullValue(type));
+    }
+    if (type->isDoubleTy()) {
+        return _builder.CreateFCmpUNE(val, llvm::Constant::getNullValue(type));
+    }
+    type->print(llvm::errs());
+    printf("\ncan't be used as condition\n");
+    exit(1);
+    return nullptr;
 }
 
 llvm::Value* CodeGen::numberExprGen(AstPtr expr, std::list<Environment>& env){
@@ -176,34 +323,81 @@ llvm::Value* CodeGen::stringExprGen(AstPtr ast , std::list<Environment>& env) {
     builder.SetInsertPoint(env.front().block);
     auto str_expr = std::dynamic_pointer_cast<StringExpression>(ast);
     assert(str_expr != nullptr);
-    auto value = builder.CreateGlobalStringPtr(str_expr->_string);
-    return value;
+    return strLiteralGen(str_expr->_string);
 }
 
 
-llvm::Value* CodeGen::identifierExprGen(AstPtr ast, std::list<Environment>& env) {
-    auto id_expr = std::dynamic_pointer_cast<IdentifierExpression>(ast);
-    assert(id_expr != nullptr);
-    std::string id = id_expr->_identifier;
-    // auto found = env.front().declared_variable.find(id);
-    // if (found == env.front().declared_variable.end()) {
-    //     printf("Can't find identifier:%s\n", id.c_str());
-    //     exit(1);
-    //     return nullptr;
-    // }
-    auto found = env.front().declared_variable.end();
+// Variables are allocas of their frame; frames are searched innermost first,
+// up to the frame of the enclosing function. The function of a pfor body
+// sees the variables around the pfor through captured addresses.
+llvm::Value* CodeGen::lookupVariable(const std::string& name, std::list<Environment>& env) {
+    std::vector<Environment*> pfor_frames;
     for (auto& env_frame : env) {
-        found = env_frame.declared_variable.find(id);
+        auto found = env_frame.declared_variable.find(name);
         if (found != env_frame.declared_variable.end()) {
+            auto addr = found->second;
+            for (auto pfor_frame = pfor_frames.rbegin(); pfor_frame != pfor_frames.rend(); ++pfor_frame) {
+                addr = captureGen(**pfor_frame, name, addr);
+            }
+            return addr;
+        }
+        if (env_frame.pfor) {
+            pfor_frames.push_back(&env_frame);
+        } else if (env_frame.function_scope) {
             break;
         }
     }
-    if (found == env.back().declared_variable.end()) {
-        printf("Can't find func:%s\n", id.c_str());
+    return nullptr;
+}
+
+llvm::Value* CodeGen::identifierExprGen(AstPtr ast, std::list<Environment>& env) {
+    auto id_expr = std::dynamic_pointer_cast<IdentifierExpression>(ast);
+    assert(id_expr != nullptr);
+    std::string id = id_expr->_identifier;
+    auto var_addr = lookupVariable(id, env);
+    if (var_addr == nullptr) {
+        printf("Can't find identifier:%s\n", id.c_str());
         exit(1);
     }
-    auto val = _builder.CreateLoad(found->second);
-    return val;
+    return loadValueGen(var_addr, typeAlign(var_addr->getType()->getPointerElementType()));
+}
+
+// Address of an expression naming memory: a variable, or an element or
+// field of one. nullptr, with nothing generated, for any other expression.
+llvm::Value* CodeGen::addressGen(ExpressionPtr expr, std::list<Environment>& env) {
+    switch (expr->GetType()) {
+    case AstType::IdentifierExpr: {
+        auto id = std::dynamic_pointer_cast<IdentifierExpression>(expr)->_identifier;
+        auto var_addr = lookupVariable(id, env);
+        if (var_addr == nullptr) {
+            printf("Can't find identifier:%s\n", id.c_str());
+            exit(1);
+        }
+        return var_addr;
+    }
+    case AstType::IndexExpr: {
+        auto index_expr = std::dynamic_pointer_cast<IndexExpression>(expr);
+        // s()[i] still addresses the elements s() views
+        llvm::Value *base_addr, *base_value;
+        operandGen(index_expr->_base, env, base_addr, base_value);
+        return indexAddressGen(index_expr, base_addr, base_value, env);
+    }
+    case AstType::MemberExpr: {
+        auto member = std::dynamic_pointer_cast<MemberExpression>(expr);
+        llvm::Align align;
+        auto addr = fieldAddressGen(member, env, align);
+        if (addr == nullptr) {
+            return nullptr;
+        }
+        if (align < typeAlign(addr->getType()->getPointerElementType())) {
+            printf("field %s of a packed struct is not aligned, it can only be read and assigned\n", member->_field.c_str());
+            exit(1);
+        }
+        return addr;
+    }
+    default:
+        return nullptr;
+    }
 }
 
 llvm::Value* CodeGen::BoolExprGen(AstPtr ast, std::list<Environment>& env) {
@@ -218,31 +412,108 @@ llvm::Value* CodeGen::FuncallExprGen(AstPtr ast, std::list<Environment>& env) {
     builder.SetInsertPoint(env.front().block);
     auto funcall_ast = std::dynamic_pointer_cast<FuncallExpression>(ast);
     assert(funcall_ast);
-    auto found = env.front().declared_prototype.end();
+    auto builtin = _builtins.find(funcall_ast->_identifier);
+    if (builtin != _builtins.end()) {
+        return builtin->second(funcall_ast, env);
+    }
+    auto func_proto = lookupFunction(funcall_ast->_identifier, env);
+    auto args = argumentsGen(funcall_ast, func_proto, env);
+    auto call = builder.CreateCall(func_proto, llvm::makeArrayRef(args));
+    call->setCallingConv(func_proto->getCallingConv());
+    return call;
+}
+
+llvm::Function* CodeGen::lookupFunction(const std::string& name, std::list<Environment>& env) {
     for (auto& env_frame : env) {
-        found = env_frame.declared_prototype.find(funcall_ast->_identifier);
+        auto found = env_frame.declared_prototype.find(name);
         if (found != env_frame.declared_prototype.end()) {
-            break;
+            return found->second;
         }
     }
-    if (found == env.back().declared_prototype.end()) {
-        printf("Can't find func:%s\n", funcall_ast->_identifier.c_str());
+    printf("Can't find func:%s\n", name.c_str());
+    exit(1);
+}
+
+// the arguments of a call of func_proto, converted to its parameters
+std::vector<llvm::Value*> CodeGen::argumentsGen(FuncallExpressionPtr funcall_ast, llvm::Function* func_proto, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto func_type = func_proto->getFunctionType();
+    if (funcall_ast->_parameters.size() != func_type->getNumParams()) {
+        printf("func:%s takes %u arguments\n", funcall_ast->_identifier.c_str(), func_type->getNumParams());
         exit(1);
     }
-
-    auto func_proto = found->second;
-
+    auto ref_params = _ref_params.find(funcall_ast->_identifier);
     std::vector<llvm::Value*> args;
     for (auto arg_ast : funcall_ast->_parameters) {
+        if (ref_params != _ref_params.end() && args.size() < ref_params->second.size()
+         && ref_params->second[args.size()]) {
+            // by reference: pass the address of the variable, element or field
+            auto addr = addressGen(arg_ast, env);
+            if (addr == nullptr) {
+                printf("func:%s argument %zu is passed by reference, it needs a variable, element or field\n", funcall_ast->_identifier.c_str(), args.size() + 1);
+                exit(1);
+            }
+            if (addr->getType() != func_type->getParamType(args.size())) {
+                printf("func:%s argument %zu type no matched\n", funcall_ast->_identifier.c_str(), args.size() + 1);
+                exit(1);
+            }
+            args.push_back(addr);
+            continue;
+        }
         auto arg =  exprGen(arg_ast, env);
+        assert(arg != nullptr);
         if(arg->getType()->isPointerTy() && arg->getType() != llvm::Type::getInt8PtrTy(_context)){
             arg = builder.CreateLoad(arg->getType()->getPointerElementType(), arg);
         }
-        assert(arg != nullptr);
-        args.push_back(arg);
+        auto param_type = func_type->getParamType(args.size());
+        // an argument only lives for the call, its bytes may stay in the frame
+        auto converted = isStrType(arg->getType()) && param_type == llvm::Type::getInt8PtrTy(_context)
+            ? strCStringGen(arg) : convertValue(arg, param_type);
+        if (converted == nullptr) {
+            printf("func:%s argument %zu type no matched\n", funcall_ast->_identifier.c_str(), args.size() + 1);
+            exit(1);
+        }
+        args.push_back(converted);
     }
+    return args;
+}
 
-    return builder.CreateCall(func_proto, llvm::makeArrayRef(args));
+// Implicit conversions of assignments, arguments and return values;
+// nullptr if val can't become type.
+llvm::Value* CodeGen::convertValue(llvm::Value* val, llvm::Type* type) {
+    if (val->getType() == type) {
+        return val;
+    }
+    if (type->isVectorTy() && !val->getType()->isVectorTy()) {
+        auto lane = convertValue(val, type->getScalarType());
+        if (lane == nullptr) {
+            return nullptr;
+        }
+        return _builder.CreateVectorSplat(laneCount(type), lane);
+    }
+    if (isStrType(type) && val->getType() == llvm::Type::getInt8PtrTy(_context)) {
+        return cStringToStrGen(val);
+    }
+    if (type == llvm::Type::getInt8PtrTy(_context) && isStrType(val->getType())) {
+        return strOwnedCStringGen(val);
+    }
+    if (type->isVectorTy() && val->getType()->isVectorTy()) {
+        if (laneCount(type) == laneCount(val->getType())
+         && type->getScalarType()->isDoubleTy() && val->getType()->getScalarType()->isIntegerTy(64)) {
+            return _builder.CreateSIToFP(val, type);
+        }
+        return nullptr;
+    }
+    if (type->isDoubleTy() && val->getType()->isIntegerTy(1)) {
+        return _builder.CreateUIToFP(val, type);
+    }
+    if (type->isDoubleTy() && val->getType()->isIntegerTy()) {
+        return _builder.CreateSIToFP(val, type);
+    }
+    if (type->isIntegerTy(64) && val->getType()->isIntegerTy(1)) {
+        return _builder.CreateZExt(val, type);
+    }
+    return nullptr;
 }
 
 bool CodeGen::isDoubleType(llvm::Value* v){
@@ -0,0 +1,186 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <string>
+
+namespace begonia {
+
+// pure, inline, noinline, hot and cold of func_ast. pure on a definition is
+// checked and applied by inferFunctionAttrs, on a prototype it is trusted.
+void CodeGen::annotateFunction(DeclareFuncStatementPtr func_ast, llvm::Function* func) {
+    auto& annotations = func_ast->_annotations;
+    bool has_body = func_ast->_block->size() != 0;
+    if (annotations.count("inline") != 0 && annotations.count("noinline") != 0) {
+        printf("func %s can't be both inline and noinline\n", func_ast->_name.c_str());
+        exit(1);
+    }
+    if (annotations.count("hot") != 0 && annotations.count("cold") != 0) {
+        printf("func %s can't be both hot and cold\n", func_ast->_name.c_str());
+        exit(1);
+    }
+    if ((func_ast->_generator || func_ast->_async) && (annotations.count("inline") != 0 || annotations.count("pure") != 0)) {
+        printf("%s func %s can't be inline or pure, its frame outlives the call\n",
+               func_ast->_generator ? "gen" : "async", func_ast->_name.c_str());
+        exit(1);
+    }
+    if (annotations.count("inline") != 0) {
+        if (!has_body) {
+            printf("func %s: inline needs a body\n", func_ast->_name.c_str());
+            exit(1);
+        }
+        func->addFnAttr(llvm::Attribute::AlwaysInline);
+    }
+    if (annotations.count("noinline") != 0) {
+        func->addFnAttr(llvm::Attribute::NoInline);
+    }
+#if LLVM_VERSION_MAJOR >= 12
+    if (annotations.count("hot") != 0) {
+        func->addFnAttr(llvm::Attribute::Hot);
+    }
+#endif
+    if (annotations.count("cold") != 0) {
+        func->addFnAttr(llvm::Attribute::Cold);
+    }
+    if (annotations.count("pure") != 0 && !has_body) {
+        func->addFnAttr(llvm::Attribute::ReadOnly);
+        func->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    // there are no exceptions, and prototypes name C functions
+    func->addFnAttr(llvm::Attribute::NoUnwind);
+}
+
+// memory in the frame of func, which callers can't see
+static bool isLocalMemory(llvm::Value* ptr, llvm::Function* func) {
+#if LLVM_VERSION_MAJOR >= 12
+    auto object = llvm::getUnderlyingObject(ptr);
+#else
+    auto object = llvm::GetUnderlyingObject(ptr, func->getParent()->getDataLayout());
+#endif
+    auto alloca = llvm::dyn_cast<llvm::AllocaInst>(object);
+    return alloca != nullptr && alloca->getFunction() == func;
+}
+
+// Bottom-up over the SCCs of the call graph, so callees are done before their
+// callers: a function is readnone when it touches no memory outside its frame,
+// readonly when it only reads it, willreturn when it has no loops, doesn't
+// recurse and only calls functions that return, and norecurse when it is not
+// part of a cycle. Traps of failed bounds checks end the program, they don't
+// count as memory access. Memory attributes are left out with
+// -fprofile-generate, whose counters are written into every function later.
+void CodeGen::inferFunctionAttrs() {
+    llvm::CallGraph graph(*_module);
+    uint64_t readnone = 0;
+    uint64_t readonly = 0;
+    for (auto scc = llvm::scc_begin(&graph); !scc.isAtEnd(); ++scc) {
+        std::set<llvm::Function*> members;
+        for (auto node : *scc) {
+            auto func = node->getFunction();
+            if (func != nullptr && !func->isDeclaration()) {
+                members.insert(func);
+            }
+        }
+        if (members.empty()) {
+            continue;
+        }
+        bool recursive = members.size() > 1 || scc.hasCycle();
+        bool reads = false;
+        bool writes = false;
+        bool returns = !recursive;
+        for (auto func : members) {
+            llvm::SmallVector<std::pair<const llvm::BasicBlock*, const llvm::BasicBlock*>, 8> backedges;
+            llvm::FindFunctionBackedges(*func, backedges);
+            if (!backedges.empty()) {
+                returns = false;
+            }
+            for (auto& block : *func) {
+                for (auto& inst : block) {
+                    if (auto load = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+                        reads = reads || !isLocalMemory(load->getPointerOperand(), func);
+                        continue;
+                    }
+                    if (auto store = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+                        writes = writes || !isLocalMemory(store->getPointerOperand(), func);
+                        continue;
+                    }
+                    auto call = llvm::dyn_cast<llvm::CallBase>(&inst);
+                    if (call == nullptr) {
+                        reads = reads || inst.mayReadFromMemory();
+                        writes = writes || inst.mayWriteToMemory();
+                        continue;
+                    }
+                    auto callee = call->getCalledFunction();
+                    if (callee != nullptr && members.count(callee) != 0) {
+                        continue;
+                    }
+                    if (!call->hasFnAttr(llvm::Attribute::WillReturn)) {
+                        returns = false;
+                    }
+                    if (call->doesNotAccessMemory()
+                     || (callee != nullptr && callee->getIntrinsicID() == llvm::Intrinsic::trap)) {
+                        continue;
+                    }
+                    bool only_reads = call->onlyReadsMemory();
+                    if (call->onlyAccessesArgMemory()) {
+                        // memset of a local array and the like
+                        for (auto& arg : call->args()) {
+                            if (arg->getType()->isPointerTy() && !isLocalMemory(arg, func)) {
+                                reads = true;
+                                writes = writes || !only_reads;
+                            }
+                        }
+                        continue;
+                    }
+                    reads = true;
+                    writes = writes || !only_reads;
+                }
+            }
+        }
+
+        for (auto func : members) {
+            func->addFnAttr(llvm::Attribute::NoUnwind);
+            if (!recursive) {
+                func->addFnAttr(llvm::Attribute::NoRecurse);
+            }
+            bool returns_here = returns;
+            auto func_ast = _defined_funcs.find(func->getName().str());
+            if (func_ast != _defined_funcs.end()
+             && std::dynamic_pointer_cast<DeclareFuncStatement>(func_ast->second)->_annotations.count("pure") != 0) {
+                if (writes) {
+                    printf("func %s is pure but writes memory outside its frame, or calls a function that may\n", func->getName().str().c_str());
+                    exit(1);
+                }
+                // pure promises to return, also from loops the analysis can't bound
+                returns_here = true;
+            }
+            if (returns_here) {
+                func->addFnAttr(llvm::Attribute::WillReturn);
+            }
+            if (_options.profile_generate) {
+                continue;
+            }
+            if (!reads && !writes) {
+                func->addFnAttr(llvm::Attribute::ReadNone);
+                readnone++;
+            } else if (!writes) {
+                func->addFnAttr(llvm::Attribute::ReadOnly);
+                readonly++;
+            }
+        }
+    }
+    Profiler::Get().addCounter("functions_readnone", readnone);
+    Profiler::Get().addCounter("functions_readonly", readonly);
+}
+
+} //begonia
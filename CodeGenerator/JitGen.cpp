@@ -0,0 +1,74 @@
+#include "CodeGen.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+
+namespace begonia {
+
+// The tier entry of func for the interpreter of --run: i64 entry(i64* args)
+// takes every argument from a 64 bit register of the interpreter and returns
+// the result as one, 0 for void.
+void CodeGen::tierEntryGen(const std::string& func_name, const std::string& entry_name) {
+    auto func = _module->getFunction(func_name);
+    assert(func != nullptr);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto entry_type = llvm::FunctionType::get(int_type, {int_type->getPointerTo()}, false);
+    auto entry = llvm::Function::Create(entry_type, llvm::Function::ExternalLinkage, entry_name, _module.get());
+    _builder.SetInsertPoint(llvm::BasicBlock::Create(_context, "entry", entry));
+
+    std::vector<llvm::Value*> args;
+    for (auto& param : func->args()) {
+        auto slot = _builder.CreateConstGEP1_64(int_type, entry->getArg(0), param.getArgNo());
+        llvm::Value* word = _builder.CreateLoad(int_type, slot);
+        auto type = param.getType();
+        if (type->isIntegerTy(1)) {
+            word = _builder.CreateTrunc(word, type);
+        } else if (type->isDoubleTy()) {
+            word = _builder.CreateBitCast(word, type);
+        } else if (type->isPointerTy()) {
+            word = _builder.CreateIntToPtr(word, type);
+        }
+        args.push_back(word);
+    }
+    auto call = _builder.CreateCall(func, args);
+    call->setCallingConv(func->getCallingConv());
+
+    auto ret_type = func->getReturnType();
+    llvm::Value* result = call;
+    if (ret_type->isVoidTy()) {
+        result = llvm::ConstantInt::get(int_type, 0);
+    } else if (ret_type->isIntegerTy(1)) {
+        result = _builder.CreateZExt(call, int_type);
+    } else if (ret_type->isDoubleTy()) {
+        result = _builder.CreateBitCast(call, int_type);
+    } else if (ret_type->isPointerTy()) {
+        result = _builder.CreatePtrToInt(call, int_type);
+    }
+    _builder.CreateRet(result);
+}
+
+// Compiles the functions of ast for the JIT of --run into one object in
+// memory; entries are pairs of a function and the name of its tier entry,
+// the only symbols the object defines.
+int CodeGen::jitCompile(AstPtr ast, const std::vector<std::pair<std::string, std::string>>& entries,
+                        llvm::SmallVectorImpl<char>& object) {
+    assert(_options.jit);
+    entryPointGen(ast);
+    for (auto& entry : entries) {
+        tierEntryGen(entry.first, entry.second);
+    }
+    stripDeadFunctions();
+    inferFunctionAttrs();
+    if (llvm::verifyModule(*_module, &llvm::errs())) {
+        return 1;
+    }
+    optimize(*_module);
+    if (_options.dump_ir) {
+        _module->print(llvm::errs(), nullptr);
+    }
+    llvm::raw_svector_ostream out(object);
+    return emitObject(*_module, out);
+}
+
+} //begonia
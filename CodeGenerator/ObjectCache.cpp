@@ -0,0 +1,343 @@
+#include "ObjectCache.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <memory>
+#include <unistd.h>
+#include <utime.h>
+
+namespace begonia {
+
+ObjectCache::ObjectCache(std::string dir, uint64_t max_bytes): _dir(dir), _max_bytes(max_bytes) {
+}
+
+int ObjectCache::initialize() {
+    auto EC = llvm::sys::fs::create_directories(_dir);
+    if (EC) {
+        llvm::errs() << "Could not create cache dir " << _dir << ": " << EC.message() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+std::string ObjectCache::entryPath(const std::string& key) {
+    return _dir + "/llvmcache-" + key;
+}
+
+std::string ObjectCache::hashKey(const std::string& data) {
+    return llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(data)), true);
+}
+
+bool ObjectCache::lookup(const std::string& key, std::string& path) {
+    path = entryPath(key);
+    if (!llvm::sys::fs::exists(path)) {
+        return false;
+    }
+    // refresh the access time, the LRU order must not depend on atime mount options
+    utime(path.c_str(), nullptr);
+    return true;
+}
+
+int ObjectCache::createTemp(std::string& path) {
+    llvm::SmallString<128> temp_path;
+    int fd;
+    auto EC = llvm::sys::fs::createUniqueFile(_dir + "/tmp-%%%%%%%%.o", fd, temp_path);
+    if (EC) {
+        llvm::errs() << "Could not create file in cache dir: " << EC.message() << "\n";
+        return 1;
+    }
+    close(fd);
+    path = temp_path.str().str();
+    return 0;
+}
+
+// rename is atomic, so concurrent compiles never see a partially written entry
+int ObjectCache::commit(const std::string& temp_path, const std::string& key, std::string& path) {
+    path = entryPath(key);
+    auto EC = llvm::sys::fs::rename(temp_path, path);
+    if (EC) {
+        llvm::errs() << "Could not commit cache entry " << path << ": " << EC.message() << "\n";
+        llvm::sys::fs::remove(temp_path);
+        return 1;
+    }
+    return 0;
+}
+
+void ObjectCache::prune() {
+    llvm::CachePruningPolicy policy;
+    policy.Interval = std::chrono::seconds(0);
+    policy.MaxSizeBytes = _max_bytes;
+    llvm::pruneCache(_dir, policy);
+}
+
+static bool canonicalizeBlock(AstBlockPtr block, std::string& out, std::set<std::string>& callees, bool lines) {
+    out += "{";
+    if (block != nullptr) {
+        for (auto statement : *block) {
+            if (lines) {
+                out += "@" + std::to_string(statement->_line) + " ";
+            }
+            if (!CanonicalizeAst(statement, out, callees, lines)) {
+                return false;
+            }
+            out += ";";
+        }
+    }
+    out += "}";
+    return true;
+}
+
+bool CanonicalizeAst(AstPtr ast, std::string& out, std::set<std::string>& callees, bool lines) {
+    if (ast == nullptr) {
+        out += "_";
+        return true;
+    }
+    switch (ast->GetType()) {
+    case AstType::Block:
+        return canonicalizeBlock(std::dynamic_pointer_cast<AstBlock>(ast), out, callees, lines);
+
+    case AstType::IfStatement: {
+        auto if_stat = std::dynamic_pointer_cast<IfStatement>(ast);
+        out += "(if";
+        for (auto& if_block : if_stat->_if_blocks) {
+            out += " ";
+            if (!CanonicalizeAst(if_block._cond, out, callees, lines)
+             || !canonicalizeBlock(if_block._block, out, callees, lines)) {
+                return false;
+            }
+        }
+        out += " else ";
+        if (!canonicalizeBlock(if_stat->_else_block, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::AssignStatement: {
+        auto assign = std::dynamic_pointer_cast<AssignStatement>(ast);
+        out += "(= " + assign->_identifier + " ";
+        if (!CanonicalizeAst(assign->_assign_value, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::DeclareVarStatement: {
+        auto var = std::dynamic_pointer_cast<DeclareVarStatement>(ast);
+        out += "(var " + var->_name + " " + var->_type + " ";
+        if (!CanonicalizeAst(var->_assign_value, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::DeclareFuncStatement: {
+        auto func = std::dynamic_pointer_cast<DeclareFuncStatement>(ast);
+        out += func->_generator ? "(gen func " + func->_name : func->_async ? "(async func " + func->_name : "(func " + func->_name;
+        for (auto& annotation : func->_annotations) {
+            out += " " + annotation;
+        }
+        out += " (";
+        for (auto& var : func->_decl_vars) {
+            out += var->_name + " " + var->_type + ",";
+        }
+        out += ") " + func->_ret_type + " ";
+        if (lines) {
+            out += "@" + std::to_string(func->_line) + " ";
+        }
+        if (!canonicalizeBlock(func->_block, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::ElementAssignStatement: {
+        auto assign = std::dynamic_pointer_cast<ElementAssignStatement>(ast);
+        out += "([]= ";
+        if (!CanonicalizeAst(assign->_target, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(assign->_assign_value, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::WhileStatement: {
+        auto while_stat = std::dynamic_pointer_cast<WhileStatement>(ast);
+        out += "(while ";
+        if (!CanonicalizeAst(while_stat->_condition, out, callees, lines)
+         || !canonicalizeBlock(while_stat->_block, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::RegionStatement: {
+        out += "(region ";
+        if (!canonicalizeBlock(std::dynamic_pointer_cast<RegionStatement>(ast)->_block, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::PforStatement: {
+        auto pfor = std::dynamic_pointer_cast<PforStatement>(ast);
+        out += "(pfor " + pfor->_var + " ";
+        if (!CanonicalizeAst(pfor->_low, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(pfor->_high, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(pfor->_grain, out, callees, lines)) {
+            return false;
+        }
+        for (auto& reduction : pfor->_reductions) {
+            out += " " + reduction.op + "(" + reduction.name + ")";
+        }
+        out += " ";
+        if (!canonicalizeBlock(pfor->_block, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::YieldStatement: {
+        out += "(yield ";
+        if (!CanonicalizeAst(std::dynamic_pointer_cast<YieldStatement>(ast)->_value, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::RetStatement: {
+        auto ret = std::dynamic_pointer_cast<ReturnStatement>(ast);
+        out += ret->_tail_call ? "(return tailcall" : "(return";
+        for (auto& value : ret->_ret_values) {
+            out += " ";
+            if (!CanonicalizeAst(value, out, callees, lines)) {
+                return false;
+            }
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::FuncallExpr: {
+        auto funcall = std::dynamic_pointer_cast<FuncallExpression>(ast);
+        callees.insert(funcall->_identifier);
+        out += "(call " + funcall->_identifier;
+        for (auto& param : funcall->_parameters) {
+            out += " ";
+            if (!CanonicalizeAst(param, out, callees, lines)) {
+                return false;
+            }
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::OpExpr: {
+        auto op = std::dynamic_pointer_cast<OperationExpresson>(ast);
+        out += "(op" + std::to_string(int(op->_op)) + " ";
+        if (!CanonicalizeAst(op->_lexp, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(op->_rexp, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::IndexExpr: {
+        auto index = std::dynamic_pointer_cast<IndexExpression>(ast);
+        out += "([] ";
+        if (!CanonicalizeAst(index->_base, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(index->_index, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::SliceExpr: {
+        auto slice = std::dynamic_pointer_cast<SliceExpression>(ast);
+        out += "([:] ";
+        if (!CanonicalizeAst(slice->_base, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(slice->_low, out, callees, lines)) {
+            return false;
+        }
+        out += " ";
+        if (!CanonicalizeAst(slice->_high, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::MakeExpr: {
+        auto make = std::dynamic_pointer_cast<MakeExpression>(ast);
+        out += "(make " + make->_slice_type + " ";
+        if (!CanonicalizeAst(make->_length, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::AwaitExpr: {
+        out += "(await ";
+        if (!CanonicalizeAst(std::dynamic_pointer_cast<AwaitExpression>(ast)->_value, out, callees, lines)) {
+            return false;
+        }
+        out += ")";
+        return true;
+    }
+    case AstType::MemberExpr: {
+        auto member = std::dynamic_pointer_cast<MemberExpression>(ast);
+        out += "(. ";
+        if (!CanonicalizeAst(member->_base, out, callees, lines)) {
+            return false;
+        }
+        out += " " + member->_field + ")";
+        return true;
+    }
+    case AstType::BoolExpr:
+        out += std::dynamic_pointer_cast<BoolExpression>(ast)->_value ? "true" : "false";
+        return true;
+    case AstType::NilExp:
+        out += "nil";
+        return true;
+    case AstType::NumberExpr: {
+        auto number = std::dynamic_pointer_cast<NumberExpression>(ast);
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s%a", number->_is_float ? "f" : "i", number->_number);
+        out += buf;
+        return true;
+    }
+    case AstType::StringExpr: {
+        auto str = std::dynamic_pointer_cast<StringExpression>(ast);
+        out += "\"" + std::to_string(str->_string.size()) + ":" + str->_string;
+        return true;
+    }
+    case AstType::IdentifierExpr:
+        out += std::dynamic_pointer_cast<IdentifierExpression>(ast)->_identifier;
+        return true;
+    default:
+        return false;
+    }
+}
+
+} //begonia
@@ -0,0 +1,40 @@
+#pragma once
+#include "Parser.h"
+#include "Statement.h"
+#include "Expression.h"
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+namespace begonia {
+
+// On-disk, content-addressed cache of per-function objects.
+// Entries are named "llvmcache-<key>" so llvm::pruneCache can evict them
+// least-recently-used first once the directory grows over max_bytes.
+class ObjectCache {
+public:
+    ObjectCache(std::string dir, uint64_t max_bytes);
+    int  initialize();
+
+    bool lookup(const std::string& key, std::string& path);
+    int  createTemp(std::string& path);
+    int  commit(const std::string& temp_path, const std::string& key, std::string& path);
+    void prune();
+
+    static std::string hashKey(const std::string& data);
+
+private:
+    std::string     _dir;
+    uint64_t        _max_bytes;
+
+    std::string entryPath(const std::string& key);
+};
+
+// Writes a canonical text form of the AST (no formatting, no line numbers unless
+// lines is set) to out, and collects the names of the called functions. Returns
+// false if the AST contains a node that can't be canonicalized, in which case it
+// must not be cached.
+bool CanonicalizeAst(AstPtr ast, std::string& out, std::set<std::string>& callees, bool lines = false);
+
+} //begonia
@@ -0,0 +1,247 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <set>
+#include <string>
+
+namespace begonia {
+
+// The variable name around a pfor, at outer_addr, seen from the function of
+// its body: the address goes into the next slot of the context the body is
+// called with, and is loaded from there once, in the entry block.
+llvm::Value* CodeGen::captureGen(Environment& pfor_frame, const std::string& name, llvm::Value* outer_addr) {
+    auto func = pfor_frame.block->getParent();
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto& entry = func->getEntryBlock();
+    llvm::IRBuilder<> builder(&entry, entry.begin());
+    auto slots = builder.CreateBitCast(func->arg_begin(), i8ptr->getPointerTo());
+    auto slot = builder.CreateConstInBoundsGEP1_64(i8ptr, slots, pfor_frame.captures.size());
+    auto addr = builder.CreateLoad(i8ptr, slot, name + ".capture");
+    // the context doesn't change while the body runs
+    addr->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(_context, {}));
+    auto typed_addr = builder.CreateBitCast(addr, outer_addr->getType(), name);
+    pfor_frame.captures.push_back(outer_addr);
+    pfor_frame.declared_variable[name] = typed_addr;
+    return typed_addr;
+}
+
+// sum, min or max of two ints or doubles
+llvm::Value* CodeGen::reduceCombineGen(const std::string& op, llvm::Value* lval, llvm::Value* rval) {
+    bool is_double = lval->getType()->isDoubleTy();
+    if (op == "sum") {
+        return is_double ? _builder.CreateFAdd(lval, rval) : _builder.CreateAdd(lval, rval);
+    }
+    llvm::Value* less = is_double ? _builder.CreateFCmpOLT(lval, rval) : _builder.CreateICmpSLT(lval, rval);
+    return op == "min" ? _builder.CreateSelect(less, lval, rval) : _builder.CreateSelect(less, rval, lval);
+}
+
+static llvm::Constant* reduceIdentity(const std::string& op, llvm::Type* type) {
+    if (type->isDoubleTy()) {
+        double inf = std::numeric_limits<double>::infinity();
+        return llvm::ConstantFP::get(type, op == "sum" ? 0.0 : op == "min" ? inf : -inf);
+    }
+    int64_t value = op == "sum" ? 0 : op == "min" ? std::numeric_limits<int64_t>::max() : std::numeric_limits<int64_t>::min();
+    return llvm::ConstantInt::get(type, value, true);
+}
+
+// pfor i in low..high { ... }: the body is outlined into
+//
+//     void <func>.pfor(i8* ctx, i64 lo, i64 hi, i64 worker)
+//
+// which runs iterations lo..hi-1 and is called by begonia_pfor of
+// runtime/pfor.c on the worker threads. ctx holds the addresses of the outer
+// variables the body uses, after slot 0. A reduced variable is a local of the
+// body function instead, which adds itself into the slot of its worker in an
+// array at slot 0 when its range is done; the slots of all workers are added
+// into the variable once the pfor returns. Workers have a line of 64 bytes of
+// slots each, so they don't write to the same cache line.
+llvm::Value* CodeGen::pforGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto pfor = std::dynamic_pointer_cast<PforStatement>(ast);
+    assert(pfor != nullptr);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+
+    auto int_operand = [&](ExpressionPtr expr, const char* what) -> llvm::Value* {
+        auto val = exprGen(expr, env);
+        if (!val->getType()->isIntegerTy(64)) {
+            printf("pfor %s: the %s must be an int\n", pfor->_var.c_str(), what);
+            exit(1);
+        }
+        return val;
+    };
+    auto low = int_operand(pfor->_low, "start");
+    auto high = int_operand(pfor->_high, "end");
+    llvm::Value* grain = llvm::ConstantInt::get(int_type, 0);
+    if (pfor->_grain != nullptr) {
+        grain = int_operand(pfor->_grain, "grain");
+    }
+
+    std::vector<llvm::Value*> reduced;
+    std::set<std::string> reduced_names;
+    for (auto& reduction : pfor->_reductions) {
+        auto addr = lookupVariable(reduction.name, env);
+        if (addr == nullptr) {
+            printf("undefined var:%s\n", reduction.name.c_str());
+            exit(1);
+        }
+        auto type = addr->getType()->getPointerElementType();
+        if (!type->isIntegerTy(64) && !type->isDoubleTy()) {
+            printf("pfor %s: %s(%s) needs an int or double\n", pfor->_var.c_str(), reduction.op.c_str(), reduction.name.c_str());
+            exit(1);
+        }
+        if (!reduced_names.insert(reduction.name).second || reduction.name == pfor->_var) {
+            printf("pfor %s: %s can only be reduced once\n", pfor->_var.c_str(), reduction.name.c_str());
+            exit(1);
+        }
+        reduced.push_back(addr);
+    }
+
+    // for w in 0..count-1 { gen(w) } in the function being generated
+    auto workerLoopGen = [&](llvm::Value* count, const std::function<void(llvm::Value*)>& gen) {
+        auto func = builder.GetInsertBlock()->getParent();
+        auto id = std::to_string(env.front().GetIncID());
+        auto pre_block = builder.GetInsertBlock();
+        auto loop_block = llvm::BasicBlock::Create(_context, id + ".pfor.worker", func);
+        auto end_block = llvm::BasicBlock::Create(_context, id + ".pfor.workers_done", func);
+        builder.CreateBr(loop_block);
+        builder.SetInsertPoint(loop_block);
+        auto worker = builder.CreatePHI(int_type, 2, "worker");
+        worker->addIncoming(llvm::ConstantInt::get(int_type, 0), pre_block);
+        gen(worker);
+        auto next = builder.CreateAdd(worker, llvm::ConstantInt::get(int_type, 1));
+        worker->addIncoming(next, builder.GetInsertBlock());
+        builder.CreateCondBr(builder.CreateICmpSLT(next, count), loop_block, end_block);
+        builder.SetInsertPoint(end_block);
+    };
+    uint64_t stride = (pfor->_reductions.size() + 7) / 8 * 8;
+    auto slotGen = [&](llvm::Value* slots, llvm::Value* worker, unsigned k, llvm::Type* type) {
+        auto index = builder.CreateAdd(builder.CreateMul(worker, llvm::ConstantInt::get(int_type, stride)),
+                                       llvm::ConstantInt::get(int_type, k));
+        auto word = builder.CreateInBoundsGEP(int_type, slots, index);
+        return builder.CreateBitCast(word, type->getPointerTo());
+    };
+
+    llvm::Value* slots = nullptr;
+    llvm::Value* workers = nullptr;
+    if (!reduced.empty()) {
+        auto workers_func = _module->getOrInsertFunction("begonia_pfor_workers", llvm::FunctionType::get(int_type, false));
+        llvm::cast<llvm::Function>(workers_func.getCallee())->addFnAttr(llvm::Attribute::NoUnwind);
+        workers = builder.CreateCall(workers_func);
+        auto bytes = builder.CreateMul(workers, llvm::ConstantInt::get(int_type, stride * 8));
+        slots = builder.CreateBitCast(allocGen(bytes, 64), int_type->getPointerTo());
+        workerLoopGen(workers, [&](llvm::Value* worker) {
+            for (unsigned k = 0; k < reduced.size(); k++) {
+                auto type = reduced[k]->getType()->getPointerElementType();
+                builder.CreateStore(reduceIdentity(pfor->_reductions[k].op, type), slotGen(slots, worker, k, type));
+            }
+        });
+    }
+    auto parent_block = builder.GetInsertBlock();
+    auto parent_func = parent_block->getParent();
+
+    auto body_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), {i8ptr, int_type, int_type, int_type}, false);
+    auto body_func = llvm::Function::Create(body_type, llvm::Function::InternalLinkage,
+                                            parent_func->getName() + ".pfor", _module.get());
+    body_func->addFnAttr(llvm::Attribute::NoUnwind);
+    auto arg = body_func->arg_begin();
+    llvm::Value* ctx_arg = arg++;
+    llvm::Value* lo_arg = arg++;
+    llvm::Value* hi_arg = arg++;
+    llvm::Value* worker_arg = arg++;
+    ctx_arg->setName("ctx");
+    lo_arg->setName("lo");
+    hi_arg->setName("hi");
+    worker_arg->setName("worker");
+
+    auto entry_block = llvm::BasicBlock::Create(_context, "entry", body_func);
+    auto cond_block = llvm::BasicBlock::Create(_context, "pfor.cond", body_func);
+    auto body_block = llvm::BasicBlock::Create(_context, "pfor.body", body_func);
+    auto done_block = llvm::BasicBlock::Create(_context, "pfor.done", body_func);
+
+    Environment frame;
+    frame.function_scope = true;
+    frame.pfor = true;
+    frame.captures.push_back(slots != nullptr ? slots : llvm::ConstantPointerNull::get(i8ptr));
+    builder.SetInsertPoint(entry_block);
+    auto outer_loc = debugFuncBegin(body_func, pfor->_line);
+    auto next_addr = createEntryAlloca(int_type, "pfor.next");
+    builder.CreateStore(lo_arg, next_addr);
+    auto var_addr = createEntryAlloca(int_type, pfor->_var);
+    frame.declared_variable[pfor->_var] = var_addr;
+    debugVarGen(var_addr, pfor->_var, pfor->_line);
+    std::vector<llvm::Value*> locals;
+    for (unsigned k = 0; k < reduced.size(); k++) {
+        auto type = reduced[k]->getType()->getPointerElementType();
+        auto local = createEntryAlloca(type, pfor->_reductions[k].name);
+        builder.CreateStore(reduceIdentity(pfor->_reductions[k].op, type), local);
+        frame.declared_variable[pfor->_reductions[k].name] = local;
+        locals.push_back(local);
+    }
+    builder.CreateBr(cond_block);
+
+    builder.SetInsertPoint(cond_block);
+    auto index = builder.CreateLoad(int_type, next_addr);
+    builder.CreateCondBr(builder.CreateICmpSLT(index, hi_arg), body_block, done_block);
+
+    builder.SetInsertPoint(body_block);
+    builder.CreateStore(index, var_addr);
+    frame.block = body_block;
+    env.push_front(frame);
+    blockGen(pfor->_block, env);
+    if (env.front().block->getTerminator() == nullptr) {
+        builder.SetInsertPoint(env.front().block);
+        builder.CreateStore(builder.CreateAdd(builder.CreateLoad(int_type, next_addr), llvm::ConstantInt::get(int_type, 1)), next_addr);
+        builder.CreateBr(cond_block);
+    }
+    auto captures = std::move(env.front().captures);
+    env.pop_front();
+
+    builder.SetInsertPoint(done_block);
+    if (!locals.empty()) {
+        auto ctx_slots = builder.CreateBitCast(ctx_arg, i8ptr->getPointerTo());
+        auto worker_slots = builder.CreateBitCast(builder.CreateLoad(i8ptr, ctx_slots), int_type->getPointerTo());
+        for (unsigned k = 0; k < locals.size(); k++) {
+            auto type = locals[k]->getType()->getPointerElementType();
+            auto slot = slotGen(worker_slots, worker_arg, k, type);
+            auto combined = reduceCombineGen(pfor->_reductions[k].op, builder.CreateLoad(type, slot), builder.CreateLoad(type, locals[k]));
+            builder.CreateStore(combined, slot);
+        }
+    }
+    builder.CreateRetVoid();
+    debugFuncEnd(outer_loc);
+
+    builder.SetInsertPoint(parent_block);
+    auto ctx = createEntryAlloca(llvm::ArrayType::get(i8ptr, captures.size()), "pfor.ctx");
+    for (unsigned k = 0; k < captures.size(); k++) {
+        builder.CreateStore(builder.CreateBitCast(captures[k], i8ptr), builder.CreateConstInBoundsGEP2_64(ctx->getAllocatedType(), ctx, 0, k));
+    }
+    auto pfor_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context),
+                                             {int_type, int_type, int_type, body_type->getPointerTo(), i8ptr}, false);
+    auto pfor_func = _module->getOrInsertFunction("begonia_pfor", pfor_type);
+    llvm::cast<llvm::Function>(pfor_func.getCallee())->addFnAttr(llvm::Attribute::NoUnwind);
+    builder.CreateCall(pfor_func, {low, high, grain, body_func, builder.CreateBitCast(ctx, i8ptr)});
+
+    if (!reduced.empty()) {
+        workerLoopGen(workers, [&](llvm::Value* worker) {
+            for (unsigned k = 0; k < reduced.size(); k++) {
+                auto type = reduced[k]->getType()->getPointerElementType();
+                auto partial = builder.CreateLoad(type, slotGen(slots, worker, k, type));
+                builder.CreateStore(reduceCombineGen(pfor->_reductions[k].op, builder.CreateLoad(type, reduced[k]), partial), reduced[k]);
+            }
+        });
+        freeGen(slots);
+    }
+    env.front().block = builder.GetInsertBlock();
+    return nullptr;
+}
+
+} //begonia
@@ -0,0 +1,493 @@
+#include "RangeAnalysis.h"
+
+#include <cctype>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// An index starts at most at max_start and grows by at most max_step per
+// increment. Increments run once per call, or once per iteration of a loop
+// whose condition bounds the index (below max_start), so it can't wrap.
+static constexpr long max_start = 1L << 62;
+static constexpr long max_step = 1L << 16;
+
+static bool isNonnegativeInt(ExpressionPtr expr, long max = max_start) {
+    auto number = std::dynamic_pointer_cast<NumberExpression>(expr);
+    return number != nullptr && !number->_is_float && number->_number >= 0 && number->_number <= max;
+}
+
+static std::string identifierOf(ExpressionPtr expr) {
+    auto id = std::dynamic_pointer_cast<IdentifierExpression>(expr);
+    return id != nullptr ? id->_identifier : "";
+}
+
+// true if some statement in ast assigns name
+static bool assignsTo(AstPtr ast, const std::string& name) {
+    if (ast == nullptr) {
+        return false;
+    }
+    switch (ast->GetType()) {
+    case AstType::Block:
+        for (auto statement : *std::dynamic_pointer_cast<AstBlock>(ast)) {
+            if (assignsTo(statement, name)) {
+                return true;
+            }
+        }
+        return false;
+    case AstType::AssignStatement:
+        return std::dynamic_pointer_cast<AssignStatement>(ast)->_identifier == name;
+    case AstType::IfStatement: {
+        auto if_stat = std::dynamic_pointer_cast<IfStatement>(ast);
+        for (auto& if_block : if_stat->_if_blocks) {
+            if (assignsTo(if_block._block, name)) {
+                return true;
+            }
+        }
+        return assignsTo(if_stat->_else_block, name);
+    }
+    case AstType::WhileStatement:
+        return assignsTo(std::dynamic_pointer_cast<WhileStatement>(ast)->_block, name);
+    case AstType::RegionStatement:
+        return assignsTo(std::dynamic_pointer_cast<RegionStatement>(ast)->_block, name);
+    case AstType::PforStatement:
+        return assignsTo(std::dynamic_pointer_cast<PforStatement>(ast)->_block, name);
+    default:
+        return false;
+    }
+}
+
+void RangeAnalysis::analyze(AstBlockPtr body, const std::list<DeclareVarStatementPtr>& params,
+                            const std::map<std::string, std::vector<bool>>& ref_params) {
+    _decl_count.clear();
+    _types.clear();
+    _nonnegative_init.clear();
+    _other_assigns.clear();
+    _passed_by_ref.clear();
+    _ref_param_names.clear();
+    _loop_guards.clear();
+    _ref_params = &ref_params;
+
+    for (auto& param : params) {
+        declare(param->_name, param->_type, false);
+        if (param->_type[0] == '&') {
+            _ref_param_names.insert(param->_name);
+        }
+    }
+    collect(body);
+    visitLoops(body);
+}
+
+bool RangeAnalysis::isInBounds(const AST* index_expr) const {
+    return _in_bounds.count(index_expr) != 0;
+}
+
+void RangeAnalysis::declare(const std::string& name, const std::string& type, bool nonnegative) {
+    _decl_count[name]++;
+    // soa collections are indexed like the arrays and slices they replace
+    _types[name] = type.compare(0, 4, "soa[") == 0 ? type.substr(3) : type;
+    if (nonnegative) {
+        _nonnegative_init.insert(name);
+    }
+}
+
+void RangeAnalysis::collect(AstPtr ast) {
+    if (ast == nullptr) {
+        return;
+    }
+    switch (ast->GetType()) {
+    case AstType::Block:
+        for (auto statement : *std::dynamic_pointer_cast<AstBlock>(ast)) {
+            collect(statement);
+        }
+        break;
+    case AstType::DeclareVarStatement: {
+        auto var = std::dynamic_pointer_cast<DeclareVarStatement>(ast);
+        std::string type = var->_type;
+        auto value = var->_assign_value;
+        if (type == "" && value != nullptr) {
+            if (value->GetType() == AstType::NumberExpr) {
+                type = std::dynamic_pointer_cast<NumberExpression>(value)->_is_float ? "double" : "int";
+            } else if (value->GetType() == AstType::MakeExpr) {
+                type = std::dynamic_pointer_cast<MakeExpression>(value)->_slice_type;
+            } else if (value->GetType() == AstType::SliceExpr) {
+                type = "[]";
+            }
+        }
+        declare(var->_name, type, isNonnegativeInt(value));
+        collectRefArgs(value);
+        break;
+    }
+    case AstType::AssignStatement: {
+        // i = <k> and i = i + <k> keep a non-negative i non-negative, the
+        // latter only outside loops or in one whose condition bounds i
+        auto assign = std::dynamic_pointer_cast<AssignStatement>(ast);
+        auto value = assign->_assign_value;
+        bool keeps_nonnegative = isNonnegativeInt(value);
+        auto op = std::dynamic_pointer_cast<OperationExpresson>(value);
+        if (op != nullptr && op->_op == TokenType::TOKEN_OP_ADD && op->_lexp != nullptr) {
+            auto& name = assign->_identifier;
+            keeps_nonnegative = ((identifierOf(op->_lexp) == name && isNonnegativeInt(op->_rexp, max_step))
+                              || (identifierOf(op->_rexp) == name && isNonnegativeInt(op->_lexp, max_step)))
+                             && (_loop_guards.empty() || _loop_guards.back().count(name) != 0);
+        }
+        if (!keeps_nonnegative) {
+            _other_assigns.insert(assign->_identifier);
+        }
+        collectRefArgs(value);
+        break;
+    }
+    case AstType::ElementAssignStatement: {
+        auto assign = std::dynamic_pointer_cast<ElementAssignStatement>(ast);
+        collectRefArgs(assign->_target);
+        collectRefArgs(assign->_assign_value);
+        break;
+    }
+    case AstType::IfStatement: {
+        auto if_stat = std::dynamic_pointer_cast<IfStatement>(ast);
+        for (auto& if_block : if_stat->_if_blocks) {
+            collectRefArgs(if_block._cond);
+            collect(if_block._block);
+        }
+        collect(if_stat->_else_block);
+        break;
+    }
+    case AstType::WhileStatement: {
+        auto while_stat = std::dynamic_pointer_cast<WhileStatement>(ast);
+        collectRefArgs(while_stat->_condition);
+        std::vector<Bound> bounds;
+        collectBounds(while_stat->_condition, bounds);
+        // lengths of arrays and slices, and literal bounds, are below max_start
+        std::set<std::string> guarded;
+        for (auto& bound : bounds) {
+            guarded.insert(bound.index);
+        }
+        _loop_guards.push_back(guarded);
+        collect(while_stat->_block);
+        _loop_guards.pop_back();
+        break;
+    }
+    case AstType::RegionStatement:
+        collect(std::dynamic_pointer_cast<RegionStatement>(ast)->_block);
+        break;
+    case AstType::PforStatement: {
+        auto pfor = std::dynamic_pointer_cast<PforStatement>(ast);
+        collectRefArgs(pfor->_low);
+        collectRefArgs(pfor->_high);
+        collectRefArgs(pfor->_grain);
+        declare(pfor->_var, "int", isNonnegativeInt(pfor->_low));
+        _loop_guards.push_back({});
+        collect(pfor->_block);
+        _loop_guards.pop_back();
+        break;
+    }
+    case AstType::RetStatement:
+        for (auto& value : std::dynamic_pointer_cast<ReturnStatement>(ast)->_ret_values) {
+            collectRefArgs(value);
+        }
+        break;
+    case AstType::YieldStatement:
+        // the caller runs until the generator resumes, and may change what
+        // the reference parameters refer to
+        _passed_by_ref.insert(_ref_param_names.begin(), _ref_param_names.end());
+        collectRefArgs(std::dynamic_pointer_cast<YieldStatement>(ast)->_value);
+        break;
+    case AstType::DeclareFuncStatement:
+    case AstType::DeclareStructStatement:
+        // function bodies are analyzed on their own
+        break;
+    default:
+        collectRefArgs(std::dynamic_pointer_cast<Expression>(ast));
+        break;
+    }
+}
+
+// variables passed to a reference parameter may change in the call
+void RangeAnalysis::collectRefArgs(ExpressionPtr expr) {
+    if (expr == nullptr) {
+        return;
+    }
+    switch (expr->GetType()) {
+    case AstType::FuncallExpr: {
+        auto funcall = std::dynamic_pointer_cast<FuncallExpression>(expr);
+        auto refs = _ref_params->find(funcall->_identifier);
+        for (size_t i = 0; i < funcall->_parameters.size(); i++) {
+            if (refs != _ref_params->end() && i < refs->second.size() && refs->second[i]) {
+                auto name = identifierOf(funcall->_parameters[i]);
+                if (name != "") {
+                    _passed_by_ref.insert(name);
+                }
+            }
+            collectRefArgs(funcall->_parameters[i]);
+        }
+        break;
+    }
+    case AstType::OpExpr: {
+        auto op = std::dynamic_pointer_cast<OperationExpresson>(expr);
+        collectRefArgs(op->_lexp);
+        collectRefArgs(op->_rexp);
+        break;
+    }
+    case AstType::IndexExpr: {
+        auto index = std::dynamic_pointer_cast<IndexExpression>(expr);
+        collectRefArgs(index->_base);
+        collectRefArgs(index->_index);
+        break;
+    }
+    case AstType::SliceExpr: {
+        auto slice = std::dynamic_pointer_cast<SliceExpression>(expr);
+        collectRefArgs(slice->_base);
+        collectRefArgs(slice->_low);
+        collectRefArgs(slice->_high);
+        break;
+    }
+    case AstType::MakeExpr:
+        collectRefArgs(std::dynamic_pointer_cast<MakeExpression>(expr)->_length);
+        break;
+    case AstType::MemberExpr:
+        collectRefArgs(std::dynamic_pointer_cast<MemberExpression>(expr)->_base);
+        break;
+    case AstType::AwaitExpr:
+        // other coroutines run until the async func resumes, as for a yield
+        _passed_by_ref.insert(_ref_param_names.begin(), _ref_param_names.end());
+        collectRefArgs(std::dynamic_pointer_cast<AwaitExpression>(expr)->_value);
+        break;
+    default:
+        break;
+    }
+}
+
+bool RangeAnalysis::isNonnegative(const std::string& name) {
+    return _decl_count[name] == 1
+        && _nonnegative_init.count(name) != 0
+        && _other_assigns.count(name) == 0
+        && _passed_by_ref.count(name) == 0;
+}
+
+// length of a fixed size array variable, -1 for anything else
+long RangeAnalysis::fixedLength(const std::string& name) {
+    if (_decl_count[name] != 1) {
+        return -1;
+    }
+    auto& type = _types[name];
+    if (type.size() < 3 || type[0] != '[' || !isdigit(type[1])) {
+        return -1;
+    }
+    return std::stol(type.substr(1));
+}
+
+void RangeAnalysis::visitLoops(AstPtr ast) {
+    if (ast == nullptr) {
+        return;
+    }
+    switch (ast->GetType()) {
+    case AstType::Block:
+        for (auto statement : *std::dynamic_pointer_cast<AstBlock>(ast)) {
+            visitLoops(statement);
+        }
+        break;
+    case AstType::IfStatement: {
+        auto if_stat = std::dynamic_pointer_cast<IfStatement>(ast);
+        for (auto& if_block : if_stat->_if_blocks) {
+            visitLoops(if_block._block);
+        }
+        visitLoops(if_stat->_else_block);
+        break;
+    }
+    case AstType::RegionStatement:
+        visitLoops(std::dynamic_pointer_cast<RegionStatement>(ast)->_block);
+        break;
+    case AstType::WhileStatement: {
+        auto while_stat = std::dynamic_pointer_cast<WhileStatement>(ast);
+        std::vector<Bound> bounds;
+        collectBounds(while_stat->_condition, bounds);
+        markLoopBody(bounds, while_stat->_block);
+        visitLoops(while_stat->_block);
+        break;
+    }
+    case AstType::PforStatement: {
+        // pfor i in 0..n runs the body with i < n, like while i < n
+        auto pfor = std::dynamic_pointer_cast<PforStatement>(ast);
+        auto cond = std::make_shared<OperationExpresson>(TokenType::TOKEN_OP_LT,
+            std::make_shared<IdentifierExpression>(pfor->_var), pfor->_high);
+        std::vector<Bound> bounds;
+        collectBounds(cond, bounds);
+        markLoopBody(bounds, pfor->_block);
+        visitLoops(pfor->_block);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// marks the index expressions of a loop body that the bounds of its
+// condition prove in range
+void RangeAnalysis::markLoopBody(const std::vector<Bound>& bounds, AstBlockPtr block) {
+    for (auto& bound : bounds) {
+        if (!isNonnegative(bound.index)) {
+            continue;
+        }
+        if (bound.array != "") {
+            auto& type = _types[bound.array];
+            if (_decl_count[bound.array] != 1 || type.empty() || type[0] != '['
+             || _passed_by_ref.count(bound.array) != 0
+             || assignsTo(block, bound.array)) {
+                continue;
+            }
+        }
+        // the condition holds until the first statement that changes the index
+        for (auto statement : *block) {
+            if (assignsTo(statement, bound.index)) {
+                if (statement->GetType() == AstType::AssignStatement) {
+                    markInBounds(std::dynamic_pointer_cast<AssignStatement>(statement)->_assign_value, bound);
+                }
+                break;
+            }
+            markInBounds(statement, bound);
+        }
+    }
+}
+
+// i < len(a), len(a) > i, i < 16 and conjunctions of them
+void RangeAnalysis::collectBounds(ExpressionPtr cond, std::vector<Bound>& bounds) {
+    auto op = std::dynamic_pointer_cast<OperationExpresson>(cond);
+    if (op == nullptr || op->_lexp == nullptr) {
+        return;
+    }
+    ExpressionPtr index;
+    ExpressionPtr limit;
+    switch (op->_op) {
+    case TokenType::TOKEN_OP_AND:
+        collectBounds(op->_lexp, bounds);
+        collectBounds(op->_rexp, bounds);
+        return;
+    case TokenType::TOKEN_OP_LT:
+        index = op->_lexp;
+        limit = op->_rexp;
+        break;
+    case TokenType::TOKEN_OP_GT:
+        index = op->_rexp;
+        limit = op->_lexp;
+        break;
+    default:
+        return;
+    }
+
+    auto index_name = identifierOf(index);
+    if (index_name == "") {
+        return;
+    }
+    auto funcall = std::dynamic_pointer_cast<FuncallExpression>(limit);
+    if (funcall != nullptr && funcall->_identifier == "len" && funcall->_parameters.size() == 1) {
+        auto array_name = identifierOf(funcall->_parameters[0]);
+        if (array_name != "") {
+            bounds.push_back(Bound{index_name, array_name, 0});
+        }
+    } else if (isNonnegativeInt(limit)) {
+        bounds.push_back(Bound{index_name, "", long(std::dynamic_pointer_cast<NumberExpression>(limit)->_number)});
+    }
+}
+
+void RangeAnalysis::markInBounds(AstPtr ast, const Bound& bound) {
+    if (ast == nullptr) {
+        return;
+    }
+    switch (ast->GetType()) {
+    case AstType::IndexExpr: {
+        auto index = std::dynamic_pointer_cast<IndexExpression>(ast);
+        auto base_name = identifierOf(index->_base);
+        if (base_name != "" && identifierOf(index->_index) == bound.index) {
+            if (bound.array != "" ? base_name == bound.array : fixedLength(base_name) >= bound.length) {
+                _in_bounds.insert(ast.get());
+            }
+        }
+        markInBounds(index->_base, bound);
+        markInBounds(index->_index, bound);
+        break;
+    }
+    case AstType::SliceExpr: {
+        auto slice = std::dynamic_pointer_cast<SliceExpression>(ast);
+        markInBounds(slice->_base, bound);
+        markInBounds(slice->_low, bound);
+        markInBounds(slice->_high, bound);
+        break;
+    }
+    case AstType::MakeExpr:
+        markInBounds(std::dynamic_pointer_cast<MakeExpression>(ast)->_length, bound);
+        break;
+    case AstType::OpExpr: {
+        auto op = std::dynamic_pointer_cast<OperationExpresson>(ast);
+        markInBounds(op->_lexp, bound);
+        markInBounds(op->_rexp, bound);
+        break;
+    }
+    case AstType::FuncallExpr:
+        for (auto& param : std::dynamic_pointer_cast<FuncallExpression>(ast)->_parameters) {
+            markInBounds(param, bound);
+        }
+        break;
+    case AstType::Block:
+        for (auto statement : *std::dynamic_pointer_cast<AstBlock>(ast)) {
+            markInBounds(statement, bound);
+        }
+        break;
+    case AstType::IfStatement: {
+        auto if_stat = std::dynamic_pointer_cast<IfStatement>(ast);
+        for (auto& if_block : if_stat->_if_blocks) {
+            markInBounds(if_block._cond, bound);
+            markInBounds(if_block._block, bound);
+        }
+        markInBounds(if_stat->_else_block, bound);
+        break;
+    }
+    case AstType::WhileStatement: {
+        auto while_stat = std::dynamic_pointer_cast<WhileStatement>(ast);
+        markInBounds(while_stat->_condition, bound);
+        markInBounds(while_stat->_block, bound);
+        break;
+    }
+    case AstType::RegionStatement:
+        markInBounds(std::dynamic_pointer_cast<RegionStatement>(ast)->_block, bound);
+        break;
+    case AstType::PforStatement: {
+        auto pfor = std::dynamic_pointer_cast<PforStatement>(ast);
+        markInBounds(pfor->_low, bound);
+        markInBounds(pfor->_high, bound);
+        markInBounds(pfor->_grain, bound);
+        markInBounds(pfor->_block, bound);
+        break;
+    }
+    case AstType::AssignStatement:
+        markInBounds(std::dynamic_pointer_cast<AssignStatement>(ast)->_assign_value, bound);
+        break;
+    case AstType::MemberExpr:
+        markInBounds(std::dynamic_pointer_cast<MemberExpression>(ast)->_base, bound);
+        break;
+    case AstType::AwaitExpr:
+        markInBounds(std::dynamic_pointer_cast<AwaitExpression>(ast)->_value, bound);
+        break;
+    case AstType::ElementAssignStatement: {
+        auto assign = std::dynamic_pointer_cast<ElementAssignStatement>(ast);
+        markInBounds(assign->_target, bound);
+        markInBounds(assign->_assign_value, bound);
+        break;
+    }
+    case AstType::DeclareVarStatement:
+        markInBounds(std::dynamic_pointer_cast<DeclareVarStatement>(ast)->_assign_value, bound);
+        break;
+    case AstType::RetStatement:
+        for (auto& value : std::dynamic_pointer_cast<ReturnStatement>(ast)->_ret_values) {
+            markInBounds(value, bound);
+        }
+        break;
+    case AstType::YieldStatement:
+        markInBounds(std::dynamic_pointer_cast<YieldStatement>(ast)->_value, bound);
+        break;
+    default:
+        break;
+    }
+}
+
+} //begonia
@@ -0,0 +1,62 @@
+#pragma once
+#include "Parser.h"
+#include "Statement.h"
+#include "Expression.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// Proves index expressions in bounds from the while loops around them, so
+// CodeGen can drop their bounds checks. In
+//
+//     var i = 0;
+//     while i < len(a) {
+//         s = s + a[i];
+//         i = i + 1;
+//     }
+//
+// i only ever grows from a non-negative start and a is not reassigned in the
+// loop, so a[i] is in bounds until the statement that changes i.
+// Anything the analysis doesn't understand keeps its check, and so does
+// anything passed by reference to a function, which may change it.
+class RangeAnalysis {
+public:
+    // params is empty for the top-level statements; ref_params tells which
+    // parameters of the functions declared so far are references
+    void analyze(AstBlockPtr body, const std::list<DeclareVarStatementPtr>& params,
+                 const std::map<std::string, std::vector<bool>>& ref_params);
+    bool isInBounds(const AST* index_expr) const;
+
+private:
+    struct Bound {
+        std::string     index;
+        std::string     array;      // i < len(array)
+        long            length;     // i < length, when array is empty
+    };
+
+    std::map<std::string, int>          _decl_count;
+    std::map<std::string, std::string>  _types;
+    std::set<std::string>               _nonnegative_init;
+    std::set<std::string>               _other_assigns;
+    std::set<std::string>               _passed_by_ref;
+    std::set<std::string>               _ref_param_names;
+    std::set<const AST*>                _in_bounds;
+    std::vector<std::set<std::string>>  _loop_guards;   // indexes bounded by the loops around, innermost last
+    const std::map<std::string, std::vector<bool>>* _ref_params = nullptr;
+
+    void collect(AstPtr ast);
+    void collectRefArgs(ExpressionPtr expr);
+    void declare(const std::string& name, const std::string& type, bool nonnegative);
+    bool isNonnegative(const std::string& name);
+    long fixedLength(const std::string& name);
+    void visitLoops(AstPtr ast);
+    void collectBounds(ExpressionPtr cond, std::vector<Bound>& bounds);
+    void markInBounds(AstPtr ast, const Bound& bound);
+    void markLoopBody(const std::vector<Bound>& bounds, AstBlockPtr block);
+};
+
+} //begonia
@@ -0,0 +1,112 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace begonia {
+
+// Declares a function of runtime/arena.c. Entering and leaving a region
+// invalidates memory the program may still point to, so those get no
+// memory attributes.
+llvm::FunctionCallee CodeGen::arenaRuntimeFunc(const std::string& name, llvm::FunctionType* func_type) {
+    auto func = _module->getFunction(name);
+    if (func != nullptr) {
+        return func;
+    }
+    func = llvm::Function::Create(func_type, llvm::GlobalValue::ExternalLinkage, name, _module.get());
+    func->addFnAttr(llvm::Attribute::NoUnwind);
+    func->addFnAttr(llvm::Attribute::WillReturn);
+    return func;
+}
+
+// bytes of zeroed memory aligned to align: bump-allocated inside a region,
+// from calloc or aligned_alloc outside
+llvm::Value* CodeGen::allocGen(llvm::Value* bytes, uint64_t align) {
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto func_type = llvm::FunctionType::get(llvm::Type::getInt8PtrTy(_context), {int_type, int_type}, false);
+    auto alloc = arenaRuntimeFunc("begonia_alloc_zeroed", func_type);
+    auto func = llvm::cast<llvm::Function>(alloc.getCallee());
+    func->addFnAttr(llvm::Attribute::InaccessibleMemOnly);
+    auto memory = _builder.CreateCall(alloc, {bytes, llvm::ConstantInt::get(int_type, align)});
+    auto align_attr = llvm::Attribute::getWithAlignment(_context, llvm::Align(align));
+#if LLVM_VERSION_MAJOR >= 14
+    func->addRetAttr(llvm::Attribute::NoAlias);
+    memory->addRetAttr(align_attr);
+#else
+    func->addAttribute(llvm::AttributeList::ReturnIndex, llvm::Attribute::NoAlias);
+    memory->addAttribute(llvm::AttributeList::ReturnIndex, align_attr);
+#endif
+    return memory;
+}
+
+// delete: memory of a region is left to the region
+llvm::Value* CodeGen::freeGen(llvm::Value* memory) {
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto func_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), {i8ptr}, false);
+    auto free_func = arenaRuntimeFunc("begonia_free", func_type);
+    auto func = llvm::cast<llvm::Function>(free_func.getCallee());
+    func->addFnAttr(llvm::Attribute::InaccessibleMemOrArgMemOnly);
+    func->addParamAttr(0, llvm::Attribute::NoCapture);
+    return _builder.CreateCall(free_func, {_builder.CreateBitCast(memory, i8ptr)});
+}
+
+// _begonia_main sets up the arena of the main thread
+void CodeGen::arenaInitGen() {
+    auto func_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), false);
+    _builder.CreateCall(arenaRuntimeFunc("begonia_arena_init", func_type));
+}
+
+// region { ... }: every allocation while the block runs, including those of
+// the functions it calls, comes from the arena of the thread, and is released
+// when the block ends or a return leaves it
+llvm::Value* CodeGen::regionGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto region = std::dynamic_pointer_cast<RegionStatement>(ast);
+    assert(region != nullptr);
+
+    auto func_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), false);
+    builder.CreateCall(arenaRuntimeFunc("begonia_region_enter", func_type));
+    Environment frame;
+    frame.block = env.front().block;
+    frame.region = true;
+    env.push_front(frame);
+    blockGen(region->_block, env);
+    auto end_block = env.front().block;
+    env.pop_front();
+
+    env.front().block = end_block;
+    builder.SetInsertPoint(end_block);
+    if (end_block->getTerminator() == nullptr) {
+        builder.CreateCall(arenaRuntimeFunc("begonia_region_exit", func_type));
+    }
+    return nullptr;
+}
+
+// A return leaves the regions it is in, innermost first. The call of
+// return f(...) runs inside them, so it is no tail call.
+bool CodeGen::leaveRegionsGen(ReturnStatementPtr ret_stat, std::list<Environment>& env) {
+    auto func_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), false);
+    bool left = false;
+    for (auto& env_frame : env) {
+        if (env_frame.region) {
+            _builder.CreateCall(arenaRuntimeFunc("begonia_region_exit", func_type));
+            left = true;
+        }
+        if (env_frame.function_scope) {
+            break;
+        }
+    }
+    if (left && ret_stat->_tail_call) {
+        printf("return tailcall inside a region: the region is left after the call returns\n");
+        exit(1);
+    }
+    return left;
+}
+
+} //begonia
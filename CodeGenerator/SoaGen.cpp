@@ -0,0 +1,229 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace begonia {
+
+// Columns of make(soa []S, n) start on a cache line of their own.
+static const uint64_t kColumnAlign = 64;
+
+// soa [N]S and soa []S hold the same elements as [N]S and []S, but every field
+// of S lives in an array of its own, so a loop over one field of all the
+// elements reads contiguous memory. Columns follow the field order of S.
+llvm::Type* CodeGen::getSoaType(const std::string& type_name) {
+    auto close = type_name.find(']');
+    auto length = type_name.substr(4, close - 4);
+    auto elem_name = type_name.substr(close + 1);
+    auto elem = _structs.find(elem_name);
+    if (elem == _structs.end()) {
+        printf("soa collections hold structs, not %s\n", elem_name.c_str());
+        exit(1);
+    }
+    auto name = elem_name + ".soa" + length;
+    auto found = _soa_types.find(name);
+    if (found != _soa_types.end()) {
+        return found->second.type;
+    }
+    if (elem->second.field_index.empty()) {
+        printf("soa collection of %s, a struct without fields\n", elem_name.c_str());
+        exit(1);
+    }
+
+    SoaInfo soa;
+    soa.elem_type = elem->second.type;
+    soa.length = length.empty() ? 0 : std::stoull(length);
+    std::vector<std::pair<unsigned, std::string>> fields;
+    for (auto& field : elem->second.field_index) {
+        fields.emplace_back(field.second, field.first);
+    }
+    std::sort(fields.begin(), fields.end());
+    std::vector<llvm::Type*> columns;
+    for (auto& field : fields) {
+        auto field_type = soa.elem_type->getElementType(field.first);
+        soa.column[field.second] = columns.size();
+        soa.elem_index.push_back(field.first);
+        if (soa.length != 0) {
+            columns.push_back(llvm::ArrayType::get(field_type, soa.length));
+        } else {
+            columns.push_back(field_type->getPointerTo());
+        }
+    }
+    if (soa.length == 0) {
+        columns.push_back(llvm::Type::getInt64Ty(_context));
+    }
+    soa.type = llvm::StructType::create(_context, columns, name);
+    _soa_types[name] = soa;
+    return soa.type;
+}
+
+const CodeGen::SoaInfo* CodeGen::soaInfo(llvm::Type* type) {
+    auto struct_type = llvm::dyn_cast<llvm::StructType>(type);
+    if (struct_type == nullptr || struct_type->isLiteral()) {
+        return nullptr;
+    }
+    auto found = _soa_types.find(struct_type->getName().str());
+    return found != _soa_types.end() ? &found->second : nullptr;
+}
+
+// [N]T and soa [N]S live in memory and are used through slices of them
+bool CodeGen::isFixedCollection(llvm::Type* type) {
+    auto soa = soaInfo(type);
+    return type->isArrayTy() || (soa != nullptr && soa->length != 0);
+}
+
+// the first element of every column, and the number of elements
+void CodeGen::soaBaseGen(const SoaInfo* soa, llvm::Value* addr, llvm::Value* value, std::vector<llvm::Value*>& columns, llvm::Value*& length) {
+    auto& builder = _builder;
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    unsigned count = soa->elem_index.size();
+    if (soa->length != 0) {
+        // fixed soa collections only exist in memory, as values they are slices
+        assert(addr != nullptr);
+        for (unsigned k = 0; k < count; k++) {
+            columns.push_back(builder.CreateInBoundsGEP(soa->type, addr,
+                {builder.getInt32(0), builder.getInt32(k), builder.getInt64(0)}));
+        }
+        length = llvm::ConstantInt::get(int_type, soa->length);
+        return;
+    }
+    if (value == nullptr) {
+        value = builder.CreateLoad(soa->type, addr);
+    }
+    for (unsigned k = 0; k < count; k++) {
+        columns.push_back(builder.CreateExtractValue(value, k));
+    }
+    length = builder.CreateExtractValue(value, count);
+}
+
+// a soa [N]S used as a value is a soa []S of all of it
+llvm::Value* CodeGen::soaSliceGen(llvm::Value* soa_addr) {
+    auto soa = soaInfo(soa_addr->getType()->getPointerElementType());
+    assert(soa != nullptr && soa->length != 0);
+    std::vector<llvm::Value*> columns;
+    llvm::Value* length;
+    soaBaseGen(soa, soa_addr, nullptr, columns, length);
+    auto slice_type = getValueType("soa[]" + soa->elem_type->getName().str());
+    llvm::Value* slice = llvm::UndefValue::get(slice_type);
+    for (unsigned k = 0; k < columns.size(); k++) {
+        slice = _builder.CreateInsertValue(slice, columns[k], k);
+    }
+    return _builder.CreateInsertValue(slice, length, columns.size());
+}
+
+// ps[i].x is element i of the column of x
+llvm::Value* CodeGen::soaFieldAddressGen(IndexExpressionPtr index_expr, const std::string& field, const SoaInfo* soa,
+                                         llvm::Value* addr, llvm::Value* value, std::list<Environment>& env, llvm::Align& align) {
+    auto column = soa->column.find(field);
+    if (column == soa->column.end()) {
+        printf("struct %s has no field %s\n", soa->elem_type->getName().str().c_str(), field.c_str());
+        exit(1);
+    }
+    std::vector<llvm::Value*> columns;
+    llvm::Value* length;
+    soaBaseGen(soa, addr, value, columns, length);
+    auto index = indexValueGen(index_expr->_index, env);
+    boundsCheckGen(index_expr, index, length, env);
+    auto field_type = soa->elem_type->getElementType(soa->elem_index[column->second]);
+    align = typeAlign(field_type);
+    return _builder.CreateInBoundsGEP(field_type, columns[column->second], index);
+}
+
+// ps[i] gathers element i of every column into an S
+llvm::Value* CodeGen::soaElementGen(IndexExpressionPtr index_expr, const SoaInfo* soa, llvm::Value* addr, llvm::Value* value,
+                                    std::list<Environment>& env) {
+    std::vector<llvm::Value*> columns;
+    llvm::Value* length;
+    soaBaseGen(soa, addr, value, columns, length);
+    auto index = indexValueGen(index_expr->_index, env);
+    boundsCheckGen(index_expr, index, length, env);
+    llvm::Value* elem = llvm::UndefValue::get(soa->elem_type);
+    for (unsigned k = 0; k < columns.size(); k++) {
+        auto field_type = soa->elem_type->getElementType(soa->elem_index[k]);
+        auto field_addr = _builder.CreateInBoundsGEP(field_type, columns[k], index);
+        auto field = _builder.CreateAlignedLoad(field_type, field_addr, typeAlign(field_type));
+        elem = _builder.CreateInsertValue(elem, field, soa->elem_index[k]);
+    }
+    return elem;
+}
+
+// ps[i] = p scatters the fields of p over the columns
+llvm::Value* CodeGen::soaElementAssignGen(IndexExpressionPtr index_expr, llvm::Value* val, const SoaInfo* soa,
+                                          llvm::Value* addr, llvm::Value* value, std::list<Environment>& env) {
+    if (val->getType() != soa->elem_type) {
+        printf("[soaElementAssignGen] element type no matched\n");
+        exit(1);
+    }
+    std::vector<llvm::Value*> columns;
+    llvm::Value* length;
+    soaBaseGen(soa, addr, value, columns, length);
+    auto index = indexValueGen(index_expr->_index, env);
+    boundsCheckGen(index_expr, index, length, env);
+    for (unsigned k = 0; k < columns.size(); k++) {
+        auto field_type = soa->elem_type->getElementType(soa->elem_index[k]);
+        auto field_addr = _builder.CreateInBoundsGEP(field_type, columns[k], index);
+        _builder.CreateAlignedStore(_builder.CreateExtractValue(val, soa->elem_index[k]), field_addr, typeAlign(field_type));
+    }
+    return nullptr;
+}
+
+// ps[low:high] offsets every column by low
+llvm::Value* CodeGen::soaSubsliceGen(SliceExpressionPtr slice_expr, const SoaInfo* soa, llvm::Value* addr, llvm::Value* value,
+                                     std::list<Environment>& env) {
+    auto& builder = _builder;
+    std::vector<llvm::Value*> columns;
+    llvm::Value *length, *low, *high;
+    soaBaseGen(soa, addr, value, columns, length);
+    sliceBoundsGen(slice_expr, length, env, low, high);
+    auto slice_type = getValueType("soa[]" + soa->elem_type->getName().str());
+    llvm::Value* slice = llvm::UndefValue::get(slice_type);
+    for (unsigned k = 0; k < columns.size(); k++) {
+        auto field_type = soa->elem_type->getElementType(soa->elem_index[k]);
+        slice = builder.CreateInsertValue(slice, builder.CreateInBoundsGEP(field_type, columns[k], low), k);
+    }
+    return builder.CreateInsertValue(slice, builder.CreateSub(high, low), columns.size());
+}
+
+// make(soa []S, n) allocates all the columns at once, each starting on a
+// cache line; delete frees them through the first column
+llvm::Value* CodeGen::soaMakeGen(MakeExpressionPtr make_expr, const SoaInfo* soa, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto length = indexValueGen(make_expr->_length, env);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    trapUnlessGen(builder.CreateICmpSGE(length, llvm::ConstantInt::get(int_type, 0)), env);
+
+    auto& layout = _module->getDataLayout();
+    uint64_t align = kColumnAlign;
+    for (auto index : soa->elem_index) {
+        align = std::max(align, uint64_t(typeAlign(soa->elem_type->getElementType(index)).value()));
+    }
+    // every column is rounded up to align
+    std::vector<llvm::Value*> offsets;
+    llvm::Value* bytes = llvm::ConstantInt::get(int_type, 0);
+    for (auto index : soa->elem_index) {
+        offsets.push_back(bytes);
+        auto elem_size = layout.getTypeAllocSize(soa->elem_type->getElementType(index));
+        bytes = builder.CreateAdd(bytes, builder.CreateMul(length, llvm::ConstantInt::get(int_type, elem_size)));
+        bytes = builder.CreateAnd(builder.CreateAdd(bytes, llvm::ConstantInt::get(int_type, align - 1)),
+                                  llvm::ConstantInt::get(int_type, ~(align - 1)));
+    }
+    auto memory = allocGen(bytes, align);
+
+    llvm::Value* slice = llvm::UndefValue::get(soa->type);
+    for (unsigned k = 0; k < offsets.size(); k++) {
+        auto field_type = soa->elem_type->getElementType(soa->elem_index[k]);
+        auto column = builder.CreateInBoundsGEP(builder.getInt8Ty(), memory, offsets[k]);
+        slice = builder.CreateInsertValue(slice, builder.CreateBitCast(column, field_type->getPointerTo()), k);
+    }
+    return builder.CreateInsertValue(slice, length, offsets.size());
+}
+
+} //begonia
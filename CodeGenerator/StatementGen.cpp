@@ -18,7 +18,72 @@
 
 namespace begonia {
 
+// trace event name of the CodeGen handler of each statement type
+static const char* handlerTraceName(AstType type) {
+    switch (type) {
+    case AstType::IfStatement:          return "codegen.if";
+    case AstType::AssignStatement:      return "codegen.assign";
+    case AstType::DeclareVarStatement:  return "codegen.var";
+    case AstType::DeclareFuncStatement: return "codegen.func";
+    case AstType::WhileStatement:       return "codegen.while";
+    case AstType::RegionStatement:      return "codegen.region";
+    case AstType::PforStatement:        return "codegen.pfor";
+    case AstType::YieldStatement:       return "codegen.yield";
+    case AstType::RetStatement:         return "codegen.return";
+    case AstType::ElementAssignStatement: return "codegen.element_assign";
+    case AstType::DeclareStructStatement: return "codegen.struct";
+    default:                            return "codegen.expr";
+    }
+}
+
 llvm::Type* CodeGen::getValueType(std::string type_name) {
+    if (type_name.size() > 1 && type_name[0] == '&') {
+        // &T is passed as a pointer to the caller's T
+        auto pointee = getValueType(type_name.substr(1));
+        if (pointee->isVoidTy()) {
+            printf("Unknown type:%s\n", type_name.c_str());
+            exit(1);
+        }
+        return pointee->getPointerTo();
+    }
+    if (type_name.size() > 2 && type_name[0] == '[') {
+        // [N]T is a fixed size array, []T a slice
+        auto close = type_name.find(']');
+        auto elem_type = getValueType(type_name.substr(close + 1));
+        if (close == 1) {
+            return getSliceType(elem_type);
+        }
+        return llvm::ArrayType::get(elem_type, std::stoull(type_name.substr(1, close - 1)));
+    }
+    if (type_name.compare(0, 4, "soa[") == 0) {
+        return getSoaType(type_name);
+    }
+    if (type_name.compare(0, 4, "vec<") == 0) {
+        // vec<T,N>
+        auto comma = type_name.rfind(',');
+        auto elem_type = getValueType(type_name.substr(4, comma - 4));
+        if (!elem_type->isDoubleTy() && !elem_type->isIntegerTy()) {
+            printf("vector lanes must be double, int or bool: %s\n", type_name.c_str());
+            exit(1);
+        }
+        return getVectorType(elem_type, std::stoul(type_name.substr(comma + 1)));
+    }
+    if (type_name.compare(0, 7, "atomic<") == 0) {
+        return getAtomicType(getValueType(type_name.substr(7, type_name.size() - 8)));
+    }
+    if (type_name.compare(0, 4, "gen<") == 0) {
+        return getGenType(getValueType(type_name.substr(4, type_name.size() - 5)));
+    }
+    if (type_name.compare(0, 5, "task<") == 0) {
+        return getTaskType(getValueType(type_name.substr(5, type_name.size() - 6)));
+    }
+    auto user_struct = _structs.find(type_name);
+    if (user_struct != _structs.end()) {
+        return user_struct->second.type;
+    }
+    if (type_name == "thread" || type_name == "queue") {
+        return getHandleType(type_name);
+    }
     auto type = _basic_variable_type.find(type_name);
     if (type != _basic_variable_type.end()) {
         switch (type->second) {
@@ -30,6 +95,8 @@ llvm::Type* CodeGen::getValueType(std::string type_name) {
             return llvm::Type::getInt64Ty(_context);
         case ValueType::String:
             return llvm::Type::getInt8PtrTy(_context);
+        case ValueType::Str:
+            return getStrType();
         case ValueType::Void:
             return llvm::Type::getVoidTy(_context);
         default:
@@ -43,10 +110,7 @@ llvm::Type* CodeGen::getValueType(std::string type_name) {
         printf("Unknown type:%s\n", type_name.c_str());
         assert(false);
     }
-    
-    // TODO: struct type
     return nullptr;
-
 }
 
 llvm::Value* CodeGen::declareProtoGen(AstPtr ast, std::list<Environment>& env) {
@@ -59,6 +123,7 @@ llvm::Value* CodeGen::declareProtoGen(AstPtr ast, std::list<Environment>& env) {
         exit(1);
     }
     std::vector<llvm::Type *> arg_type;
+    std::vector<bool> by_ref;
     llvm::Type* ret_type = nullptr;
 
     for(auto var : funcAst->_decl_vars){
@@ -67,35 +132,130 @@ llvm::Value* CodeGen::declareProtoGen(AstPtr ast, std::list<Environment>& env) {
             printf("Unkown Type:%s\n",var->_type.c_str());
             exit(1);
         }
+        by_ref.push_back(var->_type[0] == '&');
+        if (atomicElemType(type) != nullptr) {
+            printf("parameter %s: pass atomics by reference, &%s\n", var->_name.c_str(), var->_type.c_str());
+            exit(1);
+        }
+        if (isFixedCollection(type)) {
+            printf("parameter %s: pass arrays as slices, %s[]%s\n", var->_name.c_str(), soaInfo(type) != nullptr ? "soa " : "",
+                   var->_type.substr(var->_type.find(']') + 1).c_str());
+            exit(1);
+        }
         arg_type.push_back(type);
     }
+    if (funcAst->_ret_type[0] == '&') {
+        printf("func %s: references can't be returned\n", funcAst->_name.c_str());
+        exit(1);
+    }
     ret_type = getValueType(funcAst->_ret_type);
+    llvm::Type* yield_type = nullptr;
+    if (funcAst->_generator) {
+        // gen func f() T is called like func f() gen<T>
+        if (ret_type->isVoidTy()) {
+            printf("gen func %s: give the type of the values it yields\n", funcAst->_name.c_str());
+            exit(1);
+        }
+        yield_type = ret_type;
+        ret_type = getGenType(yield_type);
+    }
+    llvm::Type* result_type = nullptr;
+    if (funcAst->_async) {
+        // async func f() T is called like func f() task<T>, T may be void
+        result_type = ret_type;
+        ret_type = getTaskType(result_type);
+    }
+    if (atomicElemType(ret_type) != nullptr) {
+        printf("func %s: atomics can't be returned\n", funcAst->_name.c_str());
+        exit(1);
+    }
+    if (isFixedCollection(ret_type)) {
+        printf("func %s: arrays can't be returned, return a slice\n", funcAst->_name.c_str());
+        exit(1);
+    }
 
     llvm::FunctionType *func_proto =
         llvm::FunctionType::get(ret_type, arg_type, false);
     
-    llvm::Function *func =
-        llvm::Function::Create(func_proto, llvm::Function::ExternalLinkage, funcAst->_name, _module.get());
-    
+    // only main and export func are seen by other files, and nothing by
+    // other JIT modules: they are reached through their tier entries
+    bool internal = funcAst->_block->size() != 0
+        && (_options.jit || (!funcAst->_export && funcAst->_name != internal_main_func));
+    llvm::Function *func = llvm::Function::Create(func_proto,
+        internal ? llvm::Function::InternalLinkage : llvm::Function::ExternalLinkage, funcAst->_name, _module.get());
+    func->setCallingConv(callingConv(func));
+    annotateFunction(funcAst, func);
+
     env.front().declared_prototype[funcAst->_name] = func;
+    _ref_params[funcAst->_name] = by_ref;
+    for (unsigned i = 0; i < by_ref.size(); i++) {
+        if (by_ref[i]) {
+            auto pointee = arg_type[i]->getPointerElementType();
+            func->addParamAttr(i, llvm::Attribute::NonNull);
+            func->addParamAttr(i, llvm::Attribute::getWithDereferenceableBytes(_context, _module->getDataLayout().getTypeAllocSize(pointee)));
+            func->addParamAttr(i, llvm::Attribute::getWithAlignment(_context, typeAlign(pointee)));
+        }
+    }
 
     Environment current_env;
+    current_env.function_scope = true;
 
     auto decl_args = (funcAst->_decl_vars).begin();
     for (auto &arg : func->args()) {
         arg.setName((*decl_args)->_name);
         decl_args++;
-        current_env.declared_variable[arg.getName().str()] = &arg;
     }
 
     if (funcAst->_block->size() != 0) {
+        _defined_funcs[funcAst->_name] = funcAst;
         llvm::BasicBlock *block = llvm::BasicBlock::Create(_context, "entry", func);
         current_env.block = block;
         _builder.SetInsertPoint(current_env.block);
- 
+        auto outer_loc = debugFuncBegin(func, funcAst->_line);
+        Coroutine coroutine;
+        auto outer_coroutine = _coroutine;
+        _coroutine = funcAst->_generator || funcAst->_async ? &coroutine : nullptr;
+        if (funcAst->_generator) {
+            current_env.block = coroBeginGen(func, yield_type, coroutine);
+        } else if (funcAst->_async) {
+            coroutine.async = true;
+            current_env.block = coroBeginGen(func, taskPromiseType(result_type), coroutine);
+        }
+
+        // parameters live in allocas like any other variable, mem2reg undoes it;
+        // a reference parameter is the address of the caller's variable
+        for (auto &arg : func->args()) {
+            if (by_ref[arg.getArgNo()]) {
+                current_env.declared_variable[arg.getName().str()] = &arg;
+                debugVarGen(&arg, arg.getName().str(), funcAst->_line, arg.getArgNo() + 1);
+                continue;
+            }
+            auto arg_addr = createEntryAlloca(arg.getType(), arg.getName().str() + ".addr");
+            _builder.CreateStore(&arg, arg_addr);
+            current_env.declared_variable[arg.getName().str()] = arg_addr;
+            debugVarGen(arg_addr, arg.getName().str(), funcAst->_line, arg.getArgNo() + 1);
+        }
+        _range_analysis.analyze(funcAst->_block, funcAst->_decl_vars, _ref_params);
+
+        auto outer_tail_calls = std::move(_tail_calls);
+        _tail_calls.clear();
         env.push_front(current_env);
         blockGen(funcAst->_block, env);
+        if (_coroutine != nullptr) {
+            coroEndGen(env);
+        } else if (env.front().block->getTerminator() == nullptr) {
+            _builder.SetInsertPoint(env.front().block);
+            if (ret_type->isVoidTy()) {
+                _builder.CreateRetVoid();
+            } else {
+                _builder.CreateRet(llvm::Constant::getNullValue(ret_type));
+            }
+        }
         env.pop_front();
+        debugFuncEnd(outer_loc);
+        markTailCalls(func);
+        _tail_calls = std::move(outer_tail_calls);
+        _coroutine = outer_coroutine;
     }
     // llvm::raw_ostream &output = llvm::errs();
     // if (llvm::verifyFunction(*func, &output)) {
@@ -113,7 +273,11 @@ llvm::Value* CodeGen::blockGen(AstPtr ast, std::list<Environment>& env) {
         auto found = _generator.find(statement->GetType());
         assert(found != _generator.end());
         auto handler = found->second;
+        TraceScope scope(handlerTraceName(statement->GetType()));
+        auto outer_loc = _builder.getCurrentDebugLocation();
+        debugLocGen(statement);
         handler(statement, env);
+        _builder.SetCurrentDebugLocation(outer_loc);
 
         if (statement->GetType() == AstType::RetStatement){
             break;
@@ -130,22 +294,32 @@ llvm::Value* CodeGen::assignGen(AstPtr ast, std::list<Environment>& env) {
     
 
     auto var_name = assignAst->_identifier;
-    llvm::Value* var_addr;
-    auto& declared_variable = env.front().declared_variable;
-
-    auto found = declared_variable.find(var_name);
-    if (found == declared_variable.end()) {
+    llvm::Value* var_addr = lookupVariable(var_name, env);
+    if (var_addr == nullptr) {
         printf("undefined var:%s\n", var_name.c_str());
-        assert(false);
+        exit(1);
+    }
+    auto var_type = var_addr->getType()->getPointerElementType();
+    if (isFixedCollection(var_type)) {
+        printf("array %s can't be assigned, assign its elements\n", var_name.c_str());
+        exit(1);
+    }
+    if (atomicElemType(var_type) != nullptr) {
+        printf("atomic %s is written with atomic_store\n", var_name.c_str());
+        exit(1);
     }
-    var_addr = found->second;
 
     auto val_expr = assignAst->_assign_value;
     auto val = exprGen(val_expr, env);
     if(val->getType()->isPointerTy() && val->getType() != llvm::Type::getInt8PtrTy(_context)){
         val = builder.CreateLoad(val->getType()->getPointerElementType(), val);
     }
-    builder.CreateStore(val, var_addr);
+    auto converted = convertValue(val, var_type);
+    if (converted == nullptr) {
+        printf("var %s: type no matched\n", var_name.c_str());
+        exit(1);
+    }
+    builder.CreateStore(converted, var_addr);
     return nullptr;
 }
 
@@ -165,31 +339,51 @@ llvm::Value* CodeGen::declareVarGen(AstPtr ast, std::list<Environment>& env) {
     auto var_stat = std::dynamic_pointer_cast<DeclareVarStatement>(ast);
     assert(var_stat != nullptr);
 
-    llvm::Value* var_addr = nullptr;
+    llvm::Type* var_type = nullptr;
+    llvm::Value* assign_value = nullptr;
+    if (var_stat->_type[0] == '&') {
+        printf("var %s: references are only for parameters\n", var_stat->_name.c_str());
+        exit(1);
+    }
+    if (var_stat->_type != "") {
+        var_type = getValueType(var_stat->_type);
+    }
     if (var_stat->_assign_value != nullptr) {
-        llvm::Value* assign_value = exprGen(var_stat->_assign_value, env);
-        if (var_stat->_type != "" && (assign_value->getType() != getValueType(var_stat->_type))){
-            assert(false && "var type no matched");
-        }
-        
+        assign_value = exprGen(var_stat->_assign_value, env);
         assert(assign_value != nullptr);
         if (assign_value->getType()->isPointerTy()
          && assign_value->getType() != llvm::Type::getInt8PtrTy(_context)) {
-            var_addr = builder.CreateAlloca(assign_value->getType()->getPointerElementType());
-            assign_value->getType()->getContainedType(0)->print(llvm::errs());
-        } else {
-            var_addr = builder.CreateAlloca(assign_value->getType());
+            assign_value = builder.CreateLoad(assign_value->getType()->getPointerElementType(), assign_value);
+        }
+        if (var_type == nullptr) {
+            var_type = assign_value->getType();
         }
+        if (atomicElemType(var_type) != nullptr) {
+            printf("var %s: atomics start at 0 and are written with atomic_store\n", var_stat->_name.c_str());
+            exit(1);
+        }
+        assign_value = convertValue(assign_value, var_type);
+        if (assign_value == nullptr) {
+            printf("var %s: type no matched\n", var_stat->_name.c_str());
+            exit(1);
+        }
+    } else if (var_type == nullptr) {
+        assert(false&&"Unkown type for define variable");
+    }
 
+    auto var_addr = createEntryAlloca(var_type, var_stat->_name);
+    builder.SetInsertPoint(env.front().block);
+    if (assign_value != nullptr) {
         builder.CreateStore(assign_value, var_addr);
-
-    } else if (var_stat->_type != "") {
-        var_addr = builder.CreateAlloca(getValueType(var_stat->_type));
-    }else {
-        assert(false&&"Unkown type for define variable");
+    } else if (var_type->isArrayTy() || var_type->isStructTy()) {
+        auto size = _module->getDataLayout().getTypeAllocSize(var_type);
+        builder.CreateMemSet(var_addr, builder.getInt8(0), size, llvm::MaybeAlign(var_addr->getAlign()));
+    } else {
+        builder.CreateStore(llvm::Constant::getNullValue(var_type), var_addr);
     }
 
     env.front().declared_variable[var_stat->_name] = var_addr;
+    debugVarGen(var_addr, var_stat->_name, var_stat->_line);
     
     return nullptr;
 }
@@ -199,16 +393,82 @@ llvm::Value* CodeGen::returnGen(AstPtr ast, std::list<Environment>& env) {
     builder.SetInsertPoint(env.front().block);
     auto ret_stat = std::dynamic_pointer_cast<ReturnStatement>(ast);
     assert(ret_stat != nullptr);
+    for (auto& env_frame : env) {
+        if (env_frame.pfor) {
+            printf("return inside a pfor body: its iterations run on other threads\n");
+            exit(1);
+        }
+        if (env_frame.function_scope) {
+            break;
+        }
+    }
+    if (_coroutine != nullptr) {
+        coroReturnGen(ret_stat, env);
+        return nullptr;
+    }
     if (ret_stat->_ret_values.size() == 0) {
+        leaveRegionsGen(ret_stat, env);
         builder.CreateRetVoid();
     } else {
         auto ret_val = exprGen(ret_stat->_ret_values[0], env);
-        builder.CreateRet(ret_val);
+        auto ret_type = builder.GetInsertBlock()->getParent()->getReturnType();
+        if (ret_type->isVoidTy() && ret_val->getType()->isVoidTy()) {
+            // return f(); of a void f in a void function
+            if (!leaveRegionsGen(ret_stat, env)) {
+                tailCallCandidate(ret_stat, ret_val);
+            }
+            builder.CreateRetVoid();
+            return nullptr;
+        }
+        auto converted = convertValue(ret_val, ret_type);
+        if (converted == nullptr) {
+            printf("return type no matched\n");
+            exit(1);
+        }
+        bool in_region = leaveRegionsGen(ret_stat, env);
+        if (converted == ret_val && !in_region) {
+            tailCallCandidate(ret_stat, ret_val);
+        } else if (ret_stat->_tail_call) {
+            printf("return tailcall: the result has to be converted to the return type\n");
+            exit(1);
+        }
+        builder.CreateRet(converted);
     }
     return nullptr;
 }
 
 llvm::Value* CodeGen::whileStatementGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+
+    auto while_stat = std::dynamic_pointer_cast<WhileStatement>(ast);
+    assert(while_stat != nullptr);
+
+    auto paren_func = builder.GetInsertBlock()->getParent();
+    auto id = std::to_string(env.front().GetIncID());
+    auto cond_block = llvm::BasicBlock::Create(_context, id + ".while", paren_func);
+    auto body_block = llvm::BasicBlock::Create(_context, id + ".do", paren_func);
+    auto end_block = llvm::BasicBlock::Create(_context, id + ".wend", paren_func);
+    builder.CreateBr(cond_block);
+
+    env.front().block = cond_block;
+    builder.SetInsertPoint(cond_block);
+    auto cond_val = exprGen(while_stat->_condition, env);
+    CondBranchGen(env, cond_val, body_block, end_block);
+
+    Environment frame;
+    frame.block = body_block;
+    env.push_front(frame);
+    builder.SetInsertPoint(body_block);
+    blockGen(while_stat->_block, env);
+    if (env.front().block->getTerminator() == nullptr) {
+        builder.SetInsertPoint(env.front().block);
+        builder.CreateBr(cond_block);
+    }
+    env.pop_front();
+
+    env.front().block = end_block;
+    builder.SetInsertPoint(end_block);
     return nullptr;
 }
 
@@ -216,6 +476,7 @@ llvm::Value* CodeGen::ifBlockGen(std::list<Environment>& env, IfBlock ast, llvm:
     auto& builder = _builder;
     Environment frame;
     builder.SetInsertPoint(block);
+    env.front().block = block;
 
     auto cond_expr = ast._cond;
     auto cond_val = exprGen(cond_expr, env);
@@ -226,7 +487,9 @@ llvm::Value* CodeGen::ifBlockGen(std::list<Environment>& env, IfBlock ast, llvm:
     builder.SetInsertPoint(frame.block);
     blockGen(ast._block, env);
 
-    if (then_block->getTerminator() == nullptr) {
+    // nested statements may have moved the frame to a later block
+    if (env.front().block->getTerminator() == nullptr) {
+        builder.SetInsertPoint(env.front().block);
         builder.CreateBr(merge);
     }
     env.pop_front();
@@ -242,7 +505,8 @@ llvm::Value* CodeGen::elseBlockGen(std::list<Environment>& env, AstBlockPtr ast,
     env.push_front(frame);
     builder.SetInsertPoint(block);
     blockGen(ast, env);
-    if (block->getTerminator() == nullptr) {
+    if (env.front().block->getTerminator() == nullptr) {
+        builder.SetInsertPoint(env.front().block);
         builder.CreateBr(merge);
     }
     env.pop_front();
@@ -0,0 +1,270 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// bytes a str holds without a heap block; the last byte is the length
+static const uint64_t kInlineMax = 22;
+// high bit of cap: data, len and cap are used, the bytes aren't inline
+static const uint64_t kHeapFlag = uint64_t(1) << 63;
+
+// str is {i8* data, i64 len, i64 cap}, 24 bytes passed and stored by value.
+// Short strings live inline in those bytes, longer ones point to a literal,
+// a C string or a block of their own; runtime/string.c has the details.
+// Copies of a long str share its block, delete frees it.
+llvm::StructType* CodeGen::getStrType() {
+    if (_str_type == nullptr) {
+        auto int_type = llvm::Type::getInt64Ty(_context);
+        _str_type = llvm::StructType::create(_context, {llvm::Type::getInt8PtrTy(_context), int_type, int_type}, "str");
+    }
+    return _str_type;
+}
+
+bool CodeGen::isStrType(llvm::Type* type) {
+    return _str_type != nullptr && type == _str_type;
+}
+
+// a NUL-terminated copy of bytes in the constant data of the module
+llvm::Constant* CodeGen::cStringConstant(const std::string& bytes) {
+    auto array = llvm::ConstantDataArray::getString(_context, bytes);
+    auto global = new llvm::GlobalVariable(*_module, array->getType(), true, llvm::GlobalValue::PrivateLinkage, array, ".str");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(llvm::Align(1));
+    auto zero = llvm::ConstantInt::get(llvm::Type::getInt32Ty(_context), 0);
+    return llvm::ConstantExpr::getInBoundsGetElementPtr(array->getType(), global, llvm::ArrayRef<llvm::Constant*>{zero, zero});
+}
+
+// "..." is a constant str: short literals are their inline bytes, so they
+// need no memory at all, long ones point to a private global.
+llvm::Constant* CodeGen::strLiteralGen(const std::string& bytes) {
+    auto str_type = getStrType();
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    if (bytes.size() <= kInlineMax) {
+        uint64_t words[3] = {0, 0, uint64_t(bytes.size()) << 56};
+        for (size_t i = 0; i < bytes.size(); i++) {
+            words[i / 8] |= uint64_t(uint8_t(bytes[i])) << (8 * (i % 8));
+        }
+        auto data = llvm::ConstantExpr::getIntToPtr(llvm::ConstantInt::get(int_type, words[0]), llvm::Type::getInt8PtrTy(_context));
+        return llvm::ConstantStruct::get(str_type, {data, llvm::ConstantInt::get(int_type, words[1]),
+                                                    llvm::ConstantInt::get(int_type, words[2])});
+    }
+    return llvm::ConstantStruct::get(str_type, {cStringConstant(bytes), llvm::ConstantInt::get(int_type, bytes.size()),
+                                                llvm::ConstantInt::get(int_type, kHeapFlag)});
+}
+
+llvm::Value* CodeGen::strIsHeapGen(llvm::Value* str) {
+    auto cap = _builder.CreateExtractValue(str, 2);
+    return _builder.CreateICmpSLT(cap, llvm::ConstantInt::get(cap->getType(), 0));
+}
+
+// len(s) without a call: the last byte of an inline str, len otherwise
+llvm::Value* CodeGen::strLenGen(llvm::Value* str) {
+    auto inline_len = _builder.CreateLShr(_builder.CreateExtractValue(str, 2), 56);
+    return _builder.CreateSelect(strIsHeapGen(str), _builder.CreateExtractValue(str, 1), inline_len);
+}
+
+// the bytes of the str at addr, which are addr itself when inline
+llvm::Value* CodeGen::strDataGen(llvm::Value* addr) {
+    auto str = _builder.CreateLoad(getStrType(), addr);
+    auto inline_data = _builder.CreateBitCast(addr, llvm::Type::getInt8PtrTy(_context));
+    return _builder.CreateSelect(strIsHeapGen(str), _builder.CreateExtractValue(str, 0), inline_data);
+}
+
+// the runtime takes strs by pointer; a value gets a slot in the frame
+llvm::Value* CodeGen::strSpillGen(llvm::Value* str) {
+    auto slot = createEntryAlloca(getStrType(), "str.tmp");
+    _builder.CreateStore(str, slot);
+    return slot;
+}
+
+// Declares a function of runtime/string.c. It doesn't keep the strs it takes
+// by pointer, the first one is the result unless read_only, and read_only it
+// writes nothing. The bytes of a str are behind its data pointer (literals,
+// shared heap blocks), so its memory isn't limited to the arguments.
+llvm::FunctionCallee CodeGen::strRuntimeFunc(const std::string& name, llvm::Type* ret_type,
+                                             const std::vector<llvm::Type*>& params, bool read_only) {
+    auto func = _module->getFunction(name);
+    if (func != nullptr) {
+        return func;
+    }
+    auto func_type = llvm::FunctionType::get(ret_type, params, false);
+    func = llvm::Function::Create(func_type, llvm::GlobalValue::ExternalLinkage, name, _module.get());
+    func->addFnAttr(llvm::Attribute::NoUnwind);
+    func->addFnAttr(llvm::Attribute::WillReturn);
+    if (read_only) {
+        func->addFnAttr(llvm::Attribute::ReadOnly);
+    }
+    for (unsigned i = 0; i < params.size(); i++) {
+        if (!params[i]->isPointerTy()) {
+            continue;
+        }
+        // a C string may become the data of the result
+        if (params[i] == getStrType()->getPointerTo()) {
+            func->addParamAttr(i, llvm::Attribute::NoCapture);
+        }
+        if (read_only || i > 0) {
+            func->addParamAttr(i, llvm::Attribute::ReadOnly);
+        }
+    }
+    return func;
+}
+
+// A str passed as a string (a C char*) is its NUL-terminated bytes. Those of
+// a short str are in the caller's frame, and only live as long as it.
+llvm::Value* CodeGen::strCStringGen(llvm::Value* str) {
+    auto literal = llvm::dyn_cast<llvm::Constant>(str);
+    if (literal != nullptr && (llvm::isa<llvm::ConstantStruct>(literal) || llvm::isa<llvm::ConstantAggregateZero>(literal))) {
+        uint64_t words[3];
+        for (unsigned k = 0; k < 3; k++) {
+            // the first word of a short literal is an inttoptr of its bytes
+            auto field = literal->getAggregateElement(k);
+            auto expr = llvm::dyn_cast<llvm::ConstantExpr>(field);
+            auto word = llvm::dyn_cast<llvm::ConstantInt>(expr != nullptr ? expr->getOperand(0) : field);
+            words[k] = word != nullptr ? word->getZExtValue() : 0;
+        }
+        if ((words[2] & kHeapFlag) != 0) {
+            return literal->getAggregateElement(0u);
+        }
+        std::string bytes(reinterpret_cast<const char*>(words), words[2] >> 56);
+        return cStringConstant(bytes);
+    }
+    return strDataGen(strSpillGen(str));
+}
+
+// A str that becomes a string which may outlive the frame (a return value, a
+// variable, an element or a field), through begonia_str_cstr.
+llvm::Value* CodeGen::strOwnedCStringGen(llvm::Value* str) {
+    if (llvm::isa<llvm::Constant>(str)) {
+        return strCStringGen(str);
+    }
+    auto cstr = strRuntimeFunc("begonia_str_cstr", llvm::Type::getInt8PtrTy(_context),
+                               {getStrType()->getPointerTo()}, false);
+    return _builder.CreateCall(cstr, {strSpillGen(str)});
+}
+
+// a string (C char*) used as a str, through begonia_str_from_cstr
+llvm::Value* CodeGen::cStringToStrGen(llvm::Value* cstr) {
+    auto str_ptr = getStrType()->getPointerTo();
+    auto from_cstr = strRuntimeFunc("begonia_str_from_cstr", llvm::Type::getVoidTy(_context),
+                                    {str_ptr, llvm::Type::getInt8PtrTy(_context)}, false);
+    auto out = createEntryAlloca(getStrType(), "str.tmp");
+    _builder.CreateCall(from_cstr, {out, cstr});
+    return _builder.CreateLoad(getStrType(), out);
+}
+
+// s + t concatenates, == != < <= > >= compare bytewise
+llvm::Value* CodeGen::strOpExprGen(TokenType op, llvm::Value* lval, llvm::Value* rval) {
+    auto& builder = _builder;
+    auto str_type = getStrType();
+    auto str_ptr = str_type->getPointerTo();
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto lstr = convertValue(lval, str_type);
+    auto rstr = convertValue(rval, str_type);
+    if (lstr == nullptr || rstr == nullptr) {
+        printf("a str can only be combined with a str or string\n");
+        exit(1);
+    }
+    auto laddr = strSpillGen(lstr);
+    auto raddr = strSpillGen(rstr);
+    auto zero = llvm::ConstantInt::get(int_type, 0);
+    switch (op) {
+        case TokenType::TOKEN_OP_ADD: {
+            auto concat = strRuntimeFunc("begonia_str_concat", builder.getVoidTy(), {str_ptr, str_ptr, str_ptr}, false);
+            auto out = createEntryAlloca(str_type, "str.tmp");
+            builder.CreateCall(concat, {out, laddr, raddr});
+            return builder.CreateLoad(str_type, out);
+        }
+        case TokenType::TOKEN_OP_EQ:
+        case TokenType::TOKEN_OP_NEQ: {
+            auto equal = strRuntimeFunc("begonia_str_equal", int_type, {str_ptr, str_ptr}, true);
+            auto result = builder.CreateCall(equal, {laddr, raddr});
+            return op == TokenType::TOKEN_OP_EQ ? builder.CreateICmpNE(result, zero) : builder.CreateICmpEQ(result, zero);
+        }
+        case TokenType::TOKEN_OP_LT:
+        case TokenType::TOKEN_OP_LE:
+        case TokenType::TOKEN_OP_GT:
+        case TokenType::TOKEN_OP_GE: {
+            auto compare = strRuntimeFunc("begonia_str_compare", int_type, {str_ptr, str_ptr}, true);
+            auto order = builder.CreateCall(compare, {laddr, raddr});
+            auto predicate = op == TokenType::TOKEN_OP_LT ? llvm::CmpInst::ICMP_SLT
+                           : op == TokenType::TOKEN_OP_LE ? llvm::CmpInst::ICMP_SLE
+                           : op == TokenType::TOKEN_OP_GT ? llvm::CmpInst::ICMP_SGT : llvm::CmpInst::ICMP_SGE;
+            return builder.CreateICmp(predicate, order, zero);
+        }
+        default:
+            printf("strings support + and comparisons, not op:%d\n", int(op));
+            exit(1);
+    }
+    return nullptr;
+}
+
+// s[i] is byte i of s as an int
+llvm::Value* CodeGen::strIndexGen(IndexExpressionPtr index_expr, llvm::Value* addr, llvm::Value* value, std::list<Environment>& env) {
+    if (addr == nullptr) {
+        addr = strSpillGen(value);
+    }
+    auto length = strLenGen(_builder.CreateLoad(getStrType(), addr));
+    auto data = strDataGen(addr);
+    auto index = indexValueGen(index_expr->_index, env);
+    boundsCheckGen(index_expr, index, length, env);
+    auto byte = _builder.CreateLoad(_builder.getInt8Ty(), _builder.CreateInBoundsGEP(_builder.getInt8Ty(), data, index));
+    return _builder.CreateZExt(byte, llvm::Type::getInt64Ty(_context));
+}
+
+// s[low:high] is a new str of those bytes; short ones stay inline
+llvm::Value* CodeGen::strSliceGen(SliceExpressionPtr slice_expr, llvm::Value* addr, llvm::Value* value, std::list<Environment>& env) {
+    if (addr == nullptr) {
+        addr = strSpillGen(value);
+    }
+    llvm::Value *low, *high;
+    sliceBoundsGen(slice_expr, strLenGen(_builder.CreateLoad(getStrType(), addr)), env, low, high);
+    auto str_ptr = getStrType()->getPointerTo();
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto slice = strRuntimeFunc("begonia_str_slice", _builder.getVoidTy(), {str_ptr, str_ptr, int_type, int_type}, false);
+    auto out = createEntryAlloca(getStrType(), "str.tmp");
+    _builder.CreateCall(slice, {out, addr, low, high});
+    return _builder.CreateLoad(getStrType(), out);
+}
+
+// delete(s) frees the block of a long s and leaves s == ""
+llvm::Value* CodeGen::strFreeGen(llvm::Value* addr, llvm::Value* value) {
+    if (addr == nullptr) {
+        addr = strSpillGen(value);
+    }
+    auto str_free = strRuntimeFunc("begonia_str_free", _builder.getVoidTy(), {getStrType()->getPointerTo()}, false);
+    return _builder.CreateCall(str_free, {addr});
+}
+
+// hash(s): 64-bit FNV-1a of the bytes of s
+llvm::Value* CodeGen::hashGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    if (funcall->_parameters.size() != 1) {
+        printf("hash takes 1 argument\n");
+        exit(1);
+    }
+    llvm::Value *addr, *value;
+    auto type = operandGen(funcall->_parameters[0], env, addr, value);
+    if (!isStrType(type)) {
+        value = convertValue(value != nullptr ? value : _builder.CreateLoad(type, addr), getStrType());
+        if (value == nullptr) {
+            printf("hash takes a str\n");
+            exit(1);
+        }
+        addr = nullptr;
+    }
+    if (addr == nullptr) {
+        addr = strSpillGen(value);
+    }
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto hash = strRuntimeFunc("begonia_str_hash", int_type, {getStrType()->getPointerTo()}, true);
+    return _builder.CreateCall(hash, {addr});
+}
+
+} //begonia
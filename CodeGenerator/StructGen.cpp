@@ -0,0 +1,218 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+static llvm::Align abiAlign(const llvm::DataLayout& layout, llvm::Type* type) {
+#if LLVM_VERSION_MAJOR >= 11
+    return layout.getABITypeAlign(type);
+#else
+    return llvm::Align(layout.getABITypeAlignment(type));
+#endif
+}
+
+// ABI alignment of type, raised by align(N) and by over-aligned fields,
+// also in the columns of a soa collection.
+llvm::Align CodeGen::typeAlign(llvm::Type* type) {
+    auto align = abiAlign(_module->getDataLayout(), type);
+    while (type->isArrayTy()) {
+        type = type->getArrayElementType();
+    }
+    auto info = structInfo(type);
+    if (info != nullptr && info->align > align.value()) {
+        align = llvm::Align(info->align);
+    }
+    auto soa = soaInfo(type);
+    if (soa != nullptr && soa->length != 0) {
+        for (auto index : soa->elem_index) {
+            align = std::max(align, typeAlign(soa->elem_type->getElementType(index)));
+        }
+    }
+    return align;
+}
+
+const CodeGen::StructInfo* CodeGen::structInfo(llvm::Type* type) {
+    auto struct_type = llvm::dyn_cast<llvm::StructType>(type);
+    if (struct_type == nullptr || struct_type->isLiteral()) {
+        return nullptr;
+    }
+    auto found = _structs.find(struct_type->getName().str());
+    return found != _structs.end() ? &found->second : nullptr;
+}
+
+// struct Name [packed] [align(N)] [reorder] { field type; ... }
+//
+// Fields are laid out in order with natural alignment, like C. packed drops
+// the padding, align(N) raises the alignment of the struct (and pads its
+// size, so arrays of it keep every element aligned), reorder sorts the fields
+// by decreasing alignment, which leaves no padding between them.
+llvm::Value* CodeGen::declareStructGen(AstPtr ast, std::list<Environment>& env) {
+    auto struct_ast = std::dynamic_pointer_cast<DeclareStructStatement>(ast);
+    assert(struct_ast != nullptr);
+    auto& name = struct_ast->_name;
+    if (env.size() != 1) {
+        printf("struct %s: structs are declared at the top level\n", name.c_str());
+        exit(1);
+    }
+    if (_structs.count(name) != 0 || _basic_variable_type.count(name) != 0) {
+        printf("struct %s has declared before\n", name.c_str());
+        exit(1);
+    }
+    if ((struct_ast->_align & (struct_ast->_align - 1)) != 0) {
+        printf("struct %s: align(%u) is not a power of two\n", name.c_str(), struct_ast->_align);
+        exit(1);
+    }
+
+    struct Field {
+        std::string     name;
+        llvm::Type*     type;
+        llvm::Align     align;      // where the field has to start
+        bool            over_aligned;
+    };
+    auto& layout = _module->getDataLayout();
+    std::vector<Field> fields;
+    std::set<std::string> field_names;
+    for (auto& field : struct_ast->_fields) {
+        if (!field_names.insert(field->_name).second) {
+            printf("struct %s: field %s declared twice\n", name.c_str(), field->_name.c_str());
+            exit(1);
+        }
+        if (field->_type[0] == '&') {
+            printf("struct %s: field %s, references are only for parameters\n", name.c_str(), field->_name.c_str());
+            exit(1);
+        }
+        auto type = getValueType(field->_type);
+        if (type->isVoidTy()) {
+            printf("struct %s: field %s can't be void\n", name.c_str(), field->_name.c_str());
+            exit(1);
+        }
+        // LLVM only knows the ABI alignment, fields of align(N) structs are padded by hand
+        auto align = typeAlign(type);
+        bool over_aligned = align > abiAlign(layout, type);
+        if (!over_aligned && struct_ast->_packed) {
+            align = llvm::Align(1);
+        }
+        fields.push_back(Field{field->_name, type, align, over_aligned});
+    }
+    if (struct_ast->_reorder) {
+        std::stable_sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) {
+            return a.align > b.align;
+        });
+    }
+
+    StructInfo info;
+    info.packed = struct_ast->_packed;
+    info.align = std::max(struct_ast->_align, 1u);
+    auto byte_type = llvm::Type::getInt8Ty(_context);
+    std::vector<llvm::Type*> elements;
+    uint64_t offset = 0;
+    for (auto& field : fields) {
+        auto start = llvm::alignTo(offset, field.align);
+        if (field.over_aligned && start != offset) {
+            elements.push_back(llvm::ArrayType::get(byte_type, start - offset));
+        }
+        info.align = std::max(info.align, unsigned(field.align.value()));
+        info.field_index[field.name] = elements.size();
+        elements.push_back(field.type);
+        offset = start + uint64_t(layout.getTypeAllocSize(field.type));
+    }
+    uint64_t size = layout.getTypeAllocSize(llvm::StructType::get(_context, elements, info.packed));
+    uint64_t padded_size = llvm::alignTo(size, llvm::Align(info.align));
+    if (padded_size != size) {
+        elements.push_back(llvm::ArrayType::get(byte_type, padded_size - size));
+    }
+    info.type = llvm::StructType::create(_context, elements, name, info.packed);
+    _structs[name] = info;
+    return nullptr;
+}
+
+static unsigned fieldIndex(const CodeGen::StructInfo* info, MemberExpressionPtr member) {
+    auto field = info->field_index.find(member->_field);
+    if (field == info->field_index.end()) {
+        printf("struct %s has no field %s\n", info->type->getName().str().c_str(), member->_field.c_str());
+        exit(1);
+    }
+    return field->second;
+}
+
+// Address of the field of the struct at base_addr; align is the alignment
+// the field is known to have, less than its type's in a packed struct.
+llvm::Value* CodeGen::memberAddressGen(MemberExpressionPtr member, llvm::Value* base_addr, llvm::Align& align) {
+    auto info = structInfo(base_addr->getType()->getPointerElementType());
+    if (info == nullptr) {
+        printf("[memberAddressGen] .%s of a value that is not a struct\n", member->_field.c_str());
+        exit(1);
+    }
+    auto index = fieldIndex(info, member);
+    auto field_type = info->type->getElementType(index);
+    if (info->packed) {
+        auto offset = _module->getDataLayout().getStructLayout(info->type)->getElementOffset(index);
+        align = llvm::commonAlignment(llvm::Align(info->align), offset);
+    } else {
+        align = typeAlign(field_type);
+    }
+    return _builder.CreateStructGEP(info->type, base_addr, index);
+}
+
+// Address of p.x, or nullptr when p is not in memory. Fields of the
+// elements of a soa collection are found in their own columns.
+llvm::Value* CodeGen::fieldAddressGen(MemberExpressionPtr member, std::list<Environment>& env, llvm::Align& align) {
+    auto index_expr = std::dynamic_pointer_cast<IndexExpression>(member->_base);
+    if (index_expr == nullptr) {
+        auto base_addr = addressGen(member->_base, env);
+        return base_addr != nullptr ? memberAddressGen(member, base_addr, align) : nullptr;
+    }
+    llvm::Value *coll_addr, *coll_value;
+    auto coll_type = operandGen(index_expr->_base, env, coll_addr, coll_value);
+    auto soa = soaInfo(coll_type);
+    if (soa != nullptr) {
+        return soaFieldAddressGen(index_expr, member->_field, soa, coll_addr, coll_value, env, align);
+    }
+    return memberAddressGen(member, indexAddressGen(index_expr, coll_addr, coll_value, env), align);
+}
+
+// p.x loads just the field when p is in memory, and extracts it from
+// a struct value otherwise
+llvm::Value* CodeGen::memberExprGen(AstPtr ast, std::list<Environment>& env) {
+    auto& builder = _builder;
+    builder.SetInsertPoint(env.front().block);
+    auto member = std::dynamic_pointer_cast<MemberExpression>(ast);
+    assert(member != nullptr);
+
+    llvm::Align align;
+    auto addr = fieldAddressGen(member, env, align);
+    if (addr != nullptr) {
+        auto field_type = addr->getType()->getPointerElementType();
+        if (isFixedCollection(field_type) && align < typeAlign(field_type)) {
+            printf("field %s of a packed struct is not aligned, its elements can't be used\n", member->_field.c_str());
+            exit(1);
+        }
+        return loadValueGen(addr, align);
+    }
+
+    auto base_value = exprGen(member->_base, env);
+    auto info = structInfo(base_value->getType());
+    if (info == nullptr) {
+        printf("[memberExprGen] .%s of a value that is not a struct\n", member->_field.c_str());
+        exit(1);
+    }
+    auto index = fieldIndex(info, member);
+    auto field_type = info->type->getElementType(index);
+    if (isFixedCollection(field_type)) {
+        printf("array field %s of a struct value can't be used, assign the struct to a variable first\n", member->_field.c_str());
+        exit(1);
+    }
+    return builder.CreateExtractValue(base_value, index);
+}
+
+} //begonia
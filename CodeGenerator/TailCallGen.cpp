@@ -0,0 +1,75 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include "llvm/Analysis/CaptureTracking.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace begonia {
+
+// Internal functions are only called from their own module, so they use
+// fastcc: arguments in more registers and, unlike the C convention, free to
+// change. main, export func and prototypes of outside functions keep the C one.
+llvm::CallingConv::ID CodeGen::callingConv(llvm::Function* func) {
+    return func->hasLocalLinkage() ? llvm::CallingConv::Fast : llvm::CallingConv::C;
+}
+
+// Remembers the call of return f(...), when ret_val is the value of that
+// call as returned, for markTailCalls.
+void CodeGen::tailCallCandidate(ReturnStatementPtr ret_stat, llvm::Value* ret_val) {
+    auto funcall = std::dynamic_pointer_cast<FuncallExpression>(ret_stat->_ret_values[0]);
+    auto call = llvm::dyn_cast<llvm::CallInst>(ret_val);
+    if (funcall == nullptr || call == nullptr || call->getCalledFunction() == nullptr
+     || _builtins.count(funcall->_identifier) != 0) {
+        if (ret_stat->_tail_call) {
+            assert(funcall != nullptr);
+            printf("return tailcall: %s is a builtin, not a function\n", funcall->_identifier.c_str());
+            exit(1);
+        }
+        return;
+    }
+    _tail_calls.push_back(TailCall{call, ret_stat->_tail_call});
+}
+
+// Once func is generated: its calls in tail position become tail calls if no
+// local variable of func can be reached from the callee, and return tailcall
+// ones musttail, which LLVM guarantees to reuse the frame but only between
+// functions of the same prototype and calling convention.
+void CodeGen::markTailCalls(llvm::Function* func) {
+    bool frame_escapes = false;
+    for (auto& inst : func->getEntryBlock()) {
+        if (llvm::isa<llvm::AllocaInst>(inst) && llvm::PointerMayBeCaptured(&inst, true, true)) {
+            frame_escapes = true;
+            break;
+        }
+    }
+    for (auto& tail_call : _tail_calls) {
+        auto callee = tail_call.call->getCalledFunction();
+        std::string reason;
+        if (frame_escapes) {
+            reason = "a local variable of " + func->getName().str() + " is passed by reference or sliced";
+        } else if (callee->getFunctionType() != func->getFunctionType()) {
+            reason = callee->getName().str() + " and " + func->getName().str() + " have different parameters or results";
+        } else if (callee->getCallingConv() != func->getCallingConv()) {
+            reason = "only one of " + callee->getName().str() + " and " + func->getName().str() + " is internal to this file";
+        }
+        if (tail_call.required && reason != "") {
+            printf("func %s: return tailcall %s can't reuse the frame, %s\n", func->getName().str().c_str(),
+                   callee->getName().str().c_str(), reason.c_str());
+            exit(1);
+        }
+        if (frame_escapes) {
+            continue;
+        }
+        tail_call.call->setTailCallKind(tail_call.required ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+        _tail_calls_marked++;
+    }
+    _tail_calls.clear();
+}
+
+} //begonia
@@ -0,0 +1,355 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace begonia {
+
+// thread and queue are {i8*} around the handle the runtime returns, so they
+// are passed and stored like other values and can't be mixed up
+llvm::StructType* CodeGen::getHandleType(const std::string& name) {
+    auto& type = _runtime_types[name];
+    if (type == nullptr) {
+        type = llvm::StructType::create(_context, {llvm::Type::getInt8PtrTy(_context)}, name);
+    }
+    return type;
+}
+
+bool CodeGen::isHandleType(llvm::Type* type, const std::string& name) {
+    auto found = _runtime_types.find(name);
+    return found != _runtime_types.end() && found->second == type;
+}
+
+// atomic<int> and atomic<double> are {i64} and {double}, which only the
+// atomic_ builtins read and write
+llvm::StructType* CodeGen::getAtomicType(llvm::Type* elem_type) {
+    if (!elem_type->isIntegerTy(64) && !elem_type->isDoubleTy()) {
+        printf("atomic<T> needs T int or double\n");
+        exit(1);
+    }
+    std::string name = elem_type->isDoubleTy() ? "atomic.double" : "atomic.int";
+    auto& type = _runtime_types[name];
+    if (type == nullptr) {
+        type = llvm::StructType::create(_context, {elem_type}, name);
+    }
+    return type;
+}
+
+// the int or double inside an atomic type, nullptr for other types
+llvm::Type* CodeGen::atomicElemType(llvm::Type* type) {
+    if (isHandleType(type, "atomic.int") || isHandleType(type, "atomic.double")) {
+        return type->getStructElementType(0);
+    }
+    return nullptr;
+}
+
+llvm::FunctionCallee CodeGen::threadRuntimeFunc(const std::string& name, llvm::FunctionType* func_type) {
+    auto callee = _module->getOrInsertFunction(name, func_type);
+    llvm::cast<llvm::Function>(callee.getCallee())->addFnAttr(llvm::Attribute::NoUnwind);
+    return callee;
+}
+
+// the handle inside the thread or queue argument of builtin
+llvm::Value* CodeGen::handleGen(ExpressionPtr expr, const std::string& type_name, const std::string& builtin, std::list<Environment>& env) {
+    auto val = exprGen(expr, env);
+    if (val->getType()->isPointerTy() && val->getType() != llvm::Type::getInt8PtrTy(_context)) {
+        val = _builder.CreateLoad(val->getType()->getPointerElementType(), val);
+    }
+    if (!isHandleType(val->getType(), type_name)) {
+        printf("%s takes a %s\n", builtin.c_str(), type_name.c_str());
+        exit(1);
+    }
+    return _builder.CreateExtractValue(val, 0);
+}
+
+// spawn(f(a, b)): a thread running f(a, b). The arguments are evaluated by
+// the caller and copied to the thread; a reference argument is the address
+// of the caller's variable, which has to outlive the thread.
+llvm::Value* CodeGen::spawnGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto& builder = _builder;
+    std::shared_ptr<FuncallExpression> call;
+    if (funcall->_parameters.size() == 1) {
+        call = std::dynamic_pointer_cast<FuncallExpression>(funcall->_parameters[0]);
+    }
+    if (call == nullptr || _builtins.count(call->_identifier) != 0) {
+        printf("spawn takes a call of a function, spawn(f(...))\n");
+        exit(1);
+    }
+    auto callee = lookupFunction(call->_identifier, env);
+    auto ret_type = callee->getReturnType();
+    if (callee->isVarArg() || (!ret_type->isVoidTy() && !ret_type->isIntegerTy(64))) {
+        printf("spawn %s: only functions returning int or void with fixed parameters can be spawned\n", call->_identifier.c_str());
+        exit(1);
+    }
+    auto args = argumentsGen(call, callee, env);
+
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto args_type = llvm::StructType::get(_context, callee->getFunctionType()->params());
+    auto thunk_type = llvm::FunctionType::get(int_type, {i8ptr}, false);
+    auto thunk = _module->getFunction(callee->getName().str() + ".spawn");
+    if (thunk == nullptr) {
+        thunk = llvm::Function::Create(thunk_type, llvm::Function::InternalLinkage, callee->getName() + ".spawn", _module.get());
+        thunk->addFnAttr(llvm::Attribute::NoUnwind);
+        llvm::IRBuilder<> thunk_builder(llvm::BasicBlock::Create(_context, "entry", thunk));
+        auto packed = thunk_builder.CreateBitCast(thunk->arg_begin(), args_type->getPointerTo());
+        std::vector<llvm::Value*> unpacked;
+        for (unsigned i = 0; i < args_type->getNumElements(); i++) {
+            unpacked.push_back(thunk_builder.CreateLoad(args_type->getElementType(i), thunk_builder.CreateStructGEP(args_type, packed, i)));
+        }
+        auto result = thunk_builder.CreateCall(callee, unpacked);
+        result->setCallingConv(callee->getCallingConv());
+        thunk_builder.CreateRet(ret_type->isVoidTy() ? llvm::ConstantInt::get(int_type, 0) : static_cast<llvm::Value*>(result));
+    }
+
+    auto packed = createEntryAlloca(args_type, "spawn.args");
+    for (unsigned i = 0; i < args.size(); i++) {
+        builder.CreateStore(args[i], builder.CreateStructGEP(args_type, packed, i));
+    }
+    auto spawn_type = llvm::FunctionType::get(i8ptr, {thunk_type->getPointerTo(), i8ptr, int_type}, false);
+    auto size = llvm::ConstantInt::get(int_type, _module->getDataLayout().getTypeAllocSize(args_type));
+    auto handle = builder.CreateCall(threadRuntimeFunc("begonia_spawn", spawn_type), {thunk, builder.CreateBitCast(packed, i8ptr), size});
+    return builder.CreateInsertValue(llvm::UndefValue::get(getHandleType("thread")), handle, 0);
+}
+
+// join(t): waits for t to end, the int its function returned
+llvm::Value* CodeGen::joinGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    if (funcall->_parameters.size() != 1) {
+        printf("join takes 1 argument\n");
+        exit(1);
+    }
+    auto handle = handleGen(funcall->_parameters[0], "thread", "join", env);
+    auto join_type = llvm::FunctionType::get(llvm::Type::getInt64Ty(_context), {llvm::Type::getInt8PtrTy(_context)}, false);
+    return _builder.CreateCall(threadRuntimeFunc("begonia_join", join_type), {handle});
+}
+
+// The memory ordering given as the last argument of an atomic builtin, as in
+// atomic_load(a, acquire); seq_cst when it is left out, in which case
+// nothing is taken from args.
+static llvm::AtomicOrdering atomicOrdering(std::vector<ExpressionPtr>& args, size_t operands, const std::string& builtin) {
+    if (args.size() == operands) {
+        return llvm::AtomicOrdering::SequentiallyConsistent;
+    }
+    auto id = std::dynamic_pointer_cast<IdentifierExpression>(args.back());
+    if (args.size() != operands + 1 || id == nullptr) {
+        printf("%s takes %zu arguments and a memory ordering\n", builtin.c_str(), operands);
+        exit(1);
+    }
+    auto& name = id->_identifier;
+    if (name == "relaxed") {
+        return llvm::AtomicOrdering::Monotonic;
+    } else if (name == "acquire") {
+        return llvm::AtomicOrdering::Acquire;
+    } else if (name == "release") {
+        return llvm::AtomicOrdering::Release;
+    } else if (name == "acq_rel") {
+        return llvm::AtomicOrdering::AcquireRelease;
+    } else if (name == "seq_cst") {
+        return llvm::AtomicOrdering::SequentiallyConsistent;
+    }
+    printf("%s: unknown memory ordering %s, use relaxed, acquire, release, acq_rel or seq_cst\n", builtin.c_str(), name.c_str());
+    exit(1);
+}
+
+// address of the value inside the atomic variable, element or field expr
+llvm::Value* CodeGen::atomicAddressGen(ExpressionPtr expr, const std::string& builtin, std::list<Environment>& env) {
+    auto addr = addressGen(expr, env);
+    llvm::Type* elem_type = nullptr;
+    if (addr != nullptr) {
+        elem_type = atomicElemType(addr->getType()->getPointerElementType());
+    }
+    if (elem_type == nullptr) {
+        printf("%s needs an atomic<int> or atomic<double> variable, element or field\n", builtin.c_str());
+        exit(1);
+    }
+    return _builder.CreateStructGEP(addr->getType()->getPointerElementType(), addr, 0);
+}
+
+llvm::Value* CodeGen::atomicOperandGen(ExpressionPtr expr, llvm::Type* type, const std::string& builtin, std::list<Environment>& env) {
+    auto val = exprGen(expr, env);
+    if (val->getType()->isPointerTy() && val->getType() != llvm::Type::getInt8PtrTy(_context)) {
+        val = _builder.CreateLoad(val->getType()->getPointerElementType(), val);
+    }
+    auto converted = convertValue(val, type);
+    if (converted == nullptr) {
+        printf("%s: type no matched\n", builtin.c_str());
+        exit(1);
+    }
+    return converted;
+}
+
+// atomic_load(a[, order])
+llvm::Value* CodeGen::atomicLoadGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto order = atomicOrdering(funcall->_parameters, 1, "atomic_load");
+    if (order == llvm::AtomicOrdering::Release || order == llvm::AtomicOrdering::AcquireRelease) {
+        printf("atomic_load can't be release or acq_rel\n");
+        exit(1);
+    }
+    auto addr = atomicAddressGen(funcall->_parameters[0], "atomic_load", env);
+    auto type = addr->getType()->getPointerElementType();
+    auto load = _builder.CreateAlignedLoad(type, addr, llvm::Align(8));
+    load->setAtomic(order);
+    return load;
+}
+
+// atomic_store(a, v[, order])
+llvm::Value* CodeGen::atomicStoreGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto order = atomicOrdering(funcall->_parameters, 2, "atomic_store");
+    if (order == llvm::AtomicOrdering::Acquire || order == llvm::AtomicOrdering::AcquireRelease) {
+        printf("atomic_store can't be acquire or acq_rel\n");
+        exit(1);
+    }
+    auto addr = atomicAddressGen(funcall->_parameters[0], "atomic_store", env);
+    auto val = atomicOperandGen(funcall->_parameters[1], addr->getType()->getPointerElementType(), "atomic_store", env);
+    auto store = _builder.CreateAlignedStore(val, addr, llvm::Align(8));
+    store->setAtomic(order);
+    return nullptr;
+}
+
+// atomic_add(a, v[, order]) and the other read-modify-writes: the value of a
+// before the operation. A double is swapped by its bits.
+llvm::Value* CodeGen::atomicRMWGen(const std::string& op, FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto builtin = "atomic_" + op;
+    auto order = atomicOrdering(funcall->_parameters, 2, builtin);
+    auto addr = atomicAddressGen(funcall->_parameters[0], builtin, env);
+    auto type = addr->getType()->getPointerElementType();
+    auto val = atomicOperandGen(funcall->_parameters[1], type, builtin, env);
+    bool is_double = type->isDoubleTy();
+
+    llvm::AtomicRMWInst::BinOp bin_op;
+    if (op == "add") {
+        bin_op = is_double ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add;
+    } else if (op == "sub") {
+        bin_op = is_double ? llvm::AtomicRMWInst::FSub : llvm::AtomicRMWInst::Sub;
+    } else if (op == "swap") {
+        bin_op = llvm::AtomicRMWInst::Xchg;
+    } else if (is_double) {
+        printf("%s takes an atomic<int>\n", builtin.c_str());
+        exit(1);
+    } else if (op == "and") {
+        bin_op = llvm::AtomicRMWInst::And;
+    } else if (op == "or") {
+        bin_op = llvm::AtomicRMWInst::Or;
+    } else if (op == "xor") {
+        bin_op = llvm::AtomicRMWInst::Xor;
+    } else if (op == "min") {
+        bin_op = llvm::AtomicRMWInst::Min;
+    } else {
+        assert(op == "max");
+        bin_op = llvm::AtomicRMWInst::Max;
+    }
+    if (is_double && bin_op == llvm::AtomicRMWInst::Xchg) {
+        auto int_type = llvm::Type::getInt64Ty(_context);
+        addr = _builder.CreateBitCast(addr, int_type->getPointerTo());
+        val = _builder.CreateBitCast(val, int_type);
+    }
+#if LLVM_VERSION_MAJOR >= 13
+    llvm::Value* old = _builder.CreateAtomicRMW(bin_op, addr, val, llvm::MaybeAlign(8), order);
+#else
+    llvm::Value* old = _builder.CreateAtomicRMW(bin_op, addr, val, order);
+#endif
+    return _builder.CreateBitCast(old, type);
+}
+
+// atomic_cas(a, expected, desired[, order]): sets a to desired and is true if
+// a was expected. Doubles are compared by their bits.
+llvm::Value* CodeGen::atomicCasGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto order = atomicOrdering(funcall->_parameters, 3, "atomic_cas");
+    // a failed exchange only reads
+    auto failure_order = order;
+    if (order == llvm::AtomicOrdering::AcquireRelease) {
+        failure_order = llvm::AtomicOrdering::Acquire;
+    } else if (order == llvm::AtomicOrdering::Release) {
+        failure_order = llvm::AtomicOrdering::Monotonic;
+    }
+    auto addr = atomicAddressGen(funcall->_parameters[0], "atomic_cas", env);
+    auto type = addr->getType()->getPointerElementType();
+    auto expected = atomicOperandGen(funcall->_parameters[1], type, "atomic_cas", env);
+    auto desired = atomicOperandGen(funcall->_parameters[2], type, "atomic_cas", env);
+    if (type->isDoubleTy()) {
+        auto int_type = llvm::Type::getInt64Ty(_context);
+        addr = _builder.CreateBitCast(addr, int_type->getPointerTo());
+        expected = _builder.CreateBitCast(expected, int_type);
+        desired = _builder.CreateBitCast(desired, int_type);
+    }
+#if LLVM_VERSION_MAJOR >= 13
+    auto cas = _builder.CreateAtomicCmpXchg(addr, expected, desired, llvm::MaybeAlign(8), order, failure_order);
+#else
+    auto cas = _builder.CreateAtomicCmpXchg(addr, expected, desired, order, failure_order);
+#endif
+    return _builder.CreateExtractValue(cas, 1);
+}
+
+// fence([order])
+llvm::Value* CodeGen::fenceGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto order = atomicOrdering(funcall->_parameters, 0, "fence");
+    if (order == llvm::AtomicOrdering::Monotonic) {
+        printf("fence takes acquire, release, acq_rel or seq_cst\n");
+        exit(1);
+    }
+    _builder.CreateFence(order);
+    return nullptr;
+}
+
+// queue_new(capacity): an empty queue of at least capacity ints
+llvm::Value* CodeGen::queueNewGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    if (funcall->_parameters.size() != 1) {
+        printf("queue_new takes 1 argument\n");
+        exit(1);
+    }
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto capacity = atomicOperandGen(funcall->_parameters[0], int_type, "queue_new", env);
+    auto new_type = llvm::FunctionType::get(llvm::Type::getInt8PtrTy(_context), {int_type}, false);
+    auto handle = _builder.CreateCall(threadRuntimeFunc("begonia_queue_new", new_type), {capacity});
+    return _builder.CreateInsertValue(llvm::UndefValue::get(getHandleType("queue")), handle, 0);
+}
+
+// queue_push(q, v) and queue_pop(q) wait while q is full or empty,
+// queue_try_push(q, v) and queue_try_pop(q, v) return false instead; the
+// latter pops into the variable, element or field v.
+llvm::Value* CodeGen::queueOpGen(const std::string& op, FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    auto builtin = "queue_" + op;
+    size_t operands = op == "pop" ? 1 : 2;
+    if (funcall->_parameters.size() != operands) {
+        printf("%s takes %zu arguments\n", builtin.c_str(), operands);
+        exit(1);
+    }
+    auto int_type = llvm::Type::getInt64Ty(_context);
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto handle = handleGen(funcall->_parameters[0], "queue", builtin, env);
+    if (op == "pop") {
+        auto pop_type = llvm::FunctionType::get(int_type, {i8ptr}, false);
+        return _builder.CreateCall(threadRuntimeFunc("begonia_queue_pop", pop_type), {handle});
+    }
+    if (op == "try_pop") {
+        auto addr = addressGen(funcall->_parameters[1], env);
+        if (addr == nullptr || addr->getType() != int_type->getPointerTo()) {
+            printf("queue_try_pop pops into an int variable, element or field\n");
+            exit(1);
+        }
+        auto try_pop_type = llvm::FunctionType::get(int_type, {i8ptr, int_type->getPointerTo()}, false);
+        auto popped = _builder.CreateCall(threadRuntimeFunc("begonia_queue_try_pop", try_pop_type), {handle, addr});
+        return _builder.CreateICmpNE(popped, llvm::ConstantInt::get(int_type, 0));
+    }
+    auto val = atomicOperandGen(funcall->_parameters[1], int_type, builtin, env);
+    auto push_type = llvm::FunctionType::get(op == "push" ? llvm::Type::getVoidTy(_context) : int_type, {i8ptr, int_type}, false);
+    auto pushed = _builder.CreateCall(threadRuntimeFunc("begonia_queue_" + op, push_type), {handle, val});
+    if (op == "push") {
+        return nullptr;
+    }
+    return _builder.CreateICmpNE(pushed, llvm::ConstantInt::get(int_type, 0));
+}
+
+// delete(q)
+llvm::Value* CodeGen::queueFreeGen(llvm::Value* handle) {
+    auto i8ptr = llvm::Type::getInt8PtrTy(_context);
+    auto free_type = llvm::FunctionType::get(llvm::Type::getVoidTy(_context), {i8ptr}, false);
+    return _builder.CreateCall(threadRuntimeFunc("begonia_queue_free", free_type), {handle});
+}
+
+} //begonia
@@ -0,0 +1,304 @@
+#include "Parser.h"
+#include "Expression.h"
+#include "CodeGen.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+#if LLVM_VERSION_MAJOR >= 11
+using ShuffleMaskElem = int;
+#else
+using ShuffleMaskElem = uint32_t;
+#endif
+
+llvm::Type* CodeGen::getVectorType(llvm::Type* elem_type, unsigned lanes) {
+#if LLVM_VERSION_MAJOR >= 11
+    return llvm::FixedVectorType::get(elem_type, lanes);
+#else
+    return llvm::VectorType::get(elem_type, lanes);
+#endif
+}
+
+unsigned CodeGen::laneCount(llvm::Type* vec_type) {
+#if LLVM_VERSION_MAJOR >= 11
+    return llvm::cast<llvm::FixedVectorType>(vec_type)->getNumElements();
+#else
+    return vec_type->getVectorNumElements();
+#endif
+}
+
+static void checkArgs(FuncallExpressionPtr funcall, size_t count, const char* usage) {
+    if (funcall->_parameters.size() != count) {
+        printf("usage: %s\n", usage);
+        exit(1);
+    }
+}
+
+static llvm::Value* requireVector(llvm::Value* val, const char* builtin) {
+    if (!val->getType()->isVectorTy()) {
+        printf("%s takes a vector\n", builtin);
+        exit(1);
+    }
+    return val;
+}
+
+// a lane index that is not a constant is checked at run time
+llvm::Value* CodeGen::laneIndexGen(IndexExpressionPtr index_expr, unsigned lanes, std::list<Environment>& env) {
+    auto index = indexValueGen(index_expr->_index, env);
+    auto const_index = llvm::dyn_cast<llvm::ConstantInt>(index);
+    if (const_index != nullptr) {
+        if (const_index->getValue().uge(lanes)) {
+            printf("lane %ld out of range [0, %u)\n", long(const_index->getSExtValue()), lanes);
+            exit(1);
+        }
+    } else {
+        trapUnlessGen(_builder.CreateICmpULT(index, llvm::ConstantInt::get(index->getType(), lanes)), env);
+    }
+    return index;
+}
+
+llvm::Value* CodeGen::laneGen(IndexExpressionPtr index_expr, llvm::Value* vec, std::list<Environment>& env) {
+    auto index = laneIndexGen(index_expr, laneCount(vec->getType()), env);
+    return _builder.CreateExtractElement(vec, index);
+}
+
+llvm::Value* CodeGen::laneAssignGen(IndexExpressionPtr index_expr, llvm::Value* val, llvm::Value* vec_addr, std::list<Environment>& env) {
+    auto& builder = _builder;
+    auto vec_type = vec_addr->getType()->getPointerElementType();
+    auto lane_val = convertValue(val, vec_type->getScalarType());
+    if (lane_val == nullptr) {
+        printf("[laneAssignGen] lane type no matched\n");
+        exit(1);
+    }
+    auto index = laneIndexGen(index_expr, laneCount(vec_type), env);
+    auto vec = builder.CreateLoad(vec_type, vec_addr);
+    builder.CreateStore(builder.CreateInsertElement(vec, lane_val, index), vec_addr);
+    return nullptr;
+}
+
+// Address of s[i] as a pointer to a vector of lanes elements of s. Unmasked
+// accesses trap unless all lanes are in bounds; masked ones get the lanes
+// that are in bounds in lane_mask.
+llvm::Value* CodeGen::vectorAddressGen(FuncallExpressionPtr funcall, unsigned lanes, llvm::Value** lane_mask, std::list<Environment>& env) {
+    auto& builder = _builder;
+    llvm::Value *data, *length;
+    arrayBaseGen(funcall->_parameters[0], env, data, length);
+    auto index = indexValueGen(funcall->_parameters[1], env);
+    auto elem_type = data->getType()->getPointerElementType();
+    if (!elem_type->isDoubleTy() && !elem_type->isIntegerTy()) {
+        printf("%s: elements must be double, int or bool\n", funcall->_identifier.c_str());
+        exit(1);
+    }
+    auto vec_type = getVectorType(elem_type, lanes);
+    auto int_type = llvm::Type::getInt64Ty(_context);
+
+    if (lane_mask == nullptr) {
+        auto ok = builder.CreateAnd(builder.CreateICmpULE(index, length),
+            builder.CreateICmpUGE(builder.CreateSub(length, index), llvm::ConstantInt::get(int_type, lanes)));
+        if (!llvm::isa<llvm::ConstantInt>(ok)) {
+            trapUnlessGen(ok, env);
+        } else if (llvm::cast<llvm::ConstantInt>(ok)->isZero()) {
+            printf("%s out of range\n", funcall->_identifier.c_str());
+            exit(1);
+        }
+        return builder.CreateBitCast(builder.CreateInBoundsGEP(elem_type, data, index), vec_type->getPointerTo());
+    }
+
+    std::vector<llvm::Constant*> lane_ids;
+    for (unsigned lane = 0; lane < lanes; lane++) {
+        lane_ids.push_back(llvm::ConstantInt::get(int_type, lane));
+    }
+    auto lane_index = builder.CreateAdd(builder.CreateVectorSplat(lanes, index), llvm::ConstantVector::get(lane_ids));
+    *lane_mask = builder.CreateICmpULT(lane_index, builder.CreateVectorSplat(lanes, length));
+    // not inbounds: the first lanes may lie before s, they are masked off
+    return builder.CreateBitCast(builder.CreateGEP(elem_type, data, index), vec_type->getPointerTo());
+}
+
+// vload(s, i, N): N consecutive elements s[i..i+N-1] as a vector
+llvm::Value* CodeGen::vloadGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    checkArgs(funcall, 3, "vload(slice, index, lanes)");
+    auto lanes_expr = std::dynamic_pointer_cast<NumberExpression>(funcall->_parameters[2]);
+    if (lanes_expr == nullptr || lanes_expr->_is_float || lanes_expr->_number <= 0) {
+        printf("vload: lanes must be a positive integer constant\n");
+        exit(1);
+    }
+    auto ptr = vectorAddressGen(funcall, unsigned(lanes_expr->_number), nullptr, env);
+    auto vec_type = ptr->getType()->getPointerElementType();
+    return _builder.CreateAlignedLoad(vec_type, ptr, typeAlign(vec_type->getScalarType()));
+}
+
+// vstore(s, i, v): s[i..i+N-1] = v
+llvm::Value* CodeGen::vstoreGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    checkArgs(funcall, 3, "vstore(slice, index, vector)");
+    auto val = requireVector(exprGen(funcall->_parameters[2], env), "vstore");
+    auto ptr = vectorAddressGen(funcall, laneCount(val->getType()), nullptr, env);
+    auto vec_type = ptr->getType()->getPointerElementType();
+    val = convertValue(val, vec_type);
+    if (val == nullptr) {
+        printf("vstore: vector lanes don't match the elements\n");
+        exit(1);
+    }
+    return _builder.CreateAlignedStore(val, ptr, typeAlign(vec_type->getScalarType()));
+}
+
+// vload_masked(s, i, mask, passthru): the lanes where mask is set and s[i+lane]
+// exists are loaded, the others come from passthru. Safe for loop tails.
+llvm::Value* CodeGen::vloadMaskedGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    checkArgs(funcall, 4, "vload_masked(slice, index, mask, passthru)");
+    auto mask = requireVector(exprGen(funcall->_parameters[2], env), "vload_masked");
+    auto passthru = exprGen(funcall->_parameters[3], env);
+    if (!mask->getType()->getScalarType()->isIntegerTy(1)) {
+        printf("vload_masked: mask must be a vec<bool,N>\n");
+        exit(1);
+    }
+    llvm::Value* lane_mask;
+    auto ptr = vectorAddressGen(funcall, laneCount(mask->getType()), &lane_mask, env);
+    auto vec_type = ptr->getType()->getPointerElementType();
+    passthru = convertValue(passthru, vec_type);
+    if (passthru == nullptr) {
+        printf("vload_masked: passthru must match the mask lanes and the elements\n");
+        exit(1);
+    }
+    mask = _builder.CreateAnd(mask, lane_mask);
+    auto align = typeAlign(vec_type->getScalarType());
+#if LLVM_VERSION_MAJOR >= 13
+    return _builder.CreateMaskedLoad(vec_type, ptr, align, mask, passthru);
+#elif LLVM_VERSION_MAJOR >= 11
+    return _builder.CreateMaskedLoad(ptr, align, mask, passthru);
+#else
+    return _builder.CreateMaskedLoad(ptr, align.value(), mask, passthru);
+#endif
+}
+
+// vstore_masked(s, i, v, mask): stores the lanes where mask is set and s[i+lane] exists
+llvm::Value* CodeGen::vstoreMaskedGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    checkArgs(funcall, 4, "vstore_masked(slice, index, vector, mask)");
+    auto val = requireVector(exprGen(funcall->_parameters[2], env), "vstore_masked");
+    auto mask = requireVector(exprGen(funcall->_parameters[3], env), "vstore_masked");
+    if (!mask->getType()->getScalarType()->isIntegerTy(1) || laneCount(mask->getType()) != laneCount(val->getType())) {
+        printf("vstore_masked: mask must be a vec<bool,N> with the lanes of the vector\n");
+        exit(1);
+    }
+    llvm::Value* lane_mask;
+    auto ptr = vectorAddressGen(funcall, laneCount(val->getType()), &lane_mask, env);
+    auto vec_type = ptr->getType()->getPointerElementType();
+    val = convertValue(val, vec_type);
+    if (val == nullptr) {
+        printf("vstore_masked: vector lanes don't match the elements\n");
+        exit(1);
+    }
+    mask = _builder.CreateAnd(mask, lane_mask);
+    auto align = typeAlign(vec_type->getScalarType());
+#if LLVM_VERSION_MAJOR >= 11
+    return _builder.CreateMaskedStore(val, ptr, align, mask);
+#else
+    return _builder.CreateMaskedStore(val, ptr, align.value(), mask);
+#endif
+}
+
+// shuffle(a, b, i0, i1, ...): lane k of the result is lane ik of a ++ b
+llvm::Value* CodeGen::shuffleGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    if (funcall->_parameters.size() < 3) {
+        printf("usage: shuffle(a, b, lane, ...)\n");
+        exit(1);
+    }
+    auto a = requireVector(exprGen(funcall->_parameters[0], env), "shuffle");
+    auto b = requireVector(exprGen(funcall->_parameters[1], env), "shuffle");
+    if (a->getType() != b->getType()) {
+        printf("shuffle: both vectors must have one type\n");
+        exit(1);
+    }
+    auto lanes = laneCount(a->getType());
+    std::vector<ShuffleMaskElem> mask;
+    for (size_t i = 2; i < funcall->_parameters.size(); i++) {
+        auto lane = std::dynamic_pointer_cast<NumberExpression>(funcall->_parameters[i]);
+        if (lane == nullptr || lane->_is_float || lane->_number < 0 || lane->_number >= 2 * lanes) {
+            printf("shuffle: lanes must be integer constants in [0, %u)\n", 2 * lanes);
+            exit(1);
+        }
+        mask.push_back(ShuffleMaskElem(lane->_number));
+    }
+    return _builder.CreateShuffleVector(a, b, mask);
+}
+
+// select(mask, a, b): a where mask is set, else b
+llvm::Value* CodeGen::selectGen(FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    checkArgs(funcall, 3, "select(mask, a, b)");
+    auto mask = boolValueGen(exprGen(funcall->_parameters[0], env));
+    auto a = exprGen(funcall->_parameters[1], env);
+    auto b = exprGen(funcall->_parameters[2], env);
+    if (!unifyOperands(a, b)) {
+        printf("select: a and b types no matched\n");
+        exit(1);
+    }
+    if (mask->getType()->isVectorTy()) {
+        if (!a->getType()->isVectorTy()) {
+            a = convertValue(a, getVectorType(a->getType(), laneCount(mask->getType())));
+            b = convertValue(b, a->getType());
+        }
+        if (laneCount(a->getType()) != laneCount(mask->getType())) {
+            printf("select: mask and vector lanes no matched\n");
+            exit(1);
+        }
+    }
+    return _builder.CreateSelect(mask, a, b);
+}
+
+// reduce_<op>(v): horizontal reduction of all lanes. Floating point adds and
+// multiplies may be reassociated into a tree, like -ffast-math would.
+llvm::Value* CodeGen::reduceGen(const std::string& op, FuncallExpressionPtr funcall, std::list<Environment>& env) {
+    std::string usage = "reduce_" + op + "(vector)";
+    checkArgs(funcall, 1, usage.c_str());
+    auto& builder = _builder;
+    auto vec = requireVector(exprGen(funcall->_parameters[0], env), usage.c_str());
+    auto elem_type = vec->getType()->getScalarType();
+
+    if (elem_type->isDoubleTy()) {
+        llvm::Value* result = nullptr;
+        if (op == "add") {
+            result = builder.CreateFAddReduce(llvm::ConstantFP::get(elem_type, -0.0), vec);
+        } else if (op == "mul") {
+            result = builder.CreateFMulReduce(llvm::ConstantFP::get(elem_type, 1.0), vec);
+        } else if (op == "min") {
+#if LLVM_VERSION_MAJOR >= 12
+            return builder.CreateFPMinReduce(vec);
+#else
+            return builder.CreateFPMinReduce(vec, false);
+#endif
+        } else if (op == "max") {
+#if LLVM_VERSION_MAJOR >= 12
+            return builder.CreateFPMaxReduce(vec);
+#else
+            return builder.CreateFPMaxReduce(vec, false);
+#endif
+        } else {
+            printf("%s takes an int or bool vector\n", usage.c_str());
+            exit(1);
+        }
+        llvm::cast<llvm::Instruction>(result)->setHasAllowReassoc(true);
+        return result;
+    }
+
+    if (op == "add") {
+        return builder.CreateAddReduce(vec);
+    } else if (op == "mul") {
+        return builder.CreateMulReduce(vec);
+    } else if (op == "min") {
+        return builder.CreateIntMinReduce(vec, true);
+    } else if (op == "max") {
+        return builder.CreateIntMaxReduce(vec, true);
+    } else if (op == "and") {
+        return builder.CreateAndReduce(vec);
+    } else if (op == "or") {
+        return builder.CreateOrReduce(vec);
+    }
+    return builder.CreateXorReduce(vec);
+}
+
+} //begonia
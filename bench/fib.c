@@ -0,0 +1,12 @@
+#include <stdlib.h>
+
+static long fib(long n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main(void) {
+    exit(fib(35) % 256);
+}
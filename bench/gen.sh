@@ -0,0 +1,157 @@
+#!/bin/bash
+# Writes a synthetic begonia program to stdout, to measure how the compiler
+# scales with the size of its input. Functions call the one before them in
+# chains of 256, main sums the last function of every chain and exits with
+# the sum % 256, so the program also runs.
+#
+#   bench/gen.sh [-f functions] [-s statements] [-d depth] [-l literals]
+#                [-w literal width] [-b bytes] [-r seed]
+#
+#   -f  functions (default 100)
+#   -s  statements per function (default 20)
+#   -d  nesting depth of expressions (default 4)
+#   -l  string literals per function (default 2)
+#   -w  characters per string literal (default 16)
+#   -b  emit functions until the program has this size instead of -f,
+#       with a K, M or G suffix: bench/gen.sh -b 1G > big.bga
+#   -r  seed of the statement mix (default 1)
+
+FUNCS=100
+STMTS=20
+DEPTH=4
+LITERALS=2
+WIDTH=16
+BYTES=0
+SEED=1
+
+usage() {
+    sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+    exit 1
+}
+
+bytes_of() {
+    local n=${1%[KkMmGg]}
+    case "$1" in
+        *[Kk]) echo $((n << 10)) ;;
+        *[Mm]) echo $((n << 20)) ;;
+        *[Gg]) echo $((n << 30)) ;;
+        *)     echo "$n" ;;
+    esac
+}
+
+while getopts "f:s:d:l:w:b:r:h" opt; do
+    case $opt in
+        f) FUNCS=$OPTARG ;;
+        s) STMTS=$OPTARG ;;
+        d) DEPTH=$OPTARG ;;
+        l) LITERALS=$OPTARG ;;
+        w) WIDTH=$OPTARG ;;
+        b) BYTES=$(bytes_of "$OPTARG") ;;
+        r) SEED=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+exec awk -v funcs="$FUNCS" -v stmts="$STMTS" -v depth="$DEPTH" -v literals="$LITERALS" \
+    -v width="$WIDTH" -v bytes="$BYTES" -v seed="$SEED" '
+function emit(line) {
+    print line
+    written += length(line) + 1
+}
+
+function pick(n) {
+    return int(rand() * n)
+}
+
+function leaf(   r) {
+    r = pick(4)
+    if (r == 0) return "a"
+    if (r == 1) return "b"
+    if (r == 2) return "x"
+    return pick(100)
+}
+
+# one operand of every operator is a leaf, so an expression of depth d has
+# d operators however deep it is
+function expr(d,   op, inner) {
+    if (d <= 0) {
+        return leaf()
+    }
+    op = ops[pick(nops) + 1]
+    inner = expr(d - 1)
+    if (pick(2) == 0) {
+        return "(" leaf() " " op " " inner ")"
+    }
+    return "(" inner " " op " " leaf() ")"
+}
+
+function literal(   s, i) {
+    s = ""
+    for (i = 0; i < width; i++) {
+        s = s substr(chars, pick(length(chars)) + 1, 1)
+    }
+    return s
+}
+
+function statement(f, k,   r) {
+    r = pick(4)
+    if (r == 0) {
+        emit("    var v" k " = " expr(depth) ";")
+        emit("    x = x + v" k ";")
+    } else if (r == 1) {
+        emit("    x = " expr(depth) " % 1000;")
+    } else if (r == 2) {
+        emit("    if " expr(depth) " > " pick(100) " {")
+        emit("        x = x + " leaf() ";")
+        emit("    } else {")
+        emit("        x = x - " pick(100) ";")
+        emit("    }")
+    } else {
+        emit("    var j" k " = 0;")
+        emit("    while j" k " < 3 {")
+        emit("        x = (x + " expr(depth) ") % 1000;")
+        emit("        j" k " = j" k " + 1;")
+        emit("    }")
+    }
+}
+
+function function_(f,   k) {
+    emit("func f" f "(a int, b int) int {")
+    if (f % 256 == 0) {
+        emit("    var x = a + b;")
+    } else {
+        emit("    var x = f" (f - 1) "(a, b) % 1000;")
+    }
+    for (k = 0; k < stmts; k++) {
+        statement(f, k)
+    }
+    for (k = 0; k < literals; k++) {
+        emit("    var s" k " str = \"" literal() "\";")
+        emit("    x = x + len(s" k ");")
+        emit("    delete(s" k ");")
+    }
+    emit("    return x % 1000;")
+    emit("}")
+    emit("")
+}
+
+BEGIN {
+    srand(seed)
+    nops = split("+ - *", ops, " ")
+    chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 "
+    emit("func exit(code int) void;")
+    emit("")
+    f = 0
+    while (bytes > 0 ? written < bytes : f < funcs) {
+        function_(f)
+        f++
+    }
+    emit("func main() int {")
+    emit("    var sum = 0;")
+    for (k = 255; k < f + 255; k += 256) {
+        emit("    sum = (sum + f" (k < f ? k : f - 1) "(1, 2)) % 256;")
+    }
+    emit("    exit(sum);")
+    emit("    return 0;")
+    emit("}")
+}'
@@ -0,0 +1,28 @@
+#include <stdlib.h>
+
+static long mandelbrot(long size, long limit) {
+    long inside = 0;
+    for (long y = 0; y < size; y++) {
+        double ci = 2.0 * y / size - 1.0;
+        for (long x = 0; x < size; x++) {
+            double cr = 2.0 * x / size - 1.5;
+            double zr = 0.0;
+            double zi = 0.0;
+            long i = 0;
+            while (i < limit && zr * zr + zi * zi <= 4.0) {
+                double t = zr * zr - zi * zi + cr;
+                zi = 2.0 * zr * zi + ci;
+                zr = t;
+                i++;
+            }
+            if (i == limit) {
+                inside++;
+            }
+        }
+    }
+    return inside;
+}
+
+int main(void) {
+    exit(mandelbrot(1000, 100) % 256);
+}
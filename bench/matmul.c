@@ -0,0 +1,31 @@
+#include <math.h>
+#include <stdlib.h>
+
+static void matmul(const double* a, const double* b, double* c, long n) {
+    for (long i = 0; i < n; i++) {
+        for (long k = 0; k < n; k++) {
+            double aik = a[i * n + k];
+            for (long j = 0; j < n; j++) {
+                c[i * n + j] = c[i * n + j] + aik * b[k * n + j];
+            }
+        }
+    }
+}
+
+int main(void) {
+    long n = 300;
+    double* a = calloc(n * n, sizeof(double));
+    double* b = calloc(n * n, sizeof(double));
+    double* c = calloc(n * n, sizeof(double));
+    for (long i = 0; i < n * n; i++) {
+        a[i] = (i % 7) * 0.5;
+        b[i] = (i % 5) * 0.25;
+    }
+    matmul(a, b, c, n);
+    double sum = 0.0;
+    for (long i = 0; i < n * n; i++) {
+        sum = sum + c[i];
+    }
+    long check = lround(sum);
+    exit(check % 256);
+}
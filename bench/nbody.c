@@ -0,0 +1,93 @@
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct {
+    double x, y, z;
+    double vx, vy, vz;
+    double mass;
+} Body;
+
+static void body(Body* b, double x, double y, double z, double vx, double vy, double vz, double mass) {
+    double pi = 3.141592653589793;
+    double solar_mass = 4.0 * pi * pi;
+    double days_per_year = 365.24;
+    b->x = x;
+    b->y = y;
+    b->z = z;
+    b->vx = vx * days_per_year;
+    b->vy = vy * days_per_year;
+    b->vz = vz * days_per_year;
+    b->mass = mass * solar_mass;
+}
+
+static void offset_momentum(Body* bodies, long n) {
+    double px = 0.0, py = 0.0, pz = 0.0;
+    for (long i = 0; i < n; i++) {
+        px = px + bodies[i].vx * bodies[i].mass;
+        py = py + bodies[i].vy * bodies[i].mass;
+        pz = pz + bodies[i].vz * bodies[i].mass;
+    }
+    double solar_mass = bodies[0].mass;
+    bodies[0].vx = 0.0 - px / solar_mass;
+    bodies[0].vy = 0.0 - py / solar_mass;
+    bodies[0].vz = 0.0 - pz / solar_mass;
+}
+
+static void advance(Body* bodies, long n, double dt) {
+    for (long i = 0; i < n; i++) {
+        for (long j = i + 1; j < n; j++) {
+            double dx = bodies[i].x - bodies[j].x;
+            double dy = bodies[i].y - bodies[j].y;
+            double dz = bodies[i].z - bodies[j].z;
+            double d2 = dx * dx + dy * dy + dz * dz;
+            double mag = dt / (d2 * sqrt(d2));
+            double mi = bodies[i].mass * mag;
+            double mj = bodies[j].mass * mag;
+            bodies[i].vx = bodies[i].vx - dx * mj;
+            bodies[i].vy = bodies[i].vy - dy * mj;
+            bodies[i].vz = bodies[i].vz - dz * mj;
+            bodies[j].vx = bodies[j].vx + dx * mi;
+            bodies[j].vy = bodies[j].vy + dy * mi;
+            bodies[j].vz = bodies[j].vz + dz * mi;
+        }
+    }
+    for (long i = 0; i < n; i++) {
+        bodies[i].x = bodies[i].x + dt * bodies[i].vx;
+        bodies[i].y = bodies[i].y + dt * bodies[i].vy;
+        bodies[i].z = bodies[i].z + dt * bodies[i].vz;
+    }
+}
+
+static double energy(const Body* bodies, long n) {
+    double e = 0.0;
+    for (long i = 0; i < n; i++) {
+        Body b = bodies[i];
+        e = e + 0.5 * b.mass * (b.vx * b.vx + b.vy * b.vy + b.vz * b.vz);
+        for (long j = i + 1; j < n; j++) {
+            double dx = b.x - bodies[j].x;
+            double dy = b.y - bodies[j].y;
+            double dz = b.z - bodies[j].z;
+            e = e - b.mass * bodies[j].mass / sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    }
+    return e;
+}
+
+int main(void) {
+    Body bodies[5];
+    body(&bodies[0], 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
+    body(&bodies[1], 4.84143144246472090, -1.16032004402742839, -0.103622044471123109,
+         0.00166007664274403694, 0.00769901118419740425, -0.0000690460016972063023, 0.000954791938424326609);
+    body(&bodies[2], 8.34336671824457987, 4.12479856412430479, -0.403523417114321381,
+         -0.00276742510726862411, 0.00499852801234917238, 0.0000230417297573763929, 0.000285885980666130812);
+    body(&bodies[3], 12.8943695621391310, -15.1111514016986312, -0.223307578892655734,
+         0.00296460137564761618, 0.00237847173959480950, -0.0000296589568540237556, 0.0000436624404335156298);
+    body(&bodies[4], 15.3796971148509165, -25.9193146099879641, 0.179258772950371181,
+         0.00268067772490389322, 0.00162824170038242295, -0.0000951592254519715870, 0.0000515138902046611451);
+    offset_momentum(bodies, 5);
+    for (long step = 0; step < 1000000; step++) {
+        advance(bodies, 5, 0.01);
+    }
+    long check = lround(0.0 - energy(bodies, 5) * 1000000000.0);
+    exit(check % 256);
+}
@@ -0,0 +1,99 @@
+#!/bin/bash
+# Compiles every kernel of bench/ with begonia at each -O level and its C
+# reference with cc -O2, runs them and reports compile time, run time (the
+# best of RUNS) and binary size. A kernel exits with a checksum of its
+# result; a program whose checksum differs from the C one is marked WRONG
+# and makes the script fail.
+#
+#   bench/run.sh [kernel...]
+#   BEGONIA=bin/begonia LEVELS="0 2" RUNS=5 CC=clang bench/run.sh fib sieve
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BEGONIA=${BEGONIA:-$BENCH_DIR/../bin/begonia}
+CC=${CC:-cc}
+LEVELS=${LEVELS:-0 1 2 3}
+RUNS=${RUNS:-3}
+
+if [ ! -x "$BEGONIA" ]; then
+    echo "no begonia at $BEGONIA, run make first or set BEGONIA" >&2
+    exit 1
+fi
+BEGONIA=$(cd "$(dirname "$BEGONIA")" && pwd)/$(basename "$BEGONIA")
+
+KERNELS=("$@")
+if [ ${#KERNELS[@]} -eq 0 ]; then
+    for src in "$BENCH_DIR"/*.bga; do
+        KERNELS+=("$(basename "$src" .bga)")
+    done
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+# milliseconds since $1 (ns)
+elapsed_ms() {
+    echo $((($(now_ns) - $1) / 1000000))
+}
+
+# runs $1 RUNS times: RUN_MS is the best run time, CHECKSUM the exit code
+run_best() {
+    RUN_MS=
+    for _ in $(seq "$RUNS"); do
+        local start=$(now_ns)
+        "$1" >/dev/null 2>&1
+        CHECKSUM=$?
+        local ms=$(elapsed_ms "$start")
+        if [ -z "$RUN_MS" ] || [ "$ms" -lt "$RUN_MS" ]; then
+            RUN_MS=$ms
+        fi
+    done
+}
+
+failed=0
+printf "%-14s %-12s %10s %10s %10s %8s\n" kernel compiler "compile ms" "run ms" "size B" "run/C"
+for kernel in "${KERNELS[@]}"; do
+    if [ ! -f "$BENCH_DIR/$kernel.bga" ] || [ ! -f "$BENCH_DIR/$kernel.c" ]; then
+        echo "$kernel: needs $kernel.bga and $kernel.c in $BENCH_DIR" >&2
+        failed=1
+        continue
+    fi
+
+    start=$(now_ns)
+    if ! $CC -O2 -o "$WORK/$kernel.c.out" "$BENCH_DIR/$kernel.c" -lm; then
+        failed=1
+        continue
+    fi
+    compile_ms=$(elapsed_ms "$start")
+    run_best "$WORK/$kernel.c.out"
+    c_ms=$RUN_MS
+    expected=$CHECKSUM
+    printf "%-14s %-12s %10d %10d %10d %8s\n" "$kernel" "$CC -O2" "$compile_ms" "$c_ms" \
+        "$(stat -c %s "$WORK/$kernel.c.out")" "1.00"
+
+    for level in $LEVELS; do
+        out="$WORK/$kernel.O$level"
+        start=$(now_ns)
+        # begonia writes its objects next to the output
+        if ! (cd "$WORK" && "$BEGONIA" -O"$level" "$BENCH_DIR/$kernel.bga" -o "$out" >/dev/null); then
+            echo "$kernel: begonia -O$level failed" >&2
+            failed=1
+            continue
+        fi
+        compile_ms=$(elapsed_ms "$start")
+        run_best "$out"
+        run_ms=$RUN_MS
+        note=
+        if [ "$CHECKSUM" != "$expected" ]; then
+            note=" WRONG: exit $CHECKSUM, C exits $expected"
+            failed=1
+        fi
+        ratio=$(awk -v b="$run_ms" -v c="$c_ms" 'BEGIN { printf "%.2f", (c > 0 ? b / c : 0) }')
+        printf "%-14s %-12s %10d %10d %10d %8s%s\n" "$kernel" "begonia -O$level" "$compile_ms" "$run_ms" \
+            "$(stat -c %s "$out")" "$ratio" "$note"
+    done
+done
+exit $failed
@@ -0,0 +1,100 @@
+#!/bin/bash
+# Compiles synthetic programs of growing size (bench/gen.sh) with
+# begonia -O0 -c --stats and reports the throughput of the front-end phases:
+# tokens/s of lex, AST nodes/s of parse, IR instructions/s of codegen, and
+# the peak RSS of the compiler. A phase whose time grows faster than
+# size^SLOPE between the smallest program it takes MIN_MS on and the
+# largest one is flagged SUPERLINEAR and makes the script fail.
+#
+#   bench/scale.sh
+#   SIZES="1M 16M 256M 1G" STMTS=40 DEPTH=8 bench/scale.sh
+#
+#   SIZES       program sizes, with a K, M or G suffix (default 64K..2M)
+#   STMTS       statements per function (default 20)
+#   DEPTH       nesting depth of expressions (default 4)
+#   LITERALS    string literals per function (default 2)
+#   SLOPE       highest accepted growth exponent (default 1.25)
+#   MIN_MS      shortest phase time a slope is taken from (default 20)
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BEGONIA=${BEGONIA:-$BENCH_DIR/../bin/begonia}
+SIZES=${SIZES:-64K 128K 256K 512K 1M 2M}
+STMTS=${STMTS:-20}
+DEPTH=${DEPTH:-4}
+LITERALS=${LITERALS:-2}
+SLOPE=${SLOPE:-1.25}
+MIN_MS=${MIN_MS:-20}
+
+if [ ! -x "$BEGONIA" ]; then
+    echo "no begonia at $BEGONIA, run make first or set BEGONIA" >&2
+    exit 1
+fi
+BEGONIA=$(cd "$(dirname "$BEGONIA")" && pwd)/$(basename "$BEGONIA")
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# one line per size: bytes tokens lex_ms ast_nodes parse_ms ir codegen_ms peak_kb
+RESULTS=$WORK/results
+printf "%-8s %10s %12s %12s %12s %12s %12s %10s\n" size bytes tokens "tokens/s" "nodes/s" \
+    "ir insts" "insts/s" "peak MB"
+for size in $SIZES; do
+    "$BENCH_DIR/gen.sh" -b "$size" -s "$STMTS" -d "$DEPTH" -l "$LITERALS" > "$WORK/scale.bga"
+    # begonia writes its objects next to the output
+    if ! (cd "$WORK" && "$BEGONIA" -O0 -c --stats scale.bga -o scale >/dev/null 2>"$WORK/stats"); then
+        cat "$WORK/stats" >&2
+        echo "begonia failed on a program of $size" >&2
+        exit 1
+    fi
+    bytes=$(stat -c %s "$WORK/scale.bga")
+    awk -v bytes="$bytes" '
+        $1 == "total"           { peak = $5 }
+        $1 == "lex"             { lex = $3 }
+        $1 == "parse"           { parse = $3 }
+        $1 == "codegen"         { codegen = $3 }
+        $1 == "tokens"          { tokens = $2 }
+        $1 == "ast_nodes"       { nodes = $2 }
+        $1 == "ir_instructions" { ir = $2 }
+        END { print bytes, tokens, lex, nodes, parse, ir, codegen, peak }' "$WORK/stats" >> "$RESULTS"
+    tail -n 1 "$RESULTS" | awk -v size="$size" '
+        function rate(n, ms) { return ms > 0 ? n * 1000 / ms : 0 }
+        { printf "%-8s %10d %12d %12.0f %12.0f %12d %12.0f %10.1f\n",
+            size, $1, $2, rate($2, $3), rate($4, $5), $6, rate($6, $7), $8 / 1024 }'
+    rm -f "$WORK"/scale*
+done
+
+# growth exponent of each phase time against its own unit of work
+awk -v slope="$SLOPE" -v min_ms="$MIN_MS" '
+    function check(phase, n_col, ms_col,   first, k) {
+        first = 0
+        for (i = 1; i <= rows; i++) {
+            if (ms[i, ms_col] >= min_ms) {
+                first = i
+                break
+            }
+        }
+        if (first == 0 || n[rows, n_col] < 2 * n[first, n_col]) {
+            printf "%-8s not enough data for a slope\n", phase
+            return
+        }
+        k = log(ms[rows, ms_col] / ms[first, ms_col]) / log(n[rows, n_col] / n[first, n_col])
+        printf "%-8s time ~ size^%.2f", phase, k
+        if (k > slope) {
+            printf " SUPERLINEAR"
+            failed = 1
+        }
+        printf "\n"
+    }
+    {
+        rows++
+        n[rows, 2] = $2; ms[rows, 3] = $3
+        n[rows, 4] = $4; ms[rows, 5] = $5
+        n[rows, 6] = $6; ms[rows, 7] = $7
+    }
+    END {
+        print ""
+        check("Lexer", 2, 3)
+        check("Parser", 4, 5)
+        check("CodeGen", 6, 7)
+        exit failed
+    }' "$RESULTS"
@@ -0,0 +1,99 @@
+#!/bin/bash
+# Throughput of many small compiles: FILES small programs compiled with
+# begonia -c one process each, then with begonia-client against a
+# begonia --serve started on a socket of its own, both with JOBS compiles
+# at a time. Reports compiles/s of each and the speedup of the server.
+#
+#   bench/server.sh
+#   FILES=2000 JOBS=8 WORKERS=8 bench/server.sh
+#
+#   FILES       programs to compile (default 200)
+#   JOBS        compiles started at a time (default: one per core)
+#   WORKERS     workers of the server (default: one per core)
+#   OPT         optimization level (default 0)
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BEGONIA=${BEGONIA:-$BENCH_DIR/../bin/begonia}
+CLIENT=${CLIENT:-$(dirname "$BEGONIA")/begonia-client}
+FILES=${FILES:-200}
+JOBS=${JOBS:-$(nproc)}
+WORKERS=${WORKERS:-$(nproc)}
+OPT=${OPT:-0}
+
+for bin in "$BEGONIA" "$CLIENT"; do
+    if [ ! -x "$bin" ]; then
+        echo "no $(basename "$bin") at $bin, run make first or set BEGONIA and CLIENT" >&2
+        exit 1
+    fi
+done
+BEGONIA=$(cd "$(dirname "$BEGONIA")" && pwd)/$(basename "$BEGONIA")
+CLIENT=$(cd "$(dirname "$CLIENT")" && pwd)/$(basename "$CLIENT")
+
+WORK=$(mktemp -d)
+SERVER=
+cleanup() {
+    if [ -n "$SERVER" ]; then
+        kill "$SERVER" 2>/dev/null
+        wait "$SERVER" 2>/dev/null
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+for ((i = 0; i < FILES; i++)); do
+    cat > "$WORK/p$i.bga" <<EOF
+func exit(code int) void;
+
+func f(n int) int {
+    if n < 2 {
+        return n;
+    }
+    return f(n - 1) + f(n - 2) + $i;
+}
+
+func main() int {
+    exit(f(10) % 256);
+    return 0;
+}
+EOF
+done
+
+now_ns() {
+    date +%s%N
+}
+
+# compiles/s of every program with the given command, JOBS at a time
+throughput() {
+    rm -f "$WORK"/*.o
+    local start=$(now_ns)
+    if ! (cd "$WORK" && ls p*.bga | xargs -P "$JOBS" -I{} "$@" -O"$OPT" -c {} >/dev/null); then
+        echo "failed: $*" >&2
+        return 1
+    fi
+    local ns=$(($(now_ns) - start))
+    if [ "$(ls "$WORK"/*.o | wc -l)" -ne "$FILES" ]; then
+        echo "missing objects: $*" >&2
+        return 1
+    fi
+    awk -v n="$FILES" -v ns="$ns" 'BEGIN { printf "%.1f", n * 1e9 / ns }'
+}
+
+direct=$(throughput "$BEGONIA") || exit 1
+
+export BEGONIA_SOCKET=$WORK/begonia.sock
+"$BEGONIA" --serve="$BEGONIA_SOCKET" --workers="$WORKERS" 2>/dev/null &
+SERVER=$!
+for ((i = 0; i < 100; i++)); do
+    [ -S "$BEGONIA_SOCKET" ] && break
+    sleep 0.05
+done
+if [ ! -S "$BEGONIA_SOCKET" ]; then
+    echo "the compile server didn't start" >&2
+    exit 1
+fi
+served=$(throughput "$CLIENT") || exit 1
+
+printf "%-24s %12s\n" "$FILES files, $JOBS jobs" "compiles/s"
+printf "%-24s %12s\n" "begonia -c" "$direct"
+printf "%-24s %12s\n" "begonia-client -c" "$served"
+awk -v a="$direct" -v b="$served" 'BEGIN { printf "%-24s %11.1fx\n", "speedup", b / a }'
@@ -0,0 +1,25 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+static long sieve(long n) {
+    bool* composite = calloc(n + 1, sizeof(bool));
+    long count = 0;
+    for (long i = 2; i <= n; i++) {
+        if (!composite[i]) {
+            count++;
+            for (long j = i * i; j <= n; j += i) {
+                composite[j] = true;
+            }
+        }
+    }
+    free(composite);
+    return count;
+}
+
+int main(void) {
+    long count = 0;
+    for (int round = 0; round < 10; round++) {
+        count = sieve(2000000);
+    }
+    exit(count % 256);
+}
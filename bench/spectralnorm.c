@@ -0,0 +1,53 @@
+#include <math.h>
+#include <stdlib.h>
+
+static double eval_a(long i, long j) {
+    return 1.0 / ((i + j) * (i + j + 1) / 2 + i + 1);
+}
+
+static void times(double* v, const double* u, long n) {
+    for (long i = 0; i < n; i++) {
+        double s = 0.0;
+        for (long j = 0; j < n; j++) {
+            s = s + eval_a(i, j) * u[j];
+        }
+        v[i] = s;
+    }
+}
+
+static void times_transp(double* v, const double* u, long n) {
+    for (long i = 0; i < n; i++) {
+        double s = 0.0;
+        for (long j = 0; j < n; j++) {
+            s = s + eval_a(j, i) * u[j];
+        }
+        v[i] = s;
+    }
+}
+
+static void times_ata(double* v, const double* u, double* tmp, long n) {
+    times(tmp, u, n);
+    times_transp(v, tmp, n);
+}
+
+int main(void) {
+    long n = 1000;
+    double* u = calloc(n, sizeof(double));
+    double* v = calloc(n, sizeof(double));
+    double* tmp = calloc(n, sizeof(double));
+    for (long i = 0; i < n; i++) {
+        u[i] = 1.0;
+    }
+    for (int i = 0; i < 10; i++) {
+        times_ata(v, u, tmp, n);
+        times_ata(u, v, tmp, n);
+    }
+    double vbv = 0.0;
+    double vv = 0.0;
+    for (long i = 0; i < n; i++) {
+        vbv = vbv + u[i] * v[i];
+        vv = vv + v[i] * v[i];
+    }
+    long check = lround(sqrt(vbv / vv) * 1000000000.0);
+    exit(check % 256);
+}
@@ -0,0 +1,77 @@
+#!/bin/bash
+# Startup latency of begonia: the wall time of --help, of compiling an
+# empty program with -c, of compiling and linking it, and of --run on it,
+# the best and the median of RUNS. What a trivial compile costs is mostly
+# loading the binary and initializing LLVM, so this is where a lean build
+# (make lean) shows. Several binaries can be compared side by side.
+#
+#   bench/startup.sh [begonia...]
+#   RUNS=50 bench/startup.sh bin/begonia /tmp/begonia-full
+#
+#   RUNS        runs of each command (default 20)
+#   RUNTIME     libbegonia_rt.a to link with (default: next to each begonia)
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+RUNS=${RUNS:-20}
+
+BINARIES=("$@")
+if [ ${#BINARIES[@]} -eq 0 ]; then
+    BINARIES=("$BENCH_DIR/../bin/begonia")
+fi
+for i in "${!BINARIES[@]}"; do
+    bin=${BINARIES[$i]}
+    if [ ! -x "$bin" ]; then
+        echo "no begonia at $bin, run make first" >&2
+        exit 1
+    fi
+    BINARIES[$i]=$(cd "$(dirname "$bin")" && pwd)/$(basename "$bin")
+done
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cat > "$WORK/empty.bga" <<'EOF'
+func exit(code int) void;
+
+func main() int {
+    return 0;
+}
+EOF
+
+now_ns() {
+    date +%s%N
+}
+
+# best and median milliseconds of RUNS runs of a command, run in $WORK
+measure() {
+    local times=()
+    for ((run = 0; run < RUNS; run++)); do
+        local start=$(now_ns)
+        if ! (cd "$WORK" && "$@" >/dev/null 2>&1); then
+            echo "failed: $*" >&2
+            return 1
+        fi
+        times+=($(($(now_ns) - start)))
+    done
+    printf "%s\n" "${times[@]}" | sort -n | awk '
+        { t[NR] = $1 }
+        END { printf "%8.2f %8.2f", t[1] / 1e6, t[int((NR + 1) / 2)] / 1e6 }'
+}
+
+printf "%-40s %-8s %17s %17s %17s %17s\n" begonia "size" "--help" "-c" "link" "--run"
+printf "%-40s %-8s %17s %17s %17s %17s\n" "" "MB" "best   median" "best   median" "best   median" "best   median"
+for bin in "${BINARIES[@]}"; do
+    runtime=${RUNTIME:-$(dirname "$bin")/libbegonia_rt.a}
+    size=$(awk -v b="$(stat -c %s "$bin")" 'BEGIN { printf "%.1f", b / 1048576 }')
+    help=$(measure "$bin" --help) || exit 1
+    compile=$(measure "$bin" -O0 -c empty.bga -o empty) || exit 1
+    link=$(measure "$bin" -O0 empty.bga -o empty "--runtime=$runtime") || exit 1
+    run=$(measure "$bin" --run empty.bga) || exit 1
+    name=$bin
+    if [ ${#name} -gt 40 ]; then
+        name="...${name: -37}"
+    fi
+    printf "%-40s %-8s %17s %17s %17s %17s\n" "$name" "$size" "$help" "$compile" "$link" "$run"
+    if ldd "$bin" 2>/dev/null | grep -q libLLVM; then
+        echo "  (LLVM linked as a shared library)"
+    fi
+done
@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char*   data;
+    long    len;
+} str;
+
+// a new string of s and the len bytes of piece, as s + "..." makes one
+static str concat(str s, const char* piece, long len) {
+    str t;
+    t.len = s.len + len;
+    t.data = malloc(t.len + 1);
+    memcpy(t.data, s.data, s.len);
+    memcpy(t.data + s.len, piece, len);
+    t.data[t.len] = '\0';
+    return t;
+}
+
+static str build(long pieces) {
+    str s = {calloc(1, 1), 0};
+    for (long i = 0; i < pieces; i++) {
+        str t = i % 2 == 0 ? concat(s, "piece:", 6) : concat(s, "0123", 4);
+        free(s.data);
+        s = t;
+    }
+    return s;
+}
+
+// 64-bit FNV-1a
+static long hash(str s) {
+    uint64_t hash = 14695981039346656037ull;
+    for (long i = 0; i < s.len; i++) {
+        hash = (hash ^ (unsigned char)s.data[i]) * 1099511628211ull;
+    }
+    return (long)hash;
+}
+
+int main(void) {
+    long check = 0;
+    for (int round = 0; round < 100; round++) {
+        str s = build(4000);
+        check = check + hash(s) % 256 + s.len;
+        free(s.data);
+    }
+    exit(check % 256);
+}
@@ -0,0 +1,161 @@
+// begonia-client: runs a begonia command line on the compile server that
+// begonia --serve runs (server/Protocol.h). It links nothing of LLVM, so it
+// starts like any small program. Without a server it runs the begonia next
+// to it instead.
+#include "Protocol.h"
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+static void usage() {
+    printf("usage: begonia-client [--socket=<path>] <begonia options and files>...\n");
+    printf("  --socket=<path>         the socket of begonia --serve (default: $BEGONIA_SOCKET\n");
+    printf("                          or begonia.sock in $XDG_RUNTIME_DIR or /tmp/begonia-<uid>)\n");
+    printf("without a server on the socket, runs begonia itself\n");
+}
+
+static int connectServer(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path == "" || path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    // the request hands over this user's stdio and directory
+    if (!begonia::peerIsUser(fd)) {
+        fprintf(stderr, "begonia-client: the server on %s runs as another user, not using it\n", path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// begonia next to this binary, or on the PATH
+static int runBegonia(std::vector<std::string>& args) {
+    std::string begonia = "begonia";
+#ifdef __linux__
+    char self[PATH_MAX];
+    auto n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n > 0) {
+        self[n] = '\0';
+        std::string dir = self;
+        begonia = dir.substr(0, dir.rfind('/') + 1) + "begonia";
+    }
+#endif
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    execv(begonia.c_str(), argv.data());
+    execvp("begonia", argv.data());
+    perror("begonia");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    std::string socket_path = begonia::defaultSocketPath(false);
+    std::vector<std::string> args = {"begonia"};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (args.size() == 1 && arg.rfind("--socket=", 0) == 0) {
+            socket_path = arg.substr(strlen("--socket="));
+        } else if (args.size() == 1 && (arg == "-h" || arg == "--help")) {
+            usage();
+            return 0;
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    // programs run by --run and servers are no compiles
+    for (auto& arg : args) {
+        if (arg == "--run" || arg.rfind("--serve", 0) == 0) {
+            return runBegonia(args);
+        }
+    }
+    int conn = connectServer(socket_path);
+    if (conn < 0) {
+        return runBegonia(args);
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+        perror("getcwd");
+        return 1;
+    }
+    std::string payload = std::string(cwd) + '\0';
+    for (auto& arg : args) {
+        payload += arg + '\0';
+    }
+    if (payload.size() > begonia::max_request_size) {
+        fprintf(stderr, "begonia-client: arguments too long\n");
+        return 1;
+    }
+
+    // the header carries stdin, stdout and stderr, the payload follows
+    begonia::RequestHeader header = {begonia::request_magic, uint32_t(args.size()), uint32_t(payload.size())};
+    iovec iov = {&header, sizeof(header)};
+    alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+    ssize_t sent;
+    do {
+        sent = sendmsg(conn, &msg, 0);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        perror("begonia-client");
+        return 1;
+    }
+    if (size_t(sent) < sizeof(header)
+        && !begonia::writeAll(conn, reinterpret_cast<char*>(&header) + sent, sizeof(header) - sent)) {
+        perror("begonia-client");
+        return 1;
+    }
+    if (!begonia::writeAll(conn, payload.data(), payload.size())) {
+        perror("begonia-client");
+        return 1;
+    }
+
+    int32_t status = 1;
+    if (!begonia::readAll(conn, &status, sizeof(status))) {
+        fprintf(stderr, "begonia-client: the server closed the connection\n");
+        status = 1;
+    }
+    close(conn);
+    if (status < 0) {
+        // the compile died of a signal, so does the client
+        fflush(nullptr);
+        signal(-status, SIG_DFL);
+        raise(-status);
+        return 128 - status;
+    }
+    return status;
+}
@@ -1,11 +1,29 @@
 #include "CodeGen.h"
 #include "Parser.h"
+#include "Profiler.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+#include "Tiering.h"
+#include "CompileServer.h"
+#include "ParseCache.h"
+#include "Protocol.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 #include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
 #include <execinfo.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
 
 void sig_handler(int sig) {
   void *array[10];
@@ -18,28 +36,404 @@ void sig_handler(int sig) {
   exit(1);
 }
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
+void usage() {
+    printf("usage: begonia [options] <file.bga|file.bc|file.o>...\n");
+    printf("  -o <file>               output executable (default: out)\n");
+    printf("  -c                      only compile each .bga into <name>.o (or <name>.bc), don't link\n");
+    printf("  -O<level>               optimization level 0-3 (default: 0)\n");
+    printf("  -j <n>                  code-generate the module on <n> threads, 0 = one per core\n");
+    printf("  --cache-dir=<dir>       reuse the objects of unchanged functions from <dir>\n");
+    printf("  --cache-size=<MB>       evict least recently used cache entries above <MB> (default: 1024)\n");
+    printf("  -fprofile-generate[=<dir>]  instrument the program to write <dir>/default_%%m.profraw at exit\n");
+    printf("  -fprofile-use=<file>    optimize with the profile merged by llvm-profdata\n");
+    printf("  --profile-runtime=<lib> path of libclang_rt.profile (default: next to LLVM)\n");
+    printf("  --runtime=<lib>         path of libbegonia_rt.a (default: next to begonia)\n");
+    printf("  -flto=thin              emit bitcode with summaries and run ThinLTO across all modules at link\n");
+    printf("  -g                      emit DWARF debug info: line tables, functions and variables\n");
+    printf("  -fno-omit-frame-pointer keep the frame pointer in every function, for stack walking profilers\n");
+    printf("  -finstrument-functions  trace the entry and exit of every function into BEGONIA_TRACE at exit\n");
+    printf("  --emit-llvm             print the generated LLVM IR to stderr\n");
+    printf("  --time-trace[=<file>]   write Chrome trace-event JSON of the compile phases\n");
+    printf("                          (default: <output>.time-trace.json)\n");
+    printf("  --stats                 print a summary table of the compile phases\n");
+    printf("  --run                   run <file.bga> in the bytecode interpreter, compiling hot code with LLVM\n");
+    printf("  --jit-threshold=<n>     calls or loop iterations before code is compiled, 0 = never (default: 1000)\n");
+    printf("  --serve[=<socket>]      compile for begonia-client on a Unix socket (default: $BEGONIA_SOCKET\n");
+    printf("                          or begonia.sock in $XDG_RUNTIME_DIR or /tmp/begonia-<uid>)\n");
+    printf("  --workers=<n>           with --serve, compile <n> requests at a time (default: one per core)\n");
+}
+
+// the value of a numeric option, up to max; a bad one is reported like other
+// driver errors
+static uint64_t optionNumber(const std::string& option, const std::string& value, uint64_t max) {
+    char* end = nullptr;
+    errno = 0;
+    auto number = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || !isdigit((unsigned char)value[0]) || *end != '\0' || errno != 0 || number > max) {
+        printf("invalid number for %s:%s\n", option.c_str(), value.c_str());
+        exit(1);
+    }
+    return number;
+}
+
+// Options the interpreter of --run has no equivalent for.
+static const char* runFallbackReason(const begonia::CodeGenOptions& options) {
+    if (options.debug_info) {
+        return "-g";
+    }
+    if (options.instrument_functions) {
+        return "-finstrument-functions";
+    }
+    if (options.profile_generate || options.profile_use != "") {
+        return "-fprofile-*";
+    }
+    if (options.lto_thin) {
+        return "-flto=thin";
+    }
+    if (options.cache_dir != "") {
+        return "--cache-dir";
+    }
+    return nullptr;
+}
+
+// the directory --run builds in; CodeGen reports errors with exit()
+static std::string run_dir;
+
+static void removeRunDir() {
+    llvm::sys::fs::remove_directories(run_dir);
+}
+
+// Runs the executable built for --run and removes it; returns its exit
+// status, or dies of the signal it died of.
+static int runExecutable(const std::string& path) {
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execl(path.c_str(), path.c_str(), (char*)nullptr);
+        perror(path.c_str());
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    removeRunDir();
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static int serve(const std::string& socket_path, unsigned workers, const begonia::CodeGenOptions& options);
+
+static int driver(int argc, char** argv) {
+    begonia::CodeGenOptions options;
+    std::vector<std::string> input_files;
+    std::string time_trace_file;
+    bool compile_only = false;
+    bool out_given = false;
+    bool time_trace = false;
+    bool stats = false;
+    bool run = false;
+    bool opt_given = false;
+    uint64_t jit_threshold = 1000;
+    bool serving = false;
+    std::string socket_path;
+    unsigned workers = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            options.out_filename = argv[++i];
+            out_given = true;
+        } else if (arg == "-c") {
+            compile_only = true;
+        } else if (arg == "-flto=thin") {
+            options.lto_thin = true;
+        } else if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && arg[2] >= '0' && arg[2] <= '3') {
+            options.opt_level = arg[2] - '0';
+            opt_given = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            options.jobs = optionNumber("-j", argv[++i], UINT_MAX);
+        } else if (arg.rfind("-j", 0) == 0 && arg.size() > 2) {
+            options.jobs = optionNumber("-j", arg.substr(2), UINT_MAX);
+        } else if (arg.rfind("--cache-dir=", 0) == 0) {
+            options.cache_dir = arg.substr(strlen("--cache-dir="));
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            options.cache_max_bytes = optionNumber("--cache-size", arg.substr(strlen("--cache-size=")), UINT64_MAX >> 20) << 20;
+        } else if (arg == "-fprofile-generate") {
+            options.profile_generate = true;
+        } else if (arg.rfind("-fprofile-generate=", 0) == 0) {
+            options.profile_generate = true;
+            options.profile_generate_dir = arg.substr(strlen("-fprofile-generate="));
+        } else if (arg.rfind("-fprofile-use=", 0) == 0) {
+            options.profile_use = arg.substr(strlen("-fprofile-use="));
+        } else if (arg.rfind("--profile-runtime=", 0) == 0) {
+            options.profile_runtime = arg.substr(strlen("--profile-runtime="));
+        } else if (arg.rfind("--runtime=", 0) == 0) {
+            options.runtime_lib = arg.substr(strlen("--runtime="));
+        } else if (arg == "-g") {
+            options.debug_info = true;
+        } else if (arg == "-fno-omit-frame-pointer") {
+            options.frame_pointer = true;
+        } else if (arg == "-fomit-frame-pointer") {
+            options.frame_pointer = false;
+        } else if (arg == "-finstrument-functions") {
+            options.instrument_functions = true;
+        } else if (arg == "--emit-llvm") {
+            options.dump_ir = true;
+        } else if (arg == "--time-trace") {
+            time_trace = true;
+        } else if (arg.rfind("--time-trace=", 0) == 0) {
+            time_trace = true;
+            time_trace_file = arg.substr(strlen("--time-trace="));
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--run") {
+            run = true;
+        } else if (arg.rfind("--jit-threshold=", 0) == 0) {
+            jit_threshold = optionNumber("--jit-threshold", arg.substr(strlen("--jit-threshold=")), UINT64_MAX);
+        } else if (arg == "--serve") {
+            serving = true;
+        } else if (arg.rfind("--serve=", 0) == 0) {
+            serving = true;
+            socket_path = arg.substr(strlen("--serve="));
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            workers = optionNumber("--workers", arg.substr(strlen("--workers=")), UINT_MAX);
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else if (arg[0] == '-') {
+            printf("unknown option:%s\n", arg.c_str());
+            usage();
+            return 1;
+        } else {
+            input_files.push_back(arg);
+        }
+    }
+    if (options.profile_generate && options.profile_use != "") {
+        printf("-fprofile-generate and -fprofile-use can't be used together\n");
+        return 1;
+    }
+    if (serving) {
+        if (!input_files.empty() || run) {
+            printf("--serve takes no input files\n");
+            return 1;
+        }
+        if (socket_path == "") {
+            socket_path = begonia::defaultSocketPath(true);
+        }
+        if (socket_path == "") {
+            printf("no private directory for the socket, set $BEGONIA_SOCKET or use --serve=<socket>\n");
+            return 1;
+        }
+        return serve(socket_path, workers, options);
+    }
+    if (input_files.empty()) {
         printf("need input file\n");
+        usage();
         return 1;
     }
+    if (run) {
+        if (input_files.size() != 1 || llvm::sys::path::extension(input_files[0]) != ".bga" || compile_only) {
+            printf("--run needs one .bga file\n");
+            return 1;
+        }
+        auto reason = runFallbackReason(options);
+        if (reason == nullptr) {
+            begonia::Parser parser(input_files[0]);
+            parser.Tokenize();
+            parser.Parse();
+            begonia::BcProgram program;
+            begonia::BytecodeCompiler compiler;
+            if (compiler.compile(parser._ast, program)) {
+                begonia::CodeGenOptions jit_options = options;
+                if (!opt_given) {
+                    jit_options.opt_level = 2;
+                }
+                begonia::Tiering tiering(program, jit_options);
+                begonia::Interpreter interpreter(program, &tiering, jit_threshold, stats);
+                interpreter.run();
+            }
+            if (stats) {
+                fprintf(stderr, "--run: compiling ahead of time: %s\n", compiler.why().c_str());
+            }
+        } else if (stats) {
+            fprintf(stderr, "--run: compiling ahead of time: %s\n", reason);
+        }
+        // the whole program ahead of time, run from a directory of its own
+        char dir[] = "/tmp/begonia-run-XXXXXX";
+        if (mkdtemp(dir) == nullptr) {
+            perror("mkdtemp");
+            return 1;
+        }
+        run_dir = dir;
+        atexit(removeRunDir);
+        options.out_filename = run_dir + "/out";
+        time_trace = false;
+        stats = false;
+    }
+    if (time_trace_file == "") {
+        time_trace_file = options.out_filename + ".time-trace.json";
+    }
+
+    auto& profiler = begonia::Profiler::Get();
+    if (time_trace || stats) {
+        profiler.enable();
+    }
+    profiler.begin("total");
+
     signal(SIGSEGV, sig_handler);
-    printf("compiling %s\n", argv[1]);
-    begonia::Parser parser(argv[1]);
 
-    parser.Parse();
+    std::vector<std::string> objects;
+    std::vector<std::string> bitcodes;
+    bool has_entry_point = false;
+    bool has_prebuilt_inputs = false;
+    uint64_t tokens = 0;
+    for (auto& input_file : input_files) {
+        std::string stem = llvm::sys::path::stem(input_file).str();
+        auto extension = llvm::sys::path::extension(input_file);
+        if (extension == ".o") {
+            objects.push_back(input_file);
+            has_prebuilt_inputs = true;
+            continue;
+        }
+        if (extension == ".bc") {
+            bitcodes.push_back(input_file);
+            has_prebuilt_inputs = true;
+            continue;
+        }
 
-    begonia::CodeGen generator;
-    int ret_code = generator.initialize();
-    if (ret_code != 0) {
-        printf("generator. initialize err\n");
-        return 1;
+        begonia::CodeGenOptions input_options = options;
+        input_options.module_name = input_file;
+        if (compile_only) {
+            input_options.object_name = out_given && input_files.size() == 1
+                ? llvm::sys::path::stem(options.out_filename).str() : stem;
+            input_options.jobs = 1;
+            input_options.cache_dir = "";
+        } else if (input_files.size() > 1) {
+            input_options.object_name = options.out_filename + "." + stem;
+        }
+
+        if (!run) {
+            printf("compiling %s\n", input_file.c_str());
+        }
+        begonia::AstPtr ast;
+        uint64_t file_tokens = 0;
+        auto& parse_cache = begonia::ParseCache::Get();
+        if (!parse_cache.lookup(input_file, ast, file_tokens)) {
+            begonia::Parser parser(input_file);
+            {
+                begonia::TraceScope scope("lex");
+                parser.Tokenize();
+            }
+            {
+                begonia::TraceScope scope("parse");
+                parser.Parse();
+            }
+            ast = parser._ast;
+            file_tokens = parser.TokenCount();
+            parse_cache.insert(input_file, ast, file_tokens);
+        }
+        tokens += file_tokens;
+
+        begonia::CodeGen generator(input_options);
+        int ret_code;
+        {
+            begonia::TraceScope scope("initialize");
+            ret_code = generator.initialize();
+        }
+        if (ret_code != 0) {
+            printf("generator. initialize err\n");
+            return 1;
+        }
+
+        ret_code = generator.compile(ast, options.lto_thin ? bitcodes : objects);
+        if (ret_code != 0) {
+            printf("generator.compile(parser._ast) error");
+            return 1;
+        }
+        has_entry_point = has_entry_point || generator.hasEntryPoint();
+    }
+    profiler.setCounter("tokens", tokens);
+    profiler.setCounter("ast_nodes", begonia::AST::NodeCount());
+
+    if (!compile_only) {
+        if (!has_entry_point && !has_prebuilt_inputs) {
+            printf("Can't find func:main\n");
+            return 1;
+        }
+        begonia::CodeGen linker(options);
+        if (linker.initialize() != 0) {
+            printf("generator. initialize err\n");
+            return 1;
+        }
+        if (!bitcodes.empty()) {
+            begonia::TraceScope scope("lto");
+            bool has_regular_objects = !objects.empty();
+            if (linker.thinLink(bitcodes, has_regular_objects, objects) != 0) {
+                return 1;
+            }
+        }
+        begonia::TraceScope scope("link");
+        if (linker.link(objects) != 0) {
+            printf("link error\n");
+            return 1;
+        }
     }
+    profiler.end();
 
-    ret_code = generator.generate(parser._ast);
-    if (ret_code != 0) {
-        printf("generator.generate(parser._ast) error");
+    if (time_trace && profiler.writeTimeTrace(time_trace_file) != 0) {
         return 1;
     }
+    if (stats) {
+        profiler.printStats(stderr);
+    }
+    if (run) {
+        return runExecutable(options.out_filename);
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+// One compile of a --serve worker, from the arguments given to begonia-client.
+static int serveRequest(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--run" || arg.rfind("--serve", 0) == 0) {
+            printf("%s doesn't go through the compile server\n", argv[i]);
+            return 1;
+        }
+    }
+    begonia::Profiler::Get().reset();
+    begonia::AST::NodeCount() = 0;
+    return driver(argc, argv);
+}
+
+// The workers fork from here once the target is registered and the
+// TargetMachine of every -O level exists, so their first compile is as warm
+// as their last.
+static int serve(const std::string& socket_path, unsigned workers, const begonia::CodeGenOptions& options) {
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int level = 0; level <= 3; level++) {
+        begonia::CodeGenOptions warm_options = options;
+        warm_options.opt_level = level;
+        begonia::CodeGen warm(warm_options);
+        if (warm.initialize() != 0) {
+            printf("generator. initialize err\n");
+            return 1;
+        }
+    }
+    begonia::ParseCache::Get().enable(256);
+    begonia::CompileServer server(socket_path, workers, serveRequest);
+    return server.run();
+}
+
+int main(int argc, char** argv) {
+    return driver(argc, argv);
+}
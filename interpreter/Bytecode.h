@@ -0,0 +1,203 @@
+#ifndef BEGONIA_BYTECODE_H
+#define BEGONIA_BYTECODE_H
+#include "Parser.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// --run executes programs on a register machine before any of them is
+// compiled. Registers hold 64 bits: ints, bools (0 or 1), doubles and the
+// addresses of C strings.
+union Value {
+    int64_t         i;
+    double          d;
+    const char*     s;
+};
+
+enum class BcType: uint8_t {
+    Void,
+    Int,
+    Double,
+    Bool,
+    CString,    // string
+    Str,        // a literal, which only becomes a string
+};
+
+#define BEGONIA_OPCODES(X) \
+    X(MOV)      /* a = b */ \
+    X(LOADK)    /* a = constant bc */ \
+    X(ADDI) X(SUBI) X(MULI) X(DIVI) X(MODI) \
+    X(ADDIK)    /* a = b + c, c a signed 16 bit constant */ \
+    X(ANDI) X(ORI) X(XORI) \
+    X(ADDF) X(SUBF) X(MULF) X(DIVF) X(MODF) \
+    X(EQI) X(NEI) X(LTI) X(LEI) X(GTI) X(GEI) \
+    X(EQF) X(NEF) X(LTF) X(LEF) X(GTF) X(GEF) \
+    X(NOT)      /* a = b == 0 */ \
+    X(TESTI)    /* a = b != 0 */ \
+    X(TESTF)    /* a = b != 0.0, true for NaN */ \
+    X(I2F)      /* a = double(b) */ \
+    X(JMP)      /* to bc */ \
+    X(JZ)       /* to bc if a == 0 */ \
+    X(JNZ)      /* to bc if a != 0 */ \
+    X(LOOP)     /* back edge of loop a, to bc */ \
+    X(CALL)     /* a = function b, its arguments in c, c+1, ... */ \
+    X(TAILCALL) /* return function b, its arguments in c, c+1, ... */ \
+    X(CALLX)    /* a = extern b, its arguments in c, c+1, ... */ \
+    X(RET)      /* return a */ \
+    X(RETV)     /* return 0, the result of void functions and of falling off the end */
+
+enum class Op: uint8_t {
+#define BEGONIA_OPCODE_ENUM(name) name,
+    BEGONIA_OPCODES(BEGONIA_OPCODE_ENUM)
+#undef BEGONIA_OPCODE_ENUM
+};
+
+// op a b c: a is the destination, b and c the operands; jump targets and
+// constant indexes take b and c together as one 32 bit operand
+struct Instr {
+    Op          op;
+    uint16_t    a;
+    uint16_t    b;
+    uint16_t    c;
+
+    uint32_t bc() const {
+        return uint32_t(b) << 16 | c;
+    }
+};
+
+// tier entry of a compiled function, CodeGen::tierEntryGen: takes the
+// arguments as registers and returns the result as one
+using NativeEntry = int64_t (*)(int64_t* args);
+
+struct BcVar {
+    std::string     name;
+    std::string     type;       // int, double, bool or string
+    uint16_t        reg;
+};
+
+// A while loop. Its back edges are counted over all calls of the function;
+// a hot loop gets an on-stack replacement entry: the rest of the function
+// from the loop on, compiled as a function of the variables in scope.
+struct BcLoop {
+    struct Level {
+        AstBlockPtr     block;
+        size_t          index;  // of the statement being run, the loop in the last level
+    };
+    std::vector<Level>          path;       // from the function body down to the loop
+    std::vector<BcVar>          vars;       // in scope at the loop, the parameters of the entry
+    bool                        osr = true; // false for top-level code and shadowed variables
+    uint64_t                    count = 0;
+    std::atomic<NativeEntry>    entry{nullptr};
+};
+
+struct BcFunction {
+    std::string                         name;
+    DeclareFuncStatementPtr             ast;
+    std::vector<BcType>                 params;
+    BcType                              ret = BcType::Void;
+    std::vector<Instr>                  code;
+    std::vector<Value>                  consts;
+    uint32_t                            frame_size = 1;     // registers, parameters first
+    std::set<size_t>                    callees;            // indexes in BcProgram::funcs
+    std::vector<std::unique_ptr<BcLoop>> loops;
+    uint64_t                            calls = 0;
+    std::atomic<NativeEntry>            entry{nullptr};
+};
+
+// x86-64 and AArch64 pass integer and floating point arguments in registers
+// of their own, so the interpreter calls every extern as one taking 6
+// integers and 8 doubles, interpreter.cc
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(__APPLE__)
+#define BEGONIA_EXTERN_CALLS
+#endif
+
+// a function declared without a body, called through its C prototype
+struct BcExtern {
+    static constexpr size_t max_int_args = 6;       // ints, bools and strings
+    static constexpr size_t max_double_args = 8;
+
+    std::string             name;
+    std::vector<BcType>     params;
+    BcType                  ret = BcType::Void;
+    void*                   addr = nullptr;
+};
+
+struct BcProgram {
+    AstBlockPtr                                 ast;
+    std::vector<std::unique_ptr<BcFunction>>    funcs;      // in the order they are declared
+    std::vector<BcExtern>                       externs;
+    std::unique_ptr<BcFunction>                 top;        // top-level statements, then main()
+    std::deque<std::string>                     strings;    // literals, their c_str() are constants
+};
+
+// Compiles a program to bytecode. Programs using more than ints, doubles,
+// bools, C strings and calls are left to the ahead-of-time compiler: compile
+// returns false and why() names the first thing it stopped at.
+class BytecodeCompiler {
+public:
+    bool compile(AstPtr ast, BcProgram& program);
+    const std::string& why() const {
+        return _why;
+    }
+
+private:
+    struct Operand {
+        uint16_t    reg = 0;
+        BcType      type = BcType::Void;
+    };
+    struct Callable {
+        bool        is_extern;
+        size_t      index;
+    };
+    // of the function being compiled
+    struct State {
+        BcFunction*                                 func = nullptr;
+        std::vector<std::map<std::string, Operand>> scopes;     // innermost last
+        std::vector<BcLoop::Level>                  path;
+        uint32_t                                    top = 0;    // first free register
+    };
+
+    BcProgram*                          _program = nullptr;
+    State                               _state;
+    std::map<std::string, Callable>     _callables;
+    std::string                         _why;
+
+    void fail(const std::string& why);
+    void functionGen(DeclareFuncStatementPtr);
+    void externGen(DeclareFuncStatementPtr);
+    void blockGen(AstBlockPtr, bool new_scope = true);
+    bool statementGen(AstPtr);
+    void declareVarGen(DeclareVarStatementPtr);
+    void assignGen(AssignStatementPtr);
+    void ifGen(IfStatementPtr);
+    void whileGen(WhileStatementPtr);
+    void returnGen(ReturnStatementPtr);
+
+    Operand exprGen(ExpressionPtr, int dst = -1);
+    Operand opExprGen(OperationExpressonPtr, int dst);
+    Operand logicalGen(OperationExpressonPtr, int dst);
+    Operand callGen(FuncallExpressionPtr, int dst, bool tail = false);
+    Operand convert(Operand, BcType to, int dst = -1);
+    Operand boolValue(Operand);
+    size_t branchUnless(ExpressionPtr cond);
+    Operand constant(Value value, BcType type, int dst);
+
+    uint16_t temp();
+    size_t emit(Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+    size_t emitWide(Op op, uint32_t a, uint32_t bc);
+    void patch(size_t jump, uint32_t target);
+    size_t here() const;
+    BcType typeOf(const std::string& type_name);
+    const Operand* lookup(const std::string& name);
+};
+
+} //begonia
+#endif
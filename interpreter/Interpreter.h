@@ -0,0 +1,41 @@
+#ifndef BEGONIA_INTERPRETER_H
+#define BEGONIA_INTERPRETER_H
+#include "Bytecode.h"
+
+#include <cstdio>
+
+namespace begonia {
+
+class Tiering;
+
+// Runs the bytecode of a program. Calls of a function and back edges of a
+// loop are counted; at threshold the function, or the rest of it from the
+// loop on, is handed to tiering, and once its native entry is published the
+// interpreter calls that instead.
+class Interpreter {
+public:
+    // tiering may be null, a threshold of 0 never promotes
+    Interpreter(BcProgram& program, Tiering* tiering, uint64_t threshold, bool stats);
+    ~Interpreter();
+
+    // the top-level statements and main, then exit(0)
+    [[noreturn]] void run();
+    // exit() of the program, in the interpreter and in compiled code
+    [[noreturn]] static void exit(int64_t code);
+
+private:
+    BcProgram&      _program;
+    Tiering*        _tiering;
+    uint64_t        _threshold;
+    bool            _stats;
+    Value*          _stack = nullptr;
+    Value*          _stack_end = nullptr;
+
+    static Interpreter* _running;
+
+    Value execute(BcFunction* func, Value* base);
+    void printStats(FILE* out);
+};
+
+} //begonia
+#endif
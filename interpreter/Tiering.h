@@ -0,0 +1,58 @@
+#ifndef BEGONIA_TIERING_H
+#define BEGONIA_TIERING_H
+#include "Bytecode.h"
+#include "CodeGen.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+
+namespace llvm {
+namespace orc {
+class LLJIT;
+}
+}
+
+namespace begonia {
+
+// Compiles what the interpreter finds hot on a thread of its own. Requests
+// waiting together become one module: the functions asked for, everything
+// they call, and an on-stack replacement function per hot loop, generated by
+// CodeGen and loaded into an ORC LLJIT; their tier entries are published
+// to the interpreter once the module is linked.
+class Tiering {
+public:
+    Tiering(BcProgram& program, CodeGenOptions options);
+    ~Tiering();
+
+    // func, or with loop >= 0 the rest of func from that loop on; the thread
+    // starts with the first request
+    void promote(BcFunction* func, int loop = -1);
+    void printStats(FILE* out);
+
+private:
+    struct Request {
+        BcFunction*     func;
+        int             loop;
+    };
+
+    BcProgram&                          _program;
+    CodeGenOptions                      _options;
+    std::unique_ptr<llvm::orc::LLJIT>   _jit;
+    std::mutex                          _mutex;
+    std::condition_variable             _wakeup;
+    std::vector<Request>                _requests;
+    bool                                _started = false;
+    std::atomic<uint64_t>               _modules{0};
+    std::atomic<uint64_t>               _functions{0};
+    std::atomic<uint64_t>               _loops{0};
+    std::atomic<uint64_t>               _compile_us{0};
+
+    void work();
+    bool initializeJit();
+    void compile(const std::vector<Request>& requests);
+    DeclareFuncStatementPtr osrFunction(BcFunction* func, BcLoop& loop, const std::string& name);
+};
+
+} //begonia
+#endif
@@ -0,0 +1,659 @@
+#include "Bytecode.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <dlfcn.h>
+
+namespace begonia {
+
+// calls CodeGen makes itself instead of looking for a function
+static bool isBuiltin(const std::string& name) {
+    static const std::set<std::string> builtins = {
+        "len", "delete", "hash", "vload", "vstore", "vload_masked", "vstore_masked", "shuffle",
+        "select", "spawn", "join", "atomic_load", "atomic_store", "atomic_cas", "fence",
+        "queue_new", "next", "run",
+    };
+    return builtins.count(name) != 0 || name.rfind("reduce_", 0) == 0
+        || name.rfind("atomic_", 0) == 0 || name.rfind("queue_", 0) == 0;
+}
+
+static const char* typeName(BcType type) {
+    switch (type) {
+    case BcType::Int:       return "int";
+    case BcType::Double:    return "double";
+    case BcType::Bool:      return "bool";
+    case BcType::CString:   return "string";
+    case BcType::Str:       return "str";
+    default:                return "void";
+    }
+}
+
+// what the interpreter leaves to the ahead-of-time compiler
+static const char* unsupported(AstType type) {
+    switch (type) {
+    case AstType::DeclareStructStatement:   return "structs";
+    case AstType::ElementAssignStatement:   return "element assignment";
+    case AstType::RegionStatement:          return "regions";
+    case AstType::PforStatement:            return "pfor";
+    case AstType::YieldStatement:           return "yield";
+    case AstType::IndexExpr:                return "indexing";
+    case AstType::SliceExpr:                return "slices";
+    case AstType::MakeExpr:                 return "make";
+    case AstType::MemberExpr:               return "fields";
+    case AstType::AwaitExpr:                return "await";
+    case AstType::NilExp:                   return "nil";
+    default:                                return "this statement";
+    }
+}
+
+bool BytecodeCompiler::compile(AstPtr ast, BcProgram& program) {
+    auto block = std::dynamic_pointer_cast<AstBlock>(ast);
+    assert(block != nullptr);
+    _program = &program;
+    _callables.clear();
+    _why.clear();
+    program.ast = block;
+    program.top = std::make_unique<BcFunction>();
+    program.top->name = "top-level code";
+
+    _state = State();
+    _state.func = program.top.get();
+    blockGen(block, true);
+    // then main(), like the entry point of CodeGen
+    auto main = _callables.find("main");
+    auto exit = _callables.find("exit");
+    if (main == _callables.end() || main->second.is_extern) {
+        fail("no func main");
+    } else if (exit == _callables.end() || !exit->second.is_extern) {
+        fail("no func exit");
+    } else if (!program.funcs[main->second.index]->params.empty()) {
+        fail("main takes parameters");
+    } else {
+        callGen(std::make_shared<FuncallExpression>("main", std::vector<ExpressionPtr>()), -1);
+    }
+    emit(Op::RETV);
+    return _why.empty();
+}
+
+// the first reason is kept, compiling goes on with dummy operands
+void BytecodeCompiler::fail(const std::string& why) {
+    if (_why.empty()) {
+        _why = why;
+    }
+}
+
+void BytecodeCompiler::functionGen(DeclareFuncStatementPtr decl) {
+    if (_state.func != _program->top.get()) {
+        fail("func " + decl->_name + " declared inside a function");
+        return;
+    }
+    if (_callables.count(decl->_name) != 0) {
+        fail("func " + decl->_name + " declared twice");
+        return;
+    }
+    if (decl->_generator || decl->_async) {
+        fail("gen and async func");
+        return;
+    }
+    if (!decl->_annotations.empty()) {
+        // checked by CodeGen, which must not fail on the tiering thread
+        fail("annotations of func " + decl->_name);
+        return;
+    }
+    if (decl->_block->empty()) {
+        externGen(decl);
+        return;
+    }
+    auto func = std::make_unique<BcFunction>();
+    func->name = decl->_name;
+    func->ast = decl;
+    for (auto& param : decl->_decl_vars) {
+        auto type = typeOf(param->_type);
+        if (type == BcType::Void) {
+            fail("parameter " + param->_name + " of type " + param->_type);
+        }
+        func->params.push_back(type);
+    }
+    func->ret = typeOf(decl->_ret_type);
+
+    auto outer = std::move(_state);
+    _state = State();
+    _state.func = func.get();
+    _callables[decl->_name] = Callable{false, _program->funcs.size()};
+    _program->funcs.push_back(std::move(func));
+
+    // parameters are the first registers, in the scope of the body
+    _state.scopes.emplace_back();
+    size_t i = 0;
+    for (auto& param : decl->_decl_vars) {
+        _state.scopes.back()[param->_name] = Operand{temp(), _state.func->params[i++]};
+    }
+    _state.path.push_back({decl->_block, 0});
+    for (auto& statement : *decl->_block) {
+        if (statementGen(statement)) {
+            break;
+        }
+        _state.path.back().index++;
+    }
+    emit(Op::RETV);
+    _state = std::move(outer);
+}
+
+void BytecodeCompiler::externGen(DeclareFuncStatementPtr decl) {
+    BcExtern ext;
+    ext.name = decl->_name;
+    size_t ints = 0;
+    size_t doubles = 0;
+    for (auto& param : decl->_decl_vars) {
+        auto type = typeOf(param->_type);
+        if (type == BcType::Void) {
+            fail("parameter " + param->_name + " of type " + param->_type);
+        }
+        (type == BcType::Double ? doubles : ints)++;
+        ext.params.push_back(type);
+    }
+    ext.ret = typeOf(decl->_ret_type);
+#ifndef BEGONIA_EXTERN_CALLS
+    fail("calls of C functions on this target");
+#endif
+    if (ints > BcExtern::max_int_args || doubles > BcExtern::max_double_args) {
+        fail("func " + ext.name + " takes too many arguments for the interpreter");
+    }
+    ext.addr = dlsym(RTLD_DEFAULT, ext.name.c_str());
+    if (ext.addr == nullptr) {
+        fail("can't find func " + ext.name + " in the process");
+    }
+    _callables[ext.name] = Callable{true, _program->externs.size()};
+    _program->externs.push_back(ext);
+}
+
+void BytecodeCompiler::blockGen(AstBlockPtr block, bool new_scope) {
+    auto top = _state.top;
+    if (new_scope) {
+        _state.scopes.emplace_back();
+    }
+    _state.path.push_back({block, 0});
+    for (auto& statement : *block) {
+        if (statementGen(statement)) {
+            break;
+        }
+        _state.path.back().index++;
+    }
+    _state.path.pop_back();
+    if (new_scope) {
+        _state.scopes.pop_back();
+        _state.top = top;
+    }
+}
+
+// true after a return: the rest of the block is never run
+bool BytecodeCompiler::statementGen(AstPtr statement) {
+    auto top = _state.top;
+    switch (statement->GetType()) {
+    case AstType::DeclareFuncStatement:
+        functionGen(std::dynamic_pointer_cast<DeclareFuncStatement>(statement));
+        return false;
+    case AstType::DeclareVarStatement:
+        // keeps its register
+        declareVarGen(std::dynamic_pointer_cast<DeclareVarStatement>(statement));
+        return false;
+    case AstType::AssignStatement:
+        assignGen(std::dynamic_pointer_cast<AssignStatement>(statement));
+        break;
+    case AstType::IfStatement:
+        ifGen(std::dynamic_pointer_cast<IfStatement>(statement));
+        break;
+    case AstType::WhileStatement:
+        whileGen(std::dynamic_pointer_cast<WhileStatement>(statement));
+        break;
+    case AstType::RetStatement:
+        returnGen(std::dynamic_pointer_cast<ReturnStatement>(statement));
+        _state.top = top;
+        return true;
+    case AstType::FuncallExpr:
+    case AstType::OpExpr:
+    case AstType::BoolExpr:
+    case AstType::NumberExpr:
+    case AstType::StringExpr:
+    case AstType::IdentifierExpr:
+        exprGen(std::dynamic_pointer_cast<Expression>(statement));
+        break;
+    default:
+        fail(unsupported(statement->GetType()));
+        break;
+    }
+    _state.top = top;
+    return false;
+}
+
+void BytecodeCompiler::declareVarGen(DeclareVarStatementPtr decl) {
+    auto type = BcType::Void;
+    if (decl->_type != "") {
+        type = typeOf(decl->_type);
+        if (type == BcType::Void) {
+            fail("var " + decl->_name + " of type " + decl->_type);
+        }
+    }
+    auto reg = temp();
+    if (decl->_assign_value != nullptr) {
+        auto value = exprGen(decl->_assign_value, reg);
+        if (type == BcType::Void) {
+            type = value.type;
+            if (type == BcType::Str || type == BcType::Void) {
+                fail("var " + decl->_name + " of type " + typeName(type));
+            }
+        }
+        convert(value, type, reg);
+    } else if (type != BcType::Void) {
+        // zero, false, 0.0 and NULL alike
+        constant(Value{0}, type, reg);
+    } else {
+        fail("var " + decl->_name + " without a type");
+    }
+    // visible from the next statement on, not in its own initializer
+    _state.scopes.back()[decl->_name] = Operand{reg, type};
+    _state.top = reg + 1;
+}
+
+void BytecodeCompiler::assignGen(AssignStatementPtr assign) {
+    auto var = lookup(assign->_identifier);
+    if (var == nullptr) {
+        fail("undefined var " + assign->_identifier);
+        return;
+    }
+    auto target = *var;
+    convert(exprGen(assign->_assign_value, target.reg), target.type, target.reg);
+}
+
+void BytecodeCompiler::ifGen(IfStatementPtr statement) {
+    std::vector<size_t> ends;
+    auto& branches = statement->_if_blocks;
+    for (size_t i = 0; i < branches.size(); i++) {
+        auto skip = branchUnless(branches[i]._cond);
+        blockGen(branches[i]._block);
+        if (i + 1 < branches.size() || statement->_else_block != nullptr) {
+            ends.push_back(emitWide(Op::JMP, 0, 0));
+        }
+        patch(skip, here());
+    }
+    if (statement->_else_block != nullptr) {
+        blockGen(statement->_else_block);
+    }
+    for (auto end : ends) {
+        patch(end, here());
+    }
+}
+
+void BytecodeCompiler::whileGen(WhileStatementPtr statement) {
+    auto func = _state.func;
+    if (func->loops.size() > UINT16_MAX) {
+        fail("more than 65536 loops in a function");
+        return;
+    }
+    auto loop = std::make_unique<BcLoop>();
+    loop->path = _state.path;
+    // a var shadowing another can't be a parameter of the entry next to it
+    loop->osr = func != _program->top.get();
+    std::set<std::string> names;
+    for (auto& scope : _state.scopes) {
+        for (auto& var : scope) {
+            if (!names.insert(var.first).second) {
+                loop->osr = false;
+            }
+            loop->vars.push_back(BcVar{var.first, typeName(var.second.type), var.second.reg});
+        }
+    }
+    auto index = func->loops.size();
+    func->loops.push_back(std::move(loop));
+
+    auto start = here();
+    auto exit = branchUnless(statement->_condition);
+    blockGen(statement->_block);
+    emitWide(Op::LOOP, index, start);
+    patch(exit, here());
+}
+
+void BytecodeCompiler::returnGen(ReturnStatementPtr statement) {
+    auto func = _state.func;
+    if (func == _program->top.get()) {
+        fail("return in top-level code");
+        return;
+    }
+    if (statement->_ret_values.empty()) {
+        if (func->ret != BcType::Void) {
+            fail("return without a value in func " + func->name);
+        }
+        emit(Op::RETV);
+        return;
+    }
+    // like CodeGen, only the first value is returned
+    auto value = statement->_ret_values[0];
+    auto call = std::dynamic_pointer_cast<FuncallExpression>(value);
+    auto callee = call != nullptr && !isBuiltin(call->_identifier) ? _callables.find(call->_identifier) : _callables.end();
+    if (callee != _callables.end() && !callee->second.is_extern) {
+        auto& target = *_program->funcs[callee->second.index];
+        if (statement->_tail_call && (target.ret != func->ret || target.params != func->params)) {
+            fail("return tailcall of a func of another prototype");
+        }
+        if (target.ret == func->ret) {
+            // reuses the frame, however deep the recursion
+            callGen(call, -1, true);
+            return;
+        }
+    } else if (statement->_tail_call) {
+        fail("return tailcall of a builtin or extern");
+    }
+    auto result = exprGen(value);
+    if (func->ret == BcType::Void) {
+        if (result.type != BcType::Void) {
+            fail("return of a value in void func " + func->name);
+        }
+        emit(Op::RETV);
+        return;
+    }
+    emit(Op::RET, convert(result, func->ret).reg);
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::exprGen(ExpressionPtr expr, int dst) {
+    switch (expr->GetType()) {
+    case AstType::NumberExpr: {
+        auto number = std::dynamic_pointer_cast<NumberExpression>(expr);
+        Value value;
+        if (number->_is_float) {
+            value.d = number->_number;
+            return constant(value, BcType::Double, dst);
+        }
+        value.i = long(number->_number);
+        return constant(value, BcType::Int, dst);
+    }
+    case AstType::BoolExpr:
+        return constant(Value{std::dynamic_pointer_cast<BoolExpression>(expr)->_value}, BcType::Bool, dst);
+    case AstType::StringExpr: {
+        _program->strings.push_back(std::dynamic_pointer_cast<StringExpression>(expr)->_string);
+        Value value;
+        value.s = _program->strings.back().c_str();
+        return constant(value, BcType::Str, dst);
+    }
+    case AstType::IdentifierExpr: {
+        auto name = std::dynamic_pointer_cast<IdentifierExpression>(expr)->_identifier;
+        auto var = lookup(name);
+        if (var == nullptr) {
+            fail("undefined var " + name);
+            return Operand();
+        }
+        if (dst < 0 || dst == var->reg) {
+            return *var;
+        }
+        emit(Op::MOV, dst, var->reg);
+        return Operand{uint16_t(dst), var->type};
+    }
+    case AstType::OpExpr:
+        return opExprGen(std::dynamic_pointer_cast<OperationExpresson>(expr), dst);
+    case AstType::FuncallExpr:
+        return callGen(std::dynamic_pointer_cast<FuncallExpression>(expr), dst);
+    default:
+        fail(unsupported(expr->GetType()));
+        return Operand();
+    }
+}
+
+// the operators of CodeGen's opExprGen on ints, doubles and bools
+BytecodeCompiler::Operand BytecodeCompiler::opExprGen(OperationExpressonPtr expr, int dst) {
+    auto op = expr->_op;
+    if (op == TokenType::TOKEN_OP_AND || op == TokenType::TOKEN_OP_OR) {
+        return logicalGen(expr, dst);
+    }
+    if (op == TokenType::TOKEN_OP_NEG) {
+        auto value = boolValue(exprGen(expr->_rexp));
+        auto reg = dst < 0 ? temp() : dst;
+        emit(Op::NOT, reg, value.reg);
+        return Operand{uint16_t(reg), BcType::Bool};
+    }
+    if (expr->_lexp == nullptr || expr->_rexp == nullptr) {
+        fail("missing operand");
+        return Operand();
+    }
+
+    auto lval = exprGen(expr->_lexp);
+    // i + 1 and i - 1 take the constant from the instruction
+    auto number = std::dynamic_pointer_cast<NumberExpression>(expr->_rexp);
+    if ((op == TokenType::TOKEN_OP_ADD || op == TokenType::TOKEN_OP_SUB) && number != nullptr && !number->_is_float
+     && (lval.type == BcType::Int || lval.type == BcType::Bool)
+     && std::abs(number->_number) <= INT16_MAX) {
+        auto imm = int16_t(op == TokenType::TOKEN_OP_ADD ? long(number->_number) : -long(number->_number));
+        auto reg = dst < 0 ? temp() : dst;
+        emit(Op::ADDIK, reg, lval.reg, uint16_t(imm));
+        return Operand{uint16_t(reg), BcType::Int};
+    }
+    auto rval = exprGen(expr->_rexp);
+    for (auto type : {lval.type, rval.type}) {
+        if (type == BcType::Str || type == BcType::CString) {
+            fail("string operators");
+            return Operand();
+        }
+        if (type == BcType::Void) {
+            fail("an operand of type void");
+            return Operand();
+        }
+    }
+
+    // unifyOperands: bool widens to int, int meets double as double
+    auto type = BcType::Bool;
+    if (lval.type != BcType::Bool || rval.type != BcType::Bool) {
+        type = lval.type == BcType::Double || rval.type == BcType::Double ? BcType::Double : BcType::Int;
+        lval = convert(lval, type);
+        rval = convert(rval, type);
+    }
+    auto reg = dst < 0 ? temp() : dst;
+    auto arith = [&](Op int_op, Op double_op) {
+        if (type == BcType::Bool) {
+            fail("arithmetic on bools");
+        }
+        emit(type == BcType::Double ? double_op : int_op, reg, lval.reg, rval.reg);
+        return Operand{uint16_t(reg), type};
+    };
+    auto bits = [&](Op int_op) {
+        if (type == BcType::Double) {
+            fail("bit operators on doubles");
+        }
+        emit(int_op, reg, lval.reg, rval.reg);
+        return Operand{uint16_t(reg), type};
+    };
+    auto compare = [&](Op int_op, Op double_op, bool ordered) {
+        if (type == BcType::Bool && ordered) {
+            // bools compare as signed i1, where true is -1
+            std::swap(lval, rval);
+        }
+        emit(type == BcType::Double ? double_op : int_op, reg, lval.reg, rval.reg);
+        return Operand{uint16_t(reg), BcType::Bool};
+    };
+    switch (op) {
+    case TokenType::TOKEN_OP_ADD:   return arith(Op::ADDI, Op::ADDF);
+    case TokenType::TOKEN_OP_SUB:   return arith(Op::SUBI, Op::SUBF);
+    case TokenType::TOKEN_OP_MUL:   return arith(Op::MULI, Op::MULF);
+    case TokenType::TOKEN_OP_DIV:   return arith(Op::DIVI, Op::DIVF);
+    case TokenType::TOKEN_OP_MOD:   return arith(Op::MODI, Op::MODF);
+    case TokenType::TOKEN_OP_BAND:  return bits(Op::ANDI);
+    case TokenType::TOKEN_OP_BOR:   return bits(Op::ORI);
+    case TokenType::TOKEN_OP_XOR:   return bits(Op::XORI);
+    case TokenType::TOKEN_OP_EQ:    return compare(Op::EQI, Op::EQF, false);
+    case TokenType::TOKEN_OP_NEQ:   return compare(Op::NEI, Op::NEF, false);
+    case TokenType::TOKEN_OP_LT:    return compare(Op::LTI, Op::LTF, true);
+    case TokenType::TOKEN_OP_LE:    return compare(Op::LEI, Op::LEF, true);
+    case TokenType::TOKEN_OP_GT:    return compare(Op::GTI, Op::GTF, true);
+    case TokenType::TOKEN_OP_GE:    return compare(Op::GEI, Op::GEF, true);
+    default:
+        fail("operator " + std::to_string(int(op)));
+        return Operand();
+    }
+}
+
+// && and || leave the right side alone when the left one decides
+BytecodeCompiler::Operand BytecodeCompiler::logicalGen(OperationExpressonPtr expr, int dst) {
+    bool is_and = expr->_op == TokenType::TOKEN_OP_AND;
+    auto reg = temp();
+    emit(Op::MOV, reg, boolValue(exprGen(expr->_lexp)).reg);
+    auto done = emitWide(is_and ? Op::JZ : Op::JNZ, reg, 0);
+    emit(Op::MOV, reg, boolValue(exprGen(expr->_rexp)).reg);
+    patch(done, here());
+    if (dst >= 0) {
+        emit(Op::MOV, dst, reg);
+        reg = dst;
+    }
+    return Operand{uint16_t(reg), BcType::Bool};
+}
+
+// Arguments go to consecutive registers above everything live, where the
+// frame of the callee starts; the result lands in dst or the first of them.
+BytecodeCompiler::Operand BytecodeCompiler::callGen(FuncallExpressionPtr call, int dst, bool tail) {
+    auto& name = call->_identifier;
+    if (isBuiltin(name)) {
+        fail("builtin " + name);
+        return Operand();
+    }
+    auto callable = _callables.find(name);
+    if (callable == _callables.end()) {
+        fail("call of undeclared func " + name);
+        return Operand();
+    }
+    bool is_extern = callable->second.is_extern;
+    auto index = callable->second.index;
+    auto& params = is_extern ? _program->externs[index].params : _program->funcs[index]->params;
+    auto ret = is_extern ? _program->externs[index].ret : _program->funcs[index]->ret;
+    if (call->_parameters.size() != params.size()) {
+        fail("func " + name + " takes " + std::to_string(params.size()) + " arguments");
+        return Operand();
+    }
+
+    auto base = _state.top;
+    for (size_t i = 0; i < params.size(); i++) {
+        _state.top = base + i;
+        auto slot = temp();
+        convert(exprGen(call->_parameters[i], slot), params[i], slot);
+    }
+    _state.top = base;
+    _state.func->frame_size = std::max<uint32_t>(_state.func->frame_size, base + 1);
+    if (!is_extern) {
+        _state.func->callees.insert(index);
+    }
+    if (tail) {
+        emit(Op::TAILCALL, 0, index, base);
+        return Operand{0, ret};
+    }
+    auto reg = dst < 0 ? temp() : dst;
+    emit(is_extern ? Op::CALLX : Op::CALL, reg, index, base);
+    return Operand{uint16_t(reg), ret};
+}
+
+// convertValue of CodeGen: assignments, arguments and return values
+BytecodeCompiler::Operand BytecodeCompiler::convert(Operand value, BcType to, int dst) {
+    auto from = value.type;
+    if (from == to || (from == BcType::Bool && to == BcType::Int) || (from == BcType::Str && to == BcType::CString)) {
+        if (dst >= 0 && dst != value.reg) {
+            emit(Op::MOV, dst, value.reg);
+            value.reg = dst;
+        }
+        value.type = to;
+        return value;
+    }
+    if (to == BcType::Double && (from == BcType::Int || from == BcType::Bool)) {
+        auto reg = dst < 0 ? temp() : dst;
+        emit(Op::I2F, reg, value.reg);
+        return Operand{uint16_t(reg), to};
+    }
+    fail(std::string("a ") + typeName(from) + " where a " + typeName(to) + " is expected");
+    return Operand{value.reg, to};
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::boolValue(Operand value) {
+    switch (value.type) {
+    case BcType::Bool:
+        return value;
+    case BcType::Int:
+    case BcType::Double: {
+        auto reg = temp();
+        emit(value.type == BcType::Int ? Op::TESTI : Op::TESTF, reg, value.reg);
+        return Operand{reg, BcType::Bool};
+    }
+    default:
+        fail(std::string("a ") + typeName(value.type) + " can't be used as condition");
+        return value;
+    }
+}
+
+// the jump to patch with where the code goes when cond is false
+size_t BytecodeCompiler::branchUnless(ExpressionPtr cond) {
+    auto top = _state.top;
+    auto value = exprGen(cond);
+    if (value.type == BcType::Double) {
+        value = boolValue(value);
+    } else if (value.type != BcType::Int && value.type != BcType::Bool) {
+        fail(std::string("a ") + typeName(value.type) + " can't be used as condition");
+    }
+    _state.top = top;
+    return emitWide(Op::JZ, value.reg, 0);
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::constant(Value value, BcType type, int dst) {
+    auto& consts = _state.func->consts;
+    auto reg = dst < 0 ? temp() : dst;
+    emitWide(Op::LOADK, reg, consts.size());
+    consts.push_back(value);
+    return Operand{uint16_t(reg), type};
+}
+
+uint16_t BytecodeCompiler::temp() {
+    if (_state.top >= UINT16_MAX) {
+        fail("more than 65535 registers in a function");
+        return 0;
+    }
+    auto reg = _state.top++;
+    _state.func->frame_size = std::max(_state.func->frame_size, _state.top);
+    return reg;
+}
+
+size_t BytecodeCompiler::emit(Op op, uint32_t a, uint32_t b, uint32_t c) {
+    _state.func->code.push_back(Instr{op, uint16_t(a), uint16_t(b), uint16_t(c)});
+    return _state.func->code.size() - 1;
+}
+
+size_t BytecodeCompiler::emitWide(Op op, uint32_t a, uint32_t bc) {
+    return emit(op, a, bc >> 16, bc & 0xffff);
+}
+
+void BytecodeCompiler::patch(size_t jump, uint32_t target) {
+    auto& instr = _state.func->code[jump];
+    instr.b = target >> 16;
+    instr.c = target & 0xffff;
+}
+
+size_t BytecodeCompiler::here() const {
+    return _state.func->code.size();
+}
+
+// void for void and for anything the interpreter has no registers for
+BcType BytecodeCompiler::typeOf(const std::string& type_name) {
+    static const std::map<std::string, BcType> types = {
+        {"int", BcType::Int}, {"double", BcType::Double}, {"bool", BcType::Bool},
+        {"string", BcType::CString}, {"void", BcType::Void},
+    };
+    auto found = types.find(type_name);
+    if (found == types.end()) {
+        fail("values of type " + type_name);
+        return BcType::Void;
+    }
+    return found->second;
+}
+
+const BytecodeCompiler::Operand* BytecodeCompiler::lookup(const std::string& name) {
+    for (auto scope = _state.scopes.rbegin(); scope != _state.scopes.rend(); ++scope) {
+        auto found = scope->find(name);
+        if (found != scope->end()) {
+            return &found->second;
+        }
+    }
+    return nullptr;
+}
+
+} //begonia
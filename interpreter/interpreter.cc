@@ -0,0 +1,293 @@
+#include "Interpreter.h"
+#include "Tiering.h"
+
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace begonia {
+
+// registers of all frames, reserved up front and touched as calls go deeper
+static constexpr size_t stack_slots = size_t(1) << 24;
+
+Interpreter* Interpreter::_running = nullptr;
+
+Interpreter::Interpreter(BcProgram& program, Tiering* tiering, uint64_t threshold, bool stats)
+    : _program(program), _tiering(tiering), _threshold(threshold), _stats(stats) {
+    void* stack = mmap(nullptr, stack_slots * sizeof(Value), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) {
+        fprintf(stderr, "can't reserve the interpreter stack\n");
+        std::exit(1);
+    }
+    _stack = static_cast<Value*>(stack);
+    _stack_end = _stack + stack_slots;
+    for (auto& ext : _program.externs) {
+        if (ext.name == "exit") {
+            ext.addr = reinterpret_cast<void*>(&Interpreter::exit);
+        }
+    }
+}
+
+Interpreter::~Interpreter() {
+    munmap(_stack, stack_slots * sizeof(Value));
+}
+
+void Interpreter::run() {
+    _running = this;
+    if (_program.top->frame_size > stack_slots) {
+        fprintf(stderr, "stack overflow\n");
+        exit(1);
+    }
+    execute(_program.top.get(), _stack);
+    exit(0);
+}
+
+// Leaves without static destructors or atexit handlers: the tiering thread
+// may be inside LLVM. stdio is flushed like exit() would.
+void Interpreter::exit(int64_t code) {
+    fflush(nullptr);
+    if (_running != nullptr && _running->_stats) {
+        _running->printStats(stderr);
+    }
+    _exit(int(code));
+}
+
+void Interpreter::printStats(FILE* out) {
+    fprintf(out, "===-------------------------------------------------------------------------===\n");
+    fprintf(out, "  %-36s %8lu\n", "bytecode_functions", (unsigned long)_program.funcs.size());
+    if (_tiering != nullptr) {
+        _tiering->printStats(out);
+    }
+    fprintf(out, "===-------------------------------------------------------------------------===\n");
+}
+
+// like native code running out of stack
+[[noreturn]] static void stackOverflow() {
+    fprintf(stderr, "stack overflow\n");
+    fflush(nullptr);
+    signal(SIGSEGV, SIG_DFL);
+    raise(SIGSEGV);
+    abort();
+}
+
+// like the idiv of x86-64
+[[noreturn]] static void divisionTrap() {
+    fflush(nullptr);
+    signal(SIGFPE, SIG_DFL);
+    raise(SIGFPE);
+    abort();
+}
+
+// x86-64 and AArch64 pass integers and doubles in registers of their own,
+// so a C function with up to 6 of the one and 8 of the other, in any order,
+// finds them where a call with 6 integers and 8 doubles left them. The
+// doubles are variadic, which on x86-64 also tells printf and the like how
+// many vector registers hold arguments.
+using ExternIntCall = int64_t (*)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, ...);
+using ExternDoubleCall = double (*)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, ...);
+
+static int64_t callExtern(const BcExtern& ext, const Value* args) {
+    int64_t ints[BcExtern::max_int_args] = {0};
+    double doubles[BcExtern::max_double_args] = {0};
+    size_t n_int = 0;
+    size_t n_double = 0;
+    for (size_t i = 0; i < ext.params.size(); i++) {
+        if (ext.params[i] == BcType::Double) {
+            doubles[n_double++] = args[i].d;
+        } else {
+            ints[n_int++] = args[i].i;
+        }
+    }
+    if (ext.ret == BcType::Double) {
+        Value result;
+        result.d = reinterpret_cast<ExternDoubleCall>(ext.addr)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5],
+            doubles[0], doubles[1], doubles[2], doubles[3], doubles[4], doubles[5], doubles[6], doubles[7]);
+        return result.i;
+    }
+    auto result = reinterpret_cast<ExternIntCall>(ext.addr)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5],
+        doubles[0], doubles[1], doubles[2], doubles[3], doubles[4], doubles[5], doubles[6], doubles[7]);
+    // a C bool only defines the low bit
+    return ext.ret == BcType::Bool ? result & 1 : result;
+}
+
+// Threaded code where the compiler has computed goto, a switch elsewhere.
+// Calls don't recurse on the C stack: frames are kept in a vector and the
+// callee's registers start at the caller's argument registers.
+Value Interpreter::execute(BcFunction* func, Value* base) {
+    struct Frame {
+        BcFunction*     func;
+        const Instr*    pc;
+        Value*          base;
+    };
+    std::vector<Frame> frames;
+    const Instr* code = func->code.data();
+    const Instr* pc = code;
+    const Value* consts = func->consts.data();
+    Value result;
+
+#if defined(__GNUC__)
+#define BEGONIA_OPCODE_LABEL(name) &&op_##name,
+    static const void* const labels[] = {BEGONIA_OPCODES(BEGONIA_OPCODE_LABEL)};
+#undef BEGONIA_OPCODE_LABEL
+#define DISPATCH()      goto *labels[static_cast<uint8_t>(pc->op)]
+#define OPCODE(name)    op_##name:
+#define INTERPRET       DISPATCH();
+#else
+#define DISPATCH()      goto dispatch
+#define OPCODE(name)    case Op::name:
+#define INTERPRET       dispatch: switch (pc->op)
+#endif
+#define NEXT()          do { ++pc; DISPATCH(); } while (0)
+#define JUMP(target)    do { pc = code + (target); DISPATCH(); } while (0)
+#define RA              base[pc->a]
+#define RB              base[pc->b]
+#define RC              base[pc->c]
+#define WRAP(op)        int64_t(uint64_t(RB.i) op uint64_t(RC.i))
+
+    INTERPRET {
+    OPCODE(MOV)     RA = RB;                                NEXT();
+    OPCODE(LOADK)   RA = consts[pc->bc()];                  NEXT();
+    OPCODE(ADDI)    RA.i = WRAP(+);                         NEXT();
+    OPCODE(SUBI)    RA.i = WRAP(-);                         NEXT();
+    OPCODE(MULI)    RA.i = WRAP(*);                         NEXT();
+    OPCODE(DIVI)
+        if (RC.i == 0 || (RC.i == -1 && RB.i == INT64_MIN)) {
+            divisionTrap();
+        }
+        RA.i = RB.i / RC.i;
+        NEXT();
+    OPCODE(MODI)
+        if (RC.i == 0 || (RC.i == -1 && RB.i == INT64_MIN)) {
+            divisionTrap();
+        }
+        RA.i = RB.i % RC.i;
+        NEXT();
+    OPCODE(ADDIK)   RA.i = int64_t(uint64_t(RB.i) + uint64_t(int64_t(int16_t(pc->c)))); NEXT();
+    OPCODE(ANDI)    RA.i = RB.i & RC.i;                     NEXT();
+    OPCODE(ORI)     RA.i = RB.i | RC.i;                     NEXT();
+    OPCODE(XORI)    RA.i = RB.i ^ RC.i;                     NEXT();
+    OPCODE(ADDF)    RA.d = RB.d + RC.d;                     NEXT();
+    OPCODE(SUBF)    RA.d = RB.d - RC.d;                     NEXT();
+    OPCODE(MULF)    RA.d = RB.d * RC.d;                     NEXT();
+    OPCODE(DIVF)    RA.d = RB.d / RC.d;                     NEXT();
+    OPCODE(MODF)    RA.d = std::fmod(RB.d, RC.d);           NEXT();
+    OPCODE(EQI)     RA.i = RB.i == RC.i;                    NEXT();
+    OPCODE(NEI)     RA.i = RB.i != RC.i;                    NEXT();
+    OPCODE(LTI)     RA.i = RB.i < RC.i;                     NEXT();
+    OPCODE(LEI)     RA.i = RB.i <= RC.i;                    NEXT();
+    OPCODE(GTI)     RA.i = RB.i > RC.i;                     NEXT();
+    OPCODE(GEI)     RA.i = RB.i >= RC.i;                    NEXT();
+    OPCODE(EQF)     RA.i = RB.d == RC.d;                    NEXT();
+    OPCODE(NEF)     RA.i = RB.d != RC.d;                    NEXT();
+    OPCODE(LTF)     RA.i = RB.d < RC.d;                     NEXT();
+    OPCODE(LEF)     RA.i = RB.d <= RC.d;                    NEXT();
+    OPCODE(GTF)     RA.i = RB.d > RC.d;                     NEXT();
+    OPCODE(GEF)     RA.i = RB.d >= RC.d;                    NEXT();
+    OPCODE(NOT)     RA.i = RB.i == 0;                       NEXT();
+    OPCODE(TESTI)   RA.i = RB.i != 0;                       NEXT();
+    OPCODE(TESTF)   RA.i = RB.d != 0.0;                     NEXT();
+    OPCODE(I2F)     RA.d = double(RB.i);                    NEXT();
+    OPCODE(JMP)     JUMP(pc->bc());
+    OPCODE(JZ)
+        if (RA.i == 0) {
+            JUMP(pc->bc());
+        }
+        NEXT();
+    OPCODE(JNZ)
+        if (RA.i != 0) {
+            JUMP(pc->bc());
+        }
+        NEXT();
+    OPCODE(LOOP) {
+        auto& loop = *func->loops[pc->a];
+        auto entry = loop.entry.load(std::memory_order_acquire);
+        if (entry != nullptr) {
+            // on-stack replacement: the compiled rest of the function
+            // takes the variables in scope and returns for this frame
+            std::vector<int64_t> args(loop.vars.size());
+            for (size_t i = 0; i < args.size(); i++) {
+                args[i] = base[loop.vars[i].reg].i;
+            }
+            result.i = entry(args.data());
+            goto ret;
+        }
+        if (++loop.count == _threshold && loop.osr && _tiering != nullptr) {
+            _tiering->promote(func, pc->a);
+        }
+        JUMP(pc->bc());
+    }
+    OPCODE(CALL) {
+        auto callee = _program.funcs[pc->b].get();
+        auto args = base + pc->c;
+        auto entry = callee->entry.load(std::memory_order_acquire);
+        if (entry != nullptr) {
+            RA.i = entry(&args->i);
+            NEXT();
+        }
+        if (++callee->calls == _threshold && _tiering != nullptr) {
+            _tiering->promote(callee);
+        }
+        if (args + callee->frame_size > _stack_end) {
+            stackOverflow();
+        }
+        frames.push_back(Frame{func, pc, base});
+        func = callee;
+        base = args;
+        code = pc = func->code.data();
+        consts = func->consts.data();
+        DISPATCH();
+    }
+    OPCODE(TAILCALL) {
+        auto callee = _program.funcs[pc->b].get();
+        auto args = base + pc->c;
+        auto entry = callee->entry.load(std::memory_order_acquire);
+        if (entry != nullptr) {
+            result.i = entry(&args->i);
+            goto ret;
+        }
+        if (++callee->calls == _threshold && _tiering != nullptr) {
+            _tiering->promote(callee);
+        }
+        if (base + callee->frame_size > _stack_end) {
+            stackOverflow();
+        }
+        std::memmove(base, args, callee->params.size() * sizeof(Value));
+        func = callee;
+        code = pc = func->code.data();
+        consts = func->consts.data();
+        DISPATCH();
+    }
+    OPCODE(CALLX)   RA.i = callExtern(_program.externs[pc->b], base + pc->c); NEXT();
+    OPCODE(RET)     result = RA;                            goto ret;
+    OPCODE(RETV)    result.i = 0;                           goto ret;
+    }
+
+ret:
+    if (frames.empty()) {
+        return result;
+    }
+    func = frames.back().func;
+    pc = frames.back().pc;
+    base = frames.back().base;
+    frames.pop_back();
+    code = func->code.data();
+    consts = func->consts.data();
+    RA = result;
+    NEXT();
+
+#undef DISPATCH
+#undef OPCODE
+#undef INTERPRET
+#undef NEXT
+#undef JUMP
+#undef RA
+#undef RB
+#undef RC
+#undef WRAP
+}
+
+} //begonia
@@ -0,0 +1,199 @@
+#include "Tiering.h"
+#include "Interpreter.h"
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <chrono>
+#include <thread>
+
+namespace begonia {
+
+Tiering::Tiering(BcProgram& program, CodeGenOptions options): _program(program), _options(options) {
+    _options.jit = true;
+}
+
+Tiering::~Tiering() {
+}
+
+void Tiering::promote(BcFunction* func, int loop) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _requests.push_back(Request{func, loop});
+    if (!_started) {
+        // detached: programs end with _exit, whatever is being compiled
+        _started = true;
+        std::thread(&Tiering::work, this).detach();
+    }
+    _wakeup.notify_one();
+}
+
+void Tiering::work() {
+    if (!initializeJit()) {
+        // everything stays interpreted
+        return;
+    }
+    while (true) {
+        std::vector<Request> requests;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wakeup.wait(lock, [this] { return !_requests.empty(); });
+            requests.swap(_requests);
+        }
+        compile(requests);
+    }
+}
+
+bool Tiering::initializeJit() {
+    CodeGen::initializeTargets();
+    auto jit = llvm::orc::LLJITBuilder().create();
+    if (!jit) {
+        llvm::logAllUnhandledErrors(jit.takeError(), llvm::errs(), "jit: ");
+        return false;
+    }
+    _jit = std::move(*jit);
+    // externs are the C functions of this process
+    auto& dylib = _jit->getMainJITDylib();
+    auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(_jit->getDataLayout().getGlobalPrefix());
+    if (!process) {
+        llvm::logAllUnhandledErrors(process.takeError(), llvm::errs(), "jit: ");
+        return false;
+    }
+    dylib.addGenerator(std::move(*process));
+    // but exit() leaves like the interpreter's
+    auto exit_addr = reinterpret_cast<void*>(&Interpreter::exit);
+#if LLVM_VERSION_MAJOR >= 17
+    llvm::orc::ExecutorSymbolDef exit_symbol(llvm::orc::ExecutorAddr::fromPtr(exit_addr), llvm::JITSymbolFlags::Exported);
+#else
+    llvm::JITEvaluatedSymbol exit_symbol(llvm::pointerToJITTargetAddress(exit_addr), llvm::JITSymbolFlags::Exported);
+#endif
+    if (auto err = dylib.define(llvm::orc::absoluteSymbols({{_jit->mangleAndIntern("exit"), exit_symbol}}))) {
+        llvm::logAllUnhandledErrors(std::move(err), llvm::errs(), "jit: ");
+        return false;
+    }
+    return true;
+}
+
+static NativeEntry lookupEntry(llvm::orc::LLJIT& jit, const std::string& name) {
+    auto symbol = jit.lookup(name);
+    if (!symbol) {
+        llvm::logAllUnhandledErrors(symbol.takeError(), llvm::errs(), "jit: ");
+        return nullptr;
+    }
+#if LLVM_VERSION_MAJOR >= 15
+    return symbol->toPtr<NativeEntry>();
+#else
+    return reinterpret_cast<NativeEntry>(symbol->getAddress());
+#endif
+}
+
+// One module for all requests: the functions they name and everything those
+// call, in the order of the source, then the on-stack replacement functions.
+// Symbols of a module are suffixed with its number, everything but the tier
+// entries is internal.
+void Tiering::compile(const std::vector<Request>& requests) {
+    auto start = std::chrono::steady_clock::now();
+    std::set<std::string> names;
+    std::vector<BcFunction*> worklist;
+    for (auto& request : requests) {
+        worklist.push_back(request.func);
+    }
+    while (!worklist.empty()) {
+        auto func = worklist.back();
+        worklist.pop_back();
+        if (names.insert(func->name).second) {
+            for (auto callee : func->callees) {
+                worklist.push_back(_program.funcs[callee].get());
+            }
+        }
+    }
+    auto ast = std::make_shared<AstBlock>();
+    for (auto& statement : *_program.ast) {
+        auto decl = std::dynamic_pointer_cast<DeclareFuncStatement>(statement);
+        if (decl != nullptr && (decl->_block->empty() || names.count(decl->_name) != 0)) {
+            ast->push_back(decl);
+        }
+    }
+
+    auto suffix = ".tier" + std::to_string(_modules.load());
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::vector<std::atomic<NativeEntry>*> targets;
+    uint64_t loops = 0;
+    for (auto& request : requests) {
+        if (request.loop < 0) {
+            entries.push_back({request.func->name, request.func->name + suffix});
+            targets.push_back(&request.func->entry);
+            continue;
+        }
+        auto& loop = *request.func->loops[request.loop];
+        auto name = request.func->name + ".osr" + std::to_string(request.loop);
+        ast->push_back(osrFunction(request.func, loop, name));
+        entries.push_back({name, name + suffix});
+        targets.push_back(&loop.entry);
+        loops++;
+    }
+
+    llvm::SmallVector<char, 0> object;
+    {
+        CodeGen generator(_options);
+        if (generator.initialize() != 0 || generator.jitCompile(ast, entries, object) != 0) {
+            fprintf(stderr, "jit: can't compile %s\n", entries[0].first.c_str());
+            return;
+        }
+    }
+    auto buffer = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()), "tier" + suffix);
+    if (auto err = _jit->addObjectFile(std::move(buffer))) {
+        llvm::logAllUnhandledErrors(std::move(err), llvm::errs(), "jit: ");
+        return;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto entry = lookupEntry(*_jit, entries[i].second);
+        if (entry != nullptr) {
+            targets[i]->store(entry, std::memory_order_release);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    _modules++;
+    _functions += names.size();
+    _loops += loops;
+    _compile_us += elapsed.count();
+}
+
+// The rest of func from the loop on, as a function of the variables in scope
+// there. Each block around the loop keeps what follows it: the rest of block k
+// becomes `if true { rest }` in block k-1, followed by the loop of level k-1
+// again if that is a while, and by the rest of block k-1.
+DeclareFuncStatementPtr Tiering::osrFunction(BcFunction* func, BcLoop& loop, const std::string& name) {
+    auto& path = loop.path;
+    auto level = path.back();
+    std::vector<AstPtr> rest(level.block->begin() + level.index, level.block->end());
+    for (size_t k = path.size() - 1; k-- > 0;) {
+        level = path[k];
+        auto inner = std::make_shared<AstBlock>();
+        inner->assign(rest.begin(), rest.end());
+        auto scope = std::make_shared<IfStatement>(
+            std::vector<IfBlock>{IfBlock{inner, std::make_shared<BoolExpression>(true)}}, nullptr);
+        rest = {scope};
+        auto statement = (*level.block)[level.index];
+        if (statement->GetType() == AstType::WhileStatement) {
+            rest.push_back(statement);
+        }
+        rest.insert(rest.end(), level.block->begin() + level.index + 1, level.block->end());
+    }
+    auto body = std::make_shared<AstBlock>();
+    body->assign(rest.begin(), rest.end());
+    std::list<DeclareVarStatementPtr> params;
+    for (auto& var : loop.vars) {
+        params.push_back(std::make_shared<DeclareVarStatement>(var.name, var.type, nullptr));
+    }
+    return std::make_shared<DeclareFuncStatement>(name, params, func->ast->_ret_type, body);
+}
+
+void Tiering::printStats(FILE* out) {
+    fprintf(out, "  %-36s %8lu\n", "jit_modules", (unsigned long)_modules.load());
+    fprintf(out, "  %-36s %8lu\n", "jit_functions", (unsigned long)_functions.load());
+    fprintf(out, "  %-36s %8lu\n", "jit_loop_entries", (unsigned long)_loops.load());
+    fprintf(out, "  %-36s %8lu\n", "jit_compile_ms", (unsigned long)(_compile_us.load() / 1000));
+}
+
+} //begonia
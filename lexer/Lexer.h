@@ -56,6 +56,8 @@ namespace begonia
         TOKEN_KW_NIL,
         TOKEN_KW_DOUBLE,
         TOKEN_KW_STRING,
+        TOKEN_KW_STRUCT,
+        TOKEN_KW_EXPORT,
 
         TOKEN_NUMBER,
         TOKEN_STRING,
@@ -77,6 +79,10 @@ namespace begonia
         Lexer(std::string file_name);
         Token GetNextToken();
         Token LookAhead(size_t step);
+        void Tokenize();
+        size_t TokenCount() const {
+            return tokens_.size();
+        }
 
     private:
         bool SkipWhitespaceAndEmptyline();
@@ -27,6 +27,8 @@ namespace begonia {
             {"nil", 	TokenType::TOKEN_KW_NIL},
             {"double", 	TokenType::TOKEN_KW_DOUBLE},
             {"string", 	TokenType::TOKEN_KW_STRING},
+            {"struct", 	TokenType::TOKEN_KW_STRUCT},
+            {"export", 	TokenType::TOKEN_KW_EXPORT},
         };
 
         for(auto kv : key_word_type_) {
@@ -171,4 +173,12 @@ namespace begonia {
         return tokens_[token_index_ + step];
     }
 
+    // scan the rest of the source up front, so lexing can be measured apart from parsing
+    void Lexer::Tokenize() {
+        while (is_ready_ && next_token_.val != TokenType::TOKEN_SEP_EOF) {
+            next_token_ = NextToken();
+            tokens_.push_back(next_token_);
+        }
+    }
+
 }
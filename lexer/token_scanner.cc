@@ -1,7 +1,7 @@
 #include "Lexer.h"
 
+#include <cctype>
 #include <iostream>
-#include <regex>
 
 namespace begonia {
     void Lexer::InitAcceptableCharacterTable()
@@ -129,6 +129,28 @@ namespace begonia {
         // source_.unget();
     }
 
+    // [[:digit:]]+
+    static bool IsInteger(const std::string& word)
+    {
+        if (word.empty())
+            return false;
+        for (char ch : word)
+            if (!isdigit((unsigned char)ch))
+                return false;
+        return true;
+    }
+
+    // [a-zA-Z_][a-zA-Z0-9_]*
+    static bool IsIdentifier(const std::string& word)
+    {
+        if (word.empty() || isdigit((unsigned char)word[0]))
+            return false;
+        for (char ch : word)
+            if (!isalnum((unsigned char)ch) && ch != '_')
+                return false;
+        return true;
+    }
+
     bool Lexer::IsSeparationCharacter(char ch)
     {
         return acceptable_Chars_[ch] == 2 ? true : false;
@@ -177,15 +199,18 @@ namespace begonia {
 
     Token Lexer::ScanNumberToken(std::string word)
     {
-        std::regex integer("[[:digit:]]+");
-        if (!regex_match(word, integer)) {
+        if (!IsInteger(word)) {
             return Token{TokenType::TOKEN_SEP_EOF, current_line_, "ScanNumberToken", src_file_name_};
         }
         else {
             char ch = source_.get();
-            if (ch == '.') {
+            if (ch == '.' && source_.peek() == '.') {
+                // 0..n is a range, not 0. followed by .n
+                source_.unget();
+                return Token{TokenType::TOKEN_NUMBER, current_line_, word, src_file_name_};
+            } else if (ch == '.') {
                 std::string float_number = GetWord();
-                if (!regex_match(float_number, integer)) {
+                if (!IsInteger(float_number)) {
                     Interrupt("need number");
                 }
                 float_number = word + "." + float_number;
@@ -219,8 +244,7 @@ namespace begonia {
 
     Token Lexer::ScanIdentifierToken(std::string word)
     {
-        std::regex identifier("[a-zA-Z_][a-zA-Z0-9_]*");
-        if (!regex_match(word, identifier))
+        if (!IsIdentifier(word))
             return Token{TokenType::TOKEN_SEP_EOF, current_line_, "ScanIdentifierToken", src_file_name_};
         else
             return Token{TokenType::TOKEN_IDENTIFIER, current_line_, word, src_file_name_};
@@ -81,5 +81,65 @@ namespace begonia
     };
     using FuncallExpressionPtr = std::shared_ptr<FuncallExpression>;
 
+    // a[i]
+    struct IndexExpression: public Expression {
+        ExpressionPtr   _base;
+        ExpressionPtr   _index;
+        IndexExpression(ExpressionPtr base, ExpressionPtr index){
+            _base = base;
+            _index = index;
+            _type = AstType::IndexExpr;
+        }
+    };
+    using IndexExpressionPtr = std::shared_ptr<IndexExpression>;
+
+    // a[low:high], both bounds are optional
+    struct SliceExpression: public Expression {
+        ExpressionPtr   _base;
+        ExpressionPtr   _low;
+        ExpressionPtr   _high;
+        SliceExpression(ExpressionPtr base, ExpressionPtr low, ExpressionPtr high){
+            _base = base;
+            _low = low;
+            _high = high;
+            _type = AstType::SliceExpr;
+        }
+    };
+    using SliceExpressionPtr = std::shared_ptr<SliceExpression>;
+
+    // make([]double, n): heap allocated array of n elements
+    struct MakeExpression: public Expression {
+        std::string     _slice_type;
+        ExpressionPtr   _length;
+        MakeExpression(std::string slice_type, ExpressionPtr length){
+            _slice_type = slice_type;
+            _length = length;
+            _type = AstType::MakeExpr;
+        }
+    };
+    using MakeExpressionPtr = std::shared_ptr<MakeExpression>;
+
+    // p.x
+    struct MemberExpression: public Expression {
+        ExpressionPtr   _base;
+        std::string     _field;
+        MemberExpression(ExpressionPtr base, std::string field){
+            _base = base;
+            _field = field;
+            _type = AstType::MemberExpr;
+        }
+    };
+    using MemberExpressionPtr = std::shared_ptr<MemberExpression>;
+
+    // await exp: in an async func, the result of a task or I/O operation
+    struct AwaitExpression: public Expression {
+        ExpressionPtr   _value;
+        AwaitExpression(ExpressionPtr value){
+            _value = value;
+            _type = AstType::AwaitExpr;
+        }
+    };
+    using AwaitExpressionPtr = std::shared_ptr<AwaitExpression>;
+
 }
 #endif
@@ -6,19 +6,27 @@ block := {Statement}
 Statement := IfStat
         | DeclarVarStat
         | DeclarFuncStat
+        | DeclarStructStat
         | AssignStat
         | ForStat
         | WhileStat
+        | RegionStat
+        | PforStat
+        | YieldStat
         | RetStat
         | exp
         | ;
 
 IfStat          := if exp '{' block '}' [elif exp '{' block '}'] [else '{' block '}'] 
-DeclarVarStat   := var identifier ['=' exp] ;
-DeclarFuncStat  := func identifier '(' () | (exp [',' exp])  ')' '{' block '}' ;
-AssignStat      := identifier '=' exp ;
+DeclarVarStat   := var identifier [type] ['=' exp] ;
+DeclarFuncStat  := {export | gen | async | pure | inline | noinline | hot | cold} func identifier '(' () | (identifier type [',' identifier type])  ')' type '{' block '}' ;
+DeclarStructStat:= struct identifier {packed | align '(' number ')' | reorder} '{' {identifier type ';'} '}'
+AssignStat      := identifier '=' exp | exp1 ('[' exp ']' | '.' identifier) '=' exp ;
 WhileStat       := while exp '{' block '}' 
-RetStat         := return | return exp ["," exp];
+RegionStat      := region '{' block '}'
+PforStat        := pfor identifier in exp '..' exp [grain exp] [reduce identifier '(' identifier ')' {',' identifier '(' identifier ')'}] '{' block '}'
+YieldStat       := yield exp ;
+RetStat         := return | return exp ["," exp] | return tailcall funcallStat ;
 ExprStat        := exp;
 
 exp  := exp7 {('||') exp7}
@@ -27,14 +35,19 @@ exp6 := exp5 { ('<='|'>='|'=='|'<'|'>'|'!=') exp5}
 exp5 := exp4 { ('+'|'-') exp4}
 exp4 := exp3 {('*'|'/'|'%') exp3}
 exp3 := exp2 {('|' | '&' | '^') exp2}
-exp2 := !exp1 | exp1
-exp1 :=  '(' exp8 ')' | nil | false | true | number | string | identifier | funcallStat
+exp2 := !exp1 | await exp1 | exp1
+exp1 :=  ('(' exp8 ')' | nil | false | true | number | string | identifier | funcallStat | make) {postfix}
+postfix := '[' exp ']' | '[' [exp] ':' [exp] ']' | '.' identifier
+make  := make '(' ['soa'] '[' ']' type ',' exp ')'
+
+type := identifier | double | string | '[' number ']' type | '[' ']' type | vec '<' type ',' number '>' | '&' type | soa '[' [number] ']' type | atomic '<' type '>' | gen '<' type '>' | task '<' type '>'
 */
 
 #include "Lexer.h"
 #include "Statement.h"
 #include "Expression.h"
 #include <functional>
+#include <set>
 
 namespace begonia
 {
@@ -45,6 +58,8 @@ namespace begonia
     public:
         Parser(std::string source_file);
         void Parse();
+        void Tokenize();
+        size_t TokenCount() const;
         AstPtr      _ast;
 
     private:
@@ -67,6 +82,15 @@ namespace begonia
         auto ParseMultipleExpression()  -> std::vector<ExpressionPtr>;
         auto ParseReturnStatement()     -> ReturnStatementPtr;
         auto ParseWhileStatement()      -> WhileStatementPtr;
+        auto ParseRegionStatement()     -> RegionStatementPtr;
+        auto ParsePforStatement()       -> PforStatementPtr;
+        auto ParseYieldStatement()      -> YieldStatementPtr;
+        auto ParseElementAssignStatement() -> AstPtr;
+        auto ParseDeclareStructStatement() -> DeclareStructStatementPtr;
+        auto ParseType()                -> std::string;
+        bool IsTypeStart(Token token);
+        bool IsFuncAnnotation(Token token);
+        bool IsFuncPrefix(Token token);
 
         static void ParseError(Token token, std::string expected_word);
         void initStatementParser();
@@ -80,6 +104,8 @@ namespace begonia
         auto ParseExpressionL3()    -> ExpressionPtr;
         auto ParseExpressionL2()    -> ExpressionPtr;
         auto ParseExpressionL1()    -> ExpressionPtr;
+        auto ParsePostfixExpression(ExpressionPtr base) -> ExpressionPtr;
+        auto ParseMakeExpression()  -> ExpressionPtr;
 
         ExpressionPtr
         ParseOpExpression ( std::vector<TokenType>  accepted_token_type,
@@ -6,6 +6,8 @@
 #include <vector>
 #include <memory>
 #include <list>
+#include <set>
+#include <string>
 
 namespace begonia
 {
@@ -62,6 +64,10 @@ namespace begonia
         std::list<DeclareVarStatementPtr>    _decl_vars;
         std::string	                        _ret_type;
         AstBlockPtr                         _block;
+        bool                                _export = false;   // export func: visible to other files
+        std::set<std::string>               _annotations;      // pure, inline, noinline, hot, cold
+        bool                                _generator = false; // gen func: yields values of _ret_type
+        bool                                _async = false;     // async func: calls return a task<_ret_type>
 
         DeclareFuncStatement(std::string name, std::list<DeclareVarStatementPtr> decl_vars, std::string ret_type, AstBlockPtr  block) {
             _name = name;
@@ -76,6 +82,24 @@ namespace begonia
     };
     using DeclareFuncStatementPtr = std::shared_ptr<DeclareFuncStatement>;
 
+    struct DeclareStructStatement: public Statement {
+        std::string                         _name;
+        std::list<DeclareVarStatementPtr>   _fields;
+        bool                                _packed = false;    // no padding between fields
+        unsigned                            _align = 0;         // align(N), 0 for the natural alignment
+        bool                                _reorder = false;   // fields may be reordered to drop padding
+
+        DeclareStructStatement(std::string name, std::list<DeclareVarStatementPtr> fields) {
+            _name = name;
+            _fields = fields;
+        }
+
+        AstType GetType() override {
+            return AstType::DeclareStructStatement;
+        }
+    };
+    using DeclareStructStatementPtr = std::shared_ptr<DeclareStructStatement>;
+
     struct AssignStatement: public Statement {
         std::string        _identifier;
         ExpressionPtr      _assign_value;
@@ -91,6 +115,22 @@ namespace begonia
     };
     using AssignStatementPtr = std::shared_ptr<AssignStatement>;
 
+    // a[i] = exp; p.x = exp; and chains of them like a[i].pos[0] = exp;
+    struct ElementAssignStatement: public Statement {
+        ExpressionPtr       _target;    // IndexExpression or MemberExpression
+        ExpressionPtr       _assign_value;
+
+        ElementAssignStatement(ExpressionPtr target, ExpressionPtr assign_value) {
+            _target = target;
+            _assign_value = assign_value;
+        }
+
+        AstType GetType() override {
+            return AstType::ElementAssignStatement;
+        }
+    };
+    using ElementAssignStatementPtr = std::shared_ptr<ElementAssignStatement>;
+
     struct WhileStatement: public Statement {
         ExpressionPtr      _condition;
         AstBlockPtr        _block;
@@ -106,11 +146,74 @@ namespace begonia
     };
     using WhileStatementPtr = std::shared_ptr<WhileStatement>;
 
+    // region { ... }: allocations of the block are released when it is left
+    struct RegionStatement: public Statement {
+        AstBlockPtr        _block;
+
+        RegionStatement(AstBlockPtr block) {
+            _block = block;
+        }
+
+        AstType GetType() override {
+            return AstType::RegionStatement;
+        }
+    };
+    using RegionStatementPtr = std::shared_ptr<RegionStatement>;
+
+    // reduce sum(x): x is combined over the iterations with op
+    struct PforReduction {
+        std::string        op;     // sum, min or max
+        std::string        name;
+    };
+
+    // pfor i in low..high [grain g] [reduce op(x), ...] { ... }: the
+    // iterations run on the worker threads in any order
+    struct PforStatement: public Statement {
+        std::string                 _var;
+        ExpressionPtr               _low;
+        ExpressionPtr               _high;
+        ExpressionPtr               _grain;     // nullptr: chosen by the runtime
+        std::vector<PforReduction>  _reductions;
+        AstBlockPtr                 _block;
+
+        PforStatement(std::string var, ExpressionPtr low, ExpressionPtr high, ExpressionPtr grain,
+                      std::vector<PforReduction> reductions, AstBlockPtr block) {
+            _var = var;
+            _low = low;
+            _high = high;
+            _grain = grain;
+            _reductions = reductions;
+            _block = block;
+        }
+
+        AstType GetType() override {
+            return AstType::PforStatement;
+        }
+    };
+    using PforStatementPtr = std::shared_ptr<PforStatement>;
+
+    // yield exp; in a gen func: hands exp to next() and suspends until the
+    // next call of next()
+    struct YieldStatement: public Statement {
+        ExpressionPtr      _value;
+
+        YieldStatement(ExpressionPtr value) {
+            _value = value;
+        }
+
+        AstType GetType() override {
+            return AstType::YieldStatement;
+        }
+    };
+    using YieldStatementPtr = std::shared_ptr<YieldStatement>;
+
     struct ReturnStatement: public Statement {
         std::vector<ExpressionPtr>  _ret_values;
+        bool                        _tail_call = false;    // return tailcall f(...)
 
-        ReturnStatement(std::vector<ExpressionPtr>  ret_values) {
+        ReturnStatement(std::vector<ExpressionPtr>  ret_values, bool tail_call = false) {
             _ret_values = ret_values;
+            _tail_call = tail_call;
         }
 
         AstType GetType() override {
@@ -12,6 +12,7 @@ enum class AstType: uint8_t {
     AssignStatement,
     DeclareVarStatement,
     DeclareFuncStatement,
+    DeclareStructStatement,
     WhileStatement,
     RetStatement,
     Expr,
@@ -22,16 +23,32 @@ enum class AstType: uint8_t {
     NumberExpr,
     StringExpr,
     IdentifierExpr,
+    IndexExpr,
+    SliceExpr,
+    MakeExpr,
+    MemberExpr,
+    AwaitExpr,
+    ElementAssignStatement,
+    RegionStatement,
+    PforStatement,
+    YieldStatement,
     Semicolon
 };
 struct AST {
     AstType _type;
+    long    _line = 0;      // of the first token of a statement, for debug info
     AST(){
         _type = AstType::Unknown;
+        NodeCount()++;
     }
     virtual AstType GetType(){
         return _type;
     }
+    // number of AST nodes created so far, reported by --stats
+    static uint64_t& NodeCount(){
+        static uint64_t count = 0;
+        return count;
+    }
 };
 using AstPtr = std::shared_ptr<AST>;
 
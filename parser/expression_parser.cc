@@ -96,6 +96,14 @@ namespace begonia {
             auto opExp = new OperationExpresson(operator_token.val, nullptr, rExp);
             return OperationExpressonPtr(opExp);
         }
+        if (try_token.val == TokenType::TOKEN_IDENTIFIER && try_token.word == "await"
+            && (_lexer.LookAhead(1).val == TokenType::TOKEN_IDENTIFIER
+             || _lexer.LookAhead(1).val == TokenType::TOKEN_SEP_LPAREN)) {
+            // await f(x), unless await is a variable
+            _lexer.GetNextToken();
+            ExpressionPtr value = ParseExpressionL1();
+            return AwaitExpressionPtr(new AwaitExpression(value));
+        }
 
         return ParseExpressionL1();
     }
@@ -106,14 +114,15 @@ namespace begonia {
         Token token;
         switch (try_token.val)
         {
-        case TokenType::TOKEN_SEP_LPAREN: // ()
+        case TokenType::TOKEN_SEP_LPAREN: { // ()
             _lexer.GetNextToken();
-            ParseExpression();
+            ExpressionPtr exp = ParseExpression();
             token = _lexer.GetNextToken();
             if (token.val != TokenType::TOKEN_SEP_RPAREN) {
                 ParseError(try_token,")");
             }
-            break;
+            return ParsePostfixExpression(exp);
+        }
 
         case TokenType::TOKEN_KW_FALSE:
             token = _lexer.GetNextToken();
@@ -147,10 +156,13 @@ namespace begonia {
         case TokenType::TOKEN_IDENTIFIER:
             try_token1 = _lexer.LookAhead(1);
             if (try_token1.val == TokenType::TOKEN_SEP_LPAREN) {
-                return ParseFuncallExpression();
+                if (try_token.word == "make") {
+                    return ParseMakeExpression();
+                }
+                return ParsePostfixExpression(ParseFuncallExpression());
             } else {
                 token = _lexer.GetNextToken();
-                return IdentifierExpressionPtr(new IdentifierExpression{token.word});
+                return ParsePostfixExpression(IdentifierExpressionPtr(new IdentifierExpression{token.word}));
             }
             break;
 
@@ -162,6 +174,68 @@ namespace begonia {
         return ExpressionPtr(nullptr);
     }
     
+    // base '[' exp ']' | base '[' [exp] ':' [exp] ']' | base '.' identifier, repeated
+    auto Parser::ParsePostfixExpression(ExpressionPtr base) -> ExpressionPtr {
+        while (_lexer.LookAhead(0).val == TokenType::TOKEN_SEP_LBRACKET
+            || (_lexer.LookAhead(0).val == TokenType::TOKEN_SEP_DOT
+             && _lexer.LookAhead(1).val != TokenType::TOKEN_SEP_DOT)) {
+            if (_lexer.GetNextToken().val == TokenType::TOKEN_SEP_DOT) {
+                Token field = _lexer.GetNextToken();
+                if (field.val != TokenType::TOKEN_IDENTIFIER) {
+                    ParseError(field, "field name");
+                }
+                base = MemberExpressionPtr(new MemberExpression{base, field.word});
+                continue;
+            }
+            ExpressionPtr low = nullptr;
+            ExpressionPtr high = nullptr;
+            bool is_slice = false;
+
+            if (_lexer.LookAhead(0).val != TokenType::TOKEN_SEP_COLON) {
+                low = ParseExpression();
+            }
+            if (_lexer.LookAhead(0).val == TokenType::TOKEN_SEP_COLON) {
+                _lexer.GetNextToken(); // :
+                is_slice = true;
+                if (_lexer.LookAhead(0).val != TokenType::TOKEN_SEP_RBRACKET) {
+                    high = ParseExpression();
+                }
+            }
+            Token rbracket = _lexer.GetNextToken();
+            if (rbracket.val != TokenType::TOKEN_SEP_RBRACKET) {
+                ParseError(rbracket, "]");
+            }
+
+            if (is_slice) {
+                base = SliceExpressionPtr(new SliceExpression{base, low, high});
+            } else {
+                base = IndexExpressionPtr(new IndexExpression{base, low});
+            }
+        }
+        return base;
+    }
+
+    // make '(' ['soa'] '[' ']' type ',' exp ')'
+    auto Parser::ParseMakeExpression() -> ExpressionPtr {
+        _lexer.GetNextToken(); // make
+        _lexer.GetNextToken(); // (
+        Token type_token = _lexer.LookAhead(0);
+        std::string slice_type = ParseType();
+        if (slice_type.compare(0, 2, "[]") != 0 && slice_type.compare(0, 5, "soa[]") != 0) {
+            ParseError(type_token, "slice type like []double or soa []Point");
+        }
+        Token comma = _lexer.GetNextToken();
+        if (comma.val != TokenType::TOKEN_SEP_COMMA) {
+            ParseError(comma, ",");
+        }
+        ExpressionPtr length = ParseExpression();
+        Token rparen = _lexer.GetNextToken();
+        if (rparen.val != TokenType::TOKEN_SEP_RPAREN) {
+            ParseError(rparen, ")");
+        }
+        return ParsePostfixExpression(MakeExpressionPtr(new MakeExpression{slice_type, length}));
+    }
+
     auto Parser::ParseMultipleExpression() -> std::vector<ExpressionPtr>{
         std::vector<ExpressionPtr> parameters;
         bool is_continue_parse = true;
@@ -10,6 +10,11 @@ namespace begonia
         _statement_parsers[AstType::DeclareVarStatement]  = std::bind(&Parser::ParseDeclareVarStatement,this);
         _statement_parsers[AstType::RetStatement]       = std::bind(&Parser::ParseReturnStatement,this);
         _statement_parsers[AstType::WhileStatement]     = std::bind(&Parser::ParseWhileStatement,this);
+        _statement_parsers[AstType::RegionStatement]    = std::bind(&Parser::ParseRegionStatement,this);
+        _statement_parsers[AstType::PforStatement]      = std::bind(&Parser::ParsePforStatement,this);
+        _statement_parsers[AstType::YieldStatement]     = std::bind(&Parser::ParseYieldStatement,this);
+        _statement_parsers[AstType::ElementAssignStatement] = std::bind(&Parser::ParseElementAssignStatement,this);
+        _statement_parsers[AstType::DeclareStructStatement] = std::bind(&Parser::ParseDeclareStructStatement,this);
         _statement_parsers[AstType::Expr]               = std::bind(&Parser::ParseExpressionStatement,this);
         _statement_parsers[AstType::Semicolon]          = std::bind(&Parser::ParseSemicolon,this);
     }
@@ -55,9 +60,31 @@ namespace begonia
             return AstType::DeclareVarStatement;
 
         case TokenType::TOKEN_KW_FUNC:
+        case TokenType::TOKEN_KW_EXPORT:
             return AstType::DeclareFuncStatement;
 
+        case TokenType::TOKEN_KW_STRUCT:
+            return AstType::DeclareStructStatement;
+
         case TokenType::TOKEN_IDENTIFIER:
+            if (IsFuncPrefix(token) && (token2.val == TokenType::TOKEN_KW_FUNC
+             || token2.val == TokenType::TOKEN_KW_EXPORT || IsFuncPrefix(token2))) {
+                // pure func f() ..., cold export func g() ..., gen func h() ..., async func k() ...
+                return AstType::DeclareFuncStatement;
+            }
+            if (token.word == "await" && token2.val == TokenType::TOKEN_IDENTIFIER) {
+                return AstType::Expr;
+            }
+            if (token.word == "region" && token2.val == TokenType::TOKEN_SEP_LCURLY) {
+                return AstType::RegionStatement;
+            }
+            if (token.word == "pfor" && token2.val == TokenType::TOKEN_IDENTIFIER) {
+                return AstType::PforStatement;
+            }
+            if (token.word == "yield" && token2.val != TokenType::TOKEN_OP_ASSIGN
+             && token2.val != TokenType::TOKEN_SEP_LBRACKET && token2.val != TokenType::TOKEN_SEP_DOT) {
+                return AstType::YieldStatement;
+            }
             if (token2.val == TokenType::TOKEN_OP_ASSIGN) {
                 return AstType::AssignStatement;
             }
@@ -65,6 +92,10 @@ namespace begonia
                 //return AstType::FuncallExpr;
                 return AstType::Expr;
             }
+            else if (token2.val == TokenType::TOKEN_SEP_LBRACKET || token2.val == TokenType::TOKEN_SEP_DOT) {
+                // a[i] = exp; p.x = exp; or an expression statement starting with them
+                return AstType::ElementAssignStatement;
+            }
             else if(isExprToken(token2.val)){
                 return AstType::Expr;
             }
@@ -99,8 +130,12 @@ namespace begonia
         if (statement_type == AstType::Unknown) {
             exit(1);
         }
+        long line = _lexer.LookAhead(0).line;
         auto statement_parser = _statement_parsers[statement_type];
         AstPtr statement = statement_parser();
+        if (statement != nullptr) {
+            statement->_line = line;
+        }
         return statement;
     }
 
@@ -120,6 +155,14 @@ namespace begonia
         _ast = block;
     }
 
+    void Parser::Tokenize() {
+        _lexer.Tokenize();
+    }
+
+    size_t Parser::TokenCount() const {
+        return _lexer.TokenCount();
+    }
+
     void Parser::ParseError(Token token, std::string expectedWord) {
         printf("[ParseError]:\nParse error at %s, line=%ld\n", token.file_name.c_str(), token.line);
         printf("want '%s', but have '%s'\n", expectedWord.c_str(), token.word.c_str());
@@ -175,6 +218,78 @@ namespace begonia
         return WhileStatementPtr(statement);
     }
 
+    auto Parser::ParseRegionStatement() -> RegionStatementPtr {
+        Token region_token = _lexer.GetNextToken();
+        if (region_token.val != TokenType::TOKEN_IDENTIFIER || region_token.word != "region") {
+            ParseError(region_token, "region");
+        }
+        AstBlockPtr block = ParseCurlyBlock();
+        return RegionStatementPtr(new RegionStatement(block));
+    }
+
+    auto Parser::ParsePforStatement() -> PforStatementPtr {
+        Token pfor_token = _lexer.GetNextToken();
+        if (pfor_token.val != TokenType::TOKEN_IDENTIFIER || pfor_token.word != "pfor") {
+            ParseError(pfor_token, "pfor");
+        }
+        Token var_token = _lexer.GetNextToken();
+        if (var_token.val != TokenType::TOKEN_IDENTIFIER) {
+            ParseError(var_token, "identifier");
+        }
+        Token in_token = _lexer.GetNextToken();
+        if (in_token.val != TokenType::TOKEN_IDENTIFIER || in_token.word != "in") {
+            ParseError(in_token, "in");
+        }
+        ExpressionPtr low = ParseExpression();
+        for (int i = 0; i < 2; i++) {
+            Token dot = _lexer.GetNextToken();
+            if (dot.val != TokenType::TOKEN_SEP_DOT) {
+                ParseError(dot, "..");
+            }
+        }
+        ExpressionPtr high = ParseExpression();
+
+        ExpressionPtr grain;
+        if (_lexer.LookAhead(0).val == TokenType::TOKEN_IDENTIFIER && _lexer.LookAhead(0).word == "grain") {
+            _lexer.GetNextToken();
+            grain = ParseExpression();
+        }
+        std::vector<PforReduction> reductions;
+        if (_lexer.LookAhead(0).val == TokenType::TOKEN_IDENTIFIER && _lexer.LookAhead(0).word == "reduce") {
+            _lexer.GetNextToken();
+            while (true) {
+                Token op = _lexer.GetNextToken();
+                if (op.val != TokenType::TOKEN_IDENTIFIER || (op.word != "sum" && op.word != "min" && op.word != "max")) {
+                    ParseError(op, "sum, min or max");
+                }
+                Token lparen = _lexer.GetNextToken();
+                Token name = _lexer.GetNextToken();
+                Token rparen = _lexer.GetNextToken();
+                if (lparen.val != TokenType::TOKEN_SEP_LPAREN || name.val != TokenType::TOKEN_IDENTIFIER
+                 || rparen.val != TokenType::TOKEN_SEP_RPAREN) {
+                    ParseError(name, op.word + "(variable)");
+                }
+                reductions.push_back(PforReduction{op.word, name.word});
+                if (_lexer.LookAhead(0).val != TokenType::TOKEN_SEP_COMMA) {
+                    break;
+                }
+                _lexer.GetNextToken();
+            }
+        }
+        AstBlockPtr block = ParseCurlyBlock();
+        return PforStatementPtr(new PforStatement(var_token.word, low, high, grain, reductions, block));
+    }
+
+    auto Parser::ParseYieldStatement() -> YieldStatementPtr {
+        Token yield_token = _lexer.GetNextToken();
+        if (yield_token.val != TokenType::TOKEN_IDENTIFIER || yield_token.word != "yield") {
+            ParseError(yield_token, "yield");
+        }
+        ExpressionPtr value = ParseExpression();
+        ParseSemicolon();
+        return YieldStatementPtr(new YieldStatement(value));
+    }
+
     auto Parser::ParseReturnStatement() -> ReturnStatementPtr {
         Token return_token = _lexer.GetNextToken();
         if (return_token.val != TokenType::TOKEN_KW_RETURN) {
@@ -182,16 +297,45 @@ namespace begonia
         }
         std::vector<ExpressionPtr> return_val;
         Token try_token = _lexer.LookAhead(0);
+        bool tail_call = false;
+        if (try_token.val == TokenType::TOKEN_IDENTIFIER && try_token.word == "tailcall"
+         && _lexer.LookAhead(1).val == TokenType::TOKEN_IDENTIFIER) {
+            // return tailcall f(...); fails to compile unless the call reuses the frame
+            _lexer.GetNextToken();
+            tail_call = true;
+            try_token = _lexer.LookAhead(0);
+        }
         if (try_token.val != TokenType::TOKEN_SEP_SEMICOLON) {
             return_val = ParseMultipleExpression();
         }
+        if (tail_call && (return_val.size() != 1 || return_val[0]->GetType() != AstType::FuncallExpr)) {
+            ParseError(try_token, "a function call after tailcall");
+        }
         ParseSemicolon();
 
-        return ReturnStatementPtr(new ReturnStatement(return_val));
+        return ReturnStatementPtr(new ReturnStatement(return_val, tail_call));
     }
 
     auto Parser::ParseDeclareFuncStatement() -> DeclareFuncStatementPtr {
-        Token func_kw_token = _lexer.GetNextToken(); // func
+        Token func_kw_token = _lexer.GetNextToken(); // {export | gen | async | annotation} func
+        bool exported = false;
+        bool generator = false;
+        bool async = false;
+        std::set<std::string> annotations;
+        while (true) {
+            if (func_kw_token.val == TokenType::TOKEN_KW_EXPORT && !exported) {
+                exported = true;
+            } else if (func_kw_token.val == TokenType::TOKEN_IDENTIFIER && func_kw_token.word == "gen" && !generator && !async) {
+                generator = true;
+            } else if (func_kw_token.val == TokenType::TOKEN_IDENTIFIER && func_kw_token.word == "async" && !async && !generator) {
+                async = true;
+            } else if (IsFuncAnnotation(func_kw_token) && annotations.count(func_kw_token.word) == 0) {
+                annotations.insert(func_kw_token.word);
+            } else {
+                break;
+            }
+            func_kw_token = _lexer.GetNextToken();
+        }
         if (func_kw_token.val != TokenType::TOKEN_KW_FUNC) {
             ParseError(func_kw_token, "func");
             return DeclareFuncStatementPtr(nullptr);
@@ -234,15 +378,19 @@ namespace begonia
         } 
 
         //return type
-        Token ret_type = _lexer.GetNextToken();
-        if (ret_type.val != TokenType::TOKEN_IDENTIFIER) {
+        Token ret_type = _lexer.LookAhead(0);
+        if (!IsTypeStart(ret_type)) {
             ParseError(ret_type, "Need return type ");
             return DeclareFuncStatementPtr(nullptr);
         }
+        std::string ret_type_name = ParseType();
 
         AstBlockPtr block(new AstBlock);
         Token try_token = _lexer.LookAhead(0);
         if (try_token.val == TokenType::TOKEN_SEP_SEMICOLON) {
+            if (exported) {
+                ParseError(try_token, "a body for the exported function");
+            }
             _lexer.GetNextToken();
         } else {
             block = ParseCurlyBlock();
@@ -251,9 +399,13 @@ namespace begonia
         auto defFuncStat = new DeclareFuncStatement(
             identifier_token.word,
             decl_vars,
-            ret_type.word,
+            ret_type_name,
             block
         );
+        defFuncStat->_export = exported;
+        defFuncStat->_generator = generator;
+        defFuncStat->_async = async;
+        defFuncStat->_annotations = annotations;
 
         return DeclareFuncStatementPtr(defFuncStat);
         
@@ -269,11 +421,8 @@ namespace begonia
         // var type
         std::string type = "";
         Token try_token = _lexer.LookAhead(0);
-        if (try_token.val == TokenType::TOKEN_IDENTIFIER
-            || try_token.val == TokenType::TOKEN_KW_STRING
-            || try_token.val == TokenType::TOKEN_KW_DOUBLE) {
-            type = try_token.word;
-            _lexer.GetNextToken(); // pass type
+        if (IsTypeStart(try_token)) {
+            type = ParseType();
         }
         // =
         try_token = _lexer.LookAhead(0);
@@ -341,6 +490,193 @@ namespace begonia
         return AssignStatementPtr(statement);
     }
 
+    auto Parser::ParseElementAssignStatement() -> AstPtr {
+        Token start_token = _lexer.LookAhead(0);
+        ExpressionPtr target = ParseExpression();
+
+        Token try_token = _lexer.LookAhead(0);
+        if (try_token.val != TokenType::TOKEN_OP_ASSIGN) {
+            ParseSemicolon();
+            return target;
+        }
+        _lexer.GetNextToken(); // =
+
+        if (target->GetType() != AstType::IndexExpr && target->GetType() != AstType::MemberExpr) {
+            ParseError(start_token, "identifier, index or field expression before '='");
+        }
+        ExpressionPtr exp = ParseExpression();
+        ParseSemicolon();
+
+        auto statement = new ElementAssignStatement(target, exp);
+        return ElementAssignStatementPtr(statement);
+    }
+
+    auto Parser::ParseDeclareStructStatement() -> DeclareStructStatementPtr {
+        Token struct_token = _lexer.GetNextToken();
+        if (struct_token.val != TokenType::TOKEN_KW_STRUCT) {
+            ParseError(struct_token, "struct");
+        }
+        Token name_token = _lexer.GetNextToken();
+        if (name_token.val != TokenType::TOKEN_IDENTIFIER) {
+            ParseError(name_token, "identifier");
+        }
+
+        auto statement = DeclareStructStatementPtr(new DeclareStructStatement(name_token.word, {}));
+        // layout attributes
+        while (_lexer.LookAhead(0).val == TokenType::TOKEN_IDENTIFIER) {
+            Token attr = _lexer.GetNextToken();
+            if (attr.word == "packed") {
+                statement->_packed = true;
+            } else if (attr.word == "reorder") {
+                statement->_reorder = true;
+            } else if (attr.word == "align") {
+                Token lparen = _lexer.GetNextToken();
+                Token align = _lexer.GetNextToken();
+                Token rparen = _lexer.GetNextToken();
+                if (lparen.val != TokenType::TOKEN_SEP_LPAREN) {
+                    ParseError(lparen, "(");
+                }
+                if (align.val != TokenType::TOKEN_NUMBER || align.word.find('.') != std::string::npos
+                 || std::stod(align.word) <= 0) {
+                    ParseError(align, "positive integer alignment");
+                }
+                if (rparen.val != TokenType::TOKEN_SEP_RPAREN) {
+                    ParseError(rparen, ")");
+                }
+                statement->_align = unsigned(std::stoul(align.word));
+            } else {
+                ParseError(attr, "packed, align(N), reorder or {");
+            }
+        }
+
+        Token lcurly = _lexer.GetNextToken();
+        if (lcurly.val != TokenType::TOKEN_SEP_LCURLY) {
+            ParseError(lcurly, "{");
+        }
+        while (_lexer.LookAhead(0).val != TokenType::TOKEN_SEP_RCURLY) {
+            Token field = _lexer.GetNextToken();
+            if (field.val != TokenType::TOKEN_IDENTIFIER) {
+                ParseError(field, "field name");
+            }
+            if (!IsTypeStart(_lexer.LookAhead(0))) {
+                ParseError(_lexer.LookAhead(0), "field type");
+            }
+            std::string type = ParseType();
+            statement->_fields.push_back(DeclareVarStatementPtr(new DeclareVarStatement(field.word, type, nullptr)));
+            ParseSemicolon();
+        }
+        _lexer.GetNextToken(); // }
+        return statement;
+    }
+
+    bool Parser::IsFuncAnnotation(Token token) {
+        static const std::set<std::string> annotations = {"pure", "inline", "noinline", "hot", "cold"};
+        return token.val == TokenType::TOKEN_IDENTIFIER && annotations.count(token.word) != 0;
+    }
+
+    // words that may come before func: the annotations, gen and async
+    bool Parser::IsFuncPrefix(Token token) {
+        return IsFuncAnnotation(token)
+            || (token.val == TokenType::TOKEN_IDENTIFIER && (token.word == "gen" || token.word == "async"));
+    }
+
+    bool Parser::IsTypeStart(Token token) {
+        return token.val == TokenType::TOKEN_IDENTIFIER
+            || token.val == TokenType::TOKEN_KW_STRING
+            || token.val == TokenType::TOKEN_KW_DOUBLE
+            || token.val == TokenType::TOKEN_SEP_LBRACKET
+            || token.val == TokenType::TOKEN_OP_BAND;
+    }
+
+    // Types are kept in their source spelling: "double", "[8]double", "[]int", "vec<double,4>", "&Point",
+    // "soa[]Point".
+    auto Parser::ParseType() -> std::string {
+        Token token = _lexer.GetNextToken();
+        if (token.val == TokenType::TOKEN_OP_BAND) {
+            return "&" + ParseType();
+        }
+        if (token.val == TokenType::TOKEN_IDENTIFIER && token.word == "vec"
+            && _lexer.LookAhead(0).val == TokenType::TOKEN_OP_LT) {
+            // vec<double,4>
+            _lexer.GetNextToken(); // <
+            std::string elem_type = ParseType();
+            Token comma = _lexer.GetNextToken();
+            if (comma.val != TokenType::TOKEN_SEP_COMMA) {
+                ParseError(comma, ",");
+            }
+            Token lanes = _lexer.GetNextToken();
+            if (lanes.val != TokenType::TOKEN_NUMBER || lanes.word.find('.') != std::string::npos
+             || std::stod(lanes.word) <= 0) {
+                ParseError(lanes, "positive integer lane count");
+            }
+            Token gt = _lexer.GetNextToken();
+            if (gt.val != TokenType::TOKEN_OP_GT) {
+                ParseError(gt, ">");
+            }
+            return "vec<" + elem_type + "," + lanes.word + ">";
+        }
+        if (token.val == TokenType::TOKEN_IDENTIFIER && token.word == "atomic"
+            && _lexer.LookAhead(0).val == TokenType::TOKEN_OP_LT) {
+            // atomic<int>
+            _lexer.GetNextToken(); // <
+            std::string elem_type = ParseType();
+            Token gt = _lexer.GetNextToken();
+            if (gt.val != TokenType::TOKEN_OP_GT) {
+                ParseError(gt, ">");
+            }
+            return "atomic<" + elem_type + ">";
+        }
+        if (token.val == TokenType::TOKEN_IDENTIFIER && token.word == "gen"
+            && _lexer.LookAhead(0).val == TokenType::TOKEN_OP_LT) {
+            // gen<int>
+            _lexer.GetNextToken(); // <
+            std::string elem_type = ParseType();
+            Token gt = _lexer.GetNextToken();
+            if (gt.val != TokenType::TOKEN_OP_GT) {
+                ParseError(gt, ">");
+            }
+            return "gen<" + elem_type + ">";
+        }
+        if (token.val == TokenType::TOKEN_IDENTIFIER && token.word == "task"
+            && _lexer.LookAhead(0).val == TokenType::TOKEN_OP_LT) {
+            // task<int>
+            _lexer.GetNextToken(); // <
+            std::string elem_type = ParseType();
+            Token gt = _lexer.GetNextToken();
+            if (gt.val != TokenType::TOKEN_OP_GT) {
+                ParseError(gt, ">");
+            }
+            return "task<" + elem_type + ">";
+        }
+        if (token.val == TokenType::TOKEN_IDENTIFIER && token.word == "soa"
+            && _lexer.LookAhead(0).val == TokenType::TOKEN_SEP_LBRACKET) {
+            // soa [1024]Particle
+            return "soa" + ParseType();
+        }
+        if (token.val == TokenType::TOKEN_IDENTIFIER
+            || token.val == TokenType::TOKEN_KW_STRING
+            || token.val == TokenType::TOKEN_KW_DOUBLE) {
+            return token.word;
+        }
+        if (token.val != TokenType::TOKEN_SEP_LBRACKET) {
+            ParseError(token, "type");
+            return "";
+        }
+        std::string length = "";
+        Token try_token = _lexer.GetNextToken();
+        if (try_token.val == TokenType::TOKEN_NUMBER) {
+            if (try_token.word.find('.') != std::string::npos || std::stod(try_token.word) <= 0) {
+                ParseError(try_token, "positive integer array length");
+            }
+            length = try_token.word;
+            try_token = _lexer.GetNextToken();
+        }
+        if (try_token.val != TokenType::TOKEN_SEP_RBRACKET) {
+            ParseError(try_token, "]");
+        }
+        return "[" + length + "]" + ParseType();
+    }
+
     auto Parser::ParseIfStatement() -> IfStatementPtr {
         Token if_token = _lexer.GetNextToken();
         if (if_token.val != TokenType::TOKEN_KW_IF) {
@@ -0,0 +1,82 @@
+#ifndef BEGONIA_PROFILER_H
+#define BEGONIA_PROFILER_H
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace begonia {
+
+// Records wall time, allocation count and peak RSS of the compiler phases.
+// Disabled by default, a disabled Profiler costs one branch per scope.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        std::string     name;
+        uint64_t        start_us;
+        uint64_t        dur_us;
+        uint64_t        allocs;
+        long            peak_rss_kb;
+        size_t          depth;
+    };
+
+    static Profiler& Get();
+
+    void enable();
+    // disabled again, without events or counters: the next compile of a --serve worker
+    void reset();
+    bool enabled() const {
+        return _enabled;
+    }
+    void begin(const char* name);
+    void end();
+    void setCounter(const std::string& name, uint64_t value);
+    void addCounter(const std::string& name, uint64_t value);     // summed over the modules of a program
+
+    int  writeTimeTrace(const std::string& path);
+    void printStats(FILE* out);
+
+private:
+    struct OpenEvent {
+        const char*         name;
+        Clock::time_point   start;
+        uint64_t            allocs;
+    };
+
+    bool                                _enabled = false;
+    Clock::time_point                   _origin;
+    std::vector<OpenEvent>              _open_events;
+    std::vector<Event>                  _events;
+    std::map<std::string, uint64_t>     _counters;
+};
+
+// RAII helper: TraceScope scope("parse");
+class TraceScope {
+public:
+    TraceScope(const char* name) {
+        _active = Profiler::Get().enabled();
+        if (_active) {
+            Profiler::Get().begin(name);
+        }
+    }
+    ~TraceScope() {
+        if (_active) {
+            Profiler::Get().end();
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    bool _active;
+};
+
+uint64_t AllocationCount();
+long     PeakRSSKb();
+
+} // begonia
+#endif
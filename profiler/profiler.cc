@@ -0,0 +1,216 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sys/resource.h>
+
+namespace {
+    std::atomic<uint64_t> allocation_count{0};
+
+    void* countedAlloc(std::size_t size) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        if (size == 0) {
+            size = 1;
+        }
+        void* ptr;
+        // built with -fno-exceptions (llvm-config), so no std::bad_alloc here
+        while ((ptr = std::malloc(size)) == nullptr) {
+            auto handler = std::get_new_handler();
+            if (handler == nullptr) {
+                fprintf(stderr, "out of memory\n");
+                std::abort();
+            }
+            handler();
+        }
+        return ptr;
+    }
+}
+
+// Every allocation made by the compiler (LLVM included) goes through here,
+// so per-phase allocation counts can be reported by --stats/--time-trace.
+void* operator new(std::size_t size) {
+    return countedAlloc(size);
+}
+void* operator new[](std::size_t size) {
+    return countedAlloc(size);
+}
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace begonia {
+
+uint64_t AllocationCount() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+long PeakRSSKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+Profiler& Profiler::Get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::enable() {
+    if (!_enabled) {
+        _enabled = true;
+        _origin = Clock::now();
+    }
+}
+
+void Profiler::reset() {
+    _enabled = false;
+    _open_events.clear();
+    _events.clear();
+    _counters.clear();
+}
+
+void Profiler::begin(const char* name) {
+    if (!_enabled) {
+        return;
+    }
+    _open_events.push_back(OpenEvent{name, Clock::now(), AllocationCount()});
+}
+
+void Profiler::end() {
+    if (!_enabled || _open_events.empty()) {
+        return;
+    }
+    auto open = _open_events.back();
+    _open_events.pop_back();
+    auto now = Clock::now();
+
+    Event e;
+    e.name = open.name;
+    e.start_us = std::chrono::duration_cast<std::chrono::microseconds>(open.start - _origin).count();
+    e.dur_us = std::chrono::duration_cast<std::chrono::microseconds>(now - open.start).count();
+    e.allocs = AllocationCount() - open.allocs;
+    e.peak_rss_kb = PeakRSSKb();
+    e.depth = _open_events.size();
+    _events.push_back(e);
+}
+
+void Profiler::setCounter(const std::string& name, uint64_t value) {
+    _counters[name] = value;
+}
+
+void Profiler::addCounter(const std::string& name, uint64_t value) {
+    _counters[name] += value;
+}
+
+int Profiler::writeTimeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        printf("Could not open file:%s\n", path.c_str());
+        return 1;
+    }
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (auto& e : _events) {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+        out << "{\"name\":\"" << e.name << "\",\"cat\":\"begonia\",\"ph\":\"X\""
+            << ",\"ts\":" << e.start_us << ",\"dur\":" << e.dur_us
+            << ",\"pid\":1,\"tid\":0"
+            << ",\"args\":{\"allocs\":" << e.allocs << ",\"peak_rss_kb\":" << e.peak_rss_kb << "}}";
+    }
+    out << "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{";
+    first = true;
+    for (auto& counter : _counters) {
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "\"" << counter.first << "\":" << counter.second;
+    }
+    out << "}}\n";
+    return 0;
+}
+
+void Profiler::printStats(FILE* out) {
+    struct Summary {
+        uint64_t    count = 0;
+        uint64_t    total_us = 0;
+        uint64_t    allocs = 0;
+        long        peak_rss_kb = 0;
+        size_t      depth = 0;
+        uint64_t    first_start_us = 0;
+    };
+    // nested events of the same name (e.g. recursive CodeGen handlers)
+    // are only accounted once, by their outermost occurrence
+    std::map<std::string, Summary> summary;
+    std::vector<const Event*> sorted;
+    for (auto& e : _events) {
+        sorted.push_back(&e);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Event* l, const Event* r) {
+        return l->start_us < r->start_us || (l->start_us == r->start_us && l->depth < r->depth);
+    });
+    std::map<std::string, uint64_t> open_until;
+    for (auto e : sorted) {
+        auto& s = summary[e->name];
+        if (s.count == 0) {
+            s.depth = e->depth;
+            s.first_start_us = e->start_us;
+        }
+        s.count++;
+        s.peak_rss_kb = std::max(s.peak_rss_kb, e->peak_rss_kb);
+        if (open_until[e->name] > e->start_us) {
+            continue;
+        }
+        open_until[e->name] = e->start_us + e->dur_us;
+        s.total_us += e->dur_us;
+        s.allocs += e->allocs;
+    }
+    std::vector<std::pair<std::string, Summary>> rows(summary.begin(), summary.end());
+    std::sort(rows.begin(), rows.end(), [](auto& l, auto& r) {
+        return l.second.first_start_us < r.second.first_start_us
+            || (l.second.first_start_us == r.second.first_start_us && l.second.depth < r.second.depth);
+    });
+
+    fprintf(out, "===-------------------------------------------------------------------------===\n");
+    fprintf(out, "  %-36s %8s %12s %12s %12s\n", "phase", "count", "wall(ms)", "allocs", "peak rss(kb)");
+    fprintf(out, "===-------------------------------------------------------------------------===\n");
+    for (auto& row : rows) {
+        std::string name = std::string(row.second.depth * 2, ' ') + row.first;
+        fprintf(out, "  %-36s %8lu %12.3f %12lu %12ld\n",
+            name.c_str(),
+            (unsigned long)row.second.count,
+            row.second.total_us / 1000.0,
+            (unsigned long)row.second.allocs,
+            row.second.peak_rss_kb);
+    }
+    if (!_counters.empty()) {
+        fprintf(out, "===-------------------------------------------------------------------------===\n");
+        for (auto& counter : _counters) {
+            fprintf(out, "  %-36s %8lu\n", counter.first.c_str(), (unsigned long)counter.second);
+        }
+    }
+    fprintf(out, "===-------------------------------------------------------------------------===\n");
+}
+
+} // begonia
@@ -0,0 +1,170 @@
+// Regions of begonia: everything allocated while a region { ... } runs, also
+// by the functions it calls, is bump-allocated from an arena of the thread
+// and released at once when the block is left.
+//
+// The arena is a list of chunks, each twice the size of the one before up to
+// MAX_CHUNK. Entering a region bump-allocates a mark of where the arena
+// stands, leaving rolls back to it; the chunks given up are kept for the next
+// regions, up to SPARE_BYTES of them.
+
+#include "begonia_rt.h"
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CHUNK   ((size_t)64 * 1024)
+#define MAX_CHUNK   ((size_t)16 * 1024 * 1024)
+#define SPARE_BYTES ((size_t)64 * 1024 * 1024)
+
+typedef struct chunk {
+    struct chunk*   prev;
+    size_t          size;       // bytes in data
+    alignas(16) char data[];
+} chunk;
+
+typedef struct mark {
+    struct mark*    prev;       // enclosing region
+    chunk*          chunk;
+    char*           top;
+} mark;
+
+typedef struct {
+    chunk*  current;            // chunk being bump allocated, NULL if none yet
+    char*   top;
+    char*   end;
+    chunk*  spare;
+    size_t  spare_bytes;
+    mark*   regions;            // innermost region, NULL outside regions
+} arena;
+
+static _Thread_local arena the_arena;
+
+static void chunk_push(arena* a, size_t need) {
+    size_t size = a->current != NULL ? a->current->size * 2 : MIN_CHUNK;
+    if (size > MAX_CHUNK) {
+        size = MAX_CHUNK;
+    }
+    if (size < need) {
+        size = need;
+    }
+    chunk* c = NULL;
+    for (chunk** link = &a->spare; *link != NULL; link = &(*link)->prev) {
+        if ((*link)->size >= need) {
+            c = *link;
+            *link = c->prev;
+            a->spare_bytes -= c->size;
+            break;
+        }
+    }
+    if (c == NULL) {
+        c = malloc(sizeof(chunk) + size);
+        if (c == NULL) {
+            abort();
+        }
+        c->size = size;
+    }
+    c->prev = a->current;
+    a->current = c;
+    a->top = c->data;
+    a->end = c->data + c->size;
+}
+
+static void* bump(arena* a, size_t size, size_t align) {
+    uintptr_t start = ((uintptr_t)a->top + align - 1) & ~(uintptr_t)(align - 1);
+    if (a->current == NULL || start + size > (uintptr_t)a->end) {
+        chunk_push(a, size + align);
+        start = ((uintptr_t)a->top + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    a->top = (char*)(start + size);
+    return (void*)start;
+}
+
+static void* heap_alloc(int64_t size, int64_t align) {
+    void* p;
+    if (align <= 16) {
+        p = malloc(size > 0 ? size : 1);
+    } else {
+        // aligned_alloc wants a multiple of align
+        p = aligned_alloc(align, size > 0 ? (size + align - 1) & ~(align - 1) : align);
+    }
+    if (p == NULL) {
+        abort();
+    }
+    return p;
+}
+
+void* begonia_alloc(int64_t size, int64_t align) {
+    arena* a = &the_arena;
+    if (a->regions != NULL) {
+        return bump(a, size, align);
+    }
+    return heap_alloc(size, align);
+}
+
+void* begonia_alloc_zeroed(int64_t size, int64_t align) {
+    arena* a = &the_arena;
+    if (a->regions == NULL && align <= 16) {
+        void* p = calloc(size > 0 ? size : 1, 1);
+        if (p == NULL) {
+            abort();
+        }
+        return p;
+    }
+    void* p = begonia_alloc(size, align);
+    memset(p, 0, size);
+    return p;
+}
+
+// Memory of a live region of this thread is released with the region.
+void begonia_free(void* p) {
+    arena* a = &the_arena;
+    if (a->regions != NULL) {
+        for (chunk* c = a->current; c != NULL; c = c->prev) {
+            if ((char*)p >= c->data && (char*)p < c->data + c->size) {
+                return;
+            }
+        }
+    }
+    free(p);
+}
+
+void begonia_region_enter(void) {
+    arena* a = &the_arena;
+    chunk* c = a->current;
+    char* top = a->top;
+    mark* m = bump(a, sizeof(mark), alignof(mark));
+    m->prev = a->regions;
+    m->chunk = c;
+    m->top = top;
+    a->regions = m;
+}
+
+void begonia_region_exit(void) {
+    arena* a = &the_arena;
+    mark m = *a->regions;
+    while (a->current != m.chunk) {
+        chunk* c = a->current;
+        a->current = c->prev;
+        if (a->spare_bytes + c->size <= SPARE_BYTES) {
+            c->prev = a->spare;
+            a->spare = c;
+            a->spare_bytes += c->size;
+        } else {
+            free(c);
+        }
+    }
+    a->top = m.top;
+    a->end = m.chunk != NULL ? m.chunk->data + m.chunk->size : NULL;
+    a->regions = m.prev;
+}
+
+// _begonia_main gives the main thread its first chunk, so that regions of
+// short programs never reach malloc
+void begonia_arena_init(void) {
+    arena* a = &the_arena;
+    if (a->current == NULL) {
+        chunk_push(a, MIN_CHUNK);
+    }
+}
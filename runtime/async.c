@@ -0,0 +1,293 @@
+// Event loop of async func and await, one per thread, on an io_uring.
+//
+// await read(...), write, open and close fill the begonia_io record in the
+// frame of the awaiting coroutine, queue a submission pointing at it and
+// suspend. Nothing enters the kernel while coroutines still have work to do:
+// begonia_async_wait, which run() calls whenever its task is suspended,
+// submits every queued operation with one io_uring_enter that also waits for
+// the first completion, then hands out completed records one at a time for
+// run() to resume their coroutines. A task that ends hands the record of the
+// coroutine awaiting it to begonia_async_ready.
+//
+// The ring is set up with raw system calls. Where io_uring is missing, or
+// BEGONIA_IO_URING=0, the operations run synchronously when they are
+// queued and their records are ready at once.
+
+#define _GNU_SOURCE
+#include "begonia_rt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_ENTRIES    256
+// a read fills at most this many bytes, as read(2) does
+#define MAX_READ        0x7ffff000
+
+// the io record of the compiler, {i8*, i64, i8*, i8*, i8*, i64}
+typedef struct begonia_io {
+    void*               handle;     // coroutine to resume
+    int64_t             result;     // of the operation, -errno when it failed
+    struct begonia_io*  next;       // in the ready list
+    void*               out;        // read: the str receiving the bytes
+    char*               buf;
+    int64_t             size;       // of buf
+} begonia_io;
+
+static _Thread_local struct {
+    int                     state;      // 0: not set up, 1: io_uring, -1: synchronous
+    int                     fd;
+    unsigned                sq_mask;
+    unsigned                sq_entries;
+    unsigned                cq_mask;
+    unsigned                cq_entries;
+    unsigned*               sq_head;
+    unsigned*               sq_tail;
+    unsigned*               sq_array;
+    unsigned*               cq_head;
+    unsigned*               cq_tail;
+    struct io_uring_sqe*    sqes;
+    struct io_uring_cqe*    cqes;
+    unsigned                queued;     // submissions the kernel hasn't seen
+    unsigned                in_flight;  // queued or submitted, not completed
+    begonia_io*             ready;      // completed, not handed out yet
+    begonia_io*             ready_tail;
+} loop;
+
+static int setup(void) {
+    const char* env = getenv("BEGONIA_IO_URING");
+    if (env != NULL && strcmp(env, "0") == 0) {
+        return -1;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+    char* sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char* cq = sq;
+    if (sq != MAP_FAILED && !single_mmap) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    void* sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    loop.fd = fd;
+    loop.sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    loop.sq_entries = params.sq_entries;
+    loop.sq_head = (unsigned*)(sq + params.sq_off.head);
+    loop.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    loop.sq_array = (unsigned*)(sq + params.sq_off.array);
+    loop.cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    loop.cq_entries = params.cq_entries;
+    loop.cq_head = (unsigned*)(cq + params.cq_off.head);
+    loop.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    loop.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    loop.sqes = sqes;
+    return 1;
+}
+
+static int ring(void) {
+    if (loop.state == 0) {
+        loop.state = setup();
+    }
+    return loop.state > 0;
+}
+
+static void push_ready(begonia_io* io) {
+    io->next = NULL;
+    if (loop.ready_tail != NULL) {
+        loop.ready_tail->next = io;
+    } else {
+        loop.ready = io;
+    }
+    loop.ready_tail = io;
+}
+
+static void complete(begonia_io* io, int64_t result) {
+    io->result = result;
+    if (io->out != NULL) {
+        begonia_str_take(io->out, io->buf, result > 0 ? result : 0, io->size);
+        io->out = NULL;
+        io->buf = NULL;
+    }
+    push_ready(io);
+}
+
+static void reap(void) {
+    unsigned head = *loop.cq_head;
+    unsigned tail = __atomic_load_n(loop.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &loop.cqes[head & loop.cq_mask];
+        complete((begonia_io*)(uintptr_t)cqe->user_data, cqe->res);
+        head++;
+        loop.in_flight--;
+    }
+    __atomic_store_n(loop.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// submits what is queued and waits for wait_for completions
+static void enter(unsigned wait_for) {
+    unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, loop.fd, loop.queued, wait_for, flags, NULL, 0);
+        if (submitted >= 0) {
+            loop.queued -= (unsigned)submitted;
+            if (loop.queued == 0) {
+                break;
+            }
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EBUSY || errno == EAGAIN) {
+            // the completion ring is full
+            reap();
+            continue;
+        }
+        fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+        abort();
+    }
+    reap();
+}
+
+static struct io_uring_sqe* get_sqe(void) {
+    // every operation in flight needs room in the completion ring
+    if (loop.in_flight >= loop.cq_entries) {
+        enter(1);
+    }
+    unsigned tail = *loop.sq_tail;
+    if (tail - __atomic_load_n(loop.sq_head, __ATOMIC_ACQUIRE) == loop.sq_entries) {
+        enter(0);
+    }
+    struct io_uring_sqe* sqe = &loop.sqes[tail & loop.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void queue(struct io_uring_sqe* sqe, begonia_io* io) {
+    unsigned tail = *loop.sq_tail;
+    sqe->user_data = (uint64_t)(uintptr_t)io;
+    loop.sq_array[tail & loop.sq_mask] = tail & loop.sq_mask;
+    __atomic_store_n(loop.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    loop.queued++;
+    loop.in_flight++;
+}
+
+static int64_t result_of(int64_t ret) {
+    return ret < 0 ? -errno : ret;
+}
+
+// await read(fd, s, n[, offset]): up to n bytes into s, from the position of
+// fd when offset < 0
+void begonia_async_read(begonia_io* io, int64_t fd, void* out, int64_t len, int64_t offset) {
+    if (len < 0) {
+        len = 0;
+    }
+    if (len > MAX_READ) {
+        len = MAX_READ;
+    }
+    io->out = out;
+    io->size = len + 1;
+    io->buf = begonia_alloc(len + 1, 1);
+    if (!ring()) {
+        ssize_t got = offset < 0 ? read((int)fd, io->buf, len) : pread((int)fd, io->buf, len, offset);
+        complete(io, result_of(got));
+        return;
+    }
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = (int)fd;
+    sqe->addr = (uint64_t)(uintptr_t)io->buf;
+    sqe->len = (unsigned)len;
+    sqe->off = (uint64_t)offset;
+    queue(sqe, io);
+}
+
+// await write(fd, s[, offset])
+void begonia_async_write(begonia_io* io, int64_t fd, const char* data, int64_t len, int64_t offset) {
+    io->out = NULL;
+    if (!ring()) {
+        ssize_t put = offset < 0 ? write((int)fd, data, len) : pwrite((int)fd, data, len, offset);
+        complete(io, result_of(put));
+        return;
+    }
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = (int)fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = (unsigned)len;
+    sqe->off = (uint64_t)offset;
+    queue(sqe, io);
+}
+
+// await open(path[, flags[, mode]])
+void begonia_async_open(begonia_io* io, const char* path, int64_t flags, int64_t mode) {
+    io->out = NULL;
+    if (!ring()) {
+        complete(io, result_of(openat(AT_FDCWD, path, (int)flags, (mode_t)mode)));
+        return;
+    }
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = (unsigned)mode;
+    sqe->open_flags = (unsigned)flags;
+    queue(sqe, io);
+}
+
+// await close(fd)
+void begonia_async_close(begonia_io* io, int64_t fd) {
+    io->out = NULL;
+    if (!ring()) {
+        complete(io, result_of(close((int)fd)));
+        return;
+    }
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = (int)fd;
+    queue(sqe, io);
+}
+
+// a task ended, io is the record of the coroutine awaiting it, if any
+void begonia_async_ready(begonia_io* io) {
+    if (io != NULL) {
+        push_ready(io);
+    }
+}
+
+// the next completed record, submitting and waiting for the kernel when
+// there is none
+begonia_io* begonia_async_wait(void) {
+    while (loop.ready == NULL) {
+        if (loop.state <= 0 || loop.in_flight == 0) {
+            fprintf(stderr, "run: the task awaits a task that never ends\n");
+            abort();
+        }
+        enter(1);
+    }
+    begonia_io* io = loop.ready;
+    loop.ready = io->next;
+    if (loop.ready == NULL) {
+        loop.ready_tail = NULL;
+    }
+    return io;
+}
@@ -0,0 +1,15 @@
+// Functions of libbegonia_rt shared between its parts.
+#pragma once
+
+#include <stdint.h>
+
+// size bytes aligned to align, from the innermost region of the calling
+// thread, or from malloc outside regions; _zeroed clears them
+void* begonia_alloc(int64_t size, int64_t align);
+void* begonia_alloc_zeroed(int64_t size, int64_t align);
+// frees memory of begonia_alloc, unless a region releases it
+void begonia_free(void* p);
+
+// the begonia_str at out becomes len bytes of data, a block of size bytes of
+// begonia_alloc, which the str owns from then on
+void begonia_str_take(void* out, char* data, int64_t len, int64_t size);
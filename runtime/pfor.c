@@ -0,0 +1,246 @@
+// Work-stealing scheduler of pfor.
+//
+// A pool of threads is started by the first pfor, one per online CPU or
+// BEGONIA_THREADS; the thread calling pfor is worker 0. Each worker owns a
+// deque of ranges. A worker splits the range it holds in halves until it is
+// down to the grain, pushing the upper halves to the bottom of its deque, runs
+// the body on what is left and then pops the next range from the bottom. A
+// worker with an empty deque steals from the top of another one, which holds
+// the largest ranges, so a steal moves much work at once.
+//
+// A pfor inside the body of a pfor, or while another thread is running one,
+// runs its iterations serially on the calling thread.
+
+#define _GNU_SOURCE
+#include "begonia_rt.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 256
+// ranges are halved, so a deque holds at most one range per bit of the count
+#define DEQUE_SIZE  64
+
+typedef void (*pfor_body)(void* ctx, int64_t low, int64_t high, int64_t worker);
+
+typedef struct {
+    int64_t low;
+    int64_t high;
+} range;
+
+typedef struct {
+    alignas(64) pthread_mutex_t lock;
+    int     top;        // ranges[top..bottom-1]
+    int     bottom;
+    range   ranges[DEQUE_SIZE];
+} deque;
+
+static struct {
+    int                 workers;
+    deque*              deques;
+    pthread_mutex_t     submit;         // held while the pool runs a pfor
+    pthread_mutex_t     lock;
+    pthread_cond_t      start;
+    pthread_cond_t      done;
+    uint64_t            generation;     // bumped for every pfor
+    int                 active;         // pool threads still in the current pfor
+
+    pfor_body           body;
+    void*               ctx;
+    int64_t             grain;
+    alignas(64) _Atomic int64_t remaining;  // iterations not run yet
+} pool = {
+    .submit = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static _Thread_local int in_pfor;
+
+static int push(deque* d, range r) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom == DEQUE_SIZE && d->top > 0) {
+        for (int i = d->top; i < d->bottom; i++) {
+            d->ranges[i - d->top] = d->ranges[i];
+        }
+        d->bottom -= d->top;
+        d->top = 0;
+    }
+    int pushed = d->bottom < DEQUE_SIZE;
+    if (pushed) {
+        d->ranges[d->bottom++] = r;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return pushed;
+}
+
+static int pop(deque* d, range* r) {
+    pthread_mutex_lock(&d->lock);
+    int popped = d->bottom > d->top;
+    if (popped) {
+        *r = d->ranges[--d->bottom];
+    }
+    if (d->bottom == d->top) {
+        d->top = d->bottom = 0;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return popped;
+}
+
+static int steal_from(deque* d, range* r) {
+    pthread_mutex_lock(&d->lock);
+    int stolen = d->bottom > d->top;
+    if (stolen) {
+        *r = d->ranges[d->top++];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return stolen;
+}
+
+static int steal(int self, unsigned* seed, range* r) {
+    int first = (int)(rand_r(seed) % (unsigned)pool.workers);
+    for (int i = 0; i < pool.workers; i++) {
+        int victim = (first + i) % pool.workers;
+        if (victim != self && steal_from(&pool.deques[victim], r)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void run(int self, range r) {
+    while (r.high - r.low > pool.grain) {
+        int64_t mid = r.low + (r.high - r.low) / 2;
+        if (!push(&pool.deques[self], (range){mid, r.high})) {
+            break;
+        }
+        r.high = mid;
+    }
+    pool.body(pool.ctx, r.low, r.high, self);
+    atomic_fetch_sub(&pool.remaining, r.high - r.low);
+}
+
+// runs and steals ranges until every iteration of the pfor has run
+static void work(int self) {
+    unsigned seed = (unsigned)self * 2654435761u + 1;
+    range r;
+    while (atomic_load(&pool.remaining) > 0) {
+        if (pop(&pool.deques[self], &r) || steal(self, &seed, &r)) {
+            run(self, r);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    int self = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+    in_pfor = 1;
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.start, &pool.lock);
+        }
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        work(self);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static void pool_start(void) {
+    long workers = 0;
+    const char* threads = getenv("BEGONIA_THREADS");
+    if (threads != NULL) {
+        workers = atol(threads);
+    }
+    if (workers <= 0) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers <= 0) {
+        workers = 1;
+    }
+    if (workers > MAX_WORKERS) {
+        workers = MAX_WORKERS;
+    }
+    pool.deques = aligned_alloc(64, sizeof(deque) * workers);
+    if (pool.deques == NULL) {
+        abort();
+    }
+    for (long i = 0; i < workers; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].top = pool.deques[i].bottom = 0;
+    }
+    pool.workers = 1;
+    for (long i = 1; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, (void*)(intptr_t)i) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        pool.workers++;
+    }
+}
+
+// number of workers, the worker argument of a body is below it
+int64_t begonia_pfor_workers(void) {
+    pthread_once(&pool_once, pool_start);
+    return pool.workers;
+}
+
+// Calls body(ctx, lo, hi, worker) on ranges covering low..high-1 and returns
+// once all of them have run. grain <= 0 leaves ranges of about 1/8 of an even
+// share per worker.
+void begonia_pfor(int64_t low, int64_t high, int64_t grain, pfor_body body, void* ctx) {
+    if (high <= low) {
+        return;
+    }
+    int64_t workers = begonia_pfor_workers();
+    if (workers == 1 || in_pfor || pthread_mutex_trylock(&pool.submit) != 0) {
+        body(ctx, low, high, 0);
+        return;
+    }
+    if (grain <= 0) {
+        grain = (high - low) / (workers * 8);
+        if (grain < 1) {
+            grain = 1;
+        }
+    }
+    pool.body = body;
+    pool.ctx = ctx;
+    pool.grain = grain;
+    atomic_store(&pool.remaining, high - low);
+    push(&pool.deques[0], (range){low, high});
+
+    pthread_mutex_lock(&pool.lock);
+    pool.active = pool.workers - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_pfor = 1;
+    work(0);
+    in_pfor = 0;
+
+    // ctx lives in the frame of the caller, no worker may still look at it
+    pthread_mutex_lock(&pool.lock);
+    while (pool.active > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.submit);
+}
@@ -0,0 +1,133 @@
+// Bounded multi-producer multi-consumer queue of ints, after Dmitry Vyukov's.
+//
+// The capacity is rounded up to a power of two cells. Each cell has a
+// sequence number telling whose turn it is: a producer at position pos may
+// fill the cell when its number is pos, a consumer may empty it when it is
+// pos + 1. Producers and consumers only contend on their own counter, with
+// one compare-and-swap per operation and no lock. push and pop spin, then
+// yield, while the queue is full or empty.
+
+#include "begonia_rt.h"
+
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct {
+    _Atomic uint64_t    seq;
+    int64_t             value;
+} cell;
+
+typedef struct {
+    cell*               cells;
+    uint64_t            mask;
+    alignas(64) _Atomic uint64_t tail;  // next position to push
+    alignas(64) _Atomic uint64_t head;  // next position to pop
+} queue;
+
+// a capacity of 0 or less is the smallest queue, one above 2^62 can't be had
+void* begonia_queue_new(int64_t capacity) {
+    if (capacity > ((int64_t)1 << 62)) {
+        abort();
+    }
+    uint64_t size = 2;
+    while ((int64_t)size < capacity) {
+        size *= 2;
+    }
+    if (size > SIZE_MAX / sizeof(cell)) {
+        abort();
+    }
+    queue* q = aligned_alloc(alignof(queue), sizeof(queue));
+    cell* cells = malloc(sizeof(cell) * size);
+    if (q == NULL || cells == NULL) {
+        abort();
+    }
+    for (uint64_t i = 0; i < size; i++) {
+        atomic_init(&cells[i].seq, i);
+    }
+    q->cells = cells;
+    q->mask = size - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    return q;
+}
+
+void begonia_queue_free(void* handle) {
+    queue* q = handle;
+    if (q != NULL) {
+        free(q->cells);
+        free(q);
+    }
+}
+
+int64_t begonia_queue_try_push(void* handle, int64_t value) {
+    queue* q = handle;
+    uint64_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        cell* c = &q->cells[pos & q->mask];
+        uint64_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                c->value = value;
+                atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+int64_t begonia_queue_try_pop(void* handle, int64_t* value) {
+    queue* q = handle;
+    uint64_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        cell* c = &q->cells[pos & q->mask];
+        uint64_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *value = c->value;
+                atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+static void backoff(int* spins) {
+    if (++*spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+void begonia_queue_push(void* handle, int64_t value) {
+    int spins = 0;
+    while (!begonia_queue_try_push(handle, value)) {
+        backoff(&spins);
+    }
+}
+
+int64_t begonia_queue_pop(void* handle) {
+    int spins = 0;
+    int64_t value;
+    while (!begonia_queue_try_pop(handle, &value)) {
+        backoff(&spins);
+    }
+    return value;
+}
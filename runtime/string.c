@@ -0,0 +1,156 @@
+// Runtime of the str type, linked into every begonia program from
+// bin/libbegonia_rt.a.
+//
+// A str is 24 bytes, {data, len, cap}, and is passed to the runtime by
+// pointer. The high bit of its last byte tells the two forms apart:
+//
+//  - clear: the string is inline, its bytes start at the first byte of the
+//    str and the last byte is its length, at most 22. The bytes after it are
+//    zero, so a zeroed str is "" and inline strings are NUL-terminated.
+//  - set:   data points to len bytes and a NUL, cap without the high bit is
+//    the size of the begonia_alloc'ed block, or 0 when the bytes aren't owned
+//    (literals, C strings).
+//
+// The compiler reads the length and data of both forms inline; begonia only
+// targets little-endian machines, where the last byte is the top of cap.
+
+#include "begonia_rt.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char*   data;
+    int64_t len;
+    int64_t cap;
+} begonia_str;
+
+#define INLINE_MAX  ((int64_t)sizeof(begonia_str) - 2)
+#define HEAP_FLAG   ((int64_t)1 << 63)
+
+static int is_inline(const begonia_str* s) {
+    return s->cap >= 0;
+}
+
+static const char* str_data(const begonia_str* s) {
+    return is_inline(s) ? (const char*)s : s->data;
+}
+
+static int64_t str_len(const begonia_str* s) {
+    return is_inline(s) ? (int64_t)(s->cap >> 56) : s->len;
+}
+
+// Makes out a string of len bytes and returns where they go; long strings
+// get a heap block, short ones stay inline.
+static char* str_init(begonia_str* out, int64_t len) {
+    if (len <= INLINE_MAX) {
+        memset(out, 0, sizeof(*out));
+        out->cap = len << 56;
+        return (char*)out;
+    }
+    out->data = begonia_alloc(len + 1, 1);
+    out->data[len] = '\0';
+    out->len = len;
+    out->cap = (len + 1) | HEAP_FLAG;
+    return out->data;
+}
+
+void begonia_str_concat(begonia_str* out, const begonia_str* a, const begonia_str* b) {
+    int64_t a_len = str_len(a);
+    int64_t b_len = str_len(b);
+    begonia_str result;
+    char* bytes = str_init(&result, a_len + b_len);
+    memcpy(bytes, str_data(a), a_len);
+    memcpy(bytes + a_len, str_data(b), b_len);
+    *out = result;
+}
+
+// bytes low..high-1 of s; the compiler checked 0 <= low <= high <= len
+void begonia_str_slice(begonia_str* out, const begonia_str* s, int64_t low, int64_t high) {
+    begonia_str result;
+    char* bytes = str_init(&result, high - low);
+    memcpy(bytes, str_data(s) + low, high - low);
+    *out = result;
+}
+
+// <0, 0 or >0 as a sorts before, with or after b, byte by byte
+int64_t begonia_str_compare(const begonia_str* a, const begonia_str* b) {
+    int64_t a_len = str_len(a);
+    int64_t b_len = str_len(b);
+    int order = memcmp(str_data(a), str_data(b), a_len < b_len ? a_len : b_len);
+    if (order != 0) {
+        return order;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+int64_t begonia_str_equal(const begonia_str* a, const begonia_str* b) {
+    int64_t len = str_len(a);
+    return len == str_len(b) && memcmp(str_data(a), str_data(b), len) == 0;
+}
+
+// 64-bit FNV-1a
+int64_t begonia_str_hash(const begonia_str* s) {
+    const unsigned char* bytes = (const unsigned char*)str_data(s);
+    int64_t len = str_len(s);
+    uint64_t hash = 14695981039346656037ull;
+    for (int64_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return (int64_t)hash;
+}
+
+// A C string as a str: copied when it fits inline, referenced otherwise.
+void begonia_str_from_cstr(begonia_str* out, const char* cstr) {
+    begonia_str result;
+    if (cstr == NULL) {
+        cstr = "";
+    }
+    int64_t len = (int64_t)strlen(cstr);
+    if (len <= INLINE_MAX) {
+        memcpy(str_init(&result, len), cstr, len);
+    } else {
+        result.data = (char*)cstr;
+        result.len = len;
+        result.cap = HEAP_FLAG;
+    }
+    *out = result;
+}
+
+// The NUL-terminated bytes of s for a string that may outlive s: those of an
+// inline str are copied to a block of begonia_alloc, heap bytes are shared.
+const char* begonia_str_cstr(const begonia_str* s) {
+    if (!is_inline(s)) {
+        return s->data;
+    }
+    int64_t len = str_len(s);
+    char* bytes = begonia_alloc(len + 1, 1);
+    memcpy(bytes, s, len + 1);
+    return bytes;
+}
+
+// Makes the begonia_str at out the first len bytes of data, a begonia_alloc'ed
+// block of size > len bytes it takes over, or copies and frees when they fit
+// inline.
+void begonia_str_take(void* out, char* data, int64_t len, int64_t size) {
+    begonia_str result;
+    if (len <= INLINE_MAX) {
+        memcpy(str_init(&result, len), data, len);
+        begonia_free(data);
+    } else {
+        data[len] = '\0';
+        result.data = data;
+        result.len = len;
+        result.cap = size | HEAP_FLAG;
+    }
+    *(begonia_str*)out = result;
+}
+
+// frees the block of a heap string and leaves s == ""
+void begonia_str_free(begonia_str* s) {
+    if (!is_inline(s) && (s->cap & ~HEAP_FLAG) != 0) {
+        begonia_free(s->data);
+    }
+    memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,52 @@
+// Threads of spawn and join.
+//
+// spawn(f(a, b)) packs the arguments into a block on the stack of the caller
+// and calls begonia_spawn with a thunk that unpacks them and calls f. The
+// block is copied here, so the caller may return or leave a region right
+// away.
+
+#include "begonia_rt.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    pthread_t   thread;
+    int64_t     (*thunk)(void* args);
+    int64_t     result;
+    alignas(16) char args[];
+} begonia_thread;
+
+static void* thread_main(void* arg) {
+    begonia_thread* t = arg;
+    t->result = t->thunk(t->args);
+    return NULL;
+}
+
+void* begonia_spawn(int64_t (*thunk)(void* args), const void* args, int64_t size) {
+    begonia_thread* t = malloc(sizeof(begonia_thread) + size);
+    if (t == NULL) {
+        abort();
+    }
+    t->thunk = thunk;
+    memcpy(t->args, args, size);
+    if (pthread_create(&t->thread, NULL, thread_main, t) != 0) {
+        abort();
+    }
+    return t;
+}
+
+// waits for the thread and returns the int f returned, 0 for a void f or a
+// thread that was never spawned
+int64_t begonia_join(void* handle) {
+    begonia_thread* t = handle;
+    if (t == NULL) {
+        return 0;
+    }
+    pthread_join(t->thread, NULL);
+    int64_t result = t->result;
+    free(t);
+    return result;
+}
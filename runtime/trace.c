@@ -0,0 +1,345 @@
+// Runtime of -finstrument-functions.
+//
+// Every generated function left after inlining calls __cyg_profile_func_enter
+// on entry and __cyg_profile_func_exit before it returns, the hooks of GCC's
+// -finstrument-functions. A hook appends the function and a TSC timestamp to
+// a ring buffer of the calling thread: no lock, no system call, and the
+// oldest events are overwritten once the buffer is full (BEGONIA_TRACE_EVENTS
+// events per thread, 1M by default).
+//
+// At exit the buffers of all threads are replayed into calls and written to
+// BEGONIA_TRACE, begonia-trace.json by default: Chrome trace-event JSON, or
+// for a name ending in .folded, folded stacks with their self time in
+// nanoseconds, as flamegraph.pl and speedscope read them. Functions are named
+// from the symbol table of the executable.
+
+#define _GNU_SOURCE
+#include "begonia_rt.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define DEFAULT_EVENTS  (1 << 20)
+
+typedef struct {
+    uint64_t    tsc;        // low bit set on entry
+    void*       fn;
+} trace_event;
+
+typedef struct trace_buffer {
+    trace_event*            events;
+    uint64_t                mask;       // the ring holds mask + 1 events
+    uint64_t                count;      // events written so far
+    int                     tid;
+    struct trace_buffer*    next;
+} trace_buffer;
+
+static _Atomic(trace_buffer*)   buffers;    // of all threads, newest first
+static atomic_int               threads;
+static atomic_flag              armed = ATOMIC_FLAG_INIT;
+static uint64_t                 start_tsc;
+static uint64_t                 start_ns;
+static _Thread_local trace_buffer* local;
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return clock_ns();
+#endif
+}
+
+static void write_trace(void* unused);
+// atexit lives in crtbegin's world (__dso_handle), programs start without it
+int __cxa_atexit(void (*func)(void*), void* arg, void* dso_handle);
+
+static __attribute__((noinline, cold)) trace_buffer* attach(void) {
+    if (!atomic_flag_test_and_set(&armed)) {
+        start_ns = clock_ns();
+        start_tsc = ticks();
+        __cxa_atexit(write_trace, NULL, NULL);
+    }
+    uint64_t capacity = DEFAULT_EVENTS;
+    const char* env = getenv("BEGONIA_TRACE_EVENTS");
+    if (env != NULL && atoll(env) > 0) {
+        capacity = 1;
+        while (capacity < (uint64_t)atoll(env)) {
+            capacity <<= 1;
+        }
+    }
+    trace_buffer* b = malloc(sizeof(trace_buffer));
+    if (b != NULL) {
+        b->events = malloc(capacity * sizeof(trace_event));
+    }
+    if (b == NULL || b->events == NULL) {
+        fprintf(stderr, "trace: can't allocate %llu events\n", (unsigned long long)capacity);
+        abort();
+    }
+    b->mask = capacity - 1;
+    b->count = 0;
+    b->tid = atomic_fetch_add(&threads, 1) + 1;
+    b->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &b->next, b)) {
+    }
+    local = b;
+    return b;
+}
+
+void __cyg_profile_func_enter(void* fn, void* call_site) {
+    (void)call_site;
+    trace_buffer* b = local;
+    if (__builtin_expect(b == NULL, 0)) {
+        b = attach();
+    }
+    trace_event* e = &b->events[b->count & b->mask];
+    e->tsc = ticks() | 1;
+    e->fn = fn;
+    b->count++;
+}
+
+void __cyg_profile_func_exit(void* fn, void* call_site) {
+    (void)call_site;
+    trace_buffer* b = local;
+    if (__builtin_expect(b == NULL, 0)) {
+        b = attach();
+    }
+    trace_event* e = &b->events[b->count & b->mask];
+    e->tsc = ticks() & ~(uint64_t)1;
+    e->fn = fn;
+    b->count++;
+}
+
+typedef struct {
+    uintptr_t   addr;
+    const char* name;
+} symbol;
+
+static symbol*  symbols;
+static size_t   symbol_count;
+
+static int by_addr(const void* l, const void* r) {
+    uintptr_t a = ((const symbol*)l)->addr;
+    uintptr_t b = ((const symbol*)r)->addr;
+    return a < b ? -1 : a > b;
+}
+
+// the functions in .symtab of /proc/self/exe, which stays mapped
+static void load_symbols(void) {
+    int fd = open("/proc/self/exe", O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        return;
+    }
+    const char* image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED || (size_t)st.st_size < sizeof(Elf64_Ehdr)
+     || memcmp(image, ELFMAG, SELFMAG) != 0 || image[EI_CLASS] != ELFCLASS64) {
+        return;
+    }
+    const Elf64_Ehdr* header = (const Elf64_Ehdr*)image;
+    const Elf64_Shdr* sections = (const Elf64_Shdr*)(image + header->e_shoff);
+    for (int i = 0; i < header->e_shnum; i++) {
+        if (sections[i].sh_type != SHT_SYMTAB) {
+            continue;
+        }
+        const Elf64_Sym* syms = (const Elf64_Sym*)(image + sections[i].sh_offset);
+        const char* names = image + sections[sections[i].sh_link].sh_offset;
+        size_t n = sections[i].sh_size / sizeof(Elf64_Sym);
+        symbols = malloc(n * sizeof(symbol));
+        if (symbols == NULL) {
+            return;
+        }
+        for (size_t k = 0; k < n; k++) {
+            if (ELF64_ST_TYPE(syms[k].st_info) == STT_FUNC && syms[k].st_value != 0) {
+                symbols[symbol_count].addr = syms[k].st_value;
+                symbols[symbol_count].name = names + syms[k].st_name;
+                symbol_count++;
+            }
+        }
+        qsort(symbols, symbol_count, sizeof(symbol), by_addr);
+        return;
+    }
+}
+
+static const char* symbol_name(void* fn, char* buf, size_t size) {
+    size_t lo = 0;
+    size_t hi = symbol_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (symbols[mid].addr < (uintptr_t)fn) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < symbol_count && symbols[lo].addr == (uintptr_t)fn) {
+        return symbols[lo].name;
+    }
+    snprintf(buf, size, "%p", fn);
+    return buf;
+}
+
+typedef struct {
+    void*       fn;
+    uint64_t    tsc;
+    size_t      node;       // folded: the call tree node of this call
+} frame;
+
+// folded stacks: the calls of all threads as one tree, by caller
+typedef struct {
+    void*       fn;
+    size_t      parent;
+    size_t      child;      // first, 0 for none: node 0 is the root
+    size_t      sibling;
+    uint64_t    self_ticks;
+} call_node;
+
+static call_node*   nodes;
+static size_t       node_count;
+static size_t       node_capacity;
+
+static size_t child_node(size_t parent, void* fn) {
+    for (size_t n = nodes[parent].child; n != 0; n = nodes[n].sibling) {
+        if (nodes[n].fn == fn) {
+            return n;
+        }
+    }
+    if (node_count == node_capacity) {
+        node_capacity = node_capacity * 2 + 1024;
+        nodes = realloc(nodes, node_capacity * sizeof(call_node));
+        if (nodes == NULL) {
+            fprintf(stderr, "trace: out of memory\n");
+            abort();
+        }
+    }
+    size_t n = node_count++;
+    nodes[n] = (call_node){fn, parent, 0, nodes[parent].child, 0};
+    nodes[parent].child = n;
+    return n;
+}
+
+static void write_folded(FILE* out, size_t n, double ns_per_tick, char* path, size_t len, size_t size) {
+    char buf[32];
+    size_t start = len;
+    if (n != 0) {
+        const char* name = symbol_name(nodes[n].fn, buf, sizeof(buf));
+        int wrote = snprintf(path + len, size - len, "%s%s", len > 0 ? ";" : "", name);
+        len = wrote < 0 || len + wrote >= size ? size - 1 : len + wrote;
+        uint64_t ns = (uint64_t)(nodes[n].self_ticks * ns_per_tick);
+        if (ns > 0) {
+            fprintf(out, "%s %llu\n", path, (unsigned long long)ns);
+        }
+    }
+    for (size_t c = nodes[n].child; c != 0; c = nodes[c].sibling) {
+        write_folded(out, c, ns_per_tick, path, len, size);
+    }
+    path[start] = '\0';
+}
+
+static void write_trace(void* unused) {
+    (void)unused;
+    uint64_t end_tsc = ticks();
+    uint64_t end_ns = clock_ns();
+    double ns_per_tick = end_tsc > start_tsc ? (double)(end_ns - start_ns) / (end_tsc - start_tsc) : 1;
+
+    const char* path = getenv("BEGONIA_TRACE");
+    if (path == NULL || path[0] == '\0') {
+        path = "begonia-trace.json";
+    }
+    size_t path_len = strlen(path);
+    int folded = path_len > 7 && strcmp(path + path_len - 7, ".folded") == 0;
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "trace: can't write %s\n", path);
+        return;
+    }
+    load_symbols();
+    if (folded) {
+        node_capacity = 1024;
+        nodes = malloc(node_capacity * sizeof(call_node));
+        if (nodes == NULL) {
+            fclose(out);
+            return;
+        }
+        nodes[0] = (call_node){NULL, 0, 0, 0, 0};     // the root
+        node_count = 1;
+    } else {
+        fprintf(out, "{\"traceEvents\":[\n");
+    }
+
+    int first = 1;
+    char buf[32];
+    for (trace_buffer* b = atomic_load(&buffers); b != NULL; b = b->next) {
+        uint64_t count = b->count;
+        uint64_t begin = count > b->mask + 1 ? count - (b->mask + 1) : 0;
+        frame* stack = NULL;
+        size_t depth = 0;
+        size_t stack_size = 0;
+        size_t node = 0;
+        uint64_t last = begin < count ? b->events[begin & b->mask].tsc : end_tsc;
+        for (uint64_t i = begin; i <= count; i++) {
+            // the last round closes the calls still open at exit
+            trace_event e = i < count ? b->events[i & b->mask] : (trace_event){end_tsc & ~(uint64_t)1, NULL};
+            if (folded) {
+                nodes[node].self_ticks += e.tsc - last;
+                last = e.tsc;
+            }
+            if (e.tsc & 1) {
+                if (depth == stack_size) {
+                    stack_size = stack_size * 2 + 64;
+                    stack = realloc(stack, stack_size * sizeof(frame));
+                    if (stack == NULL) {
+                        fprintf(stderr, "trace: out of memory\n");
+                        abort();
+                    }
+                }
+                if (folded) {
+                    node = child_node(node, e.fn);
+                }
+                stack[depth++] = (frame){e.fn, e.tsc, node};
+                continue;
+            }
+            // an exit whose entry was overwritten has nothing to close
+            while (depth > 0) {
+                frame call = stack[--depth];
+                if (folded) {
+                    node = nodes[call.node].parent;
+                } else {
+                    fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        first ? "" : ",\n", symbol_name(call.fn, buf, sizeof(buf)), b->tid,
+                        (call.tsc - start_tsc) * ns_per_tick / 1000, (e.tsc - call.tsc) * ns_per_tick / 1000);
+                    first = 0;
+                }
+                if (e.fn != NULL) {
+                    break;
+                }
+            }
+        }
+        free(stack);
+    }
+
+    if (folded) {
+        char stack_path[4096] = "";
+        write_folded(out, 0, ns_per_tick, stack_path, 0, sizeof(stack_path));
+    } else {
+        fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    }
+    fclose(out);
+}
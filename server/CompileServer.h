@@ -0,0 +1,52 @@
+#ifndef BEGONIA_COMPILE_SERVER_H
+#define BEGONIA_COMPILE_SERVER_H
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace begonia {
+
+// begonia --serve: compiles for begonia-client over a Unix socket
+// (Protocol.h). The server process registers the target and creates the
+// TargetMachines once, then forks a pool of workers that inherit them warm.
+// Each worker accepts one connection at a time and runs the request like a
+// begonia command line, in the client's directory and with its stdio, so a
+// worker has its own LLVMContext and CodeGen errors that exit() only cost
+// the worker, which the server replaces. A worker hands each connection to
+// the server too, which replies with how the worker ended if it ends on it.
+class CompileServer {
+public:
+    using Handler = std::function<int(int argc, char** argv)>;
+
+    CompileServer(std::string socket_path, unsigned workers, Handler handler);
+    ~CompileServer();
+
+    // serves until SIGINT or SIGTERM, then removes the socket
+    int run();
+
+private:
+    std::string         _socket_path;
+    unsigned            _workers;
+    Handler             _handler;
+    int                 _listen_fd = -1;
+    std::string         _cwd;
+
+    struct Worker {
+        pid_t   pid = -1;
+        int     channel = -1;   // of the server, to the worker's
+        int     conn = -1;      // the connection the worker serves
+    };
+    std::vector<Worker> _pool;
+
+    int listen();
+    Worker spawnWorker();
+    bool readChannel(Worker& worker);
+    void replaceWorker(Worker& worker);
+    [[noreturn]] void work(int channel);
+    void serve(int conn, const int saved_stdio[3]);
+    bool readRequest(int conn, std::string& cwd, std::vector<std::string>& args, int fds[3]);
+};
+
+} //begonia
+#endif
@@ -0,0 +1,47 @@
+#ifndef BEGONIA_PARSE_CACHE_H
+#define BEGONIA_PARSE_CACHE_H
+#include "ast.h"
+
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+namespace begonia {
+
+// ASTs of the files a --serve worker parsed for earlier requests, by path,
+// kept while the file's inode, size and modification time stay the same.
+// CodeGen only reads an AST, so a file that many compiles take, like one of
+// shared prototypes and helpers, is parsed once per worker. Disabled, the
+// cache holds nothing.
+class ParseCache {
+public:
+    static ParseCache& Get();
+
+    void enable(size_t max_files);
+    // the AST and token count of path if it hasn't changed since insert
+    bool lookup(const std::string& path, AstPtr& ast, uint64_t& tokens);
+    void insert(const std::string& path, AstPtr ast, uint64_t tokens);
+
+private:
+    struct Entry {
+        std::string     path;   // real path
+        dev_t           dev;
+        ino_t           ino;
+        off_t           size;
+        timespec        mtime;
+        AstPtr          ast;
+        uint64_t        tokens;
+    };
+
+    size_t                                                  _max_files = 0;
+    std::list<Entry>                                        _entries;   // most recently used first
+    std::map<std::string, std::list<Entry>::iterator>       _index;
+
+    bool identify(const std::string& path, Entry& entry);
+};
+
+} //begonia
+#endif
@@ -0,0 +1,98 @@
+#ifndef BEGONIA_PROTOCOL_H
+#define BEGONIA_PROTOCOL_H
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace begonia {
+
+// begonia --serve and begonia-client talk over a Unix socket. A request is
+// a RequestHeader, sent with the client's stdin, stdout and stderr as
+// SCM_RIGHTS, then `size` bytes: the client's working directory and its
+// `argc` arguments, each ending in '\0'. The reply is an int32_t, the exit
+// status of the compile or minus the signal that ended it. Both ends check
+// that the other runs as the same user.
+struct RequestHeader {
+    uint32_t    magic;
+    uint32_t    argc;
+    uint32_t    size;
+};
+
+static constexpr uint32_t request_magic = 0x62676131;     // "bga1"
+static constexpr uint32_t max_request_size = 1 << 20;
+
+// whether dir is a directory, not a link, of this user that no one else may
+// enter; with create, a missing one is made so
+inline bool privateDirectory(const std::string& dir, bool create) {
+    if (create && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat st;
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid()
+        && (st.st_mode & 0077) == 0;
+}
+
+// $BEGONIA_SOCKET, or begonia.sock in $XDG_RUNTIME_DIR or /tmp/begonia-<uid>.
+// Those directories must be private, or there is no default ("").
+inline std::string defaultSocketPath(bool create) {
+    auto path = getenv("BEGONIA_SOCKET");
+    if (path != nullptr && path[0] != '\0') {
+        return path;
+    }
+    auto runtime_dir = getenv("XDG_RUNTIME_DIR");
+    std::string dir = runtime_dir != nullptr && runtime_dir[0] == '/'
+        ? runtime_dir : "/tmp/begonia-" + std::to_string(getuid());
+    return privateDirectory(dir, create) ? dir + "/begonia.sock" : "";
+}
+
+// whether the process at the other end of a Unix socket runs as this user
+inline bool peerIsUser(int fd) {
+#ifdef __linux__
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+inline bool writeAll(int fd, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        auto n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool readAll(int fd, void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        auto n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+} //begonia
+#endif
@@ -0,0 +1,366 @@
+#include "CompileServer.h"
+#include "Protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace begonia {
+
+// a client that connects and sends nothing doesn't hold a worker longer
+static constexpr time_t request_timeout_s = 10;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopServer(int) {
+    stopping = 1;
+}
+
+CompileServer::CompileServer(std::string socket_path, unsigned workers, Handler handler)
+    : _socket_path(socket_path), _workers(std::max(1u, workers)), _handler(handler) {
+}
+
+CompileServer::~CompileServer() {
+    if (_listen_fd >= 0) {
+        close(_listen_fd);
+    }
+}
+
+int CompileServer::listen() {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (_socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", _socket_path.c_str());
+        return 1;
+    }
+    strcpy(addr.sun_path, _socket_path.c_str());
+
+    _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    // a socket left by a server that died is replaced, a live one is not
+    if (connect(_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        if (peerIsUser(_listen_fd)) {
+            fprintf(stderr, "a compile server is already running on %s\n", _socket_path.c_str());
+        } else {
+            fprintf(stderr, "another user listens on %s\n", _socket_path.c_str());
+        }
+        return 1;
+    }
+    close(_listen_fd);
+    _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // not inherited by the linker and other commands a compile runs
+    fcntl(_listen_fd, F_SETFD, FD_CLOEXEC);
+    unlink(_socket_path.c_str());
+    // only this user may connect
+    auto mask = umask(0077);
+    int ret = bind(_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    umask(mask);
+    if (ret != 0 || ::listen(_listen_fd, 128) != 0) {
+        fprintf(stderr, "can't listen on %s: %s\n", _socket_path.c_str(), strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int CompileServer::run() {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+        perror("getcwd");
+        return 1;
+    }
+    _cwd = cwd;
+    if (listen() != 0) {
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServer;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    for (unsigned i = 0; i < _workers; i++) {
+        _pool.push_back(spawnWorker());
+    }
+    fprintf(stderr, "serving on %s with %u workers\n", _socket_path.c_str(), _workers);
+
+    // follow the connections of the workers and replace the workers that
+    // exit: a compile error ends in exit(1)
+    std::vector<pollfd> channels(_pool.size());
+    while (!stopping) {
+        for (size_t i = 0; i < _pool.size(); i++) {
+            channels[i] = {_pool[i].channel, POLLIN, 0};
+        }
+        if (poll(channels.data(), channels.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        for (size_t i = 0; i < _pool.size() && !stopping; i++) {
+            if (channels[i].revents != 0 && !readChannel(_pool[i])) {
+                replaceWorker(_pool[i]);
+            }
+        }
+    }
+
+    for (auto& worker : _pool) {
+        if (worker.pid > 0) {
+            kill(worker.pid, SIGTERM);
+        }
+    }
+    while (wait(nullptr) > 0 || errno == EINTR) {
+    }
+    for (auto& worker : _pool) {
+        close(worker.channel);
+        if (worker.conn >= 0) {
+            close(worker.conn);
+        }
+    }
+    unlink(_socket_path.c_str());
+    return 0;
+}
+
+CompileServer::Worker CompileServer::spawnWorker() {
+    Worker worker;
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        perror("socketpair");
+        return worker;
+    }
+    fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pair[1], F_SETFD, FD_CLOEXEC);
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(pair[0]);
+        close(pair[1]);
+        return worker;
+    }
+    if (pid == 0) {
+        close(pair[0]);
+        for (auto& other : _pool) {
+            close(other.channel);
+            if (other.conn >= 0) {
+                close(other.conn);
+            }
+        }
+        work(pair[1]);
+    }
+    close(pair[1]);
+    worker.pid = pid;
+    worker.channel = pair[0];
+    return worker;
+}
+
+// A worker sends 'R' with each connection it starts to serve and 'D' when it
+// is done with it; false once the worker is gone.
+bool CompileServer::readChannel(Worker& worker) {
+    char tag;
+    iovec iov = {&tag, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(worker.channel, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    if (worker.conn >= 0) {
+        close(worker.conn);
+        worker.conn = -1;
+    }
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (tag == 'R' && cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&worker.conn, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return true;
+}
+
+// Reaps a worker whose channel closed, replies to the client it was serving
+// with how it ended and forks a new one.
+void CompileServer::replaceWorker(Worker& worker) {
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (worker.conn >= 0) {
+        int32_t reply = WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+        writeAll(worker.conn, &reply, sizeof(reply));
+        close(worker.conn);
+    }
+    close(worker.channel);
+    // the new worker must not close the numbers these had
+    worker = Worker();
+    worker = spawnWorker();
+}
+
+void CompileServer::work(int channel) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    // a client may leave before its reply
+    signal(SIGPIPE, SIG_IGN);
+    int saved_stdio[3];
+    for (int i = 0; i < 3; i++) {
+        saved_stdio[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    }
+    while (true) {
+        int conn = accept(_listen_fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            _exit(1);
+        }
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+        // requests run as this user, so only this user may send them
+        if (!peerIsUser(conn)) {
+            close(conn);
+            continue;
+        }
+        // the server answers for this worker if it ends while serving conn
+        char tag = 'R';
+        iovec iov = {&tag, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &conn, sizeof(int));
+        if (sendmsg(channel, &msg, 0) != 1) {
+            // the server is gone
+            _exit(1);
+        }
+        serve(conn, saved_stdio);
+        close(conn);
+        if (!writeAll(channel, "D", 1)) {
+            _exit(1);
+        }
+    }
+}
+
+void CompileServer::serve(int conn, const int saved_stdio[3]) {
+    timeval timeout = {request_timeout_s, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string cwd;
+    std::vector<std::string> args;
+    int fds[3] = {-1, -1, -1};
+    if (!readRequest(conn, cwd, args, fds)) {
+        for (auto fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        return;
+    }
+
+    // the compile runs in the client's directory and writes to its stdio
+    fflush(nullptr);
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    int32_t status = 1;
+    if (chdir(cwd.c_str()) != 0) {
+        fprintf(stderr, "can't enter %s: %s\n", cwd.c_str(), strerror(errno));
+    } else {
+        std::vector<char*> argv;
+        for (auto& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        status = _handler(int(args.size()), argv.data());
+    }
+    fflush(nullptr);
+    for (int i = 0; i < 3; i++) {
+        dup2(saved_stdio[i], i);
+    }
+    if (chdir(_cwd.c_str()) != 0) {
+        perror("chdir");
+    }
+    writeAll(conn, &status, sizeof(status));
+}
+
+bool CompileServer::readRequest(int conn, std::string& cwd, std::vector<std::string>& args, int fds[3]) {
+    RequestHeader header;
+    iovec iov = {&header, sizeof(header)};
+    alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+            memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+        }
+    }
+    if ((msg.msg_flags & MSG_CTRUNC) != 0 || fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+        return false;
+    }
+    if (size_t(n) < sizeof(header) && !readAll(conn, reinterpret_cast<char*>(&header) + n, sizeof(header) - n)) {
+        return false;
+    }
+    if (header.magic != request_magic || header.argc == 0 || header.size > max_request_size) {
+        return false;
+    }
+
+    std::string payload(header.size, '\0');
+    if (!readAll(conn, &payload[0], payload.size())) {
+        return false;
+    }
+    size_t start = 0;
+    while (start < payload.size()) {
+        auto end = payload.find('\0', start);
+        if (end == std::string::npos) {
+            return false;
+        }
+        if (start == 0) {
+            cwd = payload.substr(0, end);
+        } else {
+            args.push_back(payload.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return cwd != "" && args.size() == header.argc;
+}
+
+} //begonia
@@ -0,0 +1,79 @@
+#include "ParseCache.h"
+
+#include <climits>
+#include <cstdlib>
+#include <sys/stat.h>
+
+namespace begonia {
+
+ParseCache& ParseCache::Get() {
+    static ParseCache cache;
+    return cache;
+}
+
+void ParseCache::enable(size_t max_files) {
+    _max_files = max_files;
+}
+
+// fills the real path and file identity of entry
+bool ParseCache::identify(const std::string& path, Entry& entry) {
+    char real[PATH_MAX];
+    struct stat st;
+    if (realpath(path.c_str(), real) == nullptr || stat(real, &st) != 0) {
+        return false;
+    }
+    entry.path = real;
+    entry.dev = st.st_dev;
+    entry.ino = st.st_ino;
+    entry.size = st.st_size;
+#ifdef __APPLE__
+    entry.mtime = st.st_mtimespec;
+#else
+    entry.mtime = st.st_mtim;
+#endif
+    return true;
+}
+
+bool ParseCache::lookup(const std::string& path, AstPtr& ast, uint64_t& tokens) {
+    Entry key;
+    if (_max_files == 0 || !identify(path, key)) {
+        return false;
+    }
+    auto found = _index.find(key.path);
+    if (found == _index.end()) {
+        return false;
+    }
+    auto entry = found->second;
+    if (entry->dev != key.dev || entry->ino != key.ino || entry->size != key.size
+        || entry->mtime.tv_sec != key.mtime.tv_sec || entry->mtime.tv_nsec != key.mtime.tv_nsec) {
+        _index.erase(found);
+        _entries.erase(entry);
+        return false;
+    }
+    _entries.splice(_entries.begin(), _entries, entry);
+    ast = entry->ast;
+    tokens = entry->tokens;
+    return true;
+}
+
+void ParseCache::insert(const std::string& path, AstPtr ast, uint64_t tokens) {
+    Entry entry;
+    if (_max_files == 0 || !identify(path, entry)) {
+        return;
+    }
+    auto found = _index.find(entry.path);
+    if (found != _index.end()) {
+        _entries.erase(found->second);
+        _index.erase(found);
+    }
+    entry.ast = ast;
+    entry.tokens = tokens;
+    _entries.push_front(entry);
+    _index[entry.path] = _entries.begin();
+    while (_entries.size() > _max_files) {
+        _index.erase(_entries.back().path);
+        _entries.pop_back();
+    }
+}
+
+} //begonia
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Bounds check elision: the checks the range analysis drops, and the ones it
+# must keep. elide.bga sums a slice in a loop the analysis proves in range;
+# wrap.bga steps its index by constants that wrap it negative, so its check
+# stays and the program ends in llvm.trap (SIGILL) instead of a wild read.
+#
+#   test/bounds.sh
+#   BEGONIA=/path/to/begonia test/bounds.sh
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+BEGONIA=${BEGONIA:-$TEST_DIR/../bin/begonia}
+BEGONIA=$(cd "$(dirname "$BEGONIA")" && pwd)/$(basename "$BEGONIA")
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cp "$TEST_DIR"/bounds/*.bga "$WORK"
+cd "$WORK" || exit 1
+
+failed=0
+# check <name> <file> <elided checks> <exit status>
+check() {
+    local name=$1 file=$2 want_elided=$3 want=$4
+    shift 4
+    local elided
+    elided=$("$BEGONIA" "$@" --stats -o prog "$file" 2>&1 | awk '$1 == "bounds_checks_elided" { print $2 }')
+    { ./prog; } 2>/dev/null
+    local got=$?
+    if [ "$elided" == "$want_elided" ] && [ "$got" -eq "$want" ]; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name: $elided checks elided, exit $got; expected $want_elided and $want"
+        failed=1
+    fi
+    rm -f prog
+}
+
+for opt in -O0 -O2; do
+    check "$opt elide" elide.bga 1 45 $opt
+    check "$opt wrap" wrap.bga 0 $((128 + 4)) $opt
+done
+exit $failed
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Two files that define a local function (and a pfor body) of the same name
+# link into one program with --cache-dir and -j, which split a module into
+# several objects. helper and its pfor body are local to each file.
+#
+#   test/locals.sh
+#   BEGONIA=/path/to/begonia test/locals.sh
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+BEGONIA=${BEGONIA:-$TEST_DIR/../bin/begonia}
+BEGONIA=$(cd "$(dirname "$BEGONIA")" && pwd)/$(basename "$BEGONIA")
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cp "$TEST_DIR"/locals/*.bga "$WORK"
+cd "$WORK" || exit 1
+
+failed=0
+check() {
+    local name=$1
+    shift
+    "$BEGONIA" "$@" -o m m1.bga m2.bga >/dev/null && ./m
+    local got=$?
+    if [ "$got" -eq 43 ]; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name: exit $got, expected 43"
+        failed=1
+    fi
+    rm -f m ./*.o
+}
+
+for opt in -O0 -O2; do
+    check "$opt --cache-dir" $opt --cache-dir=cache
+    check "$opt --cache-dir (cached)" $opt --cache-dir=cache
+    check "$opt -j4" $opt -j4
+done
+exit $failed